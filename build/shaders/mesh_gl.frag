@@ -0,0 +1,18 @@
+#version 130
+
+// The same as mesh.frag, for OpenGL
+in vec3 normal;
+in vec2 uv;
+
+out vec4 outColor;
+
+void main()
+{
+    float light = max(dot(normalize(normal), normalize(vec3(0.4, 0.6, 0.7))),
+                      0.0);
+
+    // A checker from the UVs, so they can be seen
+    float check = mod(floor(uv.x * 8.0) + floor(uv.y * 8.0), 2.0);
+
+    outColor = vec4(vec3(0.2 + 0.8 * light) * mix(0.8, 1.0, check), 1.0);
+}
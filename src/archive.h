@@ -0,0 +1,57 @@
+// Copyright (c) 2023 licktheroom //
+
+/*
+    Asset archive layout, shared by the game and src/pack.c.
+
+    [header][entries, sorted by hash][names][blobs]
+
+    Every blob starts on an ARCHIVE_ALIGN boundary, so uncompressed ones can
+    be used straight out of the mapped file. Everything is little endian.
+*/
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+
+#define ARCHIVE_MAGIC "XCBPAK01"
+#define ARCHIVE_ALIGN 64
+
+// Entry flags
+#define ARCHIVE_LZ4 1 // The blob is a raw LZ4 block
+
+typedef struct
+{
+    char magic[8];
+    uint32_t entry_count;
+    uint32_t names_size;
+    uint64_t entries_offset;
+    uint64_t names_offset;
+} archive_header_t;
+
+typedef struct
+{
+    uint64_t hash;
+    uint64_t offset;
+    uint64_t size;     // Bytes in the archive
+    uint64_t raw_size; // Bytes once decompressed
+    uint32_t name;     // Offset into the names, NUL terminated
+    uint32_t flags;
+} archive_entry_t;
+
+// FNV-1a of the path relative to build/, like "shaders/vert.spv"
+static inline uint64_t
+archive_hash(const char *name)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    while(*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+#endif
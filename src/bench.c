@@ -0,0 +1,979 @@
+// Copyright (c) 2023 licktheroom //
+
+/*
+    Micro-benchmarks for the culling kernels, setup, swapchain recreation,
+    submission, what capturing costs a frame, the cost of an OpenGL draw
+    call in each kind of context and what running compute on a queue of its
+    own saves.
+
+    bench [out.json] [game options...]
+
+    The game is built into this file with its own main left out, so every
+    function timed here is the one the game runs. Each benchmark is warmed
+    up, then timed for a number of runs, once for each backend that loads.
+    A table goes to stdout and the same numbers, as JSON, go to out.json.
+    Run it from build/ like the game.
+*/
+
+// DEFINES //
+
+#define XCB_MULTI_NO_MAIN
+
+#define BENCH_OUTPUT "bench.json"
+
+// Untimed runs before each benchmark
+#define BENCH_WARMUP 5
+
+#define BENCH_REPS 200
+
+// Instances and pipelines take milliseconds each
+#define BENCH_SLOW_REPS 20
+
+#define BENCH_MAX_RESULTS 64
+
+// Draws timed together by gl_draw_calls, one alone is below the clock's
+// resolution
+#define BENCH_DRAWS 1000
+
+// Written by the frames with capturing on, and removed after
+#define BENCH_CAPTURE "bench-capture.y4m"
+
+// Simulated by the particle frames unless --vk-particles says otherwise,
+// 32 MiB of them each way
+#define BENCH_PARTICLES (1u << 20)
+
+// HEADERS //
+
+#include "main.c"
+
+// TYPES //
+
+typedef struct
+{
+    char name[64];
+    const char *backend;
+    unsigned int reps;
+    uint64_t min_ns, median_ns, p95_ns, mean_ns;
+} bench_result_t;
+
+// Times one run of something into ns, setup it needs isn't counted
+typedef bool (*bench_fn_t)(uint64_t *ns);
+
+typedef struct
+{
+    const char *name;
+    graphics_api_e api;
+    bool render_pass; // Vulkan without dynamic rendering
+    unsigned int windows;
+    gl_context_e gl_context;
+} bench_backend_t;
+
+// GLOBALS //
+
+static struct
+{
+    bench_result_t results[BENCH_MAX_RESULTS];
+    unsigned int count;
+
+    // What the frame benchmarks draw, the changing one moves it along
+    sim_state_t state;
+
+    // Draws a triangle that's always clipped, for gl_draw_calls
+    GLuint gl_program;
+    GLint gl_offset;
+
+    // What bench_cull runs, against the demo's starting camera
+    cull_kernel_t cull_kernel;
+    cull_bounds_t cull_bounds;
+    float cull_planes[6][4];
+    uint32_t *cull_visible;
+} bench;
+
+// FUNCTIONS //
+
+bool
+bench_run(const char *name,
+          const char *backend,
+          unsigned int reps,
+          bench_fn_t fn);
+
+bool
+bench_write_json(const char *path);
+
+bool
+bench_backend(const char *backend);
+
+bool
+bench_input(uint64_t *ns);
+
+bool
+bench_cull_kernels(void);
+
+bool
+bench_cull(uint64_t *ns);
+
+bool
+bench_vk_create_instance(uint64_t *ns);
+
+bool
+bench_vk_get_physical_device(uint64_t *ns);
+
+bool
+bench_vk_create_graphics_pipeline(uint64_t *ns);
+
+bool
+bench_vk_recreate_swapchain(uint64_t *ns);
+
+bool
+bench_window_size(unsigned int width, unsigned int height);
+
+bool
+bench_render_vulkan(uint64_t *ns);
+
+bool
+bench_render_opengl(uint64_t *ns);
+
+bool
+bench_gl_program(void);
+
+bool
+bench_gl_draw_calls(uint64_t *ns);
+
+bool
+bench_frame(bool changing, uint64_t *ns);
+
+bool
+bench_frame_static(uint64_t *ns);
+
+bool
+bench_frame_changing(uint64_t *ns);
+
+bool
+bench_capture(const char *backend);
+
+bool
+bench_frame_capture(uint64_t *ns);
+
+bool
+bench_particles(bool on_graphics, uint64_t *ns);
+
+bool
+bench_particles_graphics(uint64_t *ns);
+
+bool
+bench_particles_async(uint64_t *ns);
+
+// MAIN //
+
+int
+main(int argc, char **argv)
+{
+    const char *output = BENCH_OUTPUT;
+
+    // Anything else is handled like it was given to the game
+    if(argc > 1 && strncmp(argv[1], "--", 2) != 0)
+        output = argv[1];
+
+    options_parse(argc, argv);
+
+    bool success = true;
+
+    // Before any backend, nothing else may be using the event queue
+    success = bench_run("input", "none", BENCH_REPS, bench_input) && success;
+
+    success = bench_cull_kernels() && success;
+
+    // Vulkan twice, so both ways of rendering get their resizes timed,
+    // OpenGL with each kind of context, and again with four windows for
+    // what each extra one costs a frame
+    const bench_backend_t backends[] = {
+        {"vk-dynamic", GRAPHICS_API_VULKAN, false, 1, GL_CONTEXT_LEGACY},
+        {"vk-renderpass", GRAPHICS_API_VULKAN, true, 1, GL_CONTEXT_LEGACY},
+        {"opengl", GRAPHICS_API_OPENGL, false, 1, GL_CONTEXT_NO_ERROR},
+        {"opengl-core", GRAPHICS_API_OPENGL, false, 1, GL_CONTEXT_CORE},
+        {"opengl-legacy", GRAPHICS_API_OPENGL, false, 1, GL_CONTEXT_LEGACY},
+        {"vk-dynamic-x4", GRAPHICS_API_VULKAN, false, 4, GL_CONTEXT_LEGACY},
+        {"opengl-x4", GRAPHICS_API_OPENGL, false, 4, GL_CONTEXT_NO_ERROR}
+    };
+
+    bool render_pass = game.vk.no_dynamic_rendering;
+    unsigned int windows = game.window.count;
+    gl_context_e gl_context = game.gl.wanted;
+
+    for(unsigned int i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        const bench_backend_t *backend = &backends[i];
+
+        game.gpu_api = backend->api;
+        game.gpu_api_is_forced = true;
+        game.vk.no_dynamic_rendering = render_pass || backend->render_pass;
+        game.window.width = game.window.height = 300;
+        game.window.count = backend->windows;
+        game.gl.wanted = backend->gl_context;
+
+        if(!init()) {
+            fprintf(stderr, "Failed to load %s, skipping it!\n",
+                            backend->name);
+            clean_up();
+            continue;
+        }
+
+        if(backend->api == GRAPHICS_API_VULKAN &&
+           !backend->render_pass && !game.vk.dynamic_rendering) {
+            fprintf(stderr, "No dynamic rendering, skipping %s!\n",
+                            backend->name);
+            clean_up();
+            continue;
+        }
+
+        // Falling back would time the same context twice
+        if(backend->api == GRAPHICS_API_OPENGL &&
+           game.gl.context != backend->gl_context) {
+            fprintf(stderr, "Got a %s context, skipping %s!\n",
+                            gl_context_name(game.gl.context),
+                            backend->name);
+            clean_up();
+            continue;
+        }
+
+        sim_init();
+
+        success = bench_backend(backend->name) && success;
+
+        if(game.gpu_api == GRAPHICS_API_VULKAN)
+            vkDeviceWaitIdle(game.vk.device);
+
+        clean_up();
+    }
+
+    game.window.count = windows;
+    game.gl.wanted = gl_context;
+
+    fprintf(stdout, "\n  %-36s %-13s %5s %11s %11s %11s %11s\n",
+                    "benchmark", "backend", "reps",
+                    "min us", "median us", "p95 us", "mean us");
+
+    for(unsigned int i = 0; i < bench.count; i++)
+    {
+        const bench_result_t *r = &bench.results[i];
+
+        fprintf(stdout, "  %-36s %-13s %5u %11.2f %11.2f %11.2f %11.2f\n",
+                        r->name, r->backend, r->reps,
+                        (double)r->min_ns / 1e3,
+                        (double)r->median_ns / 1e3,
+                        (double)r->p95_ns / 1e3,
+                        (double)r->mean_ns / 1e3);
+    }
+
+    if(!bench_write_json(output))
+        return EXIT_FAILURE;
+
+    fprintf(stdout, "\nWrote '%s'.\n", output);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// FUNCTIONS //
+
+bool
+bench_run(const char *name,
+          const char *backend,
+          unsigned int reps,
+          bench_fn_t fn)
+{
+    if(bench.count == BENCH_MAX_RESULTS) {
+        fprintf(stderr, "Too many benchmarks, dropping '%s'!\n", name);
+        return false;
+    }
+
+    uint64_t ns;
+
+    for(unsigned int i = 0; i < BENCH_WARMUP; i++)
+        if(!fn(&ns)) {
+            fprintf(stderr, "Benchmark '%s' failed!\n", name);
+            return false;
+        }
+
+    samples_t samples = {0};
+    uint64_t total = 0;
+
+    for(unsigned int i = 0; i < reps; i++)
+    {
+        if(!fn(&ns)) {
+            fprintf(stderr, "Benchmark '%s' failed!\n", name);
+            samples_free(&samples);
+            return false;
+        }
+
+        samples_add(&samples, ns);
+        total += ns;
+    }
+
+    bench_result_t *r = &bench.results[bench.count++];
+
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->backend = backend;
+    r->reps = (unsigned int)samples.count;
+    r->median_ns = samples_percentile(&samples, 50);
+    r->p95_ns = samples_percentile(&samples, 95);
+    r->min_ns = samples.count > 0 ? samples.values[0] : 0; // Sorted now
+    r->mean_ns = samples.count > 0 ? total / samples.count : 0;
+
+    samples_free(&samples);
+
+    return true;
+}
+
+bool
+bench_write_json(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if(file == NULL) {
+        fprintf(stderr, "Failed to open '%s'!\n"
+                        "%s\n",
+                        path, strerror(errno));
+        return false;
+    }
+
+    // Names are ours, nothing in them needs escaping
+    fprintf(file, "{\n  \"warmup\": %u,\n  \"benchmarks\": [\n",
+                  BENCH_WARMUP);
+
+    for(unsigned int i = 0; i < bench.count; i++)
+    {
+        const bench_result_t *r = &bench.results[i];
+
+        fprintf(file, "    {\"name\": \"%s\", \"backend\": \"%s\", "
+                      "\"reps\": %u, \"min_ns\": %lu, \"median_ns\": %lu, "
+                      "\"p95_ns\": %lu, \"mean_ns\": %lu}%s\n",
+                      r->name, r->backend, r->reps,
+                      (unsigned long)r->min_ns,
+                      (unsigned long)r->median_ns,
+                      (unsigned long)r->p95_ns,
+                      (unsigned long)r->mean_ns,
+                      i + 1 < bench.count ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+
+    if(fclose(file) != 0) {
+        fprintf(stderr, "Failed to write '%s'!\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+bench_backend(const char *backend)
+{
+    bool success = true;
+
+    // The same frame over and over against a new one every time, in CPU
+    // time so waiting on the GPU isn't counted
+    sim_interpolate(&game.sim, time_ns(), &bench.state);
+
+    success = bench_run("frame_cpu_static",
+                        backend,
+                        BENCH_REPS,
+                        bench_frame_static) && success;
+
+    success = bench_run("frame_cpu_changing",
+                        backend,
+                        BENCH_REPS,
+                        bench_frame_changing) && success;
+
+    // Extra windows only add to the per frame cost, the rest is the same
+    if(game.window.count > 1)
+        return success;
+
+    success = bench_capture(backend) && success;
+
+    if(game.gpu_api == GRAPHICS_API_OPENGL) {
+        success = bench_run("render_opengl_empty",
+                            backend,
+                            BENCH_REPS,
+                            bench_render_opengl) && success;
+
+        if(!bench_gl_program())
+            return false;
+
+        success = bench_run("gl_draw_calls_1000",
+                            backend,
+                            BENCH_REPS,
+                            bench_gl_draw_calls) && success;
+
+        glDeleteProgram(bench.gl_program);
+        bench.gl_program = 0;
+
+        return success;
+    }
+
+    success = bench_run("vk_create_instance",
+                        backend,
+                        BENCH_SLOW_REPS,
+                        bench_vk_create_instance) && success;
+
+    success = bench_run("vk_get_physical_device",
+                        backend,
+                        BENCH_REPS,
+                        bench_vk_get_physical_device) && success;
+
+    success = bench_run("vk_create_graphics_pipeline",
+                        backend,
+                        BENCH_SLOW_REPS,
+                        bench_vk_create_graphics_pipeline) && success;
+
+    const unsigned int sizes[][2] = {
+        {320, 240},
+        {1280, 720},
+        {1920, 1080}
+    };
+
+    for(unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        if(!bench_window_size(sizes[i][0], sizes[i][1])) {
+            success = false;
+            continue;
+        }
+
+        // Window managers don't have to give us what we asked for
+        const VkExtent2D *ex = &game.vk.windows[0].surface_cap.currentExtent;
+        char name[64];
+        snprintf(name, sizeof(name), "vk_recreate_swapchain_%ux%u",
+                                     ex->width, ex->height);
+
+        success = bench_run(name,
+                            backend,
+                            BENCH_SLOW_REPS,
+                            bench_vk_recreate_swapchain) && success;
+    }
+
+    // Back to the size the simulation thinks it is
+    success = bench_window_size((unsigned int)game.sim.width,
+                                (unsigned int)game.sim.height) &&
+              vk_recreate_swapchain(&game.vk.windows[0]) &&
+              success;
+
+    success = bench_run("render_vulkan_empty",
+                        backend,
+                        BENCH_REPS,
+                        bench_render_vulkan) && success;
+
+    // The same simulation in the graphics queue's submit and on a queue of
+    // its own. Whole frames are timed, so the difference is how much of it
+    // ran next to the draws.
+    unsigned int particles = game.vk.compute.particles;
+    bool on_graphics = game.vk.compute.on_graphics;
+
+    if(game.vk.compute.count == 0) {
+        game.vk.compute.particles = BENCH_PARTICLES;
+
+        if(!vk_create_particles()) {
+            vk_destroy_particles();
+            game.vk.compute.particles = particles;
+
+            return false;
+        }
+    }
+
+    success = bench_run("frame_particles_graphics",
+                        backend,
+                        BENCH_REPS,
+                        bench_particles_graphics) && success;
+
+    if(game.vk.compute.async)
+        success = bench_run("frame_particles_async",
+                            backend,
+                            BENCH_REPS,
+                            bench_particles_async) && success;
+    else
+        fprintf(stderr, "No spare compute queue, "
+                        "skipping frame_particles_async!\n");
+
+    vkDeviceWaitIdle(game.vk.device);
+
+    if(particles == 0)
+        vk_destroy_particles();
+
+    game.vk.compute.particles = particles;
+    game.vk.compute.on_graphics = on_graphics;
+
+    return success;
+}
+
+bool
+bench_input(uint64_t *ns)
+{
+    // Nothing the simulation acts on, so only the draining is timed
+    for(unsigned int i = 0; i < EVENT_QUEUE_SIZE; i++)
+    {
+        event_t event = {
+            .time_ns = 0,
+            .type = i % 4 == 3 ? EVENT_KEY_PRESS : EVENT_MOTION,
+            .detail = (uint8_t)i,
+            .pointer = {
+                .x = (int16_t)(i & 0xFF),
+                .y = (int16_t)(i >> 8)
+            }
+        };
+
+        if(!event_push(&event))
+            return false;
+    }
+
+    uint64_t start = time_ns();
+    input();
+    *ns = time_ns() - start;
+
+    return true;
+}
+
+// Every kernel the CPU supports on 10 thousand to 10 million objects. They
+// don't need a backend.
+bool
+bench_cull_kernels(void)
+{
+    const unsigned int counts[] = {10000, 100000, 1000000, 10000000};
+
+    const struct {
+        const char *name;
+        cull_kernel_t kernel;
+    } kernels[] = {
+        {"scalar", cull_scalar},
+#ifdef CULL_X86
+        {"sse", cull_sse},
+        {"avx2", cull_avx2},
+#endif
+    };
+
+    // The same camera the demo starts with, on a 16:9 window
+    const sim_state_t state = {
+        .width = 16,
+        .height = 9,
+        .phase = 0.0
+    };
+
+    float view_proj[16];
+    cull_camera(&state, view_proj);
+    cull_planes(view_proj, bench.cull_planes);
+
+    bool success = true;
+
+    for(unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        bench.cull_visible = malloc(((size_t)counts[c] + CULL_SLACK) *
+                                    sizeof(uint32_t));
+
+        if(bench.cull_visible == NULL ||
+           !cull_bounds_alloc(&bench.cull_bounds, counts[c])) {
+            fprintf(stderr, "Failed to allocate %u objects!\n", counts[c]);
+            free(bench.cull_visible);
+            return false;
+        }
+
+        cull_bounds_random(&bench.cull_bounds, counts[c]);
+
+        for(unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+#ifdef CULL_X86
+            if(kernels[k].kernel == cull_avx2 &&
+               !__builtin_cpu_supports("avx2"))
+                continue;
+#endif
+
+            char name[64];
+            snprintf(name, sizeof(name), "cull_%s_%u",
+                           kernels[k].name, counts[c]);
+
+            bench.cull_kernel = kernels[k].kernel;
+
+            success = bench_run(name,
+                                "cpu",
+                                counts[c] >= 1000000 ? BENCH_SLOW_REPS
+                                                     : BENCH_REPS,
+                                bench_cull) && success;
+        }
+
+        cull_bounds_free(&bench.cull_bounds);
+        free(bench.cull_visible);
+        bench.cull_visible = NULL;
+    }
+
+    return success;
+}
+
+bool
+bench_cull(uint64_t *ns)
+{
+    uint64_t start = time_ns();
+    bench.cull_kernel(&bench.cull_bounds, bench.cull_planes,
+                      bench.cull_visible);
+    *ns = time_ns() - start;
+
+    return true;
+}
+
+bool
+bench_vk_create_instance(uint64_t *ns)
+{
+    // The game's instance has to survive, everything hangs off it
+    VkInstance instance = game.vk.instance;
+
+    uint64_t start = time_ns();
+    bool success = vk_create_instance();
+    *ns = time_ns() - start;
+
+    if(success)
+        vkDestroyInstance(game.vk.instance, NULL);
+
+    game.vk.instance = instance;
+
+#ifdef DEBUG
+    vk_load_debug_functions();
+#endif
+
+    return success;
+}
+
+bool
+bench_vk_get_physical_device(uint64_t *ns)
+{
+    uint64_t start = time_ns();
+    bool success = vk_get_physical_device();
+    *ns = time_ns() - start;
+
+    return success;
+}
+
+bool
+bench_vk_create_graphics_pipeline(uint64_t *ns)
+{
+    VkPipeline pipeline = game.vk.pipeline;
+    VkPipelineLayout layout = game.vk.pipeline_layout;
+
+    uint64_t start = time_ns();
+    bool success = vk_create_graphics_pipeline();
+    *ns = time_ns() - start;
+
+    if(success) {
+        vkDestroyPipeline(game.vk.device, game.vk.pipeline, NULL);
+        vkDestroyPipelineLayout(game.vk.device,
+                                game.vk.pipeline_layout,
+                                NULL);
+    }
+
+    game.vk.pipeline = pipeline;
+    game.vk.pipeline_layout = layout;
+
+    return success;
+}
+
+bool
+bench_vk_recreate_swapchain(uint64_t *ns)
+{
+    uint64_t start = time_ns();
+    bool success = vk_recreate_swapchain(&game.vk.windows[0]);
+    *ns = time_ns() - start;
+
+    return success;
+}
+
+bool
+bench_window_size(unsigned int width, unsigned int height)
+{
+    const uint32_t values[] = {width, height};
+
+    xcb_configure_window(game.xcb.connection,
+                         game.xcb.windows[0],
+                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
+                         values);
+
+    // A round trip, so the server has resized it before we look
+    xcb_get_geometry_reply_t *reply = xcb_get_geometry_reply(
+                    game.xcb.connection,
+                    xcb_get_geometry(game.xcb.connection, game.xcb.windows[0]),
+                    NULL);
+
+    if(reply == NULL) {
+        fprintf(stderr, "Failed to resize the window!\n");
+        return false;
+    }
+
+    free(reply);
+
+    // Drop the resize events, the simulation isn't running
+    input();
+
+    vk_window_t *win = &game.vk.windows[0];
+
+    VkResult success = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+                                                game.vk.physical_device,
+                                                win->surface,
+                                                &win->surface_cap);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to get surface capabilities!\n");
+        vk_error_print(success);
+
+        return false;
+    }
+
+    return true;
+}
+
+bool
+bench_render_vulkan(uint64_t *ns)
+{
+    sim_state_t state;
+    sim_interpolate(&game.sim, time_ns(), &state);
+
+    // Just the clear, the submit and the present
+    game.cmds.count = 0;
+    render_prepare(&state);
+
+    uint64_t start = time_ns();
+    render_vulkan(&state);
+    *ns = time_ns() - start;
+
+    return !game.should_close;
+}
+
+bool
+bench_render_opengl(uint64_t *ns)
+{
+    sim_state_t state;
+    sim_interpolate(&game.sim, time_ns(), &state);
+
+    game.cmds.count = 0;
+    render_prepare(&state);
+
+    // init() left the context current on this thread
+    uint64_t start = time_ns();
+    render_opengl(&state);
+    *ns = time_ns() - start;
+
+    return true;
+}
+
+// Built here rather than from the assets, it's only for timing draws
+bool
+bench_gl_program(void)
+{
+    // Legacy contexts might not go past 1.30, core ones might not go below
+    // 1.50, the shaders are the same in both
+    const char *version = game.gl.context == GL_CONTEXT_LEGACY
+                          ? "#version 130\n"
+                          : "#version 150\n";
+
+    // Past the far plane, so nothing reaches the rasterizer
+    const char *vert = "uniform vec4 offset;\n"
+                       "void main()\n"
+                       "{\n"
+                       "    gl_Position = vec4(0.0, 0.0, 2.0, 1.0) + offset;\n"
+                       "}\n";
+
+    const char *frag = "out vec4 color;\n"
+                       "void main()\n"
+                       "{\n"
+                       "    color = vec4(1.0);\n"
+                       "}\n";
+
+    const char *sources[2][2] = {{version, vert}, {version, frag}};
+    const GLenum types[2] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+
+    bench.gl_program = glCreateProgram();
+
+    for(unsigned int i = 0; i < 2; i++)
+    {
+        GLuint shader = glCreateShader(types[i]);
+
+        glShaderSource(shader, 2, sources[i], NULL);
+        glCompileShader(shader);
+        glAttachShader(bench.gl_program, shader);
+        glDeleteShader(shader);
+    }
+
+    glLinkProgram(bench.gl_program);
+
+    GLint linked;
+    glGetProgramiv(bench.gl_program, GL_LINK_STATUS, &linked);
+
+    if(!linked) {
+        fprintf(stderr, "Failed to build the draw call program!\n");
+
+        glDeleteProgram(bench.gl_program);
+        bench.gl_program = 0;
+        return false;
+    }
+
+    bench.gl_offset = glGetUniformLocation(bench.gl_program, "offset");
+
+    return true;
+}
+
+// What the driver costs the CPU per draw, with a uniform changing between
+// each like a draw of a different object would. No-error contexts skip
+// checking either call.
+bool
+bench_gl_draw_calls(uint64_t *ns)
+{
+    glUseProgram(bench.gl_program);
+
+    uint64_t start = thread_cpu_ns();
+
+    for(unsigned int i = 0; i < BENCH_DRAWS; i++)
+    {
+        glUniform4f(bench.gl_offset, (float)i * 1e-6f, 0.0f, 0.0f, 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    *ns = thread_cpu_ns() - start;
+
+    // Untimed, so the queue doesn't fill and start blocking the draws
+    glUseProgram(0);
+    glFinish();
+
+    return true;
+}
+
+bool
+bench_frame(bool changing, uint64_t *ns)
+{
+    if(changing) {
+        bench.state.phase += 0.001;
+
+        if(bench.state.phase >= 1.0)
+            bench.state.phase -= 1.0;
+    }
+
+    // Built the same either way, it's what comes after that can be skipped
+    render_build_commands(&bench.state);
+    cmd_list_sort();
+
+    uint64_t start = thread_cpu_ns();
+
+    render_prepare(&bench.state);
+
+    if(game.gpu_api == GRAPHICS_API_VULKAN)
+        render_vulkan(&bench.state);
+    else
+        render_opengl(&bench.state);
+
+    *ns = thread_cpu_ns() - start;
+
+    return !game.should_close;
+}
+
+bool
+bench_frame_static(uint64_t *ns)
+{
+    return bench_frame(false, ns);
+}
+
+bool
+bench_frame_changing(uint64_t *ns)
+{
+    return bench_frame(true, ns);
+}
+
+// A whole frame with and without --capture, which is meant to cost no
+// more than a few percent. Every frame is a new one so none are reused,
+// and in wall time, since the copy runs on the GPU and the writer on a
+// thread of its own
+bool
+bench_capture(const char *backend)
+{
+    bool success = true;
+    const char *path = game.capture.path;
+
+    game.capture.path = NULL;
+
+    success = bench_run("frame_capture_off",
+                        backend,
+                        BENCH_REPS,
+                        bench_frame_capture) && success;
+
+    game.capture.path = BENCH_CAPTURE;
+    capture_start();
+
+    if(game.capture.active) {
+        success = bench_run("frame_capture_on",
+                            backend,
+                            BENCH_REPS,
+                            bench_frame_capture) && success;
+    } else {
+        fprintf(stderr, "Couldn't start capturing, skipping "
+                        "frame_capture_on!\n");
+    }
+
+    // Everything captured is still written before this returns
+    capture_stop();
+    remove(BENCH_CAPTURE);
+
+    game.capture.path = path;
+
+    return success;
+}
+
+bool
+bench_frame_capture(uint64_t *ns)
+{
+    bench.state.phase += 0.001;
+
+    if(bench.state.phase >= 1.0)
+        bench.state.phase -= 1.0;
+
+    uint64_t start = time_ns();
+
+    render_build_commands(&bench.state);
+    cmd_list_sort();
+    render_prepare(&bench.state);
+
+    if(game.gpu_api == GRAPHICS_API_VULKAN)
+        render_vulkan(&bench.state);
+    else
+        render_opengl(&bench.state);
+
+    *ns = time_ns() - start;
+
+    return !game.should_close;
+}
+
+// A whole frame with the particles, from waiting for its slot to the
+// present, which is as long as the GPU takes a frame once it's the one
+// holding things up. Switching queues spawns them again, nothing is handed
+// from one queue family to the other.
+bool
+bench_particles(bool on_graphics, uint64_t *ns)
+{
+    if(game.vk.compute.on_graphics != on_graphics) {
+        vkDeviceWaitIdle(game.vk.device);
+
+        game.vk.compute.on_graphics = on_graphics;
+        game.vk.compute.frame = 0;
+        game.vk.compute.last_ns = 0;
+    }
+
+    render_build_commands(&bench.state);
+    cmd_list_sort();
+    render_prepare(&bench.state);
+
+    uint64_t start = time_ns();
+    render_vulkan(&bench.state);
+    *ns = time_ns() - start;
+
+    return !game.should_close;
+}
+
+bool
+bench_particles_graphics(uint64_t *ns)
+{
+    return bench_particles(true, ns);
+}
+
+bool
+bench_particles_async(uint64_t *ns)
+{
+    return bench_particles(false, ns);
+}
@@ -19,8 +19,28 @@
 
 // DEFINES //
 
+#define _POSIX_C_SOURCE 200809L
+
+// Buffer objects and shaders are core OpenGL, libGL exports them
+#define GL_GLEXT_PROTOTYPES
+
 #define WN_NAME "xcb-multi"
 
+// Most windows --windows can open, they all show the same scene
+#define WINDOW_MAX 8
+
+// Assets are looked up here first, then as loose files
+#define ASSET_ARCHIVE "assets.pak"
+
+// Setting this to anything but "0" turns on Vulkan validation layers
+#define ENV_VK_VALIDATION "XCB_MULTI_VK_VALIDATION"
+
+// verbose, info, warning or error. Messages below this level are dropped
+#define ENV_VK_VALIDATION_SEVERITY "XCB_MULTI_VK_VALIDATION_SEVERITY"
+
+// scalar, sse or avx2. Forces a culling kernel instead of the best one
+#define ENV_CULL_KERNEL "XCB_MULTI_CULL_KERNEL"
+
 // HEADERS //
 
 // STANDARD
@@ -30,6 +50,33 @@
 #include <string.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <time.h>
+#include <math.h>
+#include <float.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// SIMD
+
+#if defined(__x86_64__)
+#define CULL_X86
+#include <immintrin.h>
+#endif
+
+// ASSETS
+
+#include "archive.h"
+#include "mesh.h"
 
 // X11
 
@@ -43,11 +90,172 @@
 #include <GL/gl.h>
 #include <GL/glx.h>
 
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
 // VULKAN
 
 #define VK_USE_PLATFORM_XCB_KHR
 #include <vulkan/vulkan.h>
 
+// MACROS //
+
+// Debug labels show up as named regions in frame captures. In release builds
+// these compile to nothing so the labelled block is just a plain block.
+#ifdef DEBUG
+
+// Nested labels need their own loop variable
+#define LABEL_CONCAT_(a, b) a##b
+#define LABEL_CONCAT(a, b) LABEL_CONCAT_(a, b)
+#define LABEL_DONE LABEL_CONCAT(label_done_, __LINE__)
+
+#define VK_LABEL(cmd, name)                                                    \
+    for(int LABEL_DONE = (vk_label_begin((cmd), (name)), 0);                   \
+        !LABEL_DONE;                                                           \
+        LABEL_DONE = (vk_label_end(cmd), 1))
+
+#define GL_LABEL(name)                                                         \
+    for(int LABEL_DONE = (gl_label_begin(name), 0);                            \
+        !LABEL_DONE;                                                           \
+        LABEL_DONE = (gl_label_end(), 1))
+
+#define VK_NAME(type, handle, ...)                                             \
+    vk_set_object_name((type), (uint64_t)(handle), __VA_ARGS__)
+
+#else
+
+#define VK_LABEL(cmd, name)
+#define GL_LABEL(name)
+#define VK_NAME(type, handle, ...) ((void)0)
+
+#endif
+
+// How many presents can wait on the present timing thread
+#define PRESENT_QUEUE_SIZE 64
+
+// How often the present timing thread looks for a present on screen, which
+// is also how late its display times can be
+#define PRESENT_POLL_NS 250000
+
+// How far behind the last swap OpenGL present timing waits for one. Any
+// closer and the wait would hold the driver to fewer swaps in flight.
+#define PRESENT_GL_LAG 2
+
+// Frames that can be between being read back and written out. Anything
+// rendered while they're all busy isn't captured.
+#define CAPTURE_RING 6
+
+// How many window events can wait for the simulation, a power of two
+#define EVENT_QUEUE_SIZE 1024
+
+// Set in the snapshot's shared index when it holds an unread state
+#define SNAPSHOT_FRESH 4
+
+// Simulation ticks per second unless --tick-rate says otherwise
+#define SIM_TICK_RATE 60
+
+// Longest stall the simulation will try to catch up on. Anything longer is
+// dropped, otherwise a slow tick means more ticks next time and it spirals.
+#define SIM_MAX_ELAPSED_NS 250000000ull
+
+// How many times per second the clear color pulses
+#define SIM_PULSE_HZ 0.5
+
+// Frames each backend renders for --compare-backends
+#define COMPARE_FRAMES 1000
+
+// Frames rendered by a --check-golden or --check-baseline run. The first
+// CHECK_WARMUP aren't timed, they're still streaming and warming caches.
+#define CHECK_FRAMES 300
+#define CHECK_WARMUP 30
+
+// Where the simulation is held while checking, so every run draws the same
+#define CHECK_PHASE 0.125
+
+// A pixel fails if any channel is off by more than the tolerance, and the
+// image fails if more than CHECK_BAD_SHARE of its pixels do
+#define CHECK_TOLERANCE 8
+#define CHECK_BAD_SHARE 0.001
+
+// Percent a frame time percentile can grow before it's a regression
+#define CHECK_THRESHOLD 10.0
+
+// Draw sort keys, most significant first:
+// 4 bits pass, 12 bits pipeline, 16 bits material, 32 bits depth
+#define SORT_KEY_PASS_SHIFT 60
+#define SORT_KEY_PIPELINE_SHIFT 48
+#define SORT_KEY_MATERIAL_SHIFT 32
+
+#define SORT_KEY_PIPELINE(key) \
+                (unsigned int)(((key) >> SORT_KEY_PIPELINE_SHIFT) & 0xFFF)
+#define SORT_KEY_MATERIAL(key) \
+                (unsigned int)(((key) >> SORT_KEY_MATERIAL_SHIFT) & 0xFFFF)
+
+// Culling bounds are aligned and padded to a cache line, so every kernel
+// can use aligned loads and run off the end. Visible lists have room for
+// one full vector store past the last index.
+#define CULL_ALIGN 64
+#define CULL_PAD (CULL_ALIGN / sizeof(float))
+#define CULL_SLACK 8
+
+// The --cull-demo camera and the box its objects are spread through
+#define CULL_FOV 1.04719755f // 60 degrees
+#define CULL_NEAR 0.1f
+#define CULL_FAR 400.0f
+#define CULL_WORLD 200.0f
+
+// Particles per --vk-particles workgroup, matches particles.comp
+#define PARTICLE_GROUP 64
+
+// Integration steps each particle takes a frame
+#define PARTICLE_STEPS 8
+
+// A vec4 position and a vec4 velocity
+#define PARTICLE_SIZE 32
+
+// Enough for a 32768x32768 texture
+#define TEXTURE_MAX_LEVELS 16
+
+// Mips this size and smaller are the tail. Tails load before anything else
+// and are never evicted, so every texture always has something to show.
+#define TEXTURE_TAIL_SIZE 64
+
+// Texture memory when the driver can't tell us how much is free
+#define TEXTURE_BUDGET_MB 64
+
+// Never take more than this much of what the driver says is free
+#define TEXTURE_BUDGET_SHARE 0.8
+
+// How often to ask the driver for a new budget, in frames
+#define TEXTURE_BUDGET_INTERVAL 60
+
+// Most texture data to upload in one frame, more than this would hitch.
+// One level is always allowed, however big, so nothing gets stuck.
+#define TEXTURE_UPLOAD_BYTES (4u << 20)
+
+// Only Vulkan has more than one heap
+#define TEXTURE_HEAPS VK_MAX_MEMORY_HEAPS
+
+// GL_NVX_gpu_memory_info, not in every gl.h
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+
+// --dynamic-resolution never draws below this percent of the window, and
+// moves in steps this big
+#define DYNRES_MIN 50
+#define DYNRES_STEP 5
+
+// Frames between render scale changes, so the last one shows up in the GPU
+// times before the next is picked
+#define DYNRES_COOLDOWN 16
+
+// OpenGL timer queries that can be waiting for the GPU at once
+#define GL_TIMER_RING 4
+
+// Where mesh_gl.vert takes mesh_push_t, a mat4 takes four
+#define GL_MESH_TRANSFORM 3
+#define GL_MESH_CONSTANTS 7
+#define GL_MESH_ATTRIBS 10
+
 // ENUM //
 
 typedef enum {
@@ -55,6 +263,288 @@ typedef enum {
     GRAPHICS_API_OPENGL = 2,
 } graphics_api_e;
 
+// --vsync, the same choice for both backends
+typedef enum {
+    VSYNC_DEFAULT,  // Mailbox on Vulkan, whatever the driver does on OpenGL
+    VSYNC_OFF,      // Immediate, swap interval 0
+    VSYNC_ON,       // FIFO, swap interval 1
+    VSYNC_ADAPTIVE, // Relaxed FIFO, swap interval -1, tears when late
+} vsync_e;
+
+// OpenGL contexts, each one falls back to the one before
+typedef enum {
+    GL_CONTEXT_LEGACY,   // glXCreateNewContext, compatibility profile
+    GL_CONTEXT_CORE,     // Core profile, the newest version there is
+    GL_CONTEXT_NO_ERROR, // Core without error checking, KHR_no_error
+} gl_context_e;
+
+// Passes run in this order
+typedef enum {
+    RENDER_PASS_OPAQUE,
+    RENDER_PASS_TRANSPARENT,
+} render_pass_e;
+
+typedef enum {
+    RENDER_PIPELINE_MAIN,
+    RENDER_PIPELINE_MESH,
+} render_pipeline_e;
+
+// A readback goes round in this order
+typedef enum {
+    CAPTURE_IDLE,
+    CAPTURE_RECORDED, // The copy is submitted, the GPU might not be done
+    CAPTURE_READY,    // Mapped, waiting to be queued for the writer
+    CAPTURE_WRITING,
+    CAPTURE_WRITTEN,  // The render thread can unmap and reuse it
+} capture_state_e;
+
+typedef enum {
+    EVENT_CLOSE,
+    EVENT_RESIZE,
+    EVENT_KEY_PRESS,
+    EVENT_KEY_RELEASE,
+    EVENT_BUTTON_PRESS,
+    EVENT_BUTTON_RELEASE,
+    EVENT_MOTION,
+} event_type_e;
+
+// TYPES //
+
+// What glXGetProcAddressARB and eglGetProcAddress give back
+typedef void (*gl_proc_t)(void);
+
+typedef struct
+{
+    uint64_t *values;
+    size_t count, size;
+} samples_t;
+
+typedef struct
+{
+    uint64_t id;
+    uint64_t submit_ns;
+    unsigned int generation;
+} present_frame_t;
+
+// Everything the render thread needs from the simulation. Published whole
+// and never changed after, so the renderer can read it without locks.
+typedef struct
+{
+    uint64_t tick;
+    uint64_t time_ns;      // When this state was published
+    uint64_t step_ns;      // Length of a tick
+    uint64_t remainder_ns; // Time left in the accumulator when published
+
+    int width, height;
+    double phase;
+
+    // The renderer blends from the previous tick to this one
+    float prev_color[4];
+    float clear_color[4];
+} sim_state_t;
+
+// One draw, backends work out the state it needs from the key. Indexed
+// pipelines count indices instead of vertices.
+typedef struct
+{
+    uint64_t key;
+    uint32_t first_vertex;
+    uint32_t vertex_count;
+    uint32_t object; // Culled object it draws, UINT32_MAX if none
+} draw_cmd_t;
+
+// What the mesh shaders need, push constants on Vulkan and uniforms on
+// OpenGL. Matrices are column major, with OpenGL's clip space.
+typedef struct
+{
+    float transform[16];
+    float offset[4];
+    float scale[4];
+    float params[4]; // Turns the normals have made
+} mesh_push_t;
+
+// What glMultiDrawElementsIndirect reads for each draw
+typedef struct
+{
+    uint32_t count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t base_vertex;
+    uint32_t base_instance; // Which mesh_push_t it draws with
+} gl_draw_indirect_t;
+
+// Push constants of the particle simulation, matches particles.comp
+typedef struct
+{
+    float dt;
+    uint32_t count;
+    uint32_t steps;
+    uint32_t reset; // Spawn every particle instead of reading the last frame
+} particle_push_t;
+
+// Bounding spheres, an array per component so kernels load a register's
+// worth of objects at a time. Padded to CULL_PAD with spheres that are
+// never visible.
+typedef struct
+{
+    float *x, *y, *z, *radius;
+    unsigned int count;
+} cull_bounds_t;
+
+// Writes the index of every sphere inside all six planes, returns how many
+typedef unsigned int (*cull_kernel_t)(const cull_bounds_t *bounds,
+                                      const float planes[6][4],
+                                      uint32_t *visible);
+
+// A texture that streams its mips in and out. Level 0 is the biggest.
+typedef struct
+{
+    unsigned int width, height;
+    unsigned int levels;
+    unsigned int tail;     // First level of the mip tail
+    unsigned int resident; // Finest level in memory, levels if none
+    unsigned int wanted;   // Finest level asked for this frame
+    unsigned int heap;
+    uint32_t seed;
+
+    uint64_t used[TEXTURE_MAX_LEVELS];  // Frame each level was last wanted
+    uint64_t bytes[TEXTURE_MAX_LEVELS]; // Memory each resident level takes
+
+    GLuint gl;
+
+    // One image per level, so any level can be dropped on its own
+    VkImage images[TEXTURE_MAX_LEVELS];
+    VkDeviceMemory memory[TEXTURE_MAX_LEVELS];
+} texture_t;
+
+// Vulkan objects waiting for the GPU to be done with them
+typedef struct
+{
+    VkImage image;
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    uint64_t value; // Free once the timeline gets here
+} vk_retired_t;
+
+// A swapchain image's own draws, recorded once and submitted again for as
+// long as the frame it was recorded for is the one being drawn
+typedef struct
+{
+    VkCommandBuffer cmd;
+    uint64_t frame; // game.render.frame it draws, 0 if it needs recording
+    uint64_t value; // Timeline value of its last submit
+    VkExtent2D ex;  // The size it draws the scene at
+    bool timed;     // Writes the scene's timestamps
+
+    // What recording it added to the stats, added again on every reuse
+    uint64_t draws, pipeline_binds, material_binds, triangles;
+} vk_image_cmd_t;
+
+// Everything one window presents with. The device, pipelines and frame
+// slots are shared, the surface format and present mode are the first
+// window's.
+typedef struct
+{
+    VkSurfaceKHR surface;
+    VkSurfaceCapabilitiesKHR surface_cap;
+    VkExtent2D ex;
+
+    VkSwapchainKHR swap;
+    unsigned int image_c;
+    VkImage *images;
+    VkImageView *views;
+    VkFramebuffer *framebuffers;
+
+    VkSemaphore *render_finished; // Per swapchain image
+    vk_image_cmd_t *image_cmds;   // Per swapchain image, the draws
+
+    uint32_t image; // Acquired this frame, UINT32_MAX if none
+} vk_window_t;
+
+// One frame on its way from the GPU to disk. Only the state is touched by
+// both threads, everything else belongs to whoever the state says has it.
+typedef struct
+{
+    atomic_uint state;
+
+    unsigned int width, height;
+    size_t stride;
+    bool bgr;  // Bytes are BGRA instead of RGBA
+    bool flip; // The bottom row comes first
+
+    uint64_t number;         // Frames captured before this one
+    uint64_t recorded_frame; // Frames rendered when the copy was recorded
+    const uint8_t *data;     // Mapped from READY until WRITTEN
+
+    // OpenGL, a pixel pack buffer and the fence after the read into it
+    GLuint pbo;
+    GLsync fence;
+    size_t pbo_size;
+
+    // Vulkan, persistently mapped host memory, written once the timeline
+    // reaches value
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void *mapped;
+    uint64_t value;
+} capture_readback_t;
+
+// Per frame upload memory, reused once the frame slot's last submit is done
+typedef struct
+{
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    void *data;
+    VkDeviceSize size, offset;
+} vk_staging_t;
+
+// Loaded asset data. Uncompressed archive entries point straight into the
+// mapped archive, anything else was allocated and is freed on release.
+typedef struct
+{
+    const void *data;
+    size_t size;
+    void *owned;
+} asset_t;
+
+// One backend's numbers from --compare-backends
+typedef struct
+{
+    graphics_api_e api;
+    bool ok;
+
+    uint64_t frames;
+    double init_ms;
+    double p50_ms, p95_ms, p99_ms;
+    double cpu_ms, wall_ms;
+    long peak_rss_kb;
+
+    // With --present-timing
+    const char *vsync;
+    uint64_t presented, missed;
+    double latency_p50_ms, latency_p99_ms, gap_p99_ms;
+} backend_result_t;
+
+// A window event boiled down to what we use, 16 bytes
+typedef struct
+{
+    uint64_t time_ns;
+    uint8_t type;
+    uint8_t detail; // Keycode or button
+    uint16_t state; // Modifier mask
+
+    union {
+        struct {
+            int16_t x, y;
+        } pointer;
+
+        struct {
+            uint16_t width, height;
+        } size;
+    };
+} event_t;
+
 // STATIC VARIABLES //
 
 static struct 
@@ -66,48 +556,284 @@ static struct
     struct
     {
         xcb_connection_t *connection;
-        xcb_window_t window;
+        xcb_window_t windows[WINDOW_MAX]; // The first one drives the size
 
         xcb_atom_t close_event;
     } xcb;
 
+    // Single producer, single consumer. The event thread only writes head
+    // and the simulation thread only writes tail.
+    struct
+    {
+        event_t queue[EVENT_QUEUE_SIZE];
+
+        _Alignas(64) atomic_uint head;
+        _Alignas(64) atomic_uint tail;
+
+        atomic_bool quit;
+        bool running;
+        pthread_t thread;
+    } events;
+
+    // A context per window, all sharing the first one's objects
     struct {
-        GLXContext context;
-        GLXDrawable drawable;
-        GLXWindow window;
+        GLXContext contexts[WINDOW_MAX];
+        GLXWindow windows[WINDOW_MAX];
+
+        gl_context_e wanted;  // --gl-context
+        gl_context_e context; // What was made, the same for every window
+        int major, minor;
+        PFNGLXCREATECONTEXTATTRIBSARBPROC create_context;
+
+        // Core contexts can't draw without one bound, and they aren't
+        // shared, so each context has its own
+        GLuint vaos[WINDOW_MAX];
+
+        PFNGLPUSHDEBUGGROUPPROC push_debug_group;
+        PFNGLPOPDEBUGGROUPPROC pop_debug_group;
+
+        PFNGLXGETSYNCVALUESOMLPROC get_sync_values;
+        PFNGLXWAITFORSBCOMLPROC wait_for_sbc;
+
+        PFNGLXSWAPINTERVALEXTPROC swap_interval_ext;
+        PFNGLXSWAPINTERVALMESAPROC swap_interval_mesa;
+
+        // Vertices then indices, in one buffer
+        GLuint mesh_program;
+        GLuint mesh_buffer;
+
+        // OpenGL 4.3 draws the mesh from an indirect command and a
+        // mesh_push_t for each command, built again only when
+        // game.render.frame changes
+        bool indirect;
+        GLuint indirect_buffer, push_buffer;
+        gl_draw_indirect_t *indirect_cmds;
+        unsigned int indirect_size;
+        uint64_t indirect_frame;
+
+        // The first window's scene at the render scale, blitted up to the
+        // window. Allocated at the window's size.
+        GLuint scene_fbo, scene_color;
+        int scene_width, scene_height;
+
+        // How long the scene and its blit took, read back once they're done
+        GLuint timers[GL_TIMER_RING];
+        unsigned int timer_head, timer_tail;
     } gl;
 
+    // OpenGL through EGL straight on the XCB connection, with no Xlib or
+    // GLX. With no X server it draws into a pbuffer instead of windows.
+    struct {
+        bool enabled;  // --use-egl
+        bool headless; // No X server, so no windows or events
+        EGLDisplay display;
+        EGLConfig config;
+        EGLContext contexts[WINDOW_MAX];
+        EGLSurface surfaces[WINDOW_MAX];
+    } egl;
+
     struct {
         VkInstance instance;
-        VkSurfaceKHR surface;
+        unsigned int api_version;
+        VkDebugUtilsMessengerEXT messenger;
         VkPhysicalDevice physical_device;
+        unsigned int device_version;
         VkDevice device;
         VkSurfaceFormatKHR surface_format;
         VkPresentModeKHR surface_mode;
-        VkExtent2D ex;
-        VkSurfaceCapabilitiesKHR surface_cap;
         VkQueue gp_queue, pr_queue;
-        VkSwapchainKHR swap;
+        vk_window_t windows[WINDOW_MAX];
         VkRenderPass render_pass;
         VkPipelineLayout pipeline_layout;
         VkPipeline pipeline;
+
+        // Vertices then indices, in one buffer
+        VkPipelineLayout mesh_layout;
+        VkPipeline mesh_pipeline;
+        VkBuffer mesh_buffer;
+        VkDeviceMemory mesh_memory;
         VkCommandPool cmdpool;
-        VkCommandBuffer *cmdbuffer;
+        VkCommandBuffer *cmdbuffer; // Per slot, uploads and captures
+        bool slot_used; // Something went into this frame's slot buffer
 
-        VkImage *images;
-        VkImageView *views;
-        VkFramebuffer *framebuffers;
+        // Every submit signals the next value of the timeline, so one
+        // counter says how far the GPU has got. Binary semaphores are only
+        // left where the swapchain needs them.
+        VkSemaphore timeline;
+        uint64_t timeline_value; // The last value submitted
+        uint64_t *frame_values;  // Per slot, what its last submit signals
 
+        // Per slot and window, slot * game.window.count + window
         VkSemaphore *img_available;
-        VkSemaphore *render_finished;
-        VkFence *flight;
 
-        unsigned int image_c;
         unsigned int current_frame;
         unsigned int max_frames;
+
+        // Slots that have sync objects and a command buffer, the first
+        // max_frames of them are in use. The rest were dropped and are
+        // freed once their last frame is done.
+        unsigned int frame_slots;
+
+        // Frames in flight controller
+        struct {
+            bool enabled;
+            unsigned int min, max;
+
+            uint64_t last_frame;
+            uint64_t wait_ns, frame_ns;
+            unsigned int samples;
+
+            // Frame time before the last change, 0 if not trialling one
+            double trial_frame_ns;
+            int last_change;
+            unsigned int cooldown;
+        } adapt;
+
+        bool validation;
+        VkDebugUtilsMessageSeverityFlagsEXT severity;
+
+        bool debug_utils;
+        PFN_vkCmdBeginDebugUtilsLabelEXT cmd_begin_label;
+        PFN_vkCmdEndDebugUtilsLabelEXT cmd_end_label;
+        PFN_vkSetDebugUtilsObjectNameEXT set_object_name;
+
+        VkPhysicalDeviceMemoryProperties memory_props;
+        bool memory_budget;
+
+        // Vulkan 1.3 renders straight into the swapchain views, with no
+        // render pass or framebuffers to rebuild on resize
+        bool dynamic_rendering;
+        bool no_dynamic_rendering; // --vk-render-pass
+        PFN_vkCmdBeginRendering cmd_begin_rendering;
+        PFN_vkCmdEndRendering cmd_end_rendering;
+        PFN_vkCmdPipelineBarrier2 cmd_pipeline_barrier2;
+
+        // The first window's scene for --dynamic-resolution, drawn at the
+        // render scale and blitted up to the swapchain image. Allocated at
+        // the swapchain's size.
+        struct {
+            VkImage image;
+            VkDeviceMemory memory;
+            VkImageView view;
+            VkFramebuffer framebuffer;
+            VkRenderPass render_pass; // Leaves it ready to blit from
+
+            // Two per swapchain image, around its draws and blit
+            VkQueryPool queries;
+            uint64_t timestamp_mask;
+            float timestamp_period; // ns per tick
+        } scene;
+
+        // Compute work, on a queue of its own when the device has a spare
+        // one so it overlaps the graphics queue, on the graphics queue
+        // otherwise
+        struct {
+            unsigned int particles; // --vk-particles
+            bool on_graphics;       // --vk-compute-on-graphics
+
+            bool async; // queue isn't the graphics queue
+            unsigned int family, index;
+            VkQueue queue;
+
+            // Per slot, only used when async
+            VkCommandPool pool;
+            VkCommandBuffer *cmds;
+            uint64_t *values; // What the slot's last dispatch signals
+
+            // Its own timeline, the frame's is signalled from the graphics
+            // queue in order and a second queue would break that
+            VkSemaphore timeline;
+            uint64_t value; // The last value submitted
+
+            VkDescriptorSetLayout set_layout;
+            VkDescriptorPool descriptor_pool;
+            VkPipelineLayout layout;
+            VkPipeline pipeline;
+
+            // Read one, write the other, set i reads buffers[i]. The last
+            // frame's particles stay whole while the next ones are worked
+            // out.
+            VkBuffer buffers[2];
+            VkDeviceMemory memory[2];
+            VkDescriptorSet sets[2];
+            unsigned int count;
+            uint64_t frame; // Dispatches since they were spawned
+            uint64_t last_ns;
+        } compute;
+
+        unsigned int recreates;
+        uint64_t recreate_ns;
+
+        vk_retired_t *retired;
+        unsigned int retired_c, retired_size;
+
+        vk_staging_t *staging;
+        unsigned int staging_c;
     } vk;
 
-    bool should_close;
+    // Written by both threads, the render thread sets it when rendering fails
+    atomic_bool should_close;
+
+    // Simulation state, only touched by the simulation thread
+    sim_state_t sim;
+
+    // Triple buffer between the simulation and render threads. The middle
+    // index lives in the low bits of shared, SNAPSHOT_FRESH is set when the
+    // simulation published something the renderer hasn't picked up yet.
+    struct
+    {
+        sim_state_t buffers[3];
+        atomic_uint shared;
+
+        unsigned int back;  // Simulation thread only
+        unsigned int front; // Render thread only
+    } snapshot;
+
+    struct
+    {
+        pthread_t thread;
+        int width, height;
+
+        // Goes up whenever a frame draws something the last one didn't, so
+        // anything recorded for the same value can be used again
+        uint64_t frame;
+        uint64_t reused; // Frames that skipped recording
+
+        bool failed; // The thread couldn't start drawing
+
+        // The last frame's commands and the mesh constants for each
+        draw_cmd_t *drawn;
+        mesh_push_t *pushes;
+        unsigned int drawn_count, drawn_size;
+        double phase;
+        int drawn_width, drawn_height;
+        float clear_color[4];
+        float view_proj[16];
+    } render;
+
+    // Render scale of the first window, picked from how long the GPU takes
+    // on it against a budget
+    struct
+    {
+        bool enabled;     // --dynamic-resolution
+        double target_ns; // The budget
+        bool active;      // The backend could set it up
+
+        unsigned int percent; // Of the window's size
+        double gpu_ns;        // Smoothed
+        unsigned int cooldown;
+
+        uint64_t samples, changes;
+        uint64_t percent_sum, gpu_total_ns;
+        unsigned int lowest;
+    } dynres;
+
+    // How presents wait for vblank
+    struct
+    {
+        vsync_e mode;       // --vsync
+        const char *picked; // What the backend ended up with, for reports
+    } vsync;
 
     bool gpu_api_is_forced;
     graphics_api_e gpu_api;
@@ -115,7 +841,219 @@ static struct
     struct
     {
         int width, height;
+        unsigned int count; // --windows
+
+        // Every other window's size, width << 16 | height. Written by the
+        // event thread, the OpenGL viewports follow it.
+        atomic_uint sizes[WINDOW_MAX];
     } window;
+
+    struct
+    {
+        unsigned int tick_rate;
+        unsigned int fps_cap; // 0 for uncapped
+    } clock;
+
+    struct
+    {
+        uint64_t init_ns;
+        uint64_t frame_ns;
+        uint64_t frames;
+
+        uint64_t ticks;
+        uint64_t sim_cpu_ns;
+
+        // What the command list submitted, to see how much sorting saves
+        uint64_t draws;
+        uint64_t pipeline_binds;
+        uint64_t material_binds;
+    } stats;
+
+    // The asset archive, mapped once for the whole run
+    struct
+    {
+        bool disabled; // --no-archive
+
+        uint8_t *map;
+        size_t size;
+        const archive_header_t *header;
+        const archive_entry_t *entries;
+        const char *names;
+
+        // Cold start numbers
+        unsigned int loads, from_archive;
+        uint64_t bytes;
+        uint64_t load_ns;
+    } assets;
+
+    // The --mesh model. Loaded by init(), then uploaded by the render thread,
+    // which is the only thing to touch it after.
+    struct
+    {
+        const char *name; // --mesh
+
+        asset_t asset; // Until it's uploaded
+        mesh_header_t header;
+
+        bool pending; // Still has to be uploaded
+        bool ready;
+
+        uint64_t bytes;     // On the GPU
+        uint64_t triangles; // Drawn over the run
+    } mesh;
+
+    // Frames copied back from the GPU and written out on their own thread
+    struct
+    {
+        const char *path; // --capture
+        bool y4m;         // One stream, otherwise a directory of PNGs
+        bool golden;      // Only the last frame, for --check-golden
+        bool supported;   // The backend can read back what it presents
+        bool active;
+
+        capture_readback_t readbacks[CAPTURE_RING];
+
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        bool quit;
+
+        unsigned int queue[CAPTURE_RING];
+        unsigned int head, tail;
+
+        // Writer thread only
+        FILE *stream;
+        unsigned int stream_width, stream_height;
+        uint8_t *scratch;
+        size_t scratch_size;
+        uint64_t written, skipped;
+        uint64_t write_ns;
+
+        uint32_t crc_table[256]; // For PNG chunks
+
+        // Render thread only
+        uint64_t captured, dropped;
+        uint64_t latency; // Frames between recording and mapping, summed
+    } capture;
+
+    // Objects culled on the CPU every frame. Only touched by the render
+    // thread once it starts.
+    struct
+    {
+        unsigned int demo; // --cull-demo
+
+        cull_kernel_t kernel;
+        const char *kernel_name;
+
+        // Lane numbers of each bit set in a mask, packed to the front
+        _Alignas(32) uint32_t lanes[256][8];
+
+        cull_bounds_t bounds;
+        float *spin; // Each object's turn when the phase is 0
+        uint32_t *visible;
+        unsigned int visible_c;
+
+        float view_proj[16];
+
+        uint64_t frames, tested, passed;
+        uint64_t cull_ns;
+    } cull;
+
+    // Streamed textures, only touched by the render thread once it starts
+    struct
+    {
+        texture_t *list;
+        unsigned int count, size;
+
+        unsigned int demo;  // --texture-demo
+        uint64_t cap;       // --texture-budget, 0 if not given
+        bool driver_budget; // The driver told us what's free
+
+        uint64_t budget[TEXTURE_HEAPS];
+        uint64_t used[TEXTURE_HEAPS];
+        uint64_t frame;
+
+        uint8_t *scratch; // Texels for OpenGL uploads
+        size_t scratch_size;
+
+        uint64_t uploads, upload_bytes;
+        uint64_t evictions;
+        uint64_t deferred; // Uploads put off for lack of memory
+    } textures;
+
+    // Draws for the current frame, only touched by the render thread
+    struct
+    {
+        draw_cmd_t *list;
+        draw_cmd_t *scratch; // Radix sort ping-pongs between the two
+        unsigned int count, size;
+    } cmds;
+
+    // Run the same workload on every backend and report on each
+    struct
+    {
+        bool enabled;
+        unsigned int frames;
+        samples_t frame_times;
+    } compare;
+
+    // Render a fixed scene and check it against what it looked like before
+    struct
+    {
+        bool enabled;
+        bool update;          // --check-update
+        const char *golden;   // --check-golden
+        const char *baseline; // --check-baseline
+        unsigned int frames;
+        unsigned int tolerance;
+        double threshold;
+
+        samples_t frame_times;
+
+        // Set by the capture thread
+        bool golden_done, golden_ok;
+        uint64_t bad_pixels, pixels;
+        unsigned int worst;
+    } check;
+
+    // Time from submitting a frame to it reaching the screen
+    struct
+    {
+        bool enabled;
+        bool active;
+        FILE *log;
+
+        samples_t latency;
+        uint64_t frames, missed;
+        uint64_t last_display_ns, refresh_ns;
+
+        // Time between frames reaching the screen, how even the pacing is
+        samples_t intervals;
+        uint64_t last_recorded_ns;
+
+        // What present_timing_report() printed last, for --compare-backends
+        uint64_t reported_frames, reported_missed;
+        double reported_p50_ms, reported_p99_ms, reported_gap_p99_ms;
+
+        // OpenGL, GLX_OML_sync_control. Swaps go in the queue by their
+        // count, id is the count.
+        int64_t sbc;          // The last swap's count
+        int64_t recorded_sbc; // The last one timed
+        int64_t last_msc;
+
+        // Vulkan, VK_KHR_present_id and VK_KHR_present_wait
+        PFN_vkWaitForPresentKHR wait_for_present;
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        pthread_mutex_t swap_lock;
+        bool quit;
+
+        present_frame_t queue[PRESENT_QUEUE_SIZE];
+        unsigned int head, tail;
+        unsigned int generation;
+        uint64_t next_id;
+    } present;
 } game;
 
 const static char *VK_ext[] = {
@@ -137,2091 +1075,11753 @@ const static char *VK_dev_ext[] = {
 
 const static unsigned int VK_dev_ext_c = 1;
 
+// Core OpenGL versions to ask for, newest first. 3.2 is the first with a
+// core profile.
+const static int GL_versions[][2] = {
+    {4, 6}, {4, 5}, {4, 4}, {4, 3}, {4, 2}, {4, 1}, {4, 0}, {3, 3}, {3, 2}
+};
+
+const static unsigned int GL_versions_c = 9;
+
 // FUNCTIONS //
 
+void
+options_parse(int argc, char **argv);
+
 void
 clean_up(void);
 
-bool 
+bool
 init(void);
 
+bool
+run(void);
+
+bool
+compare_backends(void);
+
+void
+compare_print_report(const backend_result_t *results, unsigned int count);
+
 void
 input(void);
 
-// XCB
+// SIMULATION
 
 void
-window_error_print(xcb_generic_error_t *error);
+sim_init(void);
 
-bool
-window_get_close_event(void);
+void
+sim_step(void);
 
-// OPENGL
+void
+sim_interpolate(const sim_state_t *state, uint64_t now, sim_state_t *out);
 
-bool
-init_opengl(void);
+void
+sim_color(double phase, float out[4]);
 
 void
-render_opengl(void);
+snapshot_publish(const sim_state_t *state);
 
-bool
-window_create_opengl(void);
+const sim_state_t *
+snapshot_acquire(void);
 
-// VULKAN
+// RENDERING
 
 bool
-init_vulkan(void);
+render_start(void);
+
+void *
+render_thread(void *arg);
+
+void
+render_resize(int width, int height);
 
 void
-render_vulkan(void);
+render_build_commands(const sim_state_t *state);
 
 bool
-window_create_vulkan(void);
+render_prepare(const sim_state_t *state);
+
+// DYNAMIC RESOLUTION
 
 void
-vk_error_print(VkResult error);
+dynres_reset(void);
 
 void
-vk_read_file(const char *file_name, size_t *size, char **out);
+dynres_update(uint64_t gpu_ns);
 
-bool
-vk_supports_validation_layers(void);
+unsigned int
+dynres_scale(unsigned int size);
 
-bool
-vk_create_instance(void);
+void
+dynres_report(void);
 
-bool
-vk_create_window_surface(void);
+// COMMAND LIST
 
-bool
-vk_get_queue_families(
-    VkPhysicalDevice device,
-    unsigned int *gp_family,
-    unsigned int *pr_family
-);
+uint64_t
+cmd_sort_key(render_pass_e pass,
+             render_pipeline_e pipeline,
+             unsigned int material,
+             float depth);
 
 bool
-vk_get_physical_device(void);
+cmd_list_push(uint64_t key,
+              uint32_t first_vertex,
+              uint32_t vertex_count,
+              uint32_t object);
 
-bool
-vk_create_logic_device(void);
+void
+cmd_list_sort(void);
 
-bool
-vk_recreate_swapchain(void);
+void
+cmd_list_free(void);
 
-bool
-vk_create_swapchain(void);
+// CULLING
 
-bool
-vk_create_image_views(void);
+void
+cull_select_kernel(void);
 
 bool
-vk_create_render_pass(void);
+cull_bounds_alloc(cull_bounds_t *bounds, unsigned int count);
 
-bool
-vk_create_graphics_pipeline(void);
+void
+cull_bounds_random(cull_bounds_t *bounds, uint32_t seed);
 
-bool
-vk_create_framebuffers(void);
+void
+cull_bounds_free(cull_bounds_t *bounds);
 
-bool
-vk_create_cmd_pool(void);
+float
+cull_random(uint32_t *state);
 
-bool
-vk_create_cmd_buffer(void);
+unsigned int
+cull_scalar(const cull_bounds_t *bounds,
+            const float planes[6][4],
+            uint32_t *visible);
+
+#ifdef CULL_X86
+
+unsigned int
+cull_sse(const cull_bounds_t *bounds,
+         const float planes[6][4],
+         uint32_t *visible);
+
+unsigned int
+cull_avx2(const cull_bounds_t *bounds,
+          const float planes[6][4],
+          uint32_t *visible);
+
+#endif
+
+void
+cull_planes(const float m[16], float planes[6][4]);
+
+void
+cull_camera(const sim_state_t *state, float out[16]);
 
 bool
-vk_create_sync_objects(void);
+cull_init(void);
 
-// MAIN //
+void
+cull_build_commands(const sim_state_t *state);
 
-int
-main(int argc, char **argv)
-{
-    // Set basic window data
-    game.window.width = game.window.height = 300;
-    game.should_close = false;
+void
+cull_report(void);
 
-    game.gpu_api = GRAPHICS_API_VULKAN;
-    game.gpu_api_is_forced = false;
-    game.vk.max_frames = 2;
-    game.vk.current_frame = 0;
+void
+cull_free(void);
 
-    // Handle arguments
-    for(int i = 0; i < argc; i++)
+// CAPTURE
+
+void
+capture_start(void);
+
+void
+capture_stop(void);
+
+int
+capture_acquire(void);
+
+void
+capture_submit_ready(void);
+
+void *
+capture_thread(void *arg);
+
+bool
+capture_write_png(const capture_readback_t *readback, const char *name);
+
+bool
+capture_write_y4m(const capture_readback_t *readback);
+
+bool
+capture_scratch(size_t size);
+
+size_t
+capture_put32(uint8_t *out, size_t at, uint32_t value);
+
+uint32_t
+capture_crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+void
+capture_report(void);
+
+// CHECKS
+
+bool
+check_run(void);
+
+void
+check_pin_state(sim_state_t *state);
+
+void
+check_golden(const capture_readback_t *readback);
+
+bool
+check_read_png(const char *name,
+               unsigned int *width,
+               unsigned int *height,
+               uint8_t **rgb);
+
+uint32_t
+check_be32(const uint8_t *p);
+
+bool
+check_golden_report(void);
+
+bool
+check_baseline(void);
+
+// MATRICES
+
+void
+mat4_multiply(float out[16], const float a[16], const float b[16]);
+
+void
+mat4_rotate_y(float out[16], float turns);
+
+void
+mat4_perspective(float out[16],
+                 float fov,
+                 float aspect,
+                 float near,
+                 float far);
+
+// ASSETS
+
+void
+assets_open(void);
+
+void
+assets_close(void);
+
+const archive_entry_t *
+archive_find(const char *name);
+
+bool
+asset_load(const char *name, asset_t *out);
+
+void
+asset_release(asset_t *asset);
+
+bool
+lz4_decompress(const uint8_t *src,
+               size_t size,
+               uint8_t *dst,
+               size_t raw_size);
+
+// MESHES
+
+bool
+mesh_load(void);
+
+void
+mesh_uploaded(uint64_t bytes);
+
+void
+mesh_push_constants(const sim_state_t *state,
+                    uint32_t object,
+                    mesh_push_t *out);
+
+void
+mesh_report(void);
+
+void
+mesh_free(void);
+
+// TEXTURES
+
+bool
+texture_init(void);
+
+int
+texture_create(unsigned int width, unsigned int height, uint32_t seed);
+
+void
+texture_request(unsigned int id, float screen_px);
+
+void
+texture_stream(void);
+
+bool
+texture_make_room(unsigned int heap, uint64_t bytes);
+
+void
+texture_update_budget(void);
+
+void
+texture_fill(const texture_t *tex, unsigned int level, uint8_t *out);
+
+uint64_t
+texture_level_size(const texture_t *tex, unsigned int level);
+
+void
+texture_report(void);
+
+void
+texture_free_all(void);
+
+uint64_t
+time_ns(void);
+
+uint64_t
+thread_cpu_ns(void);
+
+uint64_t
+process_cpu_ns(void);
+
+bool
+peak_rss_reset(void);
+
+long
+peak_rss_kb(void);
+
+void
+sleep_until(uint64_t ns);
+
+void
+samples_add(samples_t *samples, uint64_t value);
+
+uint64_t
+samples_percentile(samples_t *samples, double percentile);
+
+void
+samples_free(samples_t *samples);
+
+void
+present_timing_record(uint64_t submit_ns,
+                      uint64_t display_ns,
+                      unsigned int missed);
+
+void
+present_timing_report(void);
+
+// XCB
+
+void
+window_error_print(xcb_generic_error_t *error);
+
+bool
+window_open(unsigned int index, xcb_screen_t *screen, xcb_colormap_t colormap);
+
+bool
+window_get_close_event(void);
+
+bool
+window_start_event_thread(void);
+
+void
+window_stop_event_thread(void);
+
+void *
+window_event_thread(void *arg);
+
+bool
+event_push(const event_t *event);
+
+bool
+event_pop(event_t *event);
+
+// OPENGL
+
+bool
+init_opengl(void);
+
+void
+render_opengl(const sim_state_t *state);
+
+void
+gl_draw_scene(const sim_state_t *state);
+
+void
+gl_draw_window(unsigned int index, const sim_state_t *state);
+
+void
+gl_draw_scaled(const sim_state_t *state);
+
+bool
+gl_scene_target(int width, int height);
+
+void
+gl_scene_timers(void);
+
+void
+gl_scene_free(void);
+
+bool
+window_create_opengl(void);
+
+bool
+window_create_colormap(xcb_screen_t *screen,
+                       xcb_visualid_t visual,
+                       xcb_colormap_t *colormap);
+
+bool
+gl_setup_contexts(void);
+
+bool
+gl_make_current(unsigned int index);
+
+void
+gl_release_current(void);
+
+void
+gl_swap_buffers(unsigned int index);
+
+gl_proc_t
+gl_get_proc(const char *name);
+
+// EGL
+
+bool
+window_create_egl(void);
+
+bool
+egl_create_headless(const char *client_exts,
+                    PFNEGLGETPLATFORMDISPLAYEXTPROC get_display);
+
+bool
+egl_init_display(EGLint surface_type);
+
+EGLContext
+egl_create_context(EGLContext share);
+
+EGLContext
+egl_create_context_attribs(EGLContext share,
+                           gl_context_e context,
+                           int major,
+                           int minor);
+
+void
+egl_swap_control(void);
+
+GLXContext
+gl_create_context(GLXFBConfig config, GLXContext share, int screen);
+
+GLXContext
+gl_create_context_attribs(GLXFBConfig config,
+                          GLXContext share,
+                          gl_context_e context,
+                          int major,
+                          int minor);
+
+int
+gl_ignore_x_error(Display *display, XErrorEvent *event);
+
+const char *
+gl_context_name(gl_context_e context);
+
+void
+gl_bind_vertex_array(unsigned int index);
+
+bool
+gl_has_extension(const char *name);
+
+bool
+extension_listed(const char *exts, const char *name);
+
+void
+gl_swap_control_init(int screen);
+
+void
+gl_present_timing_init(int screen);
+
+void
+gl_present_timing_collect(void);
+
+bool
+gl_texture_upload(texture_t *tex, unsigned int level);
+
+void
+gl_texture_evict(texture_t *tex, unsigned int level);
+
+GLuint
+gl_create_program(const char *vert_name, const char *frag_name);
+
+GLuint
+gl_compile_shader(GLenum type, const char *name);
+
+void
+gl_mesh_upload(void);
+
+void
+gl_mesh_bind(bool bind);
+
+void
+gl_mesh_constants(const mesh_push_t *push);
+
+void
+gl_mesh_commands(void);
+
+void
+gl_indirect_free(void);
+
+void
+gl_capture_record(void);
+
+void
+gl_capture_collect(bool wait);
+
+void
+gl_capture_free(void);
+
+#ifdef DEBUG
+
+void
+gl_load_debug_functions(void);
+
+void
+gl_label_begin(const char *name);
+
+void
+gl_label_end(void);
+
+#endif
+
+// VULKAN
+
+bool
+init_vulkan(void);
+
+void
+render_vulkan(const sim_state_t *state);
+
+void
+vk_record_scene(VkCommandBuffer cmd,
+                const vk_window_t *win,
+                const sim_state_t *state);
+
+bool
+vk_prepare_image_cmd(vk_window_t *win, const sim_state_t *state);
+
+bool
+window_create_vulkan(void);
+
+void
+vk_error_print(VkResult error);
+
+void
+vk_read_file(const char *file_name, size_t *size, char **out);
+
+bool
+vk_has_instance_extension(const char *name);
+
+bool
+vk_supports_validation_layers(void);
+
+bool
+vk_create_instance(void);
+
+VKAPI_ATTR VkBool32 VKAPI_CALL
+vk_debug_callback(
+    VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+    VkDebugUtilsMessageTypeFlagsEXT type,
+    const VkDebugUtilsMessengerCallbackDataEXT *data,
+    void *user_data
+);
+
+void
+vk_get_debug_messenger_info(VkDebugUtilsMessengerCreateInfoEXT *info);
+
+bool
+vk_create_debug_messenger(void);
+
+bool
+vk_has_device_extension(VkPhysicalDevice device, const char *name);
+
+bool
+vk_supports_present_timing(void);
+
+bool
+vk_supports_dynamic_rendering(void);
+
+bool
+vk_supports_dynamic_resolution(void);
+
+VkPresentModeKHR
+vk_pick_present_mode(const VkPresentModeKHR *modes, unsigned int count);
+
+const char *
+vk_present_mode_name(VkPresentModeKHR mode);
+
+void
+vk_present_timing_init(void);
+
+void
+vk_present_timing_stop(void);
+
+void *
+vk_present_wait_thread(void *arg);
+
+void
+vk_swap_lock(const vk_window_t *win);
+
+void
+vk_swap_unlock(const vk_window_t *win);
+
+#ifdef DEBUG
+
+void
+vk_load_debug_functions(void);
+
+void
+vk_label_begin(VkCommandBuffer cmd, const char *name);
+
+void
+vk_label_end(VkCommandBuffer cmd);
+
+void
+vk_set_object_name(VkObjectType type, uint64_t handle, const char *fmt, ...);
+
+#endif
+
+bool
+vk_create_window_surfaces(void);
+
+bool
+vk_get_queue_families(
+    VkPhysicalDevice device,
+    unsigned int *gp_family,
+    unsigned int *pr_family
+);
+
+bool
+vk_get_compute_queue(VkPhysicalDevice device,
+                     unsigned int gp_family,
+                     unsigned int *family,
+                     unsigned int *index);
+
+bool
+vk_get_physical_device(void);
+
+bool
+vk_create_logic_device(void);
+
+bool
+vk_create_windows(void);
+
+bool
+vk_create_window(vk_window_t *win);
+
+void
+vk_destroy_window(vk_window_t *win);
+
+bool
+vk_create_scene_target(const vk_window_t *win);
+
+void
+vk_destroy_scene_target(void);
+
+bool
+vk_window_scaled(const vk_window_t *win);
+
+VkExtent2D
+vk_render_extent(const vk_window_t *win);
+
+bool
+vk_recreate_swapchain(vk_window_t *win);
+
+bool
+vk_create_swapchain(vk_window_t *win);
+
+bool
+vk_create_image_views(vk_window_t *win);
+
+bool
+vk_create_render_pass(void);
+
+bool
+vk_create_graphics_pipeline(void);
+
+bool
+vk_create_mesh_pipeline(void);
+
+bool
+vk_create_pipeline(const char *vert_name,
+                   const char *frag_name,
+                   const VkPipelineVertexInputStateCreateInfo *v_input,
+                   VkFrontFace front_face,
+                   VkPipelineLayout layout,
+                   VkPipeline *pipeline);
+
+bool
+vk_create_compute_pipeline(const char *name,
+                           VkPipelineLayout layout,
+                           VkPipeline *pipeline);
+
+bool
+vk_create_particles(void);
+
+void
+vk_destroy_particles(void);
+
+bool
+vk_alloc_compute_cmds(unsigned int first, unsigned int count);
+
+void
+vk_record_particles(VkCommandBuffer cmd);
+
+bool
+vk_submit_particles(void);
+
+bool
+vk_create_framebuffers(vk_window_t *win);
+
+void
+vk_begin_rendering(VkCommandBuffer cmd,
+                   const vk_window_t *win,
+                   const VkClearValue *clear);
+
+void
+vk_end_rendering(VkCommandBuffer cmd, const vk_window_t *win);
+
+void
+vk_blit_scene(VkCommandBuffer cmd, const vk_window_t *win);
+
+void
+vk_image_barrier(VkCommandBuffer cmd,
+                 VkImage image,
+                 VkImageLayout old_layout,
+                 VkImageLayout new_layout,
+                 VkPipelineStageFlags src_stage,
+                 VkAccessFlags src_access,
+                 VkPipelineStageFlags dst_stage,
+                 VkAccessFlags dst_access);
+
+void
+vk_swapchain_barrier(VkCommandBuffer cmd,
+                     const vk_window_t *win,
+                     VkImageLayout old_layout,
+                     VkImageLayout new_layout,
+                     VkAccessFlags2 src_access,
+                     VkAccessFlags2 dst_access);
+
+bool
+vk_create_cmd_pool(void);
+
+bool
+vk_create_cmd_buffer(void);
+
+bool
+vk_create_sync_objects(void);
+
+bool
+vk_create_present_semaphores(vk_window_t *win);
+
+void
+vk_destroy_present_semaphores(vk_window_t *win);
+
+bool
+vk_create_image_cmds(vk_window_t *win);
+
+void
+vk_destroy_image_cmds(vk_window_t *win);
+
+VkResult
+vk_timeline_wait(uint64_t value, uint64_t timeout);
+
+uint64_t
+vk_timeline_completed(void);
+
+bool
+vk_alloc_cmd_buffers(unsigned int first, unsigned int count);
+
+bool
+vk_create_frame_sync(unsigned int first, unsigned int count);
+
+bool
+vk_add_frame_slot(void);
+
+void
+vk_trim_frame_slots(void);
+
+void
+vk_set_frames_in_flight(unsigned int frames, const char *reason);
+
+void
+vk_adapt_frames_in_flight(uint64_t wait_ns);
+
+bool
+vk_find_memory_type(uint32_t type_bits,
+                    VkMemoryPropertyFlags flags,
+                    unsigned int *type);
+
+bool
+vk_create_buffer(VkDeviceSize size,
+                 VkBufferUsageFlags usage,
+                 VkMemoryPropertyFlags flags,
+                 VkBuffer *buffer,
+                 VkDeviceMemory *memory);
+
+void
+vk_retire(VkImage image, VkBuffer buffer, VkDeviceMemory memory);
+
+void
+vk_release_retired(unsigned int slot, bool all);
+
+bool
+vk_staging_alloc(VkDeviceSize size, VkDeviceSize *offset, void **data);
+
+bool
+vk_texture_upload(texture_t *tex, unsigned int level);
+
+void
+vk_texture_evict(texture_t *tex, unsigned int level);
+
+void
+vk_texture_budget(void);
+
+void
+vk_mesh_upload(void);
+
+void
+vk_mesh_bind(VkCommandBuffer cmd);
+
+void
+vk_capture_record(unsigned int image);
+
+void
+vk_capture_collect(bool wait);
+
+void
+vk_capture_destroy(capture_readback_t *rb);
+
+void
+vk_capture_free(void);
+
+// MAIN //
+
+// src/bench.c includes this file and brings its own main
+#ifndef XCB_MULTI_NO_MAIN
+
+int
+main(int argc, char **argv)
+{
+    options_parse(argc, argv);
+
+    if(game.check.enabled)
+        return check_run() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if(game.compare.enabled)
+        return compare_backends() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    return run() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+// FUNCTIONS //
+
+void
+options_parse(int argc, char **argv)
+{
+    // Set basic window data
+    game.window.width = game.window.height = 300;
+    game.window.count = 1;
+    game.should_close = false;
+
+    game.gpu_api = GRAPHICS_API_VULKAN;
+    game.gpu_api_is_forced = false;
+    game.vk.max_frames = 2;
+    game.vk.current_frame = 0;
+
+    game.clock.tick_rate = SIM_TICK_RATE;
+    game.clock.fps_cap = 0;
+
+    game.compare.enabled = false;
+    game.compare.frames = COMPARE_FRAMES;
+
+    game.textures.demo = 0;
+    game.textures.cap = 0;
+
+    game.assets.disabled = false;
+
+    game.mesh.name = NULL;
+
+    game.cull.demo = 0;
+
+    game.capture.path = NULL;
+
+    game.dynres.enabled = false;
+
+    game.vsync.mode = VSYNC_DEFAULT;
+    game.vsync.picked = NULL;
+
+    game.egl.enabled = false;
+
+    // Debug builds are there to see the errors
+#ifdef DEBUG
+    game.gl.wanted = GL_CONTEXT_CORE;
+#else
+    game.gl.wanted = GL_CONTEXT_NO_ERROR;
+#endif
+
+    game.check.enabled = false;
+    game.check.update = false;
+    game.check.golden = NULL;
+    game.check.baseline = NULL;
+    game.check.frames = CHECK_FRAMES;
+    game.check.tolerance = CHECK_TOLERANCE;
+    game.check.threshold = CHECK_THRESHOLD;
+
+    // Validation is opt-in, it costs time on every Vulkan call
+    const char *env = getenv(ENV_VK_VALIDATION);
+    game.vk.validation = env != NULL && strcmp(env, "0") != 0;
+    game.vk.severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+
+    env = getenv(ENV_VK_VALIDATION_SEVERITY);
+    if(env != NULL) {
+        if(strcmp(env, "verbose") == 0)
+            game.vk.severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+        else if(strcmp(env, "info") == 0)
+            game.vk.severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
+        else if(strcmp(env, "warning") == 0)
+            game.vk.severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+        else if(strcmp(env, "error") == 0)
+            game.vk.severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+        else
+            fprintf(stderr, "Unknown validation severity '%s'!\n", env);
+    }
+
+    // Handle arguments
+    for(int i = 0; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--use-opengl") == 0) {
+            game.gpu_api = GRAPHICS_API_OPENGL;
+        } else if(strcmp(argv[i], "--use-egl") == 0) {
+            game.gpu_api = GRAPHICS_API_OPENGL;
+            game.egl.enabled = true;
+        } else if(strcmp(argv[i], "--force-opengl") == 0) {
+            game.gpu_api = GRAPHICS_API_OPENGL;
+            game.gpu_api_is_forced = true;
+        } else if(strcmp(argv[i], "--use-vulkan") == 0) {
+            game.gpu_api = GRAPHICS_API_VULKAN;
+        } else if(strcmp(argv[i], "--force-vulkan") == 0) {
+            game.gpu_api = GRAPHICS_API_VULKAN;
+            game.gpu_api_is_forced = true;
+        } else if(strcmp(argv[i], "--vk-validation") == 0) {
+            game.vk.validation = true;
+        } else if(strcmp(argv[i], "--vk-render-pass") == 0) {
+            game.vk.no_dynamic_rendering = true;
+        } else if(strcmp(argv[i], "--vk-particles") == 0) {
+            if(i + 1 < argc) {
+                game.vk.compute.particles = (unsigned int)strtol(argv[i + 1],
+                                                                 (char **)NULL,
+                                                                 10);
+
+                if(game.vk.compute.particles == 0)
+                    fprintf(stderr,
+                            "Unknown number, "
+                            "failed to add particles!\n");
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to add particles!\n");
+            }
+        } else if(strcmp(argv[i], "--vk-compute-on-graphics") == 0) {
+            game.vk.compute.on_graphics = true;
+        } else if(strcmp(argv[i], "--gl-context") == 0) {
+            const char *context = i + 1 < argc ? argv[i + 1] : "";
+
+            if(strcmp(context, "legacy") == 0) {
+                game.gl.wanted = GL_CONTEXT_LEGACY;
+            } else if(strcmp(context, "core") == 0) {
+                game.gl.wanted = GL_CONTEXT_CORE;
+            } else if(strcmp(context, "no-error") == 0) {
+                game.gl.wanted = GL_CONTEXT_NO_ERROR;
+            } else {
+                fprintf(stderr,
+                        "Needs legacy, core or no-error, "
+                        "failed to change the OpenGL context!\n");
+            }
+        } else if(strcmp(argv[i], "--vsync") == 0) {
+            const char *mode = i + 1 < argc ? argv[i + 1] : "";
+
+            if(strcmp(mode, "off") == 0) {
+                game.vsync.mode = VSYNC_OFF;
+            } else if(strcmp(mode, "on") == 0) {
+                game.vsync.mode = VSYNC_ON;
+            } else if(strcmp(mode, "adaptive") == 0) {
+                game.vsync.mode = VSYNC_ADAPTIVE;
+            } else {
+                fprintf(stderr,
+                        "Needs off, on or adaptive, "
+                        "failed to change vsync!\n");
+            }
+        } else if(strcmp(argv[i], "--present-timing") == 0) {
+            game.present.enabled = true;
+        } else if(strcmp(argv[i], "--present-timing-log") == 0) {
+            if(i + 1 < argc) {
+                game.present.log = fopen(argv[i + 1], "w");
+
+                if(game.present.log == NULL)
+                    fprintf(stderr, "Failed to open '%s'!\n"
+                                    "%s\n",
+                                    argv[i + 1], strerror(errno));
+                else
+                    game.present.enabled = true;
+            } else {
+                fprintf(stderr,
+                        "Wasn't given a file, "
+                        "failed to log present timing!\n");
+            }
+        } else if(strcmp(argv[i], "--compare-backends") == 0) {
+            game.compare.enabled = true;
+        } else if(strcmp(argv[i], "--compare-frames") == 0) {
+            if(i + 1 < argc) {
+                game.compare.frames = (unsigned int)strtol(argv[i + 1],
+                                                           (char **)NULL,
+                                                           10);
+
+                if(game.compare.frames == 0) {
+                    fprintf(stderr,
+                            "Unknown number, "
+                            "failed to change the compare frames!\n");
+
+                    game.compare.frames = COMPARE_FRAMES;
+                }
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to change the compare frames!\n");
+            }
+        } else if(strcmp(argv[i], "--no-archive") == 0) {
+            game.assets.disabled = true;
+        } else if(strcmp(argv[i], "--cull-demo") == 0) {
+            if(i + 1 < argc) {
+                long demo = strtol(argv[i + 1], (char **)NULL, 10);
+
+                if(demo < 0 || demo > UINT32_MAX) {
+                    fprintf(stderr,
+                            "%ld is not a number of objects, "
+                            "failed to start the culling demo!\n",
+                            demo);
+                    demo = 0;
+                }
+
+                game.cull.demo = (unsigned int)demo;
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to start the culling demo!\n");
+            }
+        } else if(strcmp(argv[i], "--capture") == 0) {
+            if(i + 1 < argc) {
+                game.capture.path = argv[i + 1];
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, failed to start capturing!\n");
+            }
+        } else if(strcmp(argv[i], "--check-golden") == 0) {
+            if(i + 1 < argc) {
+                game.check.golden = argv[i + 1];
+                game.check.enabled = true;
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to check against a golden image!\n");
+            }
+        } else if(strcmp(argv[i], "--check-baseline") == 0) {
+            if(i + 1 < argc) {
+                game.check.baseline = argv[i + 1];
+                game.check.enabled = true;
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to check against a baseline!\n");
+            }
+        } else if(strcmp(argv[i], "--check-update") == 0) {
+            game.check.update = true;
+        } else if(strcmp(argv[i], "--check-frames") == 0) {
+            if(i + 1 < argc) {
+                game.check.frames = (unsigned int)strtol(argv[i + 1],
+                                                         (char **)NULL,
+                                                         10);
+
+                if(game.check.frames <= CHECK_WARMUP) {
+                    fprintf(stderr,
+                            "Unknown number, "
+                            "failed to change the check frames!\n");
+
+                    game.check.frames = CHECK_FRAMES;
+                }
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to change the check frames!\n");
+            }
+        } else if(strcmp(argv[i], "--check-tolerance") == 0) {
+            if(i + 1 < argc) {
+                game.check.tolerance = (unsigned int)strtol(argv[i + 1],
+                                                            (char **)NULL,
+                                                            10);
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to change the check tolerance!\n");
+            }
+        } else if(strcmp(argv[i], "--check-threshold") == 0) {
+            if(i + 1 < argc) {
+                game.check.threshold = strtod(argv[i + 1], (char **)NULL);
+
+                if(game.check.threshold <= 0.0) {
+                    fprintf(stderr,
+                            "Unknown number, "
+                            "failed to change the check threshold!\n");
+
+                    game.check.threshold = CHECK_THRESHOLD;
+                }
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to change the check threshold!\n");
+            }
+        } else if(strcmp(argv[i], "--dynamic-resolution") == 0) {
+            if(i + 1 < argc) {
+                double ms = strtod(argv[i + 1], (char **)NULL);
+
+                if(ms <= 0.0) {
+                    fprintf(stderr,
+                            "Unknown number, "
+                            "failed to enable dynamic resolution!\n");
+                } else {
+                    game.dynres.enabled = true;
+                    game.dynres.target_ns = ms * 1e6;
+                }
+            } else {
+                fprintf(stderr,
+                        "Wasn't given a budget, "
+                        "failed to enable dynamic resolution!\n");
+            }
+        } else if(strcmp(argv[i], "--mesh") == 0) {
+            if(i + 1 < argc)
+                game.mesh.name = argv[i + 1];
+            else
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to load a mesh!\n");
+        } else if(strcmp(argv[i], "--texture-budget") == 0) {
+            if(i + 1 < argc) {
+                long mb = strtol(argv[i + 1], (char **)NULL, 10);
+
+                if(mb <= 0)
+                    fprintf(stderr,
+                            "Unknown number, "
+                            "failed to change the texture budget!\n");
+                else
+                    game.textures.cap = (uint64_t)mb << 20;
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to change the texture budget!\n");
+            }
+        } else if(strcmp(argv[i], "--texture-demo") == 0) {
+            if(i + 1 < argc) {
+                game.textures.demo = (unsigned int)strtol(argv[i + 1],
+                                                          (char **)NULL,
+                                                          10);
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to start the texture demo!\n");
+            }
+        } else if(strcmp(argv[i], "--tick-rate") == 0) {
+            if(i + 1 < argc) {
+                game.clock.tick_rate = (unsigned int)strtol(argv[i + 1],
+                                                            (char **)NULL,
+                                                            10);
+
+                if(game.clock.tick_rate == 0) {
+                    fprintf(stderr,
+                            "Unknown number, "
+                            "failed to change the tick rate!\n");
+
+                    game.clock.tick_rate = SIM_TICK_RATE;
+                }
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to change the tick rate!\n");
+            }
+        } else if(strcmp(argv[i], "--fps-cap") == 0) {
+            if(i + 1 < argc) {
+                game.clock.fps_cap = (unsigned int)strtol(argv[i + 1],
+                                                          (char **)NULL,
+                                                          10);
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to cap the frame rate!\n");
+            }
+        } else if(strcmp(argv[i], "--windows") == 0) {
+            if(i + 1 < argc) {
+                game.window.count = (unsigned int)strtol(argv[i + 1],
+                                                         (char **)NULL,
+                                                         10);
+
+                if(game.window.count == 0 || game.window.count > WINDOW_MAX) {
+                    fprintf(stderr,
+                            "Needs 1 to %d, "
+                            "failed to change the window count!\n",
+                            WINDOW_MAX);
+
+                    game.window.count = 1;
+                }
+            } else {
+                fprintf(stderr,
+                        "Wasn't given anything, "
+                        "failed to change the window count!\n");
+            }
+        } else if(strcmp(argv[i], "--vulkan-max-frames-in-flight") == 0) {
+            if(i + 1 < argc) {
+                game.vk.max_frames = (unsigned int)strtol(argv[i + 1], 
+                                                            (char **)NULL, 
+                                                            10);
+
+                if(game.vk.max_frames == 0) {
+                    fprintf(stderr, 
+                            "Unknown number, "
+                            "failed to change max frames in flight!\n");
+
+                    game.vk.max_frames = 2;
+                }
+            } else {
+                fprintf(stderr, 
+                        "Wasn't given anything, "
+                        "failed to change max frames in flight!\n");
+            }
+        } else if(strcmp(argv[i], "--vulkan-adaptive-frames-in-flight") == 0) {
+            if(i + 2 < argc) {
+                game.vk.adapt.min = (unsigned int)strtol(argv[i + 1], 
+                                                         (char **)NULL, 
+                                                         10);
+                game.vk.adapt.max = (unsigned int)strtol(argv[i + 2], 
+                                                         (char **)NULL, 
+                                                         10);
+
+                if(game.vk.adapt.min == 0 || 
+                   game.vk.adapt.max < game.vk.adapt.min) {
+                    fprintf(stderr, 
+                            "Bad range, "
+                            "failed to enable adaptive frames in flight!\n");
+                } else {
+                    game.vk.adapt.enabled = true;
+                }
+            } else {
+                fprintf(stderr, 
+                        "Wasn't given a min and max, "
+                        "failed to enable adaptive frames in flight!\n");
+            }
+        }
+    }
+
+    // Checks compare pixels, a moving render scale would fail them
+    if(game.dynres.enabled && game.check.enabled) {
+        fprintf(stderr, "Dynamic resolution is disabled while checking!\n");
+        game.dynres.enabled = false;
+    }
+
+    // Start inside the controller's range
+    if(game.vk.adapt.enabled) {
+        if(game.vk.max_frames < game.vk.adapt.min)
+            game.vk.max_frames = game.vk.adapt.min;
+        else if(game.vk.max_frames > game.vk.adapt.max)
+            game.vk.max_frames = game.vk.adapt.max;
+    }
+
+    cull_select_kernel();
+}
+
+bool
+run(void)
+{
+    game.should_close = false;
+
+    // Init
+    if(!init()) {
+        clean_up();
+        return false;
+    }
+
+    // Rendering runs on its own thread from here on
+    sim_init();
+
+    if(!render_start()) {
+        clean_up();
+        return false;
+    }
+
+    // Simulate in fixed steps until we should close, however fast we render
+    uint64_t step_ns = game.sim.step_ns;
+    uint64_t previous = time_ns();
+    uint64_t accumulator = 0;
+    uint64_t cpu_start = thread_cpu_ns();
+
+    while(game.should_close == false)
+    {
+        uint64_t now = time_ns();
+        uint64_t elapsed = now - previous;
+        previous = now;
+
+        if(elapsed > SIM_MAX_ELAPSED_NS)
+            elapsed = SIM_MAX_ELAPSED_NS;
+
+        accumulator += elapsed;
+
+        input();
+
+        if(accumulator >= step_ns) {
+            while(accumulator >= step_ns)
+            {
+                sim_step();
+                accumulator -= step_ns;
+            }
+
+            game.sim.time_ns = now;
+            game.sim.remainder_ns = accumulator;
+            snapshot_publish(&game.sim);
+        }
+
+        // Nothing to do until the next tick is due
+        sleep_until(now + step_ns - accumulator);
+    }
+
+    game.stats.sim_cpu_ns = thread_cpu_ns() - cpu_start;
+
+    pthread_join(game.render.thread, NULL);
+
+    if(game.gpu_api == GRAPHICS_API_VULKAN)
+        vkDeviceWaitIdle(game.vk.device);
+
+    if(game.stats.frames > 0) {
+        double avg = (double)game.stats.frame_ns / 
+                     (double)game.stats.frames / 1e6;
+
+        fprintf(stdout, "Rendered %lu frames, average frame time %.3f ms.\n",
+                        (unsigned long)game.stats.frames, avg);
+
+        double frames = (double)game.stats.frames;
+
+        fprintf(stdout, "Per frame: %.2f draws, %.2f pipeline binds, "
+                        "%.2f material binds.\n",
+                        (double)game.stats.draws / frames,
+                        (double)game.stats.pipeline_binds / frames,
+                        (double)game.stats.material_binds / frames);
+
+        fprintf(stdout, "%lu frames (%.1f%%) drew what the frame before did "
+                        "and reused its work.\n",
+                        (unsigned long)game.render.reused,
+                        100.0 * (double)game.render.reused / frames);
+    }
+
+    if(game.gpu_api == GRAPHICS_API_VULKAN && game.vk.recreates > 0)
+        fprintf(stdout, "Recreated the swapchain %u times with %s, "
+                        "%.3f ms each.\n",
+                        game.vk.recreates,
+                        game.vk.dynamic_rendering ? "dynamic rendering"
+                                                  : "a render pass",
+                        (double)game.vk.recreate_ns /
+                        (double)game.vk.recreates / 1e6);
+
+    texture_report();
+    mesh_report();
+    cull_report();
+    dynres_report();
+    capture_report();
+
+    // This should stay the same whatever the frame rate is
+    if(game.stats.ticks > 0) {
+        double cpu = (double)game.stats.sim_cpu_ns /
+                     (double)game.stats.ticks / 1e3;
+
+        fprintf(stdout, "Simulated %lu ticks at %u Hz, "
+                        "%.3f us of CPU per tick.\n",
+                        (unsigned long)game.stats.ticks,
+                        game.clock.tick_rate, cpu);
+    }
+
+    clean_up();
+    return !game.render.failed;
+}
+
+bool
+compare_backends(void)
+{
+    const graphics_api_e apis[] = {
+        GRAPHICS_API_VULKAN,
+        GRAPHICS_API_OPENGL
+    };
+
+    const unsigned int api_c = sizeof(apis) / sizeof(apis[0]);
+
+    backend_result_t results[sizeof(apis) / sizeof(apis[0])];
+    memset(results, 0, sizeof(results));
+
+    // The controller may change this during a run
+    unsigned int max_frames = game.vk.max_frames;
+    bool rss_reset = true;
+
+    // Each backend gets its own capture, or the second would overwrite
+    // the first
+    const char *capture = game.capture.path;
+    char capture_path[4096];
+
+    for(unsigned int i = 0; i < api_c; i++)
+    {
+        // Start every backend from the same place
+        game.gpu_api = apis[i];
+        game.gpu_api_is_forced = true;
+        game.vk.max_frames = max_frames;
+        game.window.width = game.window.height = 300;
+        memset(&game.stats, 0, sizeof(game.stats));
+        game.present.reported_frames = 0;
+
+        if(capture != NULL) {
+            const char *name = apis[i] == GRAPHICS_API_VULKAN ? "vulkan"
+                                                              : "opengl";
+            size_t len = strlen(capture);
+
+            while(len > 1 && capture[len - 1] == '/')
+                len--;
+
+            // Before the extension, so a video stays a video
+            bool y4m = len > 4 && strncmp(capture + len - 4, ".y4m", 4) == 0;
+
+            snprintf(capture_path, sizeof(capture_path), "%.*s-%s%s",
+                                   (int)(y4m ? len - 4 : len), capture,
+                                   name, y4m ? ".y4m" : "");
+
+            game.capture.path = capture_path;
+        }
+
+        rss_reset = peak_rss_reset() && rss_reset;
+
+        uint64_t wall = time_ns();
+        uint64_t cpu = process_cpu_ns();
+
+        results[i].api = apis[i];
+        results[i].ok = run();
+
+        results[i].wall_ms = (double)(time_ns() - wall) / 1e6;
+        results[i].cpu_ms = (double)(process_cpu_ns() - cpu) / 1e6;
+        results[i].peak_rss_kb = peak_rss_kb();
+
+        results[i].frames = game.stats.frames;
+        results[i].init_ms = (double)game.stats.init_ns / 1e6;
+
+        samples_t *times = &game.compare.frame_times;
+
+        if(times->count > 0) {
+            results[i].p50_ms = (double)samples_percentile(times, 50) / 1e6;
+            results[i].p95_ms = (double)samples_percentile(times, 95) / 1e6;
+            results[i].p99_ms = (double)samples_percentile(times, 99) / 1e6;
+        }
+
+        samples_free(times);
+
+        results[i].vsync = game.vsync.picked;
+        results[i].presented = game.present.reported_frames;
+        results[i].missed = game.present.reported_missed;
+        results[i].latency_p50_ms = game.present.reported_p50_ms;
+        results[i].latency_p99_ms = game.present.reported_p99_ms;
+        results[i].gap_p99_ms = game.present.reported_gap_p99_ms;
+    }
+
+    game.capture.path = capture;
+
+    compare_print_report(results, api_c);
+
+    if(!rss_reset)
+        fprintf(stdout, "Couldn't reset the peak RSS between runs, "
+                        "later backends include earlier ones.\n");
+
+    for(unsigned int i = 0; i < api_c; i++)
+        if(!results[i].ok)
+            return false;
+
+    return true;
+}
+
+void
+compare_print_report(const backend_result_t *results, unsigned int count)
+{
+    fprintf(stdout, "\nBackend comparison, %u frames each:\n"
+                    "  %-8s %9s %8s %8s %8s %9s %6s %9s\n",
+                    game.compare.frames,
+                    "backend", "init ms", "p50 ms", "p95 ms", "p99 ms",
+                    "CPU ms", "CPU %", "peak MiB");
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+        const backend_result_t *r = &results[i];
+        const char *name = r->api == GRAPHICS_API_VULKAN ? "Vulkan"
+                                                         : "OpenGL";
+
+        if(!r->ok || r->frames == 0) {
+            fprintf(stdout, "  %-8s failed\n", name);
+            continue;
+        }
+
+        // Over 100% means more than one core was busy
+        double cpu_pct = r->wall_ms > 0 ? r->cpu_ms / r->wall_ms * 100 : 0;
+
+        fprintf(stdout, "  %-8s %9.3f %8.3f %8.3f %8.3f %9.1f %6.1f %9.1f\n",
+                        name,
+                        r->init_ms,
+                        r->p50_ms, r->p95_ms, r->p99_ms,
+                        r->cpu_ms, cpu_pct,
+                        (double)r->peak_rss_kb / 1024.0);
+    }
+
+    if(!game.present.enabled)
+        return;
+
+    // Submit to display and display to display, the same targets for both
+    fprintf(stdout, "\nPresent timing:\n"
+                    "  %-8s %8s %8s %8s %8s %6s  %s\n",
+                    "backend", "frames", "p50 ms", "p99 ms", "gap p99",
+                    "missed", "vsync");
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+        const backend_result_t *r = &results[i];
+        const char *name = r->api == GRAPHICS_API_VULKAN ? "Vulkan"
+                                                         : "OpenGL";
+
+        if(r->presented == 0) {
+            fprintf(stdout, "  %-8s not measured\n", name);
+            continue;
+        }
+
+        fprintf(stdout, "  %-8s %8lu %8.3f %8.3f %8.3f %6lu  %s\n",
+                        name,
+                        (unsigned long)r->presented,
+                        r->latency_p50_ms, r->latency_p99_ms, r->gap_p99_ms,
+                        (unsigned long)r->missed,
+                        r->vsync != NULL ? r->vsync : "vsync");
+    }
+}
+
+void
+clean_up(void)
+{
+    fprintf(stdout, "Exiting.\n");
+
+    window_stop_event_thread();
+    cmd_list_free();
+    texture_free_all();
+    mesh_free();
+    cull_free();
+    assets_close();
+
+    if(game.gpu_api == GRAPHICS_API_VULKAN)
+        vk_present_timing_stop();
+
+    present_timing_report();
+
+    if(game.gpu_api == GRAPHICS_API_OPENGL && game.egl.enabled) {
+        if(game.egl.display != EGL_NO_DISPLAY) {
+            eglMakeCurrent(game.egl.display,
+                           EGL_NO_SURFACE,
+                           EGL_NO_SURFACE,
+                           EGL_NO_CONTEXT);
+
+            for(unsigned int i = 0; i < game.window.count; i++)
+            {
+                if(game.egl.surfaces[i] != EGL_NO_SURFACE)
+                    eglDestroySurface(game.egl.display,
+                                      game.egl.surfaces[i]);
+
+                if(game.egl.contexts[i] != EGL_NO_CONTEXT)
+                    eglDestroyContext(game.egl.display,
+                                      game.egl.contexts[i]);
+            }
+
+            eglTerminate(game.egl.display);
+        }
+
+        for(unsigned int i = 0; i < game.window.count; i++)
+            if(game.xcb.windows[i])
+                xcb_destroy_window(game.xcb.connection, game.xcb.windows[i]);
+
+        if(game.xcb.connection != NULL)
+            xcb_disconnect(game.xcb.connection);
+    } else if(game.gpu_api == GRAPHICS_API_OPENGL) {
+        for(unsigned int i = 0; i < game.window.count; i++)
+        {
+            if(game.gl.windows[i])
+                glXDestroyWindow(game.xlib.display, game.gl.windows[i]);
+
+            if(game.xcb.windows[i])
+                xcb_destroy_window(game.xcb.connection, game.xcb.windows[i]);
+
+            if(game.gl.contexts[i])
+                glXDestroyContext(game.xlib.display, game.gl.contexts[i]);
+        }
+
+        XCloseDisplay(game.xlib.display);
+    } else if(game.gpu_api == GRAPHICS_API_VULKAN) {
+
+        if(game.vk.img_available != NULL)
+            for(unsigned int i = 0;
+                i < game.vk.frame_slots * game.window.count;
+                i++)
+                vkDestroySemaphore(game.vk.device,
+                                   game.vk.img_available[i],
+                                   NULL);
+
+        free(game.vk.img_available);
+        free(game.vk.frame_values);
+
+        vkDestroySemaphore(game.vk.device, game.vk.timeline, NULL);
+
+        vk_destroy_particles();
+
+        // Image command buffers come out of the pool, so before it goes
+        for(unsigned int i = 0; i < game.window.count; i++)
+            vk_destroy_window(&game.vk.windows[i]);
+
+        vkDestroyCommandPool(game.vk.device, game.vk.cmdpool, NULL);
+        free(game.vk.cmdbuffer);
+
+        vkDestroyPipeline(game.vk.device, game.vk.pipeline, NULL);
+        vkDestroyPipelineLayout(game.vk.device, game.vk.pipeline_layout, NULL);
+
+        vkDestroyPipeline(game.vk.device, game.vk.mesh_pipeline, NULL);
+        vkDestroyPipelineLayout(game.vk.device, game.vk.mesh_layout, NULL);
+        vkDestroyBuffer(game.vk.device, game.vk.mesh_buffer, NULL);
+        vkFreeMemory(game.vk.device, game.vk.mesh_memory, NULL);
+        vkDestroyRenderPass(game.vk.device, game.vk.render_pass, NULL);
+        vkDestroyRenderPass(game.vk.device, game.vk.scene.render_pass, NULL);
+
+        vkDestroyDevice(game.vk.device, NULL);
+
+        for(unsigned int i = 0; i < game.window.count; i++)
+            vkDestroySurfaceKHR(game.vk.instance,
+                                game.vk.windows[i].surface,
+                                NULL);
+
+        if(game.vk.messenger != VK_NULL_HANDLE) {
+            PFN_vkDestroyDebugUtilsMessengerEXT destroy = 
+                (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(
+                                            game.vk.instance,
+                                            "vkDestroyDebugUtilsMessengerEXT");
+
+            if(destroy != NULL)
+                destroy(game.vk.instance, game.vk.messenger, NULL);
+        }
+
+        vkDestroyInstance(game.vk.instance, NULL);
+
+        for(unsigned int i = 0; i < game.window.count; i++)
+            if(game.xcb.windows[i])
+                xcb_destroy_window(game.xcb.connection, game.xcb.windows[i]);
+
+        xcb_disconnect(game.xcb.connection);
+
+    }
+
+    // Leave everything how init() expects to find it, so it can run again.
+    // Only the options from the command line survive.
+    unsigned int max_frames = game.vk.max_frames;
+    bool adapt = game.vk.adapt.enabled;
+    unsigned int adapt_min = game.vk.adapt.min;
+    unsigned int adapt_max = game.vk.adapt.max;
+    bool validation = game.vk.validation;
+    VkDebugUtilsMessageSeverityFlagsEXT severity = game.vk.severity;
+    bool no_dynamic_rendering = game.vk.no_dynamic_rendering;
+    unsigned int particles = game.vk.compute.particles;
+    bool on_graphics = game.vk.compute.on_graphics;
+
+    memset(&game.vk, 0, sizeof(game.vk));
+
+    game.vk.max_frames = max_frames;
+    game.vk.adapt.enabled = adapt;
+    game.vk.adapt.min = adapt_min;
+    game.vk.adapt.max = adapt_max;
+    game.vk.validation = validation;
+    game.vk.severity = severity;
+    game.vk.no_dynamic_rendering = no_dynamic_rendering;
+    game.vk.compute.particles = particles;
+    game.vk.compute.on_graphics = on_graphics;
+
+    gl_context_e gl_wanted = game.gl.wanted;
+    bool egl = game.egl.enabled;
+
+    memset(&game.gl, 0, sizeof(game.gl));
+    memset(&game.egl, 0, sizeof(game.egl));
+    memset(&game.xcb, 0, sizeof(game.xcb));
+
+    game.gl.wanted = gl_wanted;
+    game.egl.enabled = egl;
+    game.xlib.display = NULL;
+
+    game.present.last_display_ns = game.present.refresh_ns = 0;
+}
+
+bool
+init(void)
+{
+    uint64_t start = time_ns();
+
+    assets_open();
+    dynres_reset();
+
+    // Before the backends, they build what it needs
+    if(!mesh_load())
+        fprintf(stderr, "Continuing without a mesh.\n");
+
+    if(game.gpu_api == GRAPHICS_API_OPENGL) {
+        bool success = init_opengl();
+
+        if(!success && !game.gpu_api_is_forced) {
+            fprintf(stdout, "Failed to load OpenGL, using Vulkan!\n");
+            game.gpu_api = GRAPHICS_API_VULKAN;
+
+            if(!init_vulkan()) {
+                fprintf(stderr, "\nInitialization failed!\n");
+                return false;
+            }
+        } else if(!success) {
+            fprintf(stderr, "\nInitialization failed!\n");
+            return false;
+        }
+    } else if(game.gpu_api == GRAPHICS_API_VULKAN) {
+        bool success = init_vulkan();
+
+        if(!success && !game.gpu_api_is_forced) {
+            fprintf(stdout, "Failed to load Vulkan, using OpenGL!\n");
+            game.gpu_api = GRAPHICS_API_OPENGL;
+
+            if(!init_opengl()) {
+                fprintf(stderr, "\nInitialization failed!\n");
+                return false;
+            }
+        } else if(!success) {
+            fprintf(stderr, "\nInitialization failed!\n");
+            return false;
+        }
+    }
+
+    // Headless runs have nothing to send events
+    if(
+        !texture_init() ||
+        !cull_init()    ||
+        (!game.egl.headless && !window_start_event_thread())
+    ) {
+        fprintf(stderr, "\nInitialization failed!\n");
+        return false;
+    }
+
+    game.stats.init_ns = time_ns() - start;
+
+    fprintf(stdout, "Initialization finished in %.3f ms.\n",
+                    (double)game.stats.init_ns / 1e6);
+
+    fprintf(stdout, "Loaded %u assets, %.1f KiB in %.3f ms, "
+                    "%u from the archive.\n",
+                    game.assets.loads,
+                    (double)game.assets.bytes / 1024.0,
+                    (double)game.assets.load_ns / 1e6,
+                    game.assets.from_archive);
+
+    return true;
+}
+
+void
+input(void)
+{
+    // Everything was already read by the event thread, so no syscalls here
+    event_t event;
+
+    while(event_pop(&event))
+    {
+        switch(event.type)
+        {
+            case EVENT_CLOSE:
+                game.should_close = true;
+                break;
+
+            // The render thread resizes once it sees the new size
+            case EVENT_RESIZE:
+                game.window.width = event.size.width;
+                game.window.height = event.size.height;
+                break;
+        }
+    }
+}
+
+void
+sim_init(void)
+{
+    game.sim = (sim_state_t){
+        .tick = 0,
+        .time_ns = time_ns(),
+        .step_ns = 1000000000ull / game.clock.tick_rate,
+        .remainder_ns = 0,
+        .width = game.window.width,
+        .height = game.window.height,
+        .phase = 0.0
+    };
+
+    sim_color(game.sim.phase, game.sim.clear_color);
+    sim_color(game.sim.phase, game.sim.prev_color);
+
+    // The renderer needs something to read before the first update
+    game.snapshot.front = 0;
+    game.snapshot.back = 1;
+    game.snapshot.buffers[0] = game.sim;
+    atomic_store(&game.snapshot.shared, 2);
+}
+
+void
+sim_step(void)
+{
+    memcpy(game.sim.prev_color,
+           game.sim.clear_color,
+           sizeof(game.sim.prev_color));
+
+    game.sim.tick++;
+    game.sim.width = game.window.width;
+    game.sim.height = game.window.height;
+
+    game.sim.phase += SIM_PULSE_HZ / (double)game.clock.tick_rate;
+    if(game.sim.phase >= 1.0)
+        game.sim.phase -= 1.0;
+
+    sim_color(game.sim.phase, game.sim.clear_color);
+
+    game.stats.ticks++;
+}
+
+void
+sim_interpolate(const sim_state_t *state, uint64_t now, sim_state_t *out)
+{
+    *out = *state;
+
+    // How far we are past the newest tick, as a fraction of a tick
+    uint64_t since = now - state->time_ns + state->remainder_ns;
+    float alpha = since >= state->step_ns ?
+                  1.0f : (float)since / (float)state->step_ns;
+
+    for(int i = 0; i < 4; i++)
+        out->clear_color[i] = state->prev_color[i] +
+                              (state->clear_color[i] - state->prev_color[i]) *
+                              alpha;
+}
+
+void
+sim_color(double phase, float out[4])
+{
+    // Triangle wave so the green goes from full to half and back
+    double wave = phase < 0.5 ? phase * 2.0 : 2.0 - phase * 2.0;
+
+    out[0] = 0.0f;
+    out[1] = (float)(1.0 - wave * 0.5);
+    out[2] = 0.0f;
+    out[3] = 1.0f;
+}
+
+void
+snapshot_publish(const sim_state_t *state)
+{
+    game.snapshot.buffers[game.snapshot.back] = *state;
+
+    // Swap our back buffer with the middle one, the old middle is ours now
+    unsigned int old = atomic_exchange(&game.snapshot.shared,
+                                       game.snapshot.back | SNAPSHOT_FRESH);
+
+    game.snapshot.back = old & ~SNAPSHOT_FRESH;
+}
+
+const sim_state_t *
+snapshot_acquire(void)
+{
+    // Keep reading the same state until a new one is published
+    if(atomic_load(&game.snapshot.shared) & SNAPSHOT_FRESH) {
+        unsigned int old = atomic_exchange(&game.snapshot.shared,
+                                           game.snapshot.front);
+
+        game.snapshot.front = old & ~SNAPSHOT_FRESH;
+    }
+
+    return &game.snapshot.buffers[game.snapshot.front];
+}
+
+bool
+render_start(void)
+{
+    game.render.width = game.window.width;
+    game.render.height = game.window.height;
+    game.render.failed = false;
+
+    // A GL context can only be current on one thread
+    if(game.gpu_api == GRAPHICS_API_OPENGL)
+        gl_release_current();
+
+    if(pthread_create(&game.render.thread, NULL, render_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to start the render thread!\n");
+        return false;
+    }
+
+    return true;
+}
+
+void *
+render_thread(void *arg)
+{
+    (void)arg;
+
+    if(game.gpu_api == GRAPHICS_API_OPENGL) {
+        // The API is per thread, and releasing the context later only
+        // releases one of the bound API
+        if(game.egl.enabled)
+            eglBindAPI(EGL_OPENGL_API);
+
+        if(!gl_make_current(0)) {
+            fprintf(stderr, "Failed to make the OpenGL context current on "
+                            "the render thread!\n");
+            game.render.failed = true;
+            game.should_close = true;
+            return NULL;
+        }
+    }
+
+    // Runs as long as there are frames to capture
+    capture_start();
+
+    uint64_t last = time_ns();
+    uint64_t next = last;
+
+    while(game.should_close == false)
+    {
+        sim_state_t state;
+        sim_interpolate(snapshot_acquire(), time_ns(), &state);
+
+        if(game.check.enabled)
+            check_pin_state(&state);
+
+        if(state.width != game.render.width ||
+           state.height != game.render.height)
+            render_resize(state.width, state.height);
+
+        render_build_commands(&state);
+        cmd_list_sort();
+        render_prepare(&state);
+
+        if(game.gpu_api == GRAPHICS_API_OPENGL)
+            render_opengl(&state);
+        else if(game.gpu_api == GRAPHICS_API_VULKAN)
+            render_vulkan(&state);
+
+        if(game.clock.fps_cap > 0) {
+            next += 1000000000ull / game.clock.fps_cap;
+
+            // Don't rush to make up for frames that were already late
+            if(next < time_ns())
+                next = time_ns();
+            else
+                sleep_until(next);
+        }
+
+        uint64_t now = time_ns();
+        game.stats.frame_ns += now - last;
+        game.stats.frames++;
+
+        if(game.compare.enabled) {
+            samples_add(&game.compare.frame_times, now - last);
+
+            if(game.stats.frames >= game.compare.frames)
+                game.should_close = true;
+        }
+
+        if(game.check.enabled) {
+            if(game.stats.frames > CHECK_WARMUP)
+                samples_add(&game.check.frame_times, now - last);
+
+            if(game.stats.frames >= game.check.frames)
+                game.should_close = true;
+        }
+
+        last = now;
+    }
+
+    // Needs the context for the pixel buffers
+    capture_stop();
+
+    if(game.gpu_api == GRAPHICS_API_OPENGL) {
+        gl_scene_free();
+        gl_indirect_free();
+        gl_release_current();
+    }
+
+    return NULL;
+}
+
+void
+render_resize(int width, int height)
+{
+    game.render.width = width;
+    game.render.height = height;
+
+    if(game.gpu_api == GRAPHICS_API_OPENGL) {
+        glViewport(0, 0, width, height);
+    } else if(game.gpu_api == GRAPHICS_API_VULKAN) {
+        if(!vk_recreate_swapchain(&game.vk.windows[0]))
+            game.should_close = true;
+    }
+}
+
+void
+render_build_commands(const sim_state_t *state)
+{
+    game.cmds.count = 0;
+
+    // Each demo texture comes closer and goes away again, and is off
+    // screen for half the time
+    for(unsigned int i = 0; i < game.textures.count; i++)
+    {
+        double t = state->phase + (double)i / (double)game.textures.count;
+        if(t >= 1.0)
+            t -= 1.0;
+
+        if(t < 0.5)
+            texture_request(i, (float)(t * 8.0 * state->height));
+    }
+
+    // The placeholder shaders make their own vertices
+    cmd_list_push(cmd_sort_key(RENDER_PASS_OPAQUE,
+                               RENDER_PIPELINE_MAIN,
+                               0,
+                               0.0f),
+                  0, 3, UINT32_MAX);
+
+    // Either lots of copies seen through a camera, or one in the middle
+    if(game.cull.bounds.count > 0)
+        cull_build_commands(state);
+    else if(game.mesh.ready)
+        cmd_list_push(cmd_sort_key(RENDER_PASS_OPAQUE,
+                                   RENDER_PIPELINE_MESH,
+                                   0,
+                                   0.0f),
+                      0, game.mesh.header.index_count, UINT32_MAX);
+}
+
+// Compares the sorted command list and everything the draws read against
+// the last frame. Returns true and works out the mesh constants again if
+// anything changed.
+bool
+render_prepare(const sim_state_t *state)
+{
+    unsigned int count = game.cmds.count;
+
+    bool same = game.render.frame != 0 &&
+                count == game.render.drawn_count &&
+                state->phase == game.render.phase &&
+                state->width == game.render.drawn_width &&
+                state->height == game.render.drawn_height &&
+                memcmp(state->clear_color,
+                       game.render.clear_color,
+                       sizeof(game.render.clear_color)) == 0 &&
+                memcmp(game.cull.view_proj,
+                       game.render.view_proj,
+                       sizeof(game.render.view_proj)) == 0;
+
+    // Field by field, the padding is never written
+    for(unsigned int i = 0; same && i < count; i++)
+    {
+        const draw_cmd_t *a = &game.cmds.list[i];
+        const draw_cmd_t *b = &game.render.drawn[i];
+
+        same = a->key == b->key &&
+               a->first_vertex == b->first_vertex &&
+               a->vertex_count == b->vertex_count &&
+               a->object == b->object;
+    }
+
+    if(same) {
+        game.render.reused++;
+        return false;
+    }
+
+    if(count > game.render.drawn_size) {
+        draw_cmd_t *drawn = realloc(game.render.drawn,
+                                    count * sizeof(*drawn));
+        if(drawn != NULL)
+            game.render.drawn = drawn;
+
+        mesh_push_t *pushes = realloc(game.render.pushes,
+                                      count * sizeof(*pushes));
+        if(pushes != NULL)
+            game.render.pushes = pushes;
+
+        if(drawn == NULL || pushes == NULL) {
+            fprintf(stderr, "Failed to grow the command list!\n");
+            game.should_close = true;
+
+            // Nothing to draw with, so draw nothing
+            game.cmds.count = game.render.drawn_count = 0;
+            return false;
+        }
+
+        game.render.drawn_size = count;
+    }
+
+    if(count > 0)
+        memcpy(game.render.drawn, game.cmds.list, count * sizeof(draw_cmd_t));
+
+    for(unsigned int i = 0; i < count; i++)
+        if(SORT_KEY_PIPELINE(game.cmds.list[i].key) == RENDER_PIPELINE_MESH)
+            mesh_push_constants(state,
+                                game.cmds.list[i].object,
+                                &game.render.pushes[i]);
+
+    game.render.drawn_count = count;
+    game.render.phase = state->phase;
+    game.render.drawn_width = state->width;
+    game.render.drawn_height = state->height;
+    memcpy(game.render.clear_color,
+           state->clear_color,
+           sizeof(game.render.clear_color));
+    memcpy(game.render.view_proj,
+           game.cull.view_proj,
+           sizeof(game.render.view_proj));
+
+    game.render.frame++;
+
+    return true;
+}
+
+void
+dynres_reset(void)
+{
+    game.dynres.active = false;
+    game.dynres.percent = game.dynres.lowest = 100;
+    game.dynres.gpu_ns = 0.0;
+    game.dynres.cooldown = 0;
+    game.dynres.samples = game.dynres.changes = 0;
+    game.dynres.percent_sum = game.dynres.gpu_total_ns = 0;
+}
+
+// Takes how long the GPU spent on one of the first window's frames, and
+// moves the render scale if it's been over or well under the budget
+void
+dynres_update(uint64_t gpu_ns)
+{
+    // Smoothed, so one slow frame doesn't move the scale
+    if(game.dynres.samples == 0)
+        game.dynres.gpu_ns = (double)gpu_ns;
+    else
+        game.dynres.gpu_ns += ((double)gpu_ns - game.dynres.gpu_ns) * 0.1;
+
+    game.dynres.samples++;
+    game.dynres.percent_sum += game.dynres.percent;
+    game.dynres.gpu_total_ns += gpu_ns;
+
+    if(game.dynres.cooldown > 0) {
+        game.dynres.cooldown--;
+        return;
+    }
+
+    double gpu = game.dynres.gpu_ns;
+    double target = game.dynres.target_ns;
+    unsigned int percent = game.dynres.percent;
+
+    // The gap between the two is the hysteresis. A step up costs at most
+    // (55 / 50)^2, about 1.2 times the GPU time, which lands back inside it.
+    if(gpu > target * 1.05 && percent > DYNRES_MIN) {
+        // GPU time goes with the pixels, the square of the scale, so go
+        // straight to what should fit
+        unsigned int fit = (unsigned int)((double)percent *
+                                          sqrt(target / gpu));
+        fit -= fit % DYNRES_STEP;
+
+        if(fit >= percent)
+            fit = percent - DYNRES_STEP;
+
+        percent = fit < DYNRES_MIN ? DYNRES_MIN : fit;
+    } else if(gpu < target * 0.8 && percent < 100) {
+        // Back up a step at a time, going over is what hurts
+        percent += DYNRES_STEP;
+    } else {
+        return;
+    }
+
+    game.dynres.percent = percent;
+    game.dynres.changes++;
+    game.dynres.cooldown = DYNRES_COOLDOWN;
+
+    if(percent < game.dynres.lowest)
+        game.dynres.lowest = percent;
+}
+
+// A window dimension at the render scale
+unsigned int
+dynres_scale(unsigned int size)
+{
+    if(!game.dynres.active)
+        return size;
+
+    unsigned int scaled = size * game.dynres.percent / 100;
+
+    return scaled > 0 ? scaled : 1;
+}
+
+void
+dynres_report(void)
+{
+    if(!game.dynres.active || game.dynres.samples == 0)
+        return;
+
+    double samples = (double)game.dynres.samples;
+
+    fprintf(stdout, "Dynamic resolution: %.1f%% scale on average, %u%% at "
+                    "the lowest, changed %lu times.\n"
+                    "  GPU %.3f ms a frame against a %.3f ms budget.\n",
+                    (double)game.dynres.percent_sum / samples,
+                    game.dynres.lowest,
+                    (unsigned long)game.dynres.changes,
+                    (double)game.dynres.gpu_total_ns / samples / 1e6,
+                    game.dynres.target_ns / 1e6);
+}
+
+uint64_t
+cmd_sort_key(render_pass_e pass,
+             render_pipeline_e pipeline,
+             unsigned int material,
+             float depth)
+{
+    // Positive floats sort the same as their bits, front to back
+    uint32_t depth_bits = 0;
+
+    if(depth > 0.0f)
+        memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+    // Transparent things have to be drawn back to front
+    if(pass == RENDER_PASS_TRANSPARENT)
+        depth_bits = ~depth_bits;
+
+    return ((uint64_t)pass << SORT_KEY_PASS_SHIFT) |
+           ((uint64_t)(pipeline & 0xFFF) << SORT_KEY_PIPELINE_SHIFT) |
+           ((uint64_t)(material & 0xFFFF) << SORT_KEY_MATERIAL_SHIFT) |
+           (uint64_t)depth_bits;
+}
+
+bool
+cmd_list_push(uint64_t key,
+              uint32_t first_vertex,
+              uint32_t vertex_count,
+              uint32_t object)
+{
+    if(game.cmds.count == game.cmds.size) {
+        unsigned int size = game.cmds.size ? game.cmds.size * 2 : 64;
+
+        draw_cmd_t *list = realloc(game.cmds.list, size * sizeof(*list));
+        if(list == NULL) {
+            fprintf(stderr, "Failed to grow the command list!\n");
+            return false;
+        }
+
+        game.cmds.list = list;
+
+        draw_cmd_t *scratch = realloc(game.cmds.scratch,
+                                      size * sizeof(*scratch));
+        if(scratch == NULL) {
+            fprintf(stderr, "Failed to grow the command list!\n");
+            return false;
+        }
+
+        game.cmds.scratch = scratch;
+        game.cmds.size = size;
+    }
+
+    game.cmds.list[game.cmds.count++] = (draw_cmd_t){
+        .key = key,
+        .first_vertex = first_vertex,
+        .vertex_count = vertex_count,
+        .object = object
+    };
+
+    return true;
+}
+
+void
+cmd_list_sort(void)
+{
+    // LSD radix sort, a byte at a time. Stable, so equal keys keep the
+    // order they were pushed in.
+    draw_cmd_t *src = game.cmds.list;
+    draw_cmd_t *dst = game.cmds.scratch;
+    unsigned int count = game.cmds.count;
+
+    if(count < 2)
+        return;
+
+    for(unsigned int shift = 0; shift < 64; shift += 8)
+    {
+        unsigned int offsets[256] = {0};
+
+        for(unsigned int i = 0; i < count; i++)
+            offsets[(src[i].key >> shift) & 0xFF]++;
+
+        // Every key has the same byte here, nothing would move
+        if(offsets[(src[0].key >> shift) & 0xFF] == count)
+            continue;
+
+        unsigned int total = 0;
+        for(unsigned int i = 0; i < 256; i++)
+        {
+            unsigned int c = offsets[i];
+            offsets[i] = total;
+            total += c;
+        }
+
+        for(unsigned int i = 0; i < count; i++)
+            dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+        draw_cmd_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    game.cmds.list = src;
+    game.cmds.scratch = dst;
+}
+
+void
+cmd_list_free(void)
+{
+    free(game.cmds.list);
+    free(game.cmds.scratch);
+
+    game.cmds.list = game.cmds.scratch = NULL;
+    game.cmds.count = game.cmds.size = 0;
+
+    free(game.render.drawn);
+    free(game.render.pushes);
+
+    game.render.drawn = NULL;
+    game.render.pushes = NULL;
+    game.render.drawn_count = game.render.drawn_size = 0;
+    game.render.frame = game.render.reused = 0;
+}
+
+void
+cull_select_kernel(void)
+{
+    for(unsigned int bits = 0; bits < 256; bits++)
+    {
+        unsigned int n = 0;
+
+        for(unsigned int lane = 0; lane < 8; lane++)
+            if(bits & (1u << lane))
+                game.cull.lanes[bits][n++] = lane;
+
+        while(n < 8)
+            game.cull.lanes[bits][n++] = 0;
+    }
+
+    game.cull.kernel = cull_scalar;
+    game.cull.kernel_name = "scalar";
+
+#ifdef CULL_X86
+    __builtin_cpu_init();
+
+    // x86-64 always has SSE2
+    game.cull.kernel = cull_sse;
+    game.cull.kernel_name = "sse";
+
+    if(__builtin_cpu_supports("avx2")) {
+        game.cull.kernel = cull_avx2;
+        game.cull.kernel_name = "avx2";
+    }
+#endif
+
+    const char *env = getenv(ENV_CULL_KERNEL);
+    if(env == NULL)
+        return;
+
+    if(strcmp(env, "scalar") == 0) {
+        game.cull.kernel = cull_scalar;
+        game.cull.kernel_name = "scalar";
+#ifdef CULL_X86
+    } else if(strcmp(env, "sse") == 0) {
+        game.cull.kernel = cull_sse;
+        game.cull.kernel_name = "sse";
+    } else if(strcmp(env, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        game.cull.kernel = cull_avx2;
+        game.cull.kernel_name = "avx2";
+#endif
+    } else {
+        fprintf(stderr, "Culling kernel '%s' isn't available, using %s!\n",
+                        env, game.cull.kernel_name);
+    }
+}
+
+bool
+cull_bounds_alloc(cull_bounds_t *bounds, unsigned int count)
+{
+    size_t padded = (count + CULL_PAD - 1) & ~(size_t)(CULL_PAD - 1);
+    size_t bytes = (padded ? padded : CULL_PAD) * sizeof(float);
+
+    bounds->count = count;
+    bounds->x = aligned_alloc(CULL_ALIGN, bytes);
+    bounds->y = aligned_alloc(CULL_ALIGN, bytes);
+    bounds->z = aligned_alloc(CULL_ALIGN, bytes);
+    bounds->radius = aligned_alloc(CULL_ALIGN, bytes);
+
+    if(bounds->x == NULL || bounds->y == NULL ||
+       bounds->z == NULL || bounds->radius == NULL) {
+        fprintf(stderr, "Failed to allocate culling bounds!\n");
+        cull_bounds_free(bounds);
+
+        return false;
+    }
+
+    // Nothing is ever this far inside a plane
+    for(size_t i = count; i < bytes / sizeof(float); i++)
+    {
+        bounds->x[i] = bounds->y[i] = bounds->z[i] = 0.0f;
+        bounds->radius[i] = -FLT_MAX;
+    }
+
+    return true;
+}
+
+void
+cull_bounds_random(cull_bounds_t *bounds, uint32_t seed)
+{
+    uint32_t state = seed ? seed : 1;
+
+    for(unsigned int i = 0; i < bounds->count; i++)
+    {
+        bounds->x[i] = (cull_random(&state) - 0.5f) * CULL_WORLD;
+        bounds->y[i] = (cull_random(&state) - 0.5f) * CULL_WORLD * 0.25f;
+        bounds->z[i] = (cull_random(&state) - 0.5f) * CULL_WORLD;
+        bounds->radius[i] = 0.5f + cull_random(&state) * 1.5f;
+    }
+}
+
+void
+cull_bounds_free(cull_bounds_t *bounds)
+{
+    free(bounds->x);
+    free(bounds->y);
+    free(bounds->z);
+    free(bounds->radius);
+
+    memset(bounds, 0, sizeof(*bounds));
+}
+
+// xorshift32, 0 to 1
+float
+cull_random(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+
+    return (float)(*state >> 8) / 16777216.0f;
+}
+
+unsigned int
+cull_scalar(const cull_bounds_t *bounds,
+            const float planes[6][4],
+            uint32_t *visible)
+{
+    unsigned int n = 0;
+
+    for(unsigned int i = 0; i < bounds->count; i++)
+    {
+        bool inside = true;
+
+        for(unsigned int p = 0; p < 6 && inside; p++)
+            inside = planes[p][0] * bounds->x[i] +
+                     planes[p][1] * bounds->y[i] +
+                     planes[p][2] * bounds->z[i] +
+                     planes[p][3] >= -bounds->radius[i];
+
+        // Always written, only kept if it's inside
+        visible[n] = i;
+        n += inside;
+    }
+
+    return n;
+}
+
+#ifdef CULL_X86
+
+unsigned int
+cull_sse(const cull_bounds_t *bounds,
+         const float planes[6][4],
+         uint32_t *visible)
+{
+    __m128 px[6], py[6], pz[6], pw[6];
+
+    for(unsigned int p = 0; p < 6; p++)
+    {
+        px[p] = _mm_set1_ps(planes[p][0]);
+        py[p] = _mm_set1_ps(planes[p][1]);
+        pz[p] = _mm_set1_ps(planes[p][2]);
+        pw[p] = _mm_set1_ps(planes[p][3]);
+    }
+
+    unsigned int n = 0;
+
+    for(unsigned int i = 0; i < bounds->count; i += 4)
+    {
+        __m128 x = _mm_load_ps(&bounds->x[i]);
+        __m128 y = _mm_load_ps(&bounds->y[i]);
+        __m128 z = _mm_load_ps(&bounds->z[i]);
+        __m128 r = _mm_sub_ps(_mm_setzero_ps(),
+                              _mm_load_ps(&bounds->radius[i]));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for(unsigned int p = 0; p < 6; p++)
+        {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                                            _mm_mul_ps(px[p], x),
+                                            _mm_mul_ps(py[p], y)),
+                                            _mm_mul_ps(pz[p], z)),
+                                  pw[p]);
+
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, r));
+        }
+
+        // Write all four, then only keep the ones inside
+        unsigned int bits = (unsigned int)_mm_movemask_ps(inside);
+        __m128i lanes = _mm_load_si128((const __m128i *)
+                                                game.cull.lanes[bits]);
+
+        _mm_storeu_si128((__m128i *)&visible[n],
+                         _mm_add_epi32(lanes, _mm_set1_epi32((int)i)));
+
+        n += (unsigned int)__builtin_popcount(bits);
+    }
+
+    return n;
+}
+
+__attribute__((target("avx2")))
+unsigned int
+cull_avx2(const cull_bounds_t *bounds,
+          const float planes[6][4],
+          uint32_t *visible)
+{
+    __m256 px[6], py[6], pz[6], pw[6];
+
+    for(unsigned int p = 0; p < 6; p++)
+    {
+        px[p] = _mm256_set1_ps(planes[p][0]);
+        py[p] = _mm256_set1_ps(planes[p][1]);
+        pz[p] = _mm256_set1_ps(planes[p][2]);
+        pw[p] = _mm256_set1_ps(planes[p][3]);
+    }
+
+    unsigned int n = 0;
+
+    for(unsigned int i = 0; i < bounds->count; i += 8)
+    {
+        __m256 x = _mm256_load_ps(&bounds->x[i]);
+        __m256 y = _mm256_load_ps(&bounds->y[i]);
+        __m256 z = _mm256_load_ps(&bounds->z[i]);
+        __m256 r = _mm256_sub_ps(_mm256_setzero_ps(),
+                                 _mm256_load_ps(&bounds->radius[i]));
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        // Same order of operations as the scalar kernel, so they agree
+        for(unsigned int p = 0; p < 6; p++)
+        {
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                                            _mm256_mul_ps(px[p], x),
+                                            _mm256_mul_ps(py[p], y)),
+                                            _mm256_mul_ps(pz[p], z)),
+                                     pw[p]);
+
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, r, _CMP_GE_OQ));
+        }
+
+        unsigned int bits = (unsigned int)_mm256_movemask_ps(inside);
+        __m256i lanes = _mm256_load_si256((const __m256i *)
+                                                game.cull.lanes[bits]);
+
+        _mm256_storeu_si256((__m256i *)&visible[n],
+                            _mm256_add_epi32(lanes,
+                                             _mm256_set1_epi32((int)i)));
+
+        n += (unsigned int)__builtin_popcount(bits);
+    }
+
+    return n;
+}
+
+#endif
+
+// See Gribb and Hartmann, "Fast Extraction of Viewing Frustum Planes from
+// the World-View-Projection Matrix"
+void
+cull_planes(const float m[16], float planes[6][4])
+{
+    for(unsigned int p = 0; p < 6; p++)
+    {
+        // Left, right, bottom, top, near, far
+        unsigned int row = p / 2;
+        float sign = p % 2 ? -1.0f : 1.0f;
+
+        for(unsigned int j = 0; j < 4; j++)
+            planes[p][j] = m[j * 4 + 3] + sign * m[j * 4 + row];
+
+        float len = sqrtf(planes[p][0] * planes[p][0] +
+                          planes[p][1] * planes[p][1] +
+                          planes[p][2] * planes[p][2]);
+
+        for(unsigned int j = 0; j < 4 && len > 0.0f; j++)
+            planes[p][j] /= len;
+    }
+}
+
+void
+cull_camera(const sim_state_t *state, float out[16])
+{
+    float aspect = state->height > 0 ? (float)state->width /
+                                       (float)state->height
+                                     : 1.0f;
+
+    float proj[16], view[16];
+    mat4_perspective(proj, CULL_FOV, aspect, CULL_NEAR, CULL_FAR);
+
+    // Stands in the middle of everything and turns around once a pulse
+    mat4_rotate_y(view, -(float)state->phase);
+
+    mat4_multiply(out, proj, view);
+}
+
+bool
+cull_init(void)
+{
+    game.cull.frames = game.cull.tested = game.cull.passed = 0;
+    game.cull.cull_ns = 0;
+
+    if(game.cull.demo == 0)
+        return true;
+
+    if(game.mesh.name == NULL)
+        fprintf(stderr, "--cull-demo draws nothing without --mesh, "
+                        "only culls!\n");
+
+    if(!cull_bounds_alloc(&game.cull.bounds, game.cull.demo))
+        return false;
+
+    cull_bounds_random(&game.cull.bounds, game.cull.demo);
+
+    game.cull.spin = malloc(game.cull.demo * sizeof(float));
+    game.cull.visible = malloc((game.cull.demo + CULL_SLACK) *
+                               sizeof(uint32_t));
+
+    if(game.cull.spin == NULL || game.cull.visible == NULL) {
+        fprintf(stderr, "Failed to allocate the culling demo!\n");
+        return false;
+    }
+
+    uint32_t state = 0x9E3779B9u;
+    for(unsigned int i = 0; i < game.cull.demo; i++)
+        game.cull.spin[i] = cull_random(&state);
+
+    return true;
+}
+
+void
+cull_build_commands(const sim_state_t *state)
+{
+    float planes[6][4];
+
+    cull_camera(state, game.cull.view_proj);
+    cull_planes(game.cull.view_proj, planes);
+
+    uint64_t start = time_ns();
+
+    game.cull.visible_c = game.cull.kernel(&game.cull.bounds,
+                                           planes,
+                                           game.cull.visible);
+
+    game.cull.cull_ns += time_ns() - start;
+    game.cull.frames++;
+    game.cull.tested += game.cull.bounds.count;
+    game.cull.passed += game.cull.visible_c;
+
+    if(!game.mesh.ready)
+        return;
+
+    const cull_bounds_t *b = &game.cull.bounds;
+    const float *m = game.cull.view_proj;
+
+    for(unsigned int i = 0; i < game.cull.visible_c; i++)
+    {
+        uint32_t object = game.cull.visible[i];
+
+        // Clip w is the distance in front of the camera. There's no depth
+        // buffer yet, so overlapping copies can still draw out of order.
+        float depth = m[3] * b->x[object] +
+                      m[7] * b->y[object] +
+                      m[11] * b->z[object] +
+                      m[15];
+
+        cmd_list_push(cmd_sort_key(RENDER_PASS_OPAQUE,
+                                   RENDER_PIPELINE_MESH,
+                                   0,
+                                   depth),
+                      0, game.mesh.header.index_count, object);
+    }
+}
+
+void
+cull_report(void)
+{
+    if(game.cull.frames == 0)
+        return;
+
+    double frames = (double)game.cull.frames;
+
+    fprintf(stdout, "Culling (%s): %u objects, %.1f%% visible, "
+                    "%.3f ms a frame, %.2f objects/ns.\n",
+                    game.cull.kernel_name,
+                    game.cull.bounds.count,
+                    (double)game.cull.passed /
+                    (double)game.cull.tested * 100.0,
+                    (double)game.cull.cull_ns / frames / 1e6,
+                    (double)game.cull.tested /
+                    (double)(game.cull.cull_ns ? game.cull.cull_ns : 1));
+}
+
+void
+cull_free(void)
+{
+    cull_bounds_free(&game.cull.bounds);
+
+    free(game.cull.spin);
+    free(game.cull.visible);
+
+    game.cull.spin = NULL;
+    game.cull.visible = NULL;
+    game.cull.visible_c = 0;
+}
+
+void
+mat4_multiply(float out[16], const float a[16], const float b[16])
+{
+    float r[16];
+
+    for(unsigned int col = 0; col < 4; col++)
+        for(unsigned int row = 0; row < 4; row++)
+            r[col * 4 + row] = a[0 * 4 + row] * b[col * 4 + 0] +
+                               a[1 * 4 + row] * b[col * 4 + 1] +
+                               a[2 * 4 + row] * b[col * 4 + 2] +
+                               a[3 * 4 + row] * b[col * 4 + 3];
+
+    // out can be a or b
+    memcpy(out, r, sizeof(r));
+}
+
+void
+mat4_rotate_y(float out[16], float turns)
+{
+    float c = cosf(turns * 6.28318531f);
+    float s = sinf(turns * 6.28318531f);
+
+    memset(out, 0, sizeof(float) * 16);
+
+    out[0] = c;
+    out[2] = -s;
+    out[5] = 1.0f;
+    out[8] = s;
+    out[10] = c;
+    out[15] = 1.0f;
+}
+
+// OpenGL's clip space, the Vulkan shaders convert it
+void
+mat4_perspective(float out[16],
+                 float fov,
+                 float aspect,
+                 float near,
+                 float far)
+{
+    float f = 1.0f / tanf(fov * 0.5f);
+
+    memset(out, 0, sizeof(float) * 16);
+
+    out[0] = f / aspect;
+    out[5] = f;
+    out[10] = (far + near) / (near - far);
+    out[11] = -1.0f;
+    out[14] = 2.0f * far * near / (near - far);
+}
+
+void
+capture_start(void)
+{
+    game.capture.active = false;
+    game.capture.captured = game.capture.dropped = game.capture.latency = 0;
+    game.capture.written = game.capture.skipped = game.capture.write_ns = 0;
+
+    // Checking needs the last frame, and only that
+    game.capture.golden = game.check.golden != NULL;
+    game.check.golden_done = false;
+
+    if(game.capture.golden && game.capture.path != NULL)
+        fprintf(stderr, "Not capturing while checking a golden image!\n");
+
+    if(game.capture.path == NULL && !game.capture.golden)
+        return;
+
+    if(!game.capture.supported) {
+        fprintf(stderr, "This backend can't read back frames, "
+                        "not capturing!\n");
+        return;
+    }
+
+    const char *path = game.capture.path;
+    size_t len = path != NULL ? strlen(path) : 0;
+
+    game.capture.y4m = len > 4 && strcmp(path + len - 4, ".y4m") == 0;
+    game.capture.stream = NULL;
+
+    if(game.capture.golden) {
+        game.capture.y4m = false;
+    } else if(game.capture.y4m) {
+        game.capture.stream = fopen(path, "wb");
+
+        if(game.capture.stream == NULL) {
+            fprintf(stderr, "Failed to open '%s'!\n"
+                            "%s\n",
+                            path, strerror(errno));
+            return;
+        }
+    } else if(mkdir(path, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create '%s'!\n"
+                        "%s\n",
+                        path, strerror(errno));
+        return;
+    }
+
+    for(unsigned int i = 0; i < CAPTURE_RING; i++)
+    {
+        memset(&game.capture.readbacks[i], 0, sizeof(capture_readback_t));
+        atomic_init(&game.capture.readbacks[i].state, CAPTURE_IDLE);
+    }
+
+    for(uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+
+        for(unsigned int k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+
+        game.capture.crc_table[i] = c;
+    }
+
+    pthread_mutex_init(&game.capture.lock, NULL);
+    pthread_cond_init(&game.capture.cond, NULL);
+
+    game.capture.quit = false;
+    game.capture.head = game.capture.tail = 0;
+    game.capture.stream_width = game.capture.stream_height = 0;
+
+    if(pthread_create(&game.capture.thread,
+                      NULL,
+                      capture_thread,
+                      NULL) != 0) {
+        fprintf(stderr, "Failed to start the capture thread!\n");
+
+        pthread_cond_destroy(&game.capture.cond);
+        pthread_mutex_destroy(&game.capture.lock);
+
+        if(game.capture.stream != NULL)
+            fclose(game.capture.stream);
+
+        return;
+    }
+
+    game.capture.active = true;
+}
+
+// Render thread, once it's done rendering
+void
+capture_stop(void)
+{
+    if(!game.capture.active)
+        return;
+
+    // Everything already copied still gets written
+    if(game.gpu_api == GRAPHICS_API_OPENGL)
+        gl_capture_collect(true);
+    else if(game.gpu_api == GRAPHICS_API_VULKAN)
+        vk_capture_collect(true);
+
+    pthread_mutex_lock(&game.capture.lock);
+    game.capture.quit = true;
+    pthread_cond_signal(&game.capture.cond);
+    pthread_mutex_unlock(&game.capture.lock);
+
+    pthread_join(game.capture.thread, NULL);
+
+    pthread_cond_destroy(&game.capture.cond);
+    pthread_mutex_destroy(&game.capture.lock);
+
+    if(game.gpu_api == GRAPHICS_API_OPENGL)
+        gl_capture_free();
+    else if(game.gpu_api == GRAPHICS_API_VULKAN)
+        vk_capture_free();
+
+    if(game.capture.stream != NULL)
+        fclose(game.capture.stream);
+
+    free(game.capture.scratch);
+
+    game.capture.stream = NULL;
+    game.capture.scratch = NULL;
+    game.capture.scratch_size = 0;
+    game.capture.active = false;
+}
+
+// A readback free for this frame's copy, -1 if the writer is too far behind
+int
+capture_acquire(void)
+{
+    // Reading back failed for good, what's in flight still gets written
+    if(!game.capture.supported)
+        return -1;
+
+    // stats.frames is the frame being rendered, counting from 0
+    if(game.capture.golden && game.stats.frames + 1 != game.check.frames)
+        return -1;
+
+    for(unsigned int i = 0; i < CAPTURE_RING; i++)
+        if(atomic_load(&game.capture.readbacks[i].state) == CAPTURE_IDLE)
+            return (int)i;
+
+    game.capture.dropped++;
+
+    return -1;
+}
+
+// Hands READY readbacks to the writer, oldest first so streams stay in order
+void
+capture_submit_ready(void)
+{
+    while(true)
+    {
+        int oldest = -1;
+
+        for(unsigned int i = 0; i < CAPTURE_RING; i++)
+        {
+            const capture_readback_t *rb = &game.capture.readbacks[i];
+
+            if(atomic_load(&rb->state) == CAPTURE_READY &&
+               (oldest < 0 ||
+                rb->number < game.capture.readbacks[oldest].number))
+                oldest = (int)i;
+        }
+
+        if(oldest < 0)
+            return;
+
+        capture_readback_t *rb = &game.capture.readbacks[oldest];
+
+        game.capture.latency += game.stats.frames - rb->recorded_frame;
+        atomic_store(&rb->state, CAPTURE_WRITING);
+
+        // Never full, there are only CAPTURE_RING readbacks
+        pthread_mutex_lock(&game.capture.lock);
+        game.capture.queue[game.capture.head % CAPTURE_RING] =
+                                                        (unsigned int)oldest;
+        game.capture.head++;
+        pthread_cond_signal(&game.capture.cond);
+        pthread_mutex_unlock(&game.capture.lock);
+    }
+}
+
+void *
+capture_thread(void *arg)
+{
+    (void)arg;
+
+    while(true)
+    {
+        pthread_mutex_lock(&game.capture.lock);
+
+        while(!game.capture.quit && game.capture.head == game.capture.tail)
+            pthread_cond_wait(&game.capture.cond, &game.capture.lock);
+
+        // Quitting only once the queue is empty
+        if(game.capture.head == game.capture.tail) {
+            pthread_mutex_unlock(&game.capture.lock);
+            break;
+        }
+
+        unsigned int index =
+                    game.capture.queue[game.capture.tail % CAPTURE_RING];
+        game.capture.tail++;
+
+        pthread_mutex_unlock(&game.capture.lock);
+
+        capture_readback_t *rb = &game.capture.readbacks[index];
+        uint64_t start = time_ns();
+        bool success;
+
+        if(game.capture.golden) {
+            check_golden(rb);
+            success = game.check.golden_done;
+        } else if(game.capture.y4m) {
+            success = capture_write_y4m(rb);
+        } else {
+            char name[4096];
+            snprintf(name, sizeof(name), "%s/frame-%06lu.png",
+                                         game.capture.path,
+                                         (unsigned long)rb->number);
+
+            success = capture_write_png(rb, name);
+        }
+
+        if(success)
+            game.capture.written++;
+        else
+            game.capture.skipped++;
+
+        game.capture.write_ns += time_ns() - start;
+
+        atomic_store(&rb->state, CAPTURE_WRITTEN);
+    }
+
+    return NULL;
+}
+
+// Stored, not deflated, so writing keeps up with rendering. Anything that
+// reads PNGs can squeeze them afterwards.
+bool
+capture_write_png(const capture_readback_t *readback, const char *name)
+{
+    const unsigned int w = readback->width, h = readback->height;
+
+    // A filter byte then RGB for every row, in 65535 byte stored blocks
+    size_t row_size = 1 + (size_t)w * 3;
+    size_t raw = (size_t)h * row_size;
+    size_t blocks = raw ? (raw + 65534) / 65535 : 1; // As many as the loop
+    size_t idat = 2 + blocks * 5 + raw + 4;
+
+    // Signature, IHDR, IDAT and IEND, then the scanlines after them
+    size_t size = 8 + 25 + 12 + idat + 12;
+
+    if(idat > UINT32_MAX || !capture_scratch(size + raw))
+        return false;
+
+    uint8_t *out = game.capture.scratch;
+    uint8_t *rows = out + size;
+
+    for(unsigned int y = 0; y < h; y++)
+    {
+        unsigned int row = readback->flip ? h - 1 - y : y;
+        const uint8_t *src = readback->data + row * readback->stride;
+        uint8_t *dst = rows + y * row_size;
+
+        *dst++ = 0; // No filter
+
+        for(unsigned int x = 0; x < w; x++, src += 4, dst += 3)
+        {
+            dst[0] = src[readback->bgr ? 2 : 0];
+            dst[1] = src[1];
+            dst[2] = src[readback->bgr ? 0 : 2];
+        }
+    }
+
+    memcpy(out, "\x89PNG\r\n\x1a\n", 8);
+    size_t at = 8;
+
+    // 8 bit RGB, no interlacing
+    at = capture_put32(out, at, 13);
+    memcpy(&out[at], "IHDR", 4);
+    at = capture_put32(out, at + 4, w);
+    at = capture_put32(out, at, h);
+    memcpy(&out[at], "\x08\x02\x00\x00\x00", 5);
+    at += 5;
+    at = capture_put32(out, at, capture_crc32(0, &out[at - 17], 17));
+
+    at = capture_put32(out, at, (uint32_t)idat);
+    size_t idat_start = at;
+    memcpy(&out[at], "IDAT", 4);
+    at += 4;
+
+    // zlib header, 32K window and no compression
+    out[at++] = 0x78;
+    out[at++] = 0x01;
+
+    // Always at least one block, the last one is marked final
+    size_t done = 0;
+
+    do {
+        size_t len = raw - done < 65535 ? raw - done : 65535;
+
+        out[at++] = done + len == raw ? 1 : 0;
+        out[at++] = (uint8_t)len;
+        out[at++] = (uint8_t)(len >> 8);
+        out[at++] = (uint8_t)~len;
+        out[at++] = (uint8_t)(~len >> 8);
+
+        memcpy(&out[at], rows + done, len);
+        at += len;
+        done += len;
+    } while(done < raw);
+
+    // Adler-32, only reduced as often as it has to be to not overflow
+    uint32_t a = 1, b = 0;
+
+    for(size_t i = 0; i < raw;)
+    {
+        size_t end = raw - i < 5552 ? raw : i + 5552;
+
+        for(; i < end; i++)
+        {
+            a += rows[i];
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+    }
+
+    at = capture_put32(out, at, (b << 16) | a);
+    at = capture_put32(out, at, capture_crc32(0,
+                                              &out[idat_start],
+                                              at - idat_start));
+
+    at = capture_put32(out, at, 0);
+    memcpy(&out[at], "IEND\xae\x42\x60\x82", 8);
+    at += 8;
+
+    FILE *file = fopen(name, "wb");
+    if(file == NULL) {
+        fprintf(stderr, "Failed to open '%s'!\n"
+                        "%s\n",
+                        name, strerror(errno));
+        return false;
+    }
+
+    bool success = fwrite(out, at, 1, file) == 1;
+
+    if(fclose(file) != 0 || !success) {
+        fprintf(stderr, "Failed to write '%s'!\n", name);
+        return false;
+    }
+
+    return true;
+}
+
+// 4:4:4 BT.601 in video range. The first frame sets the stream's size,
+// frames from after a resize are skipped.
+bool
+capture_write_y4m(const capture_readback_t *readback)
+{
+    const unsigned int w = readback->width, h = readback->height;
+
+    if(game.capture.stream_width == 0) {
+        unsigned int rate = game.clock.fps_cap ? game.clock.fps_cap : 60;
+
+        fprintf(game.capture.stream, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n",
+                                     w, h, rate);
+
+        game.capture.stream_width = w;
+        game.capture.stream_height = h;
+    }
+
+    if(w != game.capture.stream_width || h != game.capture.stream_height)
+        return false;
+
+    size_t plane = (size_t)w * h;
+
+    if(!capture_scratch(plane * 3))
+        return false;
+
+    uint8_t *y_plane = game.capture.scratch;
+    uint8_t *u_plane = y_plane + plane;
+    uint8_t *v_plane = u_plane + plane;
+
+    const unsigned int r_at = readback->bgr ? 2 : 0;
+    const unsigned int b_at = readback->bgr ? 0 : 2;
+
+    for(unsigned int y = 0; y < h; y++)
+    {
+        unsigned int row = readback->flip ? h - 1 - y : y;
+        const uint8_t *src = readback->data + row * readback->stride;
+        size_t at = (size_t)y * w;
+
+        for(unsigned int x = 0; x < w; x++, src += 4, at++)
+        {
+            int r = src[r_at], g = src[1], b = src[b_at];
+
+            y_plane[at] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8)
+                                    + 16);
+            u_plane[at] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8)
+                                    + 128);
+            v_plane[at] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8)
+                                    + 128);
+        }
+    }
+
+    if(fputs("FRAME\n", game.capture.stream) == EOF ||
+       fwrite(game.capture.scratch, plane * 3, 1, game.capture.stream) != 1) {
+        fprintf(stderr, "Failed to write to '%s'!\n", game.capture.path);
+        return false;
+    }
+
+    return true;
+}
+
+// Writer thread only
+bool
+capture_scratch(size_t size)
+{
+    if(size <= game.capture.scratch_size)
+        return true;
+
+    uint8_t *scratch = realloc(game.capture.scratch, size);
+    if(scratch == NULL) {
+        fprintf(stderr, "Failed to allocate %lu bytes to write a frame!\n",
+                        (unsigned long)size);
+        return false;
+    }
+
+    game.capture.scratch = scratch;
+    game.capture.scratch_size = size;
+
+    return true;
+}
+
+// Big endian, returns where it stopped
+size_t
+capture_put32(uint8_t *out, size_t at, uint32_t value)
+{
+    out[at] = (uint8_t)(value >> 24);
+    out[at + 1] = (uint8_t)(value >> 16);
+    out[at + 2] = (uint8_t)(value >> 8);
+    out[at + 3] = (uint8_t)value;
+
+    return at + 4;
+}
+
+uint32_t
+capture_crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+    crc = ~crc;
+
+    for(size_t i = 0; i < size; i++)
+        crc = game.capture.crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+void
+capture_report(void)
+{
+    // Checks say how they went themselves
+    if(game.capture.golden ||
+       (game.capture.captured == 0 && game.capture.dropped == 0))
+        return;
+
+    double written = (double)(game.capture.written ? game.capture.written
+                                                   : 1);
+
+    fprintf(stdout, "Captured %lu frames to '%s', %lu written, "
+                    "%lu skipped, %lu dropped.\n"
+                    "Frames were mapped %.2f frames after rendering, "
+                    "and took %.3f ms each to write.\n",
+                    (unsigned long)game.capture.captured,
+                    game.capture.path,
+                    (unsigned long)game.capture.written,
+                    (unsigned long)game.capture.skipped,
+                    (unsigned long)game.capture.dropped,
+                    (double)game.capture.latency /
+                    (double)(game.capture.captured ? game.capture.captured
+                                                   : 1),
+                    (double)game.capture.write_ns / written / 1e6);
+}
+
+// Runs once with whatever backend was picked, true if every check passed
+bool
+check_run(void)
+{
+    memset(&game.check.frame_times, 0, sizeof(game.check.frame_times));
+
+    bool passed = run();
+
+    if(!passed)
+        fprintf(stderr, "The check run failed!\n");
+
+    // Report on both, even if one fails
+    if(passed && game.check.golden != NULL)
+        passed = check_golden_report();
+
+    if(game.check.baseline != NULL && game.stats.frames > 0)
+        passed = check_baseline() && passed;
+
+    samples_free(&game.check.frame_times);
+
+    fprintf(stdout, "Checks %s.\n", passed ? "passed" : "FAILED");
+
+    return passed;
+}
+
+// The simulation keeps ticking, but every frame shows the same moment
+void
+check_pin_state(sim_state_t *state)
+{
+    state->phase = CHECK_PHASE;
+
+    sim_color(CHECK_PHASE, state->clear_color);
+    sim_color(CHECK_PHASE, state->prev_color);
+}
+
+// Capture thread. Writes the golden image when updating, otherwise counts
+// the pixels that differ from it.
+void
+check_golden(const capture_readback_t *readback)
+{
+    game.check.golden_ok = false;
+    game.check.golden_done = true;
+
+    if(game.check.update) {
+        game.check.golden_ok = capture_write_png(readback,
+                                                 game.check.golden);
+        return;
+    }
+
+    unsigned int width, height;
+    uint8_t *rgb;
+
+    if(!check_read_png(game.check.golden, &width, &height, &rgb))
+        return;
+
+    if(width != readback->width || height != readback->height) {
+        fprintf(stderr, "'%s' is %ux%u, the frame was %ux%u!\n",
+                        game.check.golden, width, height,
+                        readback->width, readback->height);
+        free(rgb);
+        return;
+    }
+
+    game.check.pixels = (uint64_t)width * height;
+    game.check.bad_pixels = 0;
+    game.check.worst = 0;
+
+    for(unsigned int y = 0; y < height; y++)
+    {
+        unsigned int row = readback->flip ? height - 1 - y : y;
+        const uint8_t *src = readback->data + row * readback->stride;
+        const uint8_t *want = rgb + (size_t)y * width * 3;
+
+        for(unsigned int x = 0; x < width; x++, src += 4, want += 3)
+        {
+            int got[3] = {
+                src[readback->bgr ? 2 : 0],
+                src[1],
+                src[readback->bgr ? 0 : 2]
+            };
+
+            unsigned int diff = 0;
+
+            for(unsigned int c = 0; c < 3; c++)
+            {
+                unsigned int d = (unsigned int)abs(got[c] - want[c]);
+
+                if(d > diff)
+                    diff = d;
+            }
+
+            if(diff > game.check.worst)
+                game.check.worst = diff;
+
+            if(diff > game.check.tolerance)
+                game.check.bad_pixels++;
+        }
+    }
+
+    free(rgb);
+
+    game.check.golden_ok = (double)game.check.bad_pixels <=
+                           (double)game.check.pixels * CHECK_BAD_SHARE;
+}
+
+// Only reads what capture_write_png() writes: 8 bit RGB, stored blocks and
+// no row filters. Goldens should only ever come from --check-update.
+bool
+check_read_png(const char *name,
+               unsigned int *width,
+               unsigned int *height,
+               uint8_t **rgb)
+{
+    char *file = NULL;
+    size_t size = 0;
+
+    vk_read_file(name, &size, &file);
+
+    if(file == NULL)
+        return false;
+
+    const uint8_t *data = (const uint8_t *)file;
+    uint8_t *raw = NULL;
+    size_t raw_size = 0, raw_at = 0;
+    size_t zlib_at = 2; // Past the zlib header
+    size_t block = 0;
+    bool final = false, header = false;
+
+    *rgb = NULL;
+
+    size_t at = 8;
+    bool valid = size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0;
+
+    while(valid && at + 12 <= size)
+    {
+        size_t len = check_be32(&data[at]);
+        const uint8_t *type = &data[at + 4];
+        const uint8_t *chunk = &data[at + 8];
+
+        if(len > size - at - 12) {
+            valid = false;
+            break;
+        }
+
+        if(memcmp(type, "IHDR", 4) == 0) {
+            valid = !header && len == 13 &&
+                    memcmp(&chunk[8], "\x08\x02\x00\x00\x00", 5) == 0;
+
+            *width = check_be32(&chunk[0]);
+            *height = check_be32(&chunk[4]);
+
+            // Each row is a filter byte, then RGB
+            raw_size = (size_t)*height * (1 + (size_t)*width * 3);
+            raw = valid ? malloc(raw_size + 1) : NULL;
+            valid = raw != NULL;
+            header = true;
+        } else if(memcmp(type, "IDAT", 4) == 0) {
+            if(!header) {
+                valid = false;
+                break;
+            }
+
+            // Stored blocks can run across IDAT chunks
+            for(size_t i = 0; i < len && valid;)
+            {
+                if(zlib_at > 0) {
+                    zlib_at--;
+                    i++;
+                } else if(block > 0) {
+                    size_t n = len - i < block ? len - i : block;
+
+                    if(n > raw_size - raw_at) {
+                        valid = false;
+                        break;
+                    }
+
+                    memcpy(&raw[raw_at], &chunk[i], n);
+                    raw_at += n;
+                    block -= n;
+                    i += n;
+                } else if(final) {
+                    break; // The Adler-32 is all that's left
+                } else if(len - i >= 5) {
+                    // Stored blocks only, anything else was compressed
+                    valid = (chunk[i] & 6) == 0;
+                    final = chunk[i] & 1;
+                    block = (size_t)chunk[i + 1] | (size_t)chunk[i + 2] << 8;
+                    i += 5;
+                } else {
+                    valid = false;
+                }
+            }
+        } else if(memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+
+        at += 12 + len;
+    }
+
+    free(file);
+
+    valid = valid && header && raw_at == raw_size;
+
+    // Drop the filter bytes, which all have to be 0
+    for(unsigned int y = 0; valid && y < *height; y++)
+        valid = raw[(size_t)y * (1 + (size_t)*width * 3)] == 0;
+
+    if(!valid) {
+        fprintf(stderr, "'%s' isn't a golden image written by "
+                        "--check-update!\n", name);
+        free(raw);
+        return false;
+    }
+
+    size_t row = (size_t)*width * 3;
+    for(unsigned int y = 0; y < *height; y++)
+        memmove(&raw[(size_t)y * row], &raw[(size_t)y * (row + 1) + 1], row);
+
+    *rgb = raw;
+
+    return true;
+}
+
+uint32_t
+check_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+bool
+check_golden_report(void)
+{
+    if(!game.check.golden_done) {
+        fprintf(stderr, "The last frame was never read back, "
+                        "can't check '%s'!\n",
+                        game.check.golden);
+        return false;
+    }
+
+    if(game.check.update) {
+        if(game.check.golden_ok)
+            fprintf(stdout, "Wrote golden image '%s'.\n", game.check.golden);
+
+        return game.check.golden_ok;
+    }
+
+    if(game.check.pixels > 0)
+        fprintf(stdout, "Golden image '%s': %lu of %lu pixels off by more "
+                        "than %u, worst by %u. %s.\n",
+                        game.check.golden,
+                        (unsigned long)game.check.bad_pixels,
+                        (unsigned long)game.check.pixels,
+                        game.check.tolerance,
+                        game.check.worst,
+                        game.check.golden_ok ? "Passed" : "FAILED");
+
+    return game.check.golden_ok;
+}
+
+// The baseline is "p50 ms" lines, one per percentile
+bool
+check_baseline(void)
+{
+    const double percentiles[] = {50, 95, 99};
+    const unsigned int count = sizeof(percentiles) / sizeof(percentiles[0]);
+    double now[sizeof(percentiles) / sizeof(percentiles[0])];
+
+    if(game.check.frame_times.count == 0) {
+        fprintf(stderr, "No frames were timed, can't check '%s'!\n",
+                        game.check.baseline);
+        return false;
+    }
+
+    for(unsigned int i = 0; i < count; i++)
+        now[i] = (double)samples_percentile(&game.check.frame_times,
+                                            percentiles[i]) / 1e6;
+
+    if(game.check.update) {
+        FILE *file = fopen(game.check.baseline, "w");
+        if(file == NULL) {
+            fprintf(stderr, "Failed to open '%s'!\n"
+                            "%s\n",
+                            game.check.baseline, strerror(errno));
+            return false;
+        }
+
+        for(unsigned int i = 0; i < count; i++)
+            fprintf(file, "p%.0f %.6f\n", percentiles[i], now[i]);
+
+        if(fclose(file) != 0) {
+            fprintf(stderr, "Failed to write '%s'!\n", game.check.baseline);
+            return false;
+        }
+
+        fprintf(stdout, "Wrote baseline '%s'.\n", game.check.baseline);
+        return true;
+    }
+
+    FILE *file = fopen(game.check.baseline, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Failed to open '%s'!\n"
+                        "%s\n",
+                        game.check.baseline, strerror(errno));
+        return false;
+    }
+
+    double base[sizeof(percentiles) / sizeof(percentiles[0])];
+    bool found[sizeof(percentiles) / sizeof(percentiles[0])] = {false};
+
+    double percentile, ms;
+    while(fscanf(file, " p%lf %lf", &percentile, &ms) == 2)
+        for(unsigned int i = 0; i < count; i++)
+            if(percentile == percentiles[i]) {
+                base[i] = ms;
+                found[i] = true;
+            }
+
+    fclose(file);
+
+    bool passed = true;
+
+    fprintf(stdout, "Frame times against '%s', %.1f%% allowed:\n"
+                    "  %-4s %11s %11s %8s\n",
+                    game.check.baseline, game.check.threshold,
+                    "", "baseline ms", "now ms", "change");
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+        if(!found[i]) {
+            fprintf(stderr, "'%s' has no p%.0f!\n",
+                            game.check.baseline, percentiles[i]);
+            passed = false;
+            continue;
+        }
+
+        double change = base[i] > 0.0 ? (now[i] / base[i] - 1.0) * 100.0
+                                       : 0.0;
+        bool regressed = change > game.check.threshold;
+
+        fprintf(stdout, "  p%-3.0f %11.3f %11.3f %+7.1f%%%s\n",
+                        percentiles[i], base[i], now[i], change,
+                        regressed ? " REGRESSED" : "");
+
+        if(regressed)
+            passed = false;
+    }
+
+    return passed;
+}
+
+void
+assets_open(void)
+{
+    game.assets.loads = game.assets.from_archive = 0;
+    game.assets.bytes = game.assets.load_ns = 0;
+
+    if(game.assets.disabled)
+        return;
+
+    uint64_t start = time_ns();
+
+    int fd = open(ASSET_ARCHIVE, O_RDONLY);
+    if(fd < 0) {
+        if(errno != ENOENT)
+            fprintf(stderr, "Failed to open '%s'!\n"
+                            "%s\n",
+                            ASSET_ARCHIVE, strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(archive_header_t)) {
+        fprintf(stderr, "'%s' is too small to be an archive!\n",
+                        ASSET_ARCHIVE);
+        close(fd);
+        return;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // The mapping keeps the file open
+    close(fd);
+
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map '%s'!\n"
+                        "%s\n",
+                        ASSET_ARCHIVE, strerror(errno));
+        return;
+    }
+
+    // Everything in it is about to be read, start reading it now
+    posix_madvise(map, (size_t)st.st_size, POSIX_MADV_WILLNEED);
+
+    const archive_header_t *header = map;
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t entries_end = header->entries_offset +
+                           (uint64_t)header->entry_count *
+                           sizeof(archive_entry_t);
+
+    if(memcmp(header->magic, ARCHIVE_MAGIC, sizeof(header->magic)) != 0 ||
+       header->entries_offset % sizeof(uint64_t) != 0 ||
+       entries_end > size ||
+       header->names_offset + header->names_size > size) {
+        fprintf(stderr, "'%s' isn't a valid archive!\n", ASSET_ARCHIVE);
+        munmap(map, (size_t)st.st_size);
+        return;
+    }
+
+    game.assets.map = map;
+    game.assets.size = (size_t)st.st_size;
+    game.assets.header = header;
+    game.assets.entries = (const archive_entry_t *)
+                                ((const uint8_t *)map + header->entries_offset);
+    game.assets.names = (const char *)map + header->names_offset;
+
+    game.assets.load_ns += time_ns() - start;
+}
+
+void
+assets_close(void)
+{
+    if(game.assets.map != NULL)
+        munmap(game.assets.map, game.assets.size);
+
+    game.assets.map = NULL;
+    game.assets.size = 0;
+    game.assets.header = NULL;
+    game.assets.entries = NULL;
+    game.assets.names = NULL;
+}
+
+const archive_entry_t *
+archive_find(const char *name)
+{
+    if(game.assets.map == NULL)
+        return NULL;
+
+    uint64_t hash = archive_hash(name);
+    size_t low = 0, high = game.assets.header->entry_count;
+
+    // First entry with this hash
+    while(low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+
+        if(game.assets.entries[mid].hash < hash)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    for(size_t i = low; i < game.assets.header->entry_count; i++)
+    {
+        const archive_entry_t *entry = &game.assets.entries[i];
+
+        if(entry->hash != hash)
+            break;
+
+        // Don't trust anything pointing outside the file
+        if(entry->name >= game.assets.header->names_size ||
+           entry->offset > game.assets.size ||
+           entry->size > game.assets.size - entry->offset)
+            continue;
+
+        const char *entry_name = game.assets.names + entry->name;
+        size_t max = game.assets.header->names_size - entry->name;
+
+        if(strncmp(entry_name, name, max) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+bool
+asset_load(const char *name, asset_t *out)
+{
+    uint64_t start = time_ns();
+
+    memset(out, 0, sizeof(*out));
+
+    const archive_entry_t *entry = archive_find(name);
+
+    if(entry != NULL) {
+        const uint8_t *blob = game.assets.map + entry->offset;
+
+        if(entry->flags & ARCHIVE_LZ4) {
+            out->owned = malloc(entry->raw_size ? entry->raw_size : 1);
+
+            if(out->owned == NULL ||
+               !lz4_decompress(blob,
+                               entry->size,
+                               out->owned,
+                               entry->raw_size)) {
+                fprintf(stderr, "Failed to decompress '%s'!\n", name);
+                free(out->owned);
+                out->owned = NULL;
+
+                return false;
+            }
+
+            out->data = out->owned;
+        } else if(entry->raw_size == entry->size) {
+            // No copy, it's already in memory
+            out->data = blob;
+        } else {
+            // Stored entries are as big as they are in the file, any other
+            // size would read past the checked range
+            fprintf(stderr, "'%s' is corrupt in the archive!\n", name);
+            return false;
+        }
+
+        out->size = entry->raw_size;
+        game.assets.from_archive++;
+    } else {
+        char *data = NULL;
+        size_t size = 0;
+
+        vk_read_file(name, &size, &data);
+
+        if(data == NULL)
+            return false;
+
+        out->data = out->owned = data;
+        out->size = size;
+    }
+
+    game.assets.loads++;
+    game.assets.bytes += out->size;
+    game.assets.load_ns += time_ns() - start;
+
+    return true;
+}
+
+void
+asset_release(asset_t *asset)
+{
+    free(asset->owned);
+    memset(asset, 0, sizeof(*asset));
+}
+
+bool
+lz4_decompress(const uint8_t *src,
+               size_t size,
+               uint8_t *dst,
+               size_t raw_size)
+{
+    size_t ip = 0, op = 0;
+
+    while(ip < size)
+    {
+        unsigned int token = src[ip++];
+        size_t lit = token >> 4;
+
+        if(lit == 15) {
+            uint8_t more;
+
+            do {
+                if(ip >= size)
+                    return false;
+
+                more = src[ip++];
+                lit += more;
+            } while(more == 255);
+        }
+
+        if(lit > size - ip || lit > raw_size - op)
+            return false;
+
+        memcpy(&dst[op], &src[ip], lit);
+        ip += lit;
+        op += lit;
+
+        // The last sequence is only literals
+        if(ip == size)
+            break;
+
+        if(size - ip < 2)
+            return false;
+
+        size_t offset = (size_t)src[ip] | (size_t)src[ip + 1] << 8;
+        ip += 2;
+
+        if(offset == 0 || offset > op)
+            return false;
+
+        size_t len = token & 15;
+
+        if(len == 15) {
+            uint8_t more;
+
+            do {
+                if(ip >= size)
+                    return false;
+
+                more = src[ip++];
+                len += more;
+            } while(more == 255);
+        }
+
+        len += 4;
+
+        if(len > raw_size - op)
+            return false;
+
+        // Matches can overlap what they write, so a byte at a time
+        for(size_t i = 0; i < len; i++)
+            dst[op + i] = dst[op - offset + i];
+
+        op += len;
+    }
+
+    return op == raw_size;
+}
+
+bool
+mesh_load(void)
+{
+    game.mesh.pending = game.mesh.ready = false;
+    game.mesh.bytes = game.mesh.triangles = 0;
+
+    if(game.mesh.name == NULL)
+        return true;
+
+    asset_t *asset = &game.mesh.asset;
+    mesh_header_t *h = &game.mesh.header;
+
+    if(!asset_load(game.mesh.name, asset))
+        return false;
+
+    if(asset->size < sizeof(*h)) {
+        fprintf(stderr, "'%s' is too small to be a mesh!\n", game.mesh.name);
+        asset_release(asset);
+        return false;
+    }
+
+    memcpy(h, asset->data, sizeof(*h));
+
+    uint64_t vertex_bytes = (uint64_t)h->vertex_count * sizeof(mesh_vertex_t);
+    uint64_t index_bytes = (uint64_t)h->index_count * h->index_size;
+
+    if(memcmp(h->magic, MESH_MAGIC, sizeof(h->magic)) != 0 ||
+       h->vertex_size != sizeof(mesh_vertex_t) ||
+       (h->index_size != 2 && h->index_size != 4) ||
+       h->index_count == 0 || h->index_count % 3 != 0 ||
+       h->vertex_offset % MESH_ALIGN != 0 ||
+       h->index_offset % h->index_size != 0 ||
+       h->vertex_offset > asset->size ||
+       vertex_bytes > asset->size - h->vertex_offset ||
+       h->index_offset > asset->size ||
+       index_bytes > asset->size - h->index_offset) {
+        fprintf(stderr, "'%s' isn't a valid mesh!\n", game.mesh.name);
+        asset_release(asset);
+        return false;
+    }
+
+    // Don't let the GPU fetch outside the vertices
+    const uint8_t *indices = (const uint8_t *)asset->data + h->index_offset;
+
+    for(uint32_t i = 0; i < h->index_count; i++)
+    {
+        uint32_t index;
+
+        if(h->index_size == 2) {
+            uint16_t small;
+            memcpy(&small, &indices[i * 2], sizeof(small));
+            index = small;
+        } else {
+            memcpy(&index, &indices[i * 4], sizeof(index));
+        }
+
+        if(index >= h->vertex_count) {
+            fprintf(stderr, "'%s' has an index out of range!\n",
+                            game.mesh.name);
+            asset_release(asset);
+            return false;
+        }
+    }
+
+    game.mesh.pending = true;
+
+    return true;
+}
+
+void
+mesh_uploaded(uint64_t bytes)
+{
+    // The GPU has its own copy now
+    asset_release(&game.mesh.asset);
+
+    game.mesh.pending = false;
+    game.mesh.ready = true;
+    game.mesh.bytes = bytes;
+}
+
+void
+mesh_push_constants(const sim_state_t *state,
+                    uint32_t object,
+                    mesh_push_t *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    memcpy(out->offset, game.mesh.header.offset, sizeof(out->offset));
+    memcpy(out->scale, game.mesh.header.scale, sizeof(out->scale));
+
+    // One turn per pulse of the clear color
+    float turns = (float)state->phase;
+
+    if(object != UINT32_MAX)
+        turns += game.cull.spin[object];
+
+    out->params[0] = turns;
+
+    // The shaders hand over the mesh fitted in a unit sphere
+    float model[16];
+    mat4_rotate_y(model, turns);
+
+    if(object == UINT32_MAX) {
+        float aspect = state->height > 0 ? (float)state->width /
+                                           (float)state->height
+                                         : 1.0f;
+
+        // Flat in the middle of the window, nearer is smaller z
+        for(unsigned int col = 0; col < 4; col++)
+        {
+            model[col * 4 + 0] *= 0.8f / aspect;
+            model[col * 4 + 1] *= 0.8f;
+            model[col * 4 + 2] *= -0.8f;
+        }
+
+        memcpy(out->transform, model, sizeof(model));
+        return;
+    }
+
+    const cull_bounds_t *b = &game.cull.bounds;
+
+    for(unsigned int i = 0; i < 12; i++)
+        model[i] *= b->radius[object];
+
+    model[12] = b->x[object];
+    model[13] = b->y[object];
+    model[14] = b->z[object];
+
+    mat4_multiply(out->transform, game.cull.view_proj, model);
+}
+
+void
+mesh_report(void)
+{
+    if(game.mesh.triangles == 0 || game.stats.frame_ns == 0)
+        return;
+
+    const mesh_header_t *h = &game.mesh.header;
+
+    // What the same mesh would take with float32 everything and 32 bit
+    // indices, the way it came out of the OBJ
+    uint64_t float_bytes = (uint64_t)h->vertex_count * 32 +
+                           (uint64_t)h->index_count * 4;
+
+    double seconds = (double)game.stats.frame_ns / 1e9;
+    double triangles = (double)game.mesh.triangles;
+
+    fprintf(stdout, "Mesh: %u vertices, %u triangles, "
+                    "%.1f KiB on the GPU (%.1f KiB as float32).\n"
+                    "  Vertex fetch about %.2f MB/s "
+                    "(%.2f MB/s as float32).\n",
+                    h->vertex_count, h->index_count / 3,
+                    (double)game.mesh.bytes / 1024.0,
+                    (double)float_bytes / 1024.0,
+                    triangles * (double)h->fetch_compiled / seconds / 1e6,
+                    triangles * (double)h->fetch_float / seconds / 1e6);
+}
+
+void
+mesh_free(void)
+{
+    // GPU objects go with the backend
+    asset_release(&game.mesh.asset);
+
+    game.mesh.pending = game.mesh.ready = false;
+}
+
+bool
+texture_init(void)
+{
+    game.textures.frame = 0;
+
+    texture_update_budget();
+
+    for(unsigned int i = 0; i < game.textures.demo; i++)
+        if(texture_create(1024, 1024, 0x9E3779B9u * (i + 1)) < 0)
+            return false;
+
+    if(game.textures.count > 0)
+        fprintf(stdout, "Streaming %u textures, budget %.1f MiB (%s).\n",
+                        game.textures.count,
+                        (double)game.textures.budget[
+                                    game.textures.list[0].heap] / 1048576.0,
+                        game.textures.driver_budget ? "from the driver"
+                                                    : "configured");
+
+    return true;
+}
+
+int
+texture_create(unsigned int width, unsigned int height, uint32_t seed)
+{
+    if(width == 0 || height == 0 ||
+       width > (1u << (TEXTURE_MAX_LEVELS - 1)) ||
+       height > (1u << (TEXTURE_MAX_LEVELS - 1))) {
+        fprintf(stderr, "Bad texture size %ux%u!\n", width, height);
+        return -1;
+    }
+
+    if(game.textures.count == game.textures.size) {
+        unsigned int size = game.textures.size ? game.textures.size * 2 : 16;
+
+        texture_t *list = realloc(game.textures.list, size * sizeof(*list));
+        if(list == NULL) {
+            fprintf(stderr, "Failed to grow the texture list!\n");
+            return -1;
+        }
+
+        game.textures.list = list;
+        game.textures.size = size;
+    }
+
+    texture_t *tex = &game.textures.list[game.textures.count];
+    memset(tex, 0, sizeof(*tex));
+
+    tex->width = width;
+    tex->height = height;
+    tex->seed = seed;
+
+    unsigned int biggest = width > height ? width : height;
+
+    tex->levels = 1;
+    while((biggest >> tex->levels) > 0)
+        tex->levels++;
+
+    tex->tail = 0;
+    while((biggest >> tex->tail) > TEXTURE_TAIL_SIZE)
+        tex->tail++;
+
+    tex->resident = tex->levels;
+    tex->wanted = tex->levels;
+
+    // Every texture lives on the same heap for now
+    tex->heap = 0;
+
+    if(game.gpu_api == GRAPHICS_API_VULKAN) {
+        unsigned int type;
+
+        if(vk_find_memory_type(UINT32_MAX,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                               &type))
+            tex->heap = game.vk.memory_props.memoryTypes[type].heapIndex;
+    }
+
+    return (int)game.textures.count++;
+}
+
+void
+texture_request(unsigned int id, float screen_px)
+{
+    texture_t *tex = &game.textures.list[id];
+
+    // The smallest level that still covers every pixel it's drawn on
+    unsigned int level = 0;
+    unsigned int biggest = tex->width > tex->height ? tex->width
+                                                    : tex->height;
+
+    while(level + 1 < tex->levels &&
+          (float)(biggest >> (level + 1)) >= screen_px)
+        level++;
+
+    if(level < tex->wanted)
+        tex->wanted = level;
+
+    // Coarser levels get sampled too
+    for(unsigned int i = level; i < tex->levels; i++)
+        tex->used[i] = game.textures.frame;
+}
+
+void
+texture_stream(void)
+{
+    if(game.textures.count == 0)
+        return;
+
+    if(game.textures.frame % TEXTURE_BUDGET_INTERVAL == 0)
+        texture_update_budget();
+
+    uint64_t uploaded = 0;
+
+    // Tails first, then whatever is furthest from what's wanted
+    for(;;)
+    {
+        texture_t *next = NULL;
+        unsigned int best = 0;
+
+        for(unsigned int i = 0; i < game.textures.count; i++)
+        {
+            texture_t *tex = &game.textures.list[i];
+
+            unsigned int target = tex->wanted < tex->tail ? tex->wanted
+                                                          : tex->tail;
+            if(tex->resident <= target)
+                continue;
+
+            unsigned int missing = tex->resident - target;
+            if(tex->resident > tex->tail)
+                missing += TEXTURE_MAX_LEVELS;
+
+            if(missing > best) {
+                best = missing;
+                next = tex;
+            }
+        }
+
+        if(next == NULL)
+            break;
+
+        unsigned int level = next->resident - 1;
+        uint64_t bytes = texture_level_size(next, level);
+
+        // Staging space is handed out 16 byte aligned
+        uint64_t staged = (bytes + 15) & ~(uint64_t)15;
+
+        if(uploaded > 0 && uploaded + staged > TEXTURE_UPLOAD_BYTES)
+            break;
+
+        if(!texture_make_room(next->heap, bytes)) {
+            game.textures.deferred++;
+            break;
+        }
+
+        bool success = false;
+
+        if(game.gpu_api == GRAPHICS_API_OPENGL)
+            success = gl_texture_upload(next, level);
+        else if(game.gpu_api == GRAPHICS_API_VULKAN)
+            success = vk_texture_upload(next, level);
+
+        // Out of memory whatever the budget said, so believe the driver
+        if(!success) {
+            game.textures.budget[next->heap] = game.textures.used[next->heap];
+            game.textures.deferred++;
+            break;
+        }
+
+        next->resident = level;
+        game.textures.used[next->heap] += next->bytes[level];
+
+        game.textures.uploads++;
+        game.textures.upload_bytes += bytes;
+        uploaded += staged;
+    }
+
+    // Drop anything over a budget that shrank
+    for(unsigned int i = 0; i < TEXTURE_HEAPS; i++)
+        if(game.textures.used[i] > game.textures.budget[i])
+            texture_make_room(i, 0);
+
+    // Requests are made again every frame
+    for(unsigned int i = 0; i < game.textures.count; i++)
+        game.textures.list[i].wanted = game.textures.list[i].levels;
+
+    game.textures.frame++;
+}
+
+bool
+texture_make_room(unsigned int heap, uint64_t bytes)
+{
+    while(game.textures.used[heap] + bytes > game.textures.budget[heap])
+    {
+        // Least recently used level that isn't a tail. Only the finest
+        // resident level of a texture can go, so the chain stays whole.
+        texture_t *victim = NULL;
+        uint64_t oldest = game.textures.frame;
+
+        for(unsigned int i = 0; i < game.textures.count; i++)
+        {
+            texture_t *tex = &game.textures.list[i];
+
+            if(tex->heap != heap || tex->resident >= tex->tail)
+                continue;
+
+            if(tex->used[tex->resident] < oldest) {
+                oldest = tex->used[tex->resident];
+                victim = tex;
+            }
+        }
+
+        // Everything left is in use this frame
+        if(victim == NULL)
+            return false;
+
+        unsigned int level = victim->resident;
+
+        if(game.gpu_api == GRAPHICS_API_OPENGL)
+            gl_texture_evict(victim, level);
+        else if(game.gpu_api == GRAPHICS_API_VULKAN)
+            vk_texture_evict(victim, level);
+
+        game.textures.used[heap] -= victim->bytes[level];
+        victim->bytes[level] = 0;
+        victim->resident++;
+
+        game.textures.evictions++;
+    }
+
+    return true;
+}
+
+void
+texture_update_budget(void)
+{
+    game.textures.driver_budget = false;
+
+    uint64_t cap = game.textures.cap ? game.textures.cap
+                                     : (uint64_t)TEXTURE_BUDGET_MB << 20;
+
+    for(unsigned int i = 0; i < TEXTURE_HEAPS; i++)
+        game.textures.budget[i] = cap;
+
+    if(game.gpu_api == GRAPHICS_API_VULKAN) {
+        vk_texture_budget();
+    } else if(game.gpu_api == GRAPHICS_API_OPENGL &&
+              gl_has_extension("GL_NVX_gpu_memory_info")) {
+        GLint free_kb = 0;
+        glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX,
+                      &free_kb);
+
+        // What's free doesn't count what we already have
+        uint64_t avail = game.textures.used[0] +
+                         (uint64_t)((double)free_kb * 1024.0 *
+                                    TEXTURE_BUDGET_SHARE);
+
+        if(game.textures.cap == 0 || avail < game.textures.cap)
+            game.textures.budget[0] = avail;
+
+        game.textures.driver_budget = true;
+    }
+}
+
+void
+texture_fill(const texture_t *tex, unsigned int level, uint8_t *out)
+{
+    unsigned int width = tex->width >> level ? tex->width >> level : 1;
+    unsigned int height = tex->height >> level ? tex->height >> level : 1;
+
+    uint8_t r = (uint8_t)tex->seed;
+    uint8_t g = (uint8_t)(tex->seed >> 8);
+
+    // Checkers tinted by level, so a capture shows which level is in
+    uint8_t b = (uint8_t)(level * 255 / TEXTURE_MAX_LEVELS);
+
+    for(unsigned int y = 0; y < height; y++)
+        for(unsigned int x = 0; x < width; x++)
+        {
+            uint8_t *px = &out[((size_t)y * width + x) * 4];
+            bool on = ((x >> 3) ^ (y >> 3)) & 1;
+
+            px[0] = on ? r : r / 2;
+            px[1] = on ? g : g / 2;
+            px[2] = b;
+            px[3] = 255;
+        }
+}
+
+uint64_t
+texture_level_size(const texture_t *tex, unsigned int level)
+{
+    uint64_t width = tex->width >> level ? tex->width >> level : 1;
+    uint64_t height = tex->height >> level ? tex->height >> level : 1;
+
+    return width * height * 4;
+}
+
+void
+texture_report(void)
+{
+    if(game.textures.count == 0)
+        return;
+
+    unsigned int full = 0;
+    uint64_t used = 0, budget = 0;
+
+    for(unsigned int i = 0; i < game.textures.count; i++)
+        if(game.textures.list[i].resident == 0)
+            full++;
+
+    for(unsigned int i = 0; i < TEXTURE_HEAPS; i++)
+        if(game.textures.used[i] > 0) {
+            used += game.textures.used[i];
+            budget += game.textures.budget[i];
+        }
+
+    fprintf(stdout, "Textures: %u streamed, %u fully resident, "
+                    "%.1f of %.1f MiB in use.\n"
+                    "  %lu uploads (%.1f MiB), %lu evictions, "
+                    "%lu uploads deferred.\n",
+                    game.textures.count, full,
+                    (double)used / 1048576.0,
+                    (double)budget / 1048576.0,
+                    (unsigned long)game.textures.uploads,
+                    (double)game.textures.upload_bytes / 1048576.0,
+                    (unsigned long)game.textures.evictions,
+                    (unsigned long)game.textures.deferred);
+}
+
+void
+texture_free_all(void)
+{
+    // OpenGL textures go with the context
+    if(game.gpu_api == GRAPHICS_API_VULKAN &&
+       game.vk.device != VK_NULL_HANDLE) {
+        vkDeviceWaitIdle(game.vk.device);
+
+        for(unsigned int i = 0; i < game.textures.count; i++)
+            for(unsigned int j = 0; j < TEXTURE_MAX_LEVELS; j++)
+            {
+                vkDestroyImage(game.vk.device,
+                               game.textures.list[i].images[j],
+                               NULL);
+                vkFreeMemory(game.vk.device,
+                             game.textures.list[i].memory[j],
+                             NULL);
+            }
+
+        vk_release_retired(0, true);
+
+        for(unsigned int i = 0; i < game.vk.staging_c; i++)
+        {
+            vkDestroyBuffer(game.vk.device, game.vk.staging[i].buffer, NULL);
+            vkFreeMemory(game.vk.device, game.vk.staging[i].memory, NULL);
+        }
+    }
+
+    free(game.vk.retired);
+    free(game.vk.staging);
+    game.vk.retired = NULL;
+    game.vk.staging = NULL;
+    game.vk.retired_c = game.vk.retired_size = game.vk.staging_c = 0;
+
+    free(game.textures.list);
+    free(game.textures.scratch);
+
+    game.textures.list = NULL;
+    game.textures.scratch = NULL;
+    game.textures.count = game.textures.size = 0;
+    game.textures.scratch_size = 0;
+
+    memset(game.textures.used, 0, sizeof(game.textures.used));
+    game.textures.uploads = game.textures.upload_bytes = 0;
+    game.textures.evictions = game.textures.deferred = 0;
+}
+
+uint64_t
+time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t
+thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t
+process_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+bool
+peak_rss_reset(void)
+{
+    // Linux resets VmHWM to the current RSS when 5 is written here
+    FILE *file = fopen("/proc/self/clear_refs", "w");
+
+    if(file == NULL)
+        return false;
+
+    bool success = fputs("5", file) >= 0;
+
+    return fclose(file) == 0 && success;
+}
+
+long
+peak_rss_kb(void)
+{
+    FILE *file = fopen("/proc/self/status", "r");
+
+    if(file == NULL)
+        return 0;
+
+    char line[128];
+    long kb = 0;
+
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        if(strncmp(line, "VmHWM:", 6) == 0) {
+            kb = strtol(line + 6, (char **)NULL, 10);
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return kb;
+}
+
+void
+sleep_until(uint64_t ns)
+{
+    const struct timespec ts = {
+        .tv_sec = (time_t)(ns / 1000000000ull),
+        .tv_nsec = (long)(ns % 1000000000ull)
+    };
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+void
+samples_add(samples_t *samples, uint64_t value)
+{
+    if(samples->count == samples->size) {
+        size_t size = samples->size ? samples->size * 2 : 1024;
+        uint64_t *values = realloc(samples->values, sizeof(uint64_t) * size);
+
+        // Dropping a sample is better than dying over it
+        if(values == NULL)
+            return;
+
+        samples->values = values;
+        samples->size = size;
+    }
+
+    samples->values[samples->count++] = value;
+}
+
+static int
+samples_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+uint64_t
+samples_percentile(samples_t *samples, double percentile)
+{
+    if(samples->count == 0)
+        return 0;
+
+    // Sorting in place is fine, order doesn't matter once we report
+    qsort(samples->values, samples->count, sizeof(uint64_t), samples_compare);
+
+    size_t index = (size_t)(percentile / 100.0 * (double)(samples->count - 1));
+
+    return samples->values[index];
+}
+
+void
+samples_free(samples_t *samples)
+{
+    free(samples->values);
+
+    samples->values = NULL;
+    samples->count = samples->size = 0;
+}
+
+void
+present_timing_record(uint64_t submit_ns,
+                      uint64_t display_ns,
+                      unsigned int missed)
+{
+    uint64_t latency = display_ns > submit_ns ? display_ns - submit_ns : 0;
+
+    samples_add(&game.present.latency, latency);
+
+    if(game.present.last_recorded_ns != 0 &&
+       display_ns > game.present.last_recorded_ns)
+        samples_add(&game.present.intervals,
+                    display_ns - game.present.last_recorded_ns);
+
+    game.present.last_recorded_ns = display_ns;
+    game.present.frames++;
+    game.present.missed += missed;
+
+    if(game.present.log != NULL)
+        fprintf(game.present.log, "%lu,%.3f,%u\n",
+                                  (unsigned long)game.present.frames,
+                                  (double)latency / 1e6,
+                                  missed);
+}
+
+void
+present_timing_report(void)
+{
+    if(game.present.log != NULL) {
+        fclose(game.present.log);
+        game.present.log = NULL;
+    }
+
+    game.present.last_recorded_ns = 0;
+
+    if(game.present.frames == 0) {
+        samples_free(&game.present.latency);
+        samples_free(&game.present.intervals);
+        return;
+    }
+
+    samples_t *gaps = &game.present.intervals;
+
+    game.present.reported_frames = game.present.frames;
+    game.present.reported_missed = game.present.missed;
+    game.present.reported_p50_ms =
+                (double)samples_percentile(&game.present.latency, 50) / 1e6;
+    game.present.reported_p99_ms =
+                (double)samples_percentile(&game.present.latency, 99) / 1e6;
+    game.present.reported_gap_p99_ms =
+                (double)samples_percentile(gaps, 99) / 1e6;
+
+    fprintf(stdout, "Present timing over %lu frames with %s:\n"
+                    "  submit to display p50 %.3f ms, p99 %.3f ms\n"
+                    "  display to display p50 %.3f ms, p99 %.3f ms\n"
+                    "  missed vblanks %lu\n",
+                    (unsigned long)game.present.frames,
+                    game.vsync.picked != NULL ? game.vsync.picked : "vsync",
+                    game.present.reported_p50_ms,
+                    game.present.reported_p99_ms,
+                    (double)samples_percentile(gaps, 50) / 1e6,
+                    game.present.reported_gap_p99_ms,
+                    (unsigned long)game.present.missed);
+
+    samples_free(&game.present.latency);
+    samples_free(&game.present.intervals);
+    game.present.frames = game.present.missed = 0;
+}
+
+// As far as I could find, there are very few recources on XCB error codes
+// All I can say is look through xproto.h or pray google finds it
+void
+window_error_print(xcb_generic_error_t *error)
+{
+    if(error == NULL)
+        return;
+
+    const char *names[] = {
+        "XCB_REQUEST",
+        "XCB_VALUE",
+        "XCB_WINDOW",
+        "XCB_PIXMAP",
+        "XCB_ATOM",
+        "XCB_CURSOR",
+        "XCB_FONT",
+        "XCB_MATCH",
+        "XCB_DRAWABLE",
+        "XCB_ACCESS",
+        "XCB_ALLOC",
+        "XCB_COLORMAP",
+        "XCB_G_CONTEXT",
+        "XCB_ID_CHOICE",
+        "XCB_NAME",
+        "XCB_LENGTH",
+        "XCB_IMPLEMENTATION"
+    };
+
+    switch(error->error_code)
+    {
+        case XCB_REQUEST:
+        case XCB_MATCH:
+        case XCB_ACCESS:
+        case XCB_ALLOC:
+        case XCB_NAME:
+        case XCB_LENGTH:
+        case XCB_IMPLEMENTATION:
+            {
+                xcb_request_error_t *er = (xcb_request_error_t *)error;
+
+                fprintf(stderr, "REQUEST ERROR\n"
+                                "%s\n"
+                                "error_code: %d\n"
+                                "major: %d\n"
+                                "minor: %d\n",
+                                names[er->error_code],
+                                er->error_code,
+                                er->major_opcode,
+                                er->minor_opcode);
+            }
+            break;
+
+        case XCB_VALUE:
+        case XCB_WINDOW:
+        case XCB_PIXMAP:
+        case XCB_ATOM:
+        case XCB_CURSOR:
+        case XCB_FONT:
+        case XCB_DRAWABLE:
+        case XCB_COLORMAP:
+        case XCB_G_CONTEXT:
+        case XCB_ID_CHOICE:
+            {
+                xcb_value_error_t *er = (xcb_value_error_t *)error;
+
+                fprintf(stderr, "VALUE ERROR\n"
+                                "%s\n"
+                                "error_code: %d\n"
+                                "major: %d\n"
+                                "minor: %d\n",
+                                names[er->error_code],
+                                er->error_code,
+                                er->major_opcode,
+                                er->minor_opcode);
+            }
+            break;
+    }
+}
+
+// Creates, maps and names one of the windows. Vulkan gives no colormap,
+// OpenGL needs one for its visual.
+bool
+window_open(unsigned int index, xcb_screen_t *screen, xcb_colormap_t colormap)
+{
+    // Error data, used later
+    xcb_void_cookie_t cookie;
+    xcb_generic_error_t *error;
+
+    const uint32_t eventmask = XCB_EVENT_MASK_EXPOSURE |
+                               XCB_EVENT_MASK_KEY_PRESS |
+                               XCB_EVENT_MASK_KEY_RELEASE |
+                               XCB_EVENT_MASK_BUTTON_PRESS |
+                               XCB_EVENT_MASK_BUTTON_RELEASE |
+                               XCB_EVENT_MASK_POINTER_MOTION |
+                               XCB_EVENT_MASK_BUTTON_MOTION |
+                               XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+
+    const uint32_t valwin[] = {eventmask, colormap};
+    const uint32_t valmask = colormap != 0 ?
+                                XCB_CW_EVENT_MASK | XCB_CW_COLORMAP :
+                                XCB_CW_EVENT_MASK;
+
+    xcb_window_t window = xcb_generate_id(game.xcb.connection);
+
+    cookie = xcb_create_window_checked(game.xcb.connection,
+                                       XCB_COPY_FROM_PARENT,
+                                       window,
+                                       screen->root,
+                                       0, 0,
+                                       game.window.width, game.window.height,
+                                       10,
+                                       XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                                       screen->root_visual,
+                                       valmask, valwin);
+
+    // Check if there was an error
+    error = xcb_request_check(game.xcb.connection, cookie);
+
+    if(error != NULL) {
+        fprintf(stderr, "Failed to create window!\n");
+
+        window_error_print(error);
+
+        free(error);
+        return false;
+    }
+
+    game.xcb.windows[index] = window;
+
+    atomic_store(&game.window.sizes[index],
+                 (unsigned int)game.window.width << 16 |
+                 (unsigned int)game.window.height);
+
+    // Map the window
+    cookie = xcb_map_window_checked(game.xcb.connection, window);
+
+    // Check for error
+    error = xcb_request_check(game.xcb.connection, cookie);
+
+    if(error != NULL) {
+        fprintf(stderr, "Failed to map window!\n");
+
+        window_error_print(error);
+
+        free(error);
+        return false;
+    }
+
+    // Set the window's name, numbered after the first
+    char name[64];
+
+    if(index == 0)
+        snprintf(name, sizeof(name), "%s", WN_NAME);
+    else
+        snprintf(name, sizeof(name), "%s (%u)", WN_NAME, index + 1);
+
+    cookie = xcb_change_property_checked(game.xcb.connection,
+                                         XCB_PROP_MODE_REPLACE,
+                                         window,
+                                         XCB_ATOM_WM_NAME,
+                                         XCB_ATOM_STRING,
+                                         8,
+                                         strlen(name),
+                                         name);
+
+    // Check for error
+    error = xcb_request_check(game.xcb.connection, cookie);
+
+    if(error != NULL) {
+        fprintf(stderr, "Failed to rename window!\n");
+
+        window_error_print(error);
+
+        free(error);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+window_get_close_event(void)
+{
+    xcb_generic_error_t *error;
+
+    // We need to get WM_PROTOCOLS before we can get the close event
+    xcb_intern_atom_cookie_t c_proto = xcb_intern_atom(game.xcb.connection,
+                                                       1, 12,
+                                                       "WM_PROTOCOLS");
+    xcb_intern_atom_reply_t *r_proto = 
+                                    xcb_intern_atom_reply(game.xcb.connection,
+                                                          c_proto,
+                                                          &error);
+
+    // Check for error
+    if(error != NULL)
+    {
+        fprintf(stderr, "Failed to get WM_PROTOCOLS!\n");
+
+        window_error_print(error);
+
+        free(error);
+        return false;
+    }
+
+    // Get the close event
+    xcb_intern_atom_cookie_t c_close = xcb_intern_atom(game.xcb.connection,
+                                                       0, 16,
+                                                       "WM_DELETE_WINDOW");
+    xcb_intern_atom_reply_t *r_close = 
+                                    xcb_intern_atom_reply(game.xcb.connection,
+                                                          c_close,
+                                                          &error);
+
+    // Check for error
+    if(error != NULL)
+    {
+        fprintf(stderr, "Failed to get WM_DELETE_WINDOW!\n");
+
+        window_error_print(error);
+
+        free(error);
+        return false;
+    }
+
+    // Enable the close event so we can actually receive it, closing any
+    // window closes them all
+    for(unsigned int i = 0; i < game.window.count; i++)
+    {
+        xcb_void_cookie_t cookie = xcb_change_property(game.xcb.connection,
+                                                       XCB_PROP_MODE_REPLACE,
+                                                       game.xcb.windows[i],
+                                                       r_proto->atom,
+                                                       XCB_ATOM_ATOM,
+                                                       32,
+                                                       1,
+                                                       &r_close->atom);
+
+        error = xcb_request_check(game.xcb.connection, cookie);
+
+        if(error != NULL) {
+            fprintf(stderr, "Failed to get XCB window close event!\n");
+
+            window_error_print(error);
+
+            free(error);
+            return false;
+        }
+    }
+
+
+    game.xcb.close_event = r_close->atom;
+
+    return true;
+}
+
+bool
+window_start_event_thread(void)
+{
+    atomic_store(&game.events.head, 0);
+    atomic_store(&game.events.tail, 0);
+    atomic_store(&game.events.quit, false);
+
+    if(pthread_create(&game.events.thread,
+                      NULL,
+                      window_event_thread,
+                      NULL) != 0) {
+        fprintf(stderr, "Failed to start the event thread!\n");
+        return false;
+    }
+
+    game.events.running = true;
+
+    return true;
+}
+
+void
+window_stop_event_thread(void)
+{
+    if(!game.events.running)
+        return;
+
+    atomic_store(&game.events.quit, true);
+
+    // The thread is asleep in xcb_wait_for_event, so send it something.
+    // With no event mask it goes to the client that made the window, us.
+    xcb_client_message_event_t wake = {
+        .response_type = XCB_CLIENT_MESSAGE,
+        .format = 32,
+        .window = game.xcb.windows[0],
+        .type = XCB_ATOM_NONE
+    };
+
+    xcb_send_event(game.xcb.connection,
+                   0,
+                   game.xcb.windows[0],
+                   XCB_EVENT_MASK_NO_EVENT,
+                   (const char *)&wake);
+    xcb_flush(game.xcb.connection);
+
+    pthread_join(game.events.thread, NULL);
+    game.events.running = false;
+}
+
+void *
+window_event_thread(void *arg)
+{
+    (void)arg;
+
+    while(!atomic_load(&game.events.quit))
+    {
+        xcb_generic_event_t *xev = xcb_wait_for_event(game.xcb.connection);
+
+        // The connection is gone, nothing more will ever come
+        if(xev == NULL) {
+            event_t event = {
+                .time_ns = time_ns(),
+                .type = EVENT_CLOSE
+            };
+
+            event_push(&event);
+            break;
+        }
+
+        event_t event = {
+            .time_ns = time_ns()
+        };
+
+        bool keep = true;
+
+        switch(xev->response_type & ~0x80)
+        {
+            // if it's a message about our window
+            case XCB_CLIENT_MESSAGE:
+            {
+                unsigned int ev =
+                        (*(xcb_client_message_event_t *)xev).data.data32[0];
+
+                // if it's the close event
+                event.type = EVENT_CLOSE;
+                keep = ev == game.xcb.close_event;
+            }
+
+            break;
+
+            case XCB_CONFIGURE_NOTIFY:
+            {
+                xcb_configure_notify_event_t *cn =
+                                            (xcb_configure_notify_event_t *)xev;
+
+                event.type = EVENT_RESIZE;
+                event.size.width = cn->width;
+                event.size.height = cn->height;
+
+                // Only the first window's size goes to the simulation
+                for(unsigned int i = 1; i < game.window.count; i++)
+                    if(cn->window == game.xcb.windows[i]) {
+                        atomic_store(&game.window.sizes[i],
+                                     (unsigned int)cn->width << 16 |
+                                     cn->height);
+                        keep = false;
+                    }
+            }
+
+            break;
+
+            case XCB_KEY_PRESS:
+            case XCB_KEY_RELEASE:
+            {
+                xcb_key_press_event_t *key = (xcb_key_press_event_t *)xev;
+
+                event.type = (xev->response_type & ~0x80) == XCB_KEY_PRESS ?
+                                            EVENT_KEY_PRESS : EVENT_KEY_RELEASE;
+                event.detail = key->detail;
+                event.state = key->state;
+                event.pointer.x = key->event_x;
+                event.pointer.y = key->event_y;
+            }
+
+            break;
+
+            case XCB_BUTTON_PRESS:
+            case XCB_BUTTON_RELEASE:
+            {
+                xcb_button_press_event_t *button =
+                                            (xcb_button_press_event_t *)xev;
+
+                event.type = (xev->response_type & ~0x80) == XCB_BUTTON_PRESS ?
+                                      EVENT_BUTTON_PRESS : EVENT_BUTTON_RELEASE;
+                event.detail = button->detail;
+                event.state = button->state;
+                event.pointer.x = button->event_x;
+                event.pointer.y = button->event_y;
+            }
+
+            break;
+
+            case XCB_MOTION_NOTIFY:
+            {
+                xcb_motion_notify_event_t *motion =
+                                            (xcb_motion_notify_event_t *)xev;
+
+                event.type = EVENT_MOTION;
+                event.state = motion->state;
+                event.pointer.x = motion->event_x;
+                event.pointer.y = motion->event_y;
+            }
+
+            break;
+
+            default:
+                keep = false;
+                break;
+        }
+
+        free(xev); // Always free your event!
+
+        if(!keep)
+            continue;
+
+        // Wait for room unless it's motion, the next one replaces it anyway
+        while(!event_push(&event) &&
+              event.type != EVENT_MOTION &&
+              !atomic_load(&game.events.quit))
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+bool
+event_push(const event_t *event)
+{
+    unsigned int head = atomic_load_explicit(&game.events.head,
+                                             memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&game.events.tail,
+                                             memory_order_acquire);
+
+    if(head - tail == EVENT_QUEUE_SIZE)
+        return false;
+
+    game.events.queue[head & (EVENT_QUEUE_SIZE - 1)] = *event;
+
+    // Publish the event only after it's written
+    atomic_store_explicit(&game.events.head, head + 1, memory_order_release);
+
+    return true;
+}
+
+bool
+event_pop(event_t *event)
+{
+    unsigned int tail = atomic_load_explicit(&game.events.tail,
+                                             memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&game.events.head,
+                                             memory_order_acquire);
+
+    if(head == tail)
+        return false;
+
+    *event = game.events.queue[tail & (EVENT_QUEUE_SIZE - 1)];
+
+    // Give the slot back only after it's read
+    atomic_store_explicit(&game.events.tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+bool
+init_opengl(void)
+{
+    fprintf(stdout, "Loading game with OpenGL%s.\n",
+                    game.egl.enabled ? " through EGL" : "");
+
+    if(game.egl.enabled ? !window_create_egl() : !window_create_opengl())
+        return false;
+
+    if(!game.egl.headless && !window_get_close_event())
+        return false;
+
+    glViewport(0, 0, game.window.width, game.window.height);
+
+    // Reading back without stalling needs sync objects
+    int major = 0, minor = 0;
+    const char *version = (const char *)glGetString(GL_VERSION);
+
+    game.capture.supported = version != NULL &&
+                             sscanf(version, "%d.%d", &major, &minor) == 2 &&
+                             (major > 3 || (major == 3 && minor >= 2));
+
+    // Framebuffer blits and timer queries
+    game.dynres.active = game.dynres.enabled &&
+                         (major > 3 || (major == 3 && minor >= 3));
+
+    if(game.dynres.enabled && !game.dynres.active)
+        fprintf(stderr, "Dynamic resolution needs OpenGL 3.3, "
+                        "it's disabled!\n");
+
+    return true;
+}
+
+void
+render_opengl(const sim_state_t *state)
+{
+    if(game.capture.active)
+        gl_capture_collect(false);
+
+    texture_stream();
+
+    if(game.mesh.pending)
+        gl_mesh_upload();
+
+    // Before any window draws, they all share the buffers
+    if(game.mesh.ready && game.gl.indirect &&
+       game.gl.indirect_frame != game.render.frame)
+        gl_mesh_commands();
+
+    // The other windows first, so the first one's context is current
+    // again for the uploads and captures
+    for(unsigned int i = 1; i < game.window.count; i++)
+        gl_draw_window(i, state);
+
+    if(game.window.count > 1)
+        gl_make_current(0);
+
+    if(game.dynres.active) {
+        gl_scene_timers();
+        gl_draw_scaled(state);
+    } else {
+        gl_draw_scene(state);
+    }
+
+    // The back buffer is still ours until the swap
+    if(game.capture.active)
+        gl_capture_record();
+
+    // Whatever reached the screen since the last frame
+    if(game.present.active)
+        gl_present_timing_collect();
+
+    // Swap buffers
+    uint64_t submit_ns = time_ns();
+
+    gl_swap_buffers(0);
+
+    if(game.present.active) {
+        game.present.sbc++;
+        game.present.queue[game.present.sbc % PRESENT_QUEUE_SIZE] =
+                        (present_frame_t){
+                            .id = (uint64_t)game.present.sbc,
+                            .submit_ns = submit_ns
+                        };
+    }
+}
+
+// Draws at the render scale into the scene target, then stretches that over
+// the back buffer. A timer query goes around all of it when one's free.
+void
+gl_draw_scaled(const sim_state_t *state)
+{
+    int width = game.render.width;
+    int height = game.render.height;
+
+    if(width <= 0 || height <= 0 || !gl_scene_target(width, height)) {
+        gl_draw_scene(state);
+        return;
+    }
+
+    GLsizei scaled_width = (GLsizei)dynres_scale((unsigned int)width);
+    GLsizei scaled_height = (GLsizei)dynres_scale((unsigned int)height);
+
+    bool timed = game.gl.timer_head - game.gl.timer_tail < GL_TIMER_RING;
+
+    if(timed) {
+        glBeginQuery(GL_TIME_ELAPSED,
+                     game.gl.timers[game.gl.timer_head % GL_TIMER_RING]);
+        game.gl.timer_head++;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, game.gl.scene_fbo);
+    glViewport(0, 0, scaled_width, scaled_height);
+
+    gl_draw_scene(state);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, game.gl.scene_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    glBlitFramebuffer(0, 0, scaled_width, scaled_height,
+                      0, 0, width, height,
+                      GL_COLOR_BUFFER_BIT,
+                      GL_LINEAR);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+
+    if(timed)
+        glEndQuery(GL_TIME_ELAPSED);
+}
+
+// Sized to the window, the scene only uses the corner at the render scale
+bool
+gl_scene_target(int width, int height)
+{
+    if(game.gl.scene_fbo != 0 &&
+       game.gl.scene_width == width && game.gl.scene_height == height)
+        return true;
+
+    if(game.gl.scene_fbo == 0) {
+        glGenFramebuffers(1, &game.gl.scene_fbo);
+        glGenRenderbuffers(1, &game.gl.scene_color);
+        glGenQueries(GL_TIMER_RING, game.gl.timers);
+    }
+
+    glBindRenderbuffer(GL_RENDERBUFFER, game.gl.scene_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, game.gl.scene_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                              GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER,
+                              game.gl.scene_color);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Failed to make the scene target, "
+                        "dynamic resolution is disabled!\n");
+
+        gl_scene_free();
+        game.dynres.active = false;
+        return false;
+    }
+
+    game.gl.scene_width = width;
+    game.gl.scene_height = height;
+
+    return true;
+}
+
+// Oldest first, and only what's finished, so this never waits on the GPU
+void
+gl_scene_timers(void)
+{
+    while(game.gl.timer_tail != game.gl.timer_head) {
+        GLuint query = game.gl.timers[game.gl.timer_tail % GL_TIMER_RING];
+
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if(!available)
+            break;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+        dynres_update(elapsed);
+        game.gl.timer_tail++;
+    }
+}
+
+// Needs the first window's context
+void
+gl_scene_free(void)
+{
+    if(game.gl.scene_fbo == 0)
+        return;
+
+    glDeleteQueries(GL_TIMER_RING, game.gl.timers);
+    glDeleteRenderbuffers(1, &game.gl.scene_color);
+    glDeleteFramebuffers(1, &game.gl.scene_fbo);
+
+    game.gl.scene_fbo = 0;
+    game.gl.scene_color = 0;
+    game.gl.scene_width = 0;
+    game.gl.scene_height = 0;
+    game.gl.timer_head = 0;
+    game.gl.timer_tail = 0;
+}
+
+// Clears and draws the command list into whatever is current
+void
+gl_draw_scene(const sim_state_t *state)
+{
+    GL_LABEL("Frame")
+    {
+        // Clear the buffer
+        GL_LABEL("Clear")
+        {
+            glClearColor(state->clear_color[0],
+                         state->clear_color[1],
+                         state->clear_color[2],
+                         state->clear_color[3]);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+
+        GL_LABEL("Draw")
+        {
+            // RENDER_PIPELINE_MAIN has no program, it's fixed function
+            unsigned int pipeline = UINT32_MAX;
+            unsigned int material = UINT32_MAX;
+
+            for(unsigned int i = 0; i < game.cmds.count; i++)
+            {
+                const draw_cmd_t *cmd = &game.cmds.list[i];
+
+                if(SORT_KEY_PIPELINE(cmd->key) != pipeline) {
+                    if(pipeline == RENDER_PIPELINE_MESH)
+                        gl_mesh_bind(false);
+
+                    pipeline = SORT_KEY_PIPELINE(cmd->key);
+
+                    if(pipeline == RENDER_PIPELINE_MESH)
+                        gl_mesh_bind(true);
+
+                    game.stats.pipeline_binds++;
+                }
+
+                if(SORT_KEY_MATERIAL(cmd->key) != material) {
+                    material = SORT_KEY_MATERIAL(cmd->key);
+                    game.stats.material_binds++;
+                }
+
+                if(pipeline == RENDER_PIPELINE_MESH && game.gl.indirect) {
+                    const mesh_header_t *h = &game.mesh.header;
+                    unsigned int end = i;
+
+                    // Every mesh draw up to the next bind in one call
+                    while(end < game.cmds.count &&
+                          SORT_KEY_PIPELINE(game.cmds.list[end].key) ==
+                                                                pipeline &&
+                          SORT_KEY_MATERIAL(game.cmds.list[end].key) ==
+                                                                material)
+                        game.mesh.triangles +=
+                                    game.cmds.list[end++].vertex_count / 3;
+
+                    glMultiDrawElementsIndirect(
+                        GL_TRIANGLES,
+                        h->index_size == 2 ? GL_UNSIGNED_SHORT
+                                           : GL_UNSIGNED_INT,
+                        (const void *)(uintptr_t)(i *
+                                        sizeof(gl_draw_indirect_t)),
+                        (GLsizei)(end - i),
+                        0);
+
+                    i = end - 1;
+                } else if(pipeline == RENDER_PIPELINE_MESH) {
+                    const mesh_header_t *h = &game.mesh.header;
+                    uint64_t at = (uint64_t)h->vertex_count *
+                                  sizeof(mesh_vertex_t) +
+                                  (uint64_t)cmd->first_vertex * h->index_size;
+
+                    // Only worked out again when the frame changed
+                    gl_mesh_constants(&game.render.pushes[i]);
+
+                    glDrawElements(GL_TRIANGLES,
+                                   (GLsizei)cmd->vertex_count,
+                                   h->index_size == 2 ? GL_UNSIGNED_SHORT
+                                                      : GL_UNSIGNED_INT,
+                                   (const void *)(uintptr_t)at);
+
+                    game.mesh.triangles += cmd->vertex_count / 3;
+                } else if(game.gl.context == GL_CONTEXT_LEGACY) {
+                    // Core contexts have no fixed function to draw it with
+                    glDrawArrays(GL_TRIANGLES,
+                                 (GLint)cmd->first_vertex,
+                                 (GLsizei)cmd->vertex_count);
+                }
+            }
+
+            // Leave fixed function how the next frame expects it
+            if(pipeline == RENDER_PIPELINE_MESH)
+                gl_mesh_bind(false);
+
+            game.stats.draws += game.cmds.count;
+        }
+    }
+}
+
+// Draws one of the other windows with its own context. Making it current
+// flushes the last context, so this frame's uploads are already there.
+void
+gl_draw_window(unsigned int index, const sim_state_t *state)
+{
+    gl_make_current(index);
+
+    unsigned int size = atomic_load(&game.window.sizes[index]);
+    glViewport(0, 0, (GLsizei)(size >> 16), (GLsizei)(size & 0xFFFF));
+
+    gl_draw_scene(state);
+
+    gl_swap_buffers(index);
+}
+
+// See https://xcb.freedesktop.org/tutorial/basicwindowsanddrawing/
+// and https://xcb.freedesktop.org/tutorial/events/
+// and https://xcb.freedesktop.org/windowcontextandmanipulation/
+bool
+window_create_opengl(void)
+{
+    // The event thread shares the connection with GLX
+    XInitThreads();
+
+    // Create the connection
+    game.xlib.display = XOpenDisplay(0);
+    if(!game.xlib.display) {
+        fprintf(stderr, "Failed to open X display!\n");
+
+        return false;
+    }
+
+    game.xcb.connection = XGetXCBConnection(game.xlib.display);
+
+    if(!game.xcb.connection) {
+        fprintf(stderr, "Failed to create connection to Xorg!\n");
+
+        return false;
+    }
+
+    XSetEventQueueOwner(game.xlib.display, XCBOwnsEventQueue);
+
+    // Get screen
+    int def_screen = DefaultScreen(game.xlib.display);
+
+    const xcb_setup_t *setup = xcb_get_setup(game.xcb.connection);
+    xcb_screen_iterator_t iter = xcb_setup_roots_iterator(setup);
+    for(int screen_num = def_screen;
+        iter.rem && screen_num > 0;
+        screen_num--, xcb_screen_next(&iter));
+
+    xcb_screen_t *screen = iter.data;
+
+    // Find GL FB
+    int vis_id = 0;
+    int num_fb_configs = 0;
+
+    const int vis_attribs[] = {
+		GLX_X_RENDERABLE, True,
+		GLX_DRAWABLE_TYPE, GLX_WINDOW_BIT,
+		GLX_RENDER_TYPE, GLX_RGBA_BIT,
+		GLX_X_VISUAL_TYPE, GLX_TRUE_COLOR,
+		GLX_RED_SIZE, 8,
+		GLX_GREEN_SIZE, 8,
+		GLX_BLUE_SIZE, 8,
+		GLX_ALPHA_SIZE, 8,
+		GLX_DEPTH_SIZE, 24,
+		GLX_STENCIL_SIZE, 8,
+		GLX_DOUBLEBUFFER, True,
+	};
+
+    const GLXFBConfig *fb_configs = glXChooseFBConfig(game.xlib.display,
+                                                      def_screen,
+                                                      vis_attribs,
+                                                      &num_fb_configs);
+
+    if(!fb_configs || num_fb_configs == 0) {
+        fprintf(stderr, "Failed to find an OpenGL FB!\n");
+
+        return false;
+    }
+
+    GLXFBConfig fb_config = fb_configs[0];
+    glXGetFBConfigAttrib(game.xlib.display, fb_config, GLX_VISUAL_ID, &vis_id);
+
+    // Create GLX context
+
+    game.gl.contexts[0] = gl_create_context(fb_config, NULL, def_screen);
+
+    if(!game.gl.contexts[0]) {
+        fprintf(stderr, "Failed to create an OpenGL context!\n");
+
+        return false;
+    }
+
+    xcb_colormap_t colormap;
+    if(!window_create_colormap(screen, (xcb_visualid_t)vis_id, &colormap))
+        return false;
+
+    // Create the windows, each with a context sharing the first one's
+    // buffers, textures and programs
+    for(unsigned int i = 0; i < game.window.count; i++)
+    {
+        if(!window_open(i, screen, colormap))
+            return false;
+
+        // Start GLX
+        game.gl.windows[i] = glXCreateWindow(game.xlib.display,
+                                             fb_config,
+                                             game.xcb.windows[i],
+                                             0);
+
+        if(!game.gl.windows[i]) {
+            fprintf(stderr, "Failed to create GLX window!\n");
+
+            return false;
+        }
+
+        if(i == 0)
+            continue;
+
+        game.gl.contexts[i] = gl_create_context(fb_config,
+                                                game.gl.contexts[0],
+                                                def_screen);
+
+        if(!game.gl.contexts[i]) {
+            fprintf(stderr, "Failed to create a shared OpenGL context!\n");
+
+            return false;
+        }
+    }
+
+    if(!gl_setup_contexts())
+        return false;
+
+    gl_swap_control_init(def_screen);
+
+    if(game.present.enabled)
+        gl_present_timing_init(def_screen);
+
+    return true;
+}
+
+// For windows drawn with a visual other than the root's
+bool
+window_create_colormap(xcb_screen_t *screen,
+                       xcb_visualid_t visual,
+                       xcb_colormap_t *colormap)
+{
+    *colormap = xcb_generate_id(game.xcb.connection);
+
+    xcb_void_cookie_t cookie =
+                        xcb_create_colormap_checked(game.xcb.connection,
+                                                    XCB_COLORMAP_ALLOC_NONE,
+                                                    *colormap,
+                                                    screen->root,
+                                                    visual);
+
+    xcb_generic_error_t *error = xcb_request_check(game.xcb.connection,
+                                                   cookie);
+
+    if(error != NULL) {
+        fprintf(stderr, "Failed to create XCB colormap!\n");
+
+        window_error_print(error);
+
+        free(error);
+        return false;
+    }
+
+    return true;
+}
+
+// Gives every context its vertex array and leaves the first one current
+bool
+gl_setup_contexts(void)
+{
+    // The others are only ever current while drawing their window
+    for(unsigned int i = 1; i < game.window.count; i++)
+    {
+        gl_make_current(i);
+        gl_bind_vertex_array(i);
+    }
+
+    if(!gl_make_current(0)) {
+        fprintf(stderr, "Failed to make OpenGL current!\n");
+
+        return false;
+    }
+
+    gl_bind_vertex_array(0);
+
+#ifdef DEBUG
+    gl_load_debug_functions();
+#endif
+
+    return true;
+}
+
+// These go through EGL or GLX, whichever made the contexts
+
+bool
+gl_make_current(unsigned int index)
+{
+    if(game.egl.enabled)
+        return eglMakeCurrent(game.egl.display,
+                              game.egl.surfaces[index],
+                              game.egl.surfaces[index],
+                              game.egl.contexts[index]);
+
+    return glXMakeContextCurrent(game.xlib.display,
+                                 game.gl.windows[index],
+                                 game.gl.windows[index],
+                                 game.gl.contexts[index]);
+}
+
+void
+gl_release_current(void)
+{
+    if(game.egl.enabled)
+        eglMakeCurrent(game.egl.display,
+                       EGL_NO_SURFACE,
+                       EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+    else
+        glXMakeContextCurrent(game.xlib.display, None, None, NULL);
+}
+
+void
+gl_swap_buffers(unsigned int index)
+{
+    if(game.egl.enabled)
+        eglSwapBuffers(game.egl.display, game.egl.surfaces[index]);
+    else
+        glXSwapBuffers(game.xlib.display, game.gl.windows[index]);
+}
+
+gl_proc_t
+gl_get_proc(const char *name)
+{
+    if(game.egl.enabled)
+        return (gl_proc_t)eglGetProcAddress(name);
+
+    return (gl_proc_t)glXGetProcAddressARB((const GLubyte *)name);
+}
+
+// The windows are made like Vulkan's, on a plain XCB connection. With no
+// X server to connect to it goes headless instead.
+bool
+window_create_egl(void)
+{
+    // Client extensions, asked before there's a display
+    const char *exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+                                                "eglGetPlatformDisplayEXT");
+
+    if(!extension_listed(exts, "EGL_EXT_platform_base") ||
+       get_display == NULL) {
+        fprintf(stderr, "EGL_EXT_platform_base is unsupported!\n");
+
+        return false;
+    }
+
+    int screen_num = 0;
+    game.xcb.connection = xcb_connect(NULL, &screen_num);
+
+    if(xcb_connection_has_error(game.xcb.connection)) {
+        xcb_disconnect(game.xcb.connection);
+        game.xcb.connection = NULL;
+
+        return egl_create_headless(exts, get_display);
+    }
+
+    if(!extension_listed(exts, "EGL_EXT_platform_xcb")) {
+        fprintf(stderr, "EGL_EXT_platform_xcb is unsupported!\n");
+
+        return false;
+    }
+
+    const EGLint display_attribs[] = {
+        EGL_PLATFORM_XCB_SCREEN_EXT, screen_num,
+        EGL_NONE
+    };
+
+    game.egl.display = get_display(EGL_PLATFORM_XCB_EXT,
+                                   game.xcb.connection,
+                                   display_attribs);
+
+    if(!egl_init_display(EGL_WINDOW_BIT))
+        return false;
+
+    // Get screen
+    const xcb_setup_t *setup = xcb_get_setup(game.xcb.connection);
+    xcb_screen_iterator_t iter = xcb_setup_roots_iterator(setup);
+    for(int i = screen_num; iter.rem && i > 0; i--, xcb_screen_next(&iter));
+
+    xcb_screen_t *screen = iter.data;
+
+    EGLint vis_id = 0;
+    eglGetConfigAttrib(game.egl.display,
+                       game.egl.config,
+                       EGL_NATIVE_VISUAL_ID,
+                       &vis_id);
+
+    xcb_colormap_t colormap;
+    if(!window_create_colormap(screen, (xcb_visualid_t)vis_id, &colormap))
+        return false;
+
+    PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC create_surface =
+            (PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC)eglGetProcAddress(
+                                        "eglCreatePlatformWindowSurfaceEXT");
+
+    if(create_surface == NULL) {
+        fprintf(stderr, "eglCreatePlatformWindowSurfaceEXT is missing!\n");
+
+        return false;
+    }
+
+    // Each with a context sharing the first one's objects, like GLX
+    for(unsigned int i = 0; i < game.window.count; i++)
+    {
+        if(!window_open(i, screen, colormap))
+            return false;
+
+        game.egl.surfaces[i] = create_surface(game.egl.display,
+                                              game.egl.config,
+                                              &game.xcb.windows[i],
+                                              NULL);
+
+        if(game.egl.surfaces[i] == EGL_NO_SURFACE) {
+            fprintf(stderr, "Failed to create an EGL window surface!\n");
+
+            return false;
+        }
+
+        EGLContext share = i == 0 ? EGL_NO_CONTEXT : game.egl.contexts[0];
+        game.egl.contexts[i] = egl_create_context(share);
+
+        if(game.egl.contexts[i] == EGL_NO_CONTEXT) {
+            fprintf(stderr, "Failed to create an OpenGL context!\n");
+
+            return false;
+        }
+    }
+
+    if(!gl_setup_contexts())
+        return false;
+
+    egl_swap_control();
+
+    if(game.present.enabled)
+        fprintf(stderr, "Present timing needs GLX_OML_sync_control, "
+                        "it's disabled with EGL!\n");
+
+    return true;
+}
+
+// One pbuffer the size the window would have been. It has a back buffer
+// like a window, so drawing, captures and checks work the same.
+bool
+egl_create_headless(const char *client_exts,
+                    PFNEGLGETPLATFORMDISPLAYEXTPROC get_display)
+{
+    if(game.window.count > 1) {
+        fprintf(stderr, "No X display, and headless only draws one "
+                        "window!\n");
+
+        return false;
+    }
+
+    // Without it the default display might still manage, say on a device
+    if(extension_listed(client_exts, "EGL_MESA_platform_surfaceless"))
+        game.egl.display = get_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                       EGL_DEFAULT_DISPLAY,
+                                       NULL);
+    else
+        game.egl.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    if(!egl_init_display(EGL_PBUFFER_BIT))
+        return false;
+
+    const EGLint attribs[] = {
+        EGL_WIDTH, game.window.width,
+        EGL_HEIGHT, game.window.height,
+        EGL_NONE
+    };
+
+    game.egl.surfaces[0] = eglCreatePbufferSurface(game.egl.display,
+                                                   game.egl.config,
+                                                   attribs);
+
+    if(game.egl.surfaces[0] == EGL_NO_SURFACE) {
+        fprintf(stderr, "Failed to create an EGL pbuffer!\n");
+
+        return false;
+    }
+
+    game.egl.contexts[0] = egl_create_context(EGL_NO_CONTEXT);
+
+    if(game.egl.contexts[0] == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Failed to create an OpenGL context!\n");
+
+        return false;
+    }
+
+    game.egl.headless = true;
+
+    atomic_store(&game.window.sizes[0],
+                 (unsigned int)game.window.width << 16 |
+                 (unsigned int)game.window.height);
+
+    fprintf(stdout, "No X display, drawing headless into a %dx%d "
+                    "pbuffer.\n",
+                    game.window.width, game.window.height);
+
+    game.vsync.picked = "no vsync, headless";
+
+    return gl_setup_contexts();
+}
+
+bool
+egl_init_display(EGLint surface_type)
+{
+    EGLint major, minor;
+
+    if(game.egl.display == EGL_NO_DISPLAY ||
+       !eglInitialize(game.egl.display, &major, &minor)) {
+        fprintf(stderr, "Failed to initialize EGL!\n");
+
+        return false;
+    }
+
+    if(!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "EGL can't do desktop OpenGL!\n");
+
+        return false;
+    }
+
+    // The same as the GLX visual
+    const EGLint attribs[] = {
+        EGL_SURFACE_TYPE, surface_type,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_STENCIL_SIZE, 8,
+        EGL_NONE
+    };
+
+    EGLint count = 0;
+
+    if(!eglChooseConfig(game.egl.display,
+                        attribs,
+                        &game.egl.config,
+                        1,
+                        &count) || count == 0) {
+        fprintf(stderr, "Failed to find an EGL config!\n");
+
+        return false;
+    }
+
+    fprintf(stdout, "Using EGL %d.%d.\n", major, minor);
+
+    return true;
+}
+
+// The same choices as gl_create_context(), EGL just says no instead of
+// raising X errors
+EGLContext
+egl_create_context(EGLContext share)
+{
+    if(share != EGL_NO_CONTEXT)
+        return egl_create_context_attribs(share,
+                                          game.gl.context,
+                                          game.gl.major,
+                                          game.gl.minor);
+
+    const char *exts = eglQueryString(game.egl.display, EGL_EXTENSIONS);
+
+    gl_context_e wanted = game.gl.wanted;
+
+    if(wanted >= GL_CONTEXT_CORE &&
+       !extension_listed(exts, "EGL_KHR_create_context")) {
+        fprintf(stderr, "EGL_KHR_create_context is unsupported, "
+                        "using a legacy context!\n");
+        wanted = GL_CONTEXT_LEGACY;
+    }
+
+    if(wanted == GL_CONTEXT_NO_ERROR &&
+       !extension_listed(exts, "EGL_KHR_create_context_no_error")) {
+        fprintf(stderr, "EGL_KHR_create_context_no_error is unsupported, "
+                        "keeping error checking!\n");
+        wanted = GL_CONTEXT_CORE;
+    }
+
+    for(gl_context_e c = wanted; c >= GL_CONTEXT_CORE; c--)
+        for(unsigned int i = 0; i < GL_versions_c; i++)
+        {
+            EGLContext context = egl_create_context_attribs(
+                                                        EGL_NO_CONTEXT,
+                                                        c,
+                                                        GL_versions[i][0],
+                                                        GL_versions[i][1]);
+
+            if(context != EGL_NO_CONTEXT) {
+                game.gl.context = c;
+                game.gl.major = GL_versions[i][0];
+                game.gl.minor = GL_versions[i][1];
+
+                fprintf(stdout, "Using an OpenGL %d.%d %s context.\n",
+                                game.gl.major, game.gl.minor,
+                                gl_context_name(c));
+
+                return context;
+            }
+        }
+
+    if(wanted >= GL_CONTEXT_CORE)
+        fprintf(stderr, "Couldn't make a core context, "
+                        "using a legacy context!\n");
+
+    game.gl.context = GL_CONTEXT_LEGACY;
+
+    EGLContext context = egl_create_context_attribs(EGL_NO_CONTEXT,
+                                                    GL_CONTEXT_LEGACY,
+                                                    0, 0);
+
+    if(context != EGL_NO_CONTEXT)
+        fprintf(stdout, "Using a legacy OpenGL context.\n");
+
+    return context;
+}
+
+EGLContext
+egl_create_context_attribs(EGLContext share,
+                           gl_context_e context,
+                           int major,
+                           int minor)
+{
+    const EGLint legacy[] = {
+        EGL_NONE
+    };
+
+    // Drivers without the no-error extension reject the attribute outright
+    const EGLint core[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, major,
+        EGL_CONTEXT_MINOR_VERSION_KHR, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR,
+        EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        context == GL_CONTEXT_NO_ERROR ? EGL_CONTEXT_OPENGL_NO_ERROR_KHR
+                                       : EGL_NONE,
+        EGL_TRUE,
+        EGL_NONE
+    };
+
+    return eglCreateContext(game.egl.display,
+                            game.egl.config,
+                            share,
+                            context == GL_CONTEXT_LEGACY ? legacy : core);
+}
+
+// eglSwapInterval goes by the current surface, and has nothing like
+// adaptive vsync
+void
+egl_swap_control(void)
+{
+    game.vsync.picked = "the driver's swap interval";
+
+    if(game.vsync.mode == VSYNC_DEFAULT)
+        return;
+
+    EGLint interval = game.vsync.mode == VSYNC_OFF ? 0 : 1;
+
+    if(game.vsync.mode == VSYNC_ADAPTIVE)
+        fprintf(stderr, "EGL has no adaptive vsync, "
+                        "using vsync instead!\n");
+
+    for(unsigned int i = game.window.count; i-- > 0;)
+    {
+        gl_make_current(i);
+        eglSwapInterval(game.egl.display, interval);
+    }
+
+    game.vsync.picked = interval == 0 ? "no vsync, swap interval 0"
+                                      : "vsync, swap interval 1";
+
+    fprintf(stdout, "Swapping with %s.\n", game.vsync.picked);
+}
+
+// The first context picks what every context is, the rest share it and are
+// made the same
+GLXContext
+gl_create_context(GLXFBConfig config, GLXContext share, int screen)
+{
+    if(share != NULL) {
+        if(game.gl.context == GL_CONTEXT_LEGACY)
+            return glXCreateNewContext(game.xlib.display,
+                                       config,
+                                       GLX_RGBA_TYPE,
+                                       share,
+                                       True);
+
+        return gl_create_context_attribs(config,
+                                         share,
+                                         game.gl.context,
+                                         game.gl.major,
+                                         game.gl.minor);
+    }
+
+    const char *exts = glXQueryExtensionsString(game.xlib.display, screen);
+
+    gl_context_e wanted = game.gl.wanted;
+
+    if(wanted >= GL_CONTEXT_CORE &&
+       (!extension_listed(exts, "GLX_ARB_create_context") ||
+        !extension_listed(exts, "GLX_ARB_create_context_profile"))) {
+        fprintf(stderr, "GLX_ARB_create_context_profile is unsupported, "
+                        "using a legacy context!\n");
+        wanted = GL_CONTEXT_LEGACY;
+    }
+
+    if(wanted == GL_CONTEXT_NO_ERROR &&
+       !extension_listed(exts, "GLX_ARB_create_context_no_error")) {
+        fprintf(stderr, "GLX_ARB_create_context_no_error is unsupported, "
+                        "keeping error checking!\n");
+        wanted = GL_CONTEXT_CORE;
+    }
+
+    if(wanted >= GL_CONTEXT_CORE)
+        game.gl.create_context =
+            (PFNGLXCREATECONTEXTATTRIBSARBPROC)glXGetProcAddressARB(
+                            (const GLubyte *)"glXCreateContextAttribsARB");
+
+    GLXContext context = NULL;
+
+    if(game.gl.create_context != NULL) {
+        // Asking for a version that isn't there is an X error, which would
+        // end the program
+        XSync(game.xlib.display, False);
+        int (*handler)(Display *, XErrorEvent *) =
+                                XSetErrorHandler(gl_ignore_x_error);
+
+        for(gl_context_e c = wanted;
+            c >= GL_CONTEXT_CORE && context == NULL;
+            c--)
+            for(unsigned int i = 0; i < GL_versions_c; i++)
+            {
+                context = gl_create_context_attribs(config,
+                                                    NULL,
+                                                    c,
+                                                    GL_versions[i][0],
+                                                    GL_versions[i][1]);
+
+                if(context != NULL) {
+                    game.gl.context = c;
+                    game.gl.major = GL_versions[i][0];
+                    game.gl.minor = GL_versions[i][1];
+                    break;
+                }
+            }
+
+        XSetErrorHandler(handler);
+    }
+
+    if(context == NULL) {
+        if(wanted >= GL_CONTEXT_CORE)
+            fprintf(stderr, "Couldn't make a core context, "
+                            "using a legacy context!\n");
+
+        game.gl.context = GL_CONTEXT_LEGACY;
+        context = glXCreateNewContext(game.xlib.display,
+                                      config,
+                                      GLX_RGBA_TYPE,
+                                      NULL,
+                                      True);
+
+        if(context == NULL)
+            return NULL;
+
+        fprintf(stdout, "Using a legacy OpenGL context.\n");
+        return context;
+    }
+
+    fprintf(stdout, "Using an OpenGL %d.%d %s context.\n",
+                    game.gl.major, game.gl.minor,
+                    gl_context_name(game.gl.context));
+
+    return context;
+}
+
+GLXContext
+gl_create_context_attribs(GLXFBConfig config,
+                          GLXContext share,
+                          gl_context_e context,
+                          int major,
+                          int minor)
+{
+    // Drivers without the no-error extension reject the attribute outright
+    const int attribs[] = {
+        GLX_CONTEXT_MAJOR_VERSION_ARB, major,
+        GLX_CONTEXT_MINOR_VERSION_ARB, minor,
+        GLX_CONTEXT_PROFILE_MASK_ARB, GLX_CONTEXT_CORE_PROFILE_BIT_ARB,
+        context == GL_CONTEXT_NO_ERROR ? GLX_CONTEXT_OPENGL_NO_ERROR_ARB
+                                       : None,
+        True,
+        None
+    };
+
+    GLXContext made = game.gl.create_context(game.xlib.display,
+                                             config,
+                                             share,
+                                             True,
+                                             attribs);
+
+    // Errors only show up once the server has seen the request
+    XSync(game.xlib.display, False);
+
+    return made;
+}
+
+int
+gl_ignore_x_error(Display *display, XErrorEvent *event)
+{
+    (void)display;
+    (void)event;
+
+    return 0;
+}
+
+const char *
+gl_context_name(gl_context_e context)
+{
+    switch(context)
+    {
+        case GL_CONTEXT_CORE:
+            return "core";
+        case GL_CONTEXT_NO_ERROR:
+            return "core no-error";
+        default:
+            return "legacy";
+    }
+}
+
+// Needs the window's context current. Bound once and left bound.
+void
+gl_bind_vertex_array(unsigned int index)
+{
+    if(game.gl.context == GL_CONTEXT_LEGACY)
+        return;
+
+    glGenVertexArrays(1, &game.gl.vaos[index]);
+    glBindVertexArray(game.gl.vaos[index]);
+}
+
+bool
+gl_has_extension(const char *name)
+{
+    // A current context is needed for this
+    if(game.gl.context == GL_CONTEXT_LEGACY)
+        return extension_listed((const char *)glGetString(GL_EXTENSIONS),
+                                name);
+
+    // Core contexts only list them one at a time
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+    for(GLint i = 0; i < count; i++)
+    {
+        const char *ext = (const char *)glGetStringi(GL_EXTENSIONS,
+                                                     (GLuint)i);
+
+        if(ext != NULL && strcmp(ext, name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Match whole names only, GLX_EXT_swap_control shouldn't match
+// GLX_EXT_swap_control_tear
+bool
+extension_listed(const char *exts, const char *name)
+{
+    if(exts == NULL)
+        return false;
+
+    size_t len = strlen(name);
+    const char *at = exts;
+
+    while((at = strstr(at, name)) != NULL)
+    {
+        if((at == exts || at[-1] == ' ') && (at[len] == ' ' || at[len] == 0))
+            return true;
+
+        at += len;
+    }
+
+    return false;
+}
+
+// Every window gets the same interval, so each swap of each window waits
+// the same way
+void
+gl_swap_control_init(int screen)
+{
+    game.vsync.picked = "the driver's swap interval";
+
+    if(game.vsync.mode == VSYNC_DEFAULT)
+        return;
+
+    const char *exts = glXQueryExtensionsString(game.xlib.display, screen);
+
+    int interval = game.vsync.mode == VSYNC_OFF ? 0 : 1;
+
+    if(game.vsync.mode == VSYNC_ADAPTIVE) {
+        if(extension_listed(exts, "GLX_EXT_swap_control_tear")) {
+            interval = -1;
+        } else {
+            fprintf(stderr, "GLX_EXT_swap_control_tear is unsupported, "
+                            "using vsync instead of adaptive vsync!\n");
+        }
+    }
+
+    if(extension_listed(exts, "GLX_EXT_swap_control"))
+        game.gl.swap_interval_ext =
+            (PFNGLXSWAPINTERVALEXTPROC)glXGetProcAddressARB(
+                                    (const GLubyte *)"glXSwapIntervalEXT");
+
+    if(extension_listed(exts, "GLX_MESA_swap_control"))
+        game.gl.swap_interval_mesa =
+            (PFNGLXSWAPINTERVALMESAPROC)glXGetProcAddressARB(
+                                    (const GLubyte *)"glXSwapIntervalMESA");
+
+    if(game.gl.swap_interval_ext != NULL) {
+        for(unsigned int i = 0; i < game.window.count; i++)
+            game.gl.swap_interval_ext(game.xlib.display,
+                                      game.gl.windows[i],
+                                      interval);
+    } else if(game.gl.swap_interval_mesa != NULL) {
+        // Goes by the current drawable, and only takes positive intervals
+        if(interval < 0)
+            interval = 1;
+
+        for(unsigned int i = game.window.count; i-- > 0;)
+        {
+            glXMakeContextCurrent(game.xlib.display,
+                                  game.gl.windows[i],
+                                  game.gl.windows[i],
+                                  game.gl.contexts[i]);
+
+            game.gl.swap_interval_mesa((unsigned int)interval);
+        }
+    } else {
+        fprintf(stderr, "GLX_EXT_swap_control and GLX_MESA_swap_control are "
+                        "unsupported, --vsync is ignored!\n");
+        return;
+    }
+
+    game.vsync.picked = interval < 0  ? "adaptive vsync, swap interval -1" :
+                        interval == 0 ? "no vsync, swap interval 0"
+                                      : "vsync, swap interval 1";
+
+    fprintf(stdout, "Swapping with %s.\n", game.vsync.picked);
+}
+
+void
+gl_present_timing_init(int screen)
+{
+    game.present.active = false;
+
+    const char *exts = glXQueryExtensionsString(game.xlib.display, screen);
+
+    if(exts == NULL || strstr(exts, "GLX_OML_sync_control") == NULL) {
+        fprintf(stderr, "GLX_OML_sync_control is unsupported, "
+                        "present timing is disabled!\n");
+        return;
+    }
+
+    game.gl.get_sync_values = (PFNGLXGETSYNCVALUESOMLPROC)glXGetProcAddressARB(
+                                    (const GLubyte *)"glXGetSyncValuesOML");
+    game.gl.wait_for_sbc = (PFNGLXWAITFORSBCOMLPROC)glXGetProcAddressARB(
+                                    (const GLubyte *)"glXWaitForSbcOML");
+
+    if(game.gl.get_sync_values == NULL || game.gl.wait_for_sbc == NULL)
+        return;
+
+    // Start counting swaps from wherever the drawable is
+    int64_t ust, msc, sbc;
+    if(!game.gl.get_sync_values(game.xlib.display,
+                                game.gl.windows[0],
+                                &ust, &msc, &sbc))
+        return;
+
+    game.present.sbc = game.present.recorded_sbc = sbc;
+    game.present.last_msc = msc;
+    game.present.active = true;
+}
+
+bool
+gl_texture_upload(texture_t *tex, unsigned int level)
+{
+    uint64_t bytes = texture_level_size(tex, level);
+
+    if(bytes > game.textures.scratch_size) {
+        uint8_t *scratch = realloc(game.textures.scratch, bytes);
+        if(scratch == NULL) {
+            fprintf(stderr, "Failed to allocate texture data!\n");
+            return false;
+        }
+
+        game.textures.scratch = scratch;
+        game.textures.scratch_size = bytes;
+    }
+
+    texture_fill(tex, level, game.textures.scratch);
+
+    if(tex->gl == 0)
+        glGenTextures(1, &tex->gl);
+
+    glBindTexture(GL_TEXTURE_2D, tex->gl);
+
+    glTexImage2D(GL_TEXTURE_2D,
+                 (GLint)level,
+                 GL_RGBA8,
+                 tex->width >> level ? (GLsizei)(tex->width >> level) : 1,
+                 tex->height >> level ? (GLsizei)(tex->height >> level) : 1,
+                 0,
+                 GL_RGBA,
+                 GL_UNSIGNED_BYTE,
+                 game.textures.scratch);
+
+    if(glGetError() == GL_OUT_OF_MEMORY)
+        return false;
+
+    // Never sample a level that isn't there
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)level);
+    glTexParameteri(GL_TEXTURE_2D,
+                    GL_TEXTURE_MAX_LEVEL,
+                    (GLint)tex->levels - 1);
+
+    tex->bytes[level] = bytes;
+
+    return true;
+}
+
+void
+gl_texture_evict(texture_t *tex, unsigned int level)
+{
+    glBindTexture(GL_TEXTURE_2D, tex->gl);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)level + 1);
+
+    // An empty level gives the memory back
+    glTexImage2D(GL_TEXTURE_2D,
+                 (GLint)level,
+                 GL_RGBA8,
+                 0, 0,
+                 0,
+                 GL_RGBA,
+                 GL_UNSIGNED_BYTE,
+                 NULL);
+}
+
+GLuint
+gl_create_program(const char *vert_name, const char *frag_name)
+{
+    GLuint vert = gl_compile_shader(GL_VERTEX_SHADER, vert_name);
+    GLuint frag = gl_compile_shader(GL_FRAGMENT_SHADER, frag_name);
+
+    if(vert == 0 || frag == 0) {
+        glDeleteShader(vert);
+        glDeleteShader(frag);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+
+    glAttachShader(program, vert);
+    glAttachShader(program, frag);
+
+    // The same locations the Vulkan shaders ask for
+    glBindAttribLocation(program, 0, "in_position");
+    glBindAttribLocation(program, 1, "in_normal");
+    glBindAttribLocation(program, 2, "in_uv");
+
+    // The mesh constants, after them
+    glBindAttribLocation(program, GL_MESH_TRANSFORM, "transform");
+    glBindAttribLocation(program, GL_MESH_CONSTANTS, "offset");
+    glBindAttribLocation(program, GL_MESH_CONSTANTS + 1, "scale");
+    glBindAttribLocation(program, GL_MESH_CONSTANTS + 2, "params");
+
+    glLinkProgram(program);
+
+    // The program keeps them for as long as it needs them
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    if(!linked) {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+
+        fprintf(stderr, "Failed to link '%s' and '%s'!\n"
+                        "%s\n",
+                        vert_name, frag_name, log);
+
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+GLuint
+gl_compile_shader(GLenum type, const char *name)
+{
+    asset_t source;
+
+    if(!asset_load(name, &source))
+        return 0;
+
+    GLuint shader = glCreateShader(type);
+
+    // Not NUL terminated, so give the length
+    const GLchar *texts[2] = {"", source.data};
+    GLint lengths[2] = {0, (GLint)source.size};
+
+    // Core contexts only have to take GLSL 1.40 and up. The shaders don't
+    // use anything 1.50 took away, so they just say they're that.
+    const char version[] = "#version 130";
+    size_t skip = sizeof(version) - 1;
+
+    if(game.gl.context != GL_CONTEXT_LEGACY &&
+       source.size >= skip &&
+       memcmp(source.data, version, skip) == 0) {
+        texts[0] = "#version 150";
+        lengths[0] = (GLint)skip;
+        texts[1] += skip;
+        lengths[1] -= (GLint)skip;
+    }
+
+    glShaderSource(shader, 2, texts, lengths);
+    glCompileShader(shader);
+
+    asset_release(&source);
+
+    GLint compiled;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+
+    if(!compiled) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+
+        fprintf(stderr, "Failed to compile '%s'!\n"
+                        "%s\n",
+                        name, log);
+
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+void
+gl_mesh_upload(void)
+{
+    // Only one try, none of this gets better by waiting
+    game.mesh.pending = false;
+
+    // GLSL 1.30 and half float vertices
+    int major = 0, minor = 0;
+    const char *version = (const char *)glGetString(GL_VERSION);
+
+    if(version == NULL ||
+       sscanf(version, "%d.%d", &major, &minor) != 2 ||
+       major < 3) {
+        fprintf(stderr, "The mesh needs OpenGL 3.0, not drawing it!\n");
+        mesh_free();
+        return;
+    }
+
+    game.gl.mesh_program = gl_create_program("shaders/mesh_gl.vert",
+                                             "shaders/mesh_gl.frag");
+
+    if(game.gl.mesh_program == 0) {
+        mesh_free();
+        return;
+    }
+
+    // Base instances in indirect draws need 4.2, drawing a list of them
+    // in one call 4.3
+    game.gl.indirect = major > 4 || (major == 4 && minor >= 3);
+    game.gl.indirect_frame = 0;
+
+    if(game.gl.indirect) {
+        glGenBuffers(1, &game.gl.indirect_buffer);
+        glGenBuffers(1, &game.gl.push_buffer);
+    }
+
+    const mesh_header_t *h = &game.mesh.header;
+    const uint8_t *data = game.mesh.asset.data;
+
+    GLsizeiptr vertex_bytes = (GLsizeiptr)h->vertex_count *
+                              (GLsizeiptr)sizeof(mesh_vertex_t);
+    GLsizeiptr index_bytes = (GLsizeiptr)h->index_count *
+                             (GLsizeiptr)h->index_size;
+
+    glGenBuffers(1, &game.gl.mesh_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, game.gl.mesh_buffer);
+
+    glBufferData(GL_ARRAY_BUFFER,
+                 vertex_bytes + index_bytes,
+                 NULL,
+                 GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    0,
+                    vertex_bytes,
+                    data + h->vertex_offset);
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    vertex_bytes,
+                    index_bytes,
+                    data + h->index_offset);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if(glGetError() == GL_OUT_OF_MEMORY) {
+        fprintf(stderr, "Out of memory for the mesh, not drawing it!\n");
+        mesh_free();
+        return;
+    }
+
+    mesh_uploaded((uint64_t)(vertex_bytes + index_bytes));
+}
+
+// false puts things back for fixed function
+void
+gl_mesh_bind(bool bind)
+{
+    if(!bind) {
+        for(GLuint i = 0; i < GL_MESH_ATTRIBS; i++)
+            glDisableVertexAttribArray(i);
+
+        if(game.gl.indirect)
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glUseProgram(0);
+        glDisable(GL_CULL_FACE);
+
+        return;
+    }
+
+    glUseProgram(game.gl.mesh_program);
+
+    glBindBuffer(GL_ARRAY_BUFFER, game.gl.mesh_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, game.gl.mesh_buffer);
+
+    glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE,
+                          sizeof(mesh_vertex_t),
+                          (const void *)offsetof(mesh_vertex_t, position));
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE,
+                          sizeof(mesh_vertex_t),
+                          (const void *)offsetof(mesh_vertex_t, normal));
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE,
+                          sizeof(mesh_vertex_t),
+                          (const void *)offsetof(mesh_vertex_t, uv));
+
+    for(GLuint i = 0; i < 3; i++)
+        glEnableVertexAttribArray(i);
+
+    // Each draw's base instance picks its constants
+    if(game.gl.indirect) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, game.gl.indirect_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, game.gl.push_buffer);
+
+        for(GLuint i = 0; i < GL_MESH_ATTRIBS - GL_MESH_TRANSFORM; i++)
+        {
+            glVertexAttribPointer(GL_MESH_TRANSFORM + i, 4, GL_FLOAT,
+                                  GL_FALSE,
+                                  sizeof(mesh_push_t),
+                                  (const void *)(i * 4 * sizeof(float)));
+            glVertexAttribDivisor(GL_MESH_TRANSFORM + i, 1);
+            glEnableVertexAttribArray(GL_MESH_TRANSFORM + i);
+        }
+    }
+
+    // No depth buffer, so at least don't draw the far side
+    glEnable(GL_CULL_FACE);
+}
+
+// Without indirect draws the constants are attributes with no array, so
+// every vertex of the draw gets the same
+void
+gl_mesh_constants(const mesh_push_t *push)
+{
+    for(GLuint i = 0; i < 4; i++)
+        glVertexAttrib4fv(GL_MESH_TRANSFORM + i, &push->transform[i * 4]);
+
+    glVertexAttrib4fv(GL_MESH_CONSTANTS, push->offset);
+    glVertexAttrib4fv(GL_MESH_CONSTANTS + 1, push->scale);
+    glVertexAttrib4fv(GL_MESH_CONSTANTS + 2, push->params);
+}
+
+// A command for every one in the list at the same index, the ones that
+// don't draw the mesh are never read
+void
+gl_mesh_commands(void)
+{
+    unsigned int count = game.cmds.count;
+
+    if(count > game.gl.indirect_size) {
+        gl_draw_indirect_t *cmds = realloc(game.gl.indirect_cmds,
+                                           count * sizeof(*cmds));
+
+        if(cmds == NULL) {
+            fprintf(stderr, "Failed to grow the indirect commands, "
+                            "drawing the mesh one draw at a time!\n");
+            game.gl.indirect = false;
+            return;
+        }
+
+        game.gl.indirect_cmds = cmds;
+        game.gl.indirect_size = count;
+    }
+
+    // Indices follow the vertices in the buffer. Vertices are 16 bytes, so
+    // that's a whole number of indices.
+    const mesh_header_t *h = &game.mesh.header;
+    uint32_t first = (uint32_t)((uint64_t)h->vertex_count *
+                                sizeof(mesh_vertex_t) / h->index_size);
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+        const draw_cmd_t *cmd = &game.cmds.list[i];
+
+        game.gl.indirect_cmds[i] = (gl_draw_indirect_t){
+            .count = cmd->vertex_count,
+            .instance_count = 1,
+            .first_index = first + cmd->first_vertex,
+            .base_instance = i
+        };
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, game.gl.indirect_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                 (GLsizeiptr)(count * sizeof(gl_draw_indirect_t)),
+                 game.gl.indirect_cmds,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, game.gl.push_buffer);
+    glBufferData(GL_ARRAY_BUFFER,
+                 (GLsizeiptr)(count * sizeof(mesh_push_t)),
+                 game.render.pushes,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    game.gl.indirect_frame = game.render.frame;
+}
+
+// Needs the first window's context
+void
+gl_indirect_free(void)
+{
+    if(game.gl.indirect_buffer != 0) {
+        glDeleteBuffers(1, &game.gl.indirect_buffer);
+        glDeleteBuffers(1, &game.gl.push_buffer);
+    }
+
+    free(game.gl.indirect_cmds);
+
+    game.gl.indirect = false;
+    game.gl.indirect_buffer = game.gl.push_buffer = 0;
+    game.gl.indirect_cmds = NULL;
+    game.gl.indirect_size = 0;
+    game.gl.indirect_frame = 0;
+}
+
+// Reads the back buffer into a pixel buffer. That only queues the copy, the
+// fence says when it's done.
+void
+gl_capture_record(void)
+{
+    unsigned int width = (unsigned int)game.render.width;
+    unsigned int height = (unsigned int)game.render.height;
+
+    if(width == 0 || height == 0)
+        return;
+
+    int index = capture_acquire();
+    if(index < 0)
+        return;
+
+    capture_readback_t *rb = &game.capture.readbacks[index];
+    size_t size = (size_t)width * height * 4;
+
+    if(rb->pbo == 0)
+        glGenBuffers(1, &rb->pbo);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+
+    if(rb->pbo_size != size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)size, NULL,
+                     GL_STREAM_READ);
+        rb->pbo_size = size;
+    }
+
+    // BGRA is what drivers keep the back buffer in, so no swizzle here
+    glReadBuffer(GL_BACK);
+    glReadPixels(0, 0, (GLsizei)width, (GLsizei)height,
+                 GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb->width = width;
+    rb->height = height;
+    rb->stride = (size_t)width * 4;
+    rb->bgr = true;
+    rb->flip = true;
+    rb->number = game.capture.captured++;
+    rb->recorded_frame = game.stats.frames;
+
+    atomic_store(&rb->state, CAPTURE_RECORDED);
+}
+
+// Maps every read that has finished and unmaps every one that was written.
+// Only blocks if told to wait.
+void
+gl_capture_collect(bool wait)
+{
+    for(unsigned int i = 0; i < CAPTURE_RING; i++)
+    {
+        capture_readback_t *rb = &game.capture.readbacks[i];
+        unsigned int state = atomic_load(&rb->state);
+
+        if(state == CAPTURE_WRITTEN) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+            rb->data = NULL;
+            atomic_store(&rb->state, CAPTURE_IDLE);
+        } else if(state == CAPTURE_RECORDED) {
+            GLenum result = glClientWaitSync(rb->fence,
+                                             wait ? GL_SYNC_FLUSH_COMMANDS_BIT
+                                                  : 0,
+                                             wait ? 1000000000ull : 0);
+
+            if(result == GL_TIMEOUT_EXPIRED)
+                continue;
+
+            glDeleteSync(rb->fence);
+            rb->fence = NULL;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+
+            if(result != GL_WAIT_FAILED)
+                rb->data = glMapBufferRange(GL_PIXEL_PACK_BUFFER,
+                                            0,
+                                            (GLsizeiptr)rb->pbo_size,
+                                            GL_MAP_READ_BIT);
+
+            if(result == GL_WAIT_FAILED || rb->data == NULL) {
+                fprintf(stderr, "Failed to read back frame %lu!\n",
+                                (unsigned long)rb->number);
+                game.capture.dropped++;
+
+                atomic_store(&rb->state, CAPTURE_IDLE);
+                continue;
+            }
+
+            atomic_store(&rb->state, CAPTURE_READY);
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    capture_submit_ready();
+}
+
+// Once the writer is gone
+void
+gl_capture_free(void)
+{
+    for(unsigned int i = 0; i < CAPTURE_RING; i++)
+    {
+        capture_readback_t *rb = &game.capture.readbacks[i];
+
+        if(rb->data != NULL) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+
+        if(rb->fence != NULL)
+            glDeleteSync(rb->fence);
+
+        if(rb->pbo != 0)
+            glDeleteBuffers(1, &rb->pbo);
+
+        rb->data = NULL;
+        rb->fence = NULL;
+        rb->pbo = 0;
+        rb->pbo_size = 0;
+
+        atomic_store(&rb->state, CAPTURE_IDLE);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Times the newest swap that's done without waiting for the last one, so
+// measuring doesn't hold the driver to one swap in flight. Only a swap
+// PRESENT_GL_LAG behind the last is waited for, by then the driver would
+// hold the next swap for it anyway.
+void
+gl_present_timing_collect(void)
+{
+    int64_t ust, msc, sbc;
+
+    // How many swaps are done, without blocking
+    if(!game.gl.get_sync_values(game.xlib.display,
+                                game.gl.windows[0],
+                                &ust, &msc, &sbc))
+        return;
+
+    int64_t target = game.present.sbc - PRESENT_GL_LAG;
+
+    if(sbc > target)
+        target = sbc;
+
+    if(target <= game.present.recorded_sbc)
+        return;
+
+    // Gives the time of the newest swap done, which can be past target.
+    // Doesn't block unless target isn't done yet.
+    if(!game.gl.wait_for_sbc(game.xlib.display,
+                             game.gl.windows[0],
+                             target,
+                             &ust, &msc, &sbc))
+        return;
+
+    int64_t swaps = sbc - game.present.recorded_sbc;
+
+    // Each swap should land one vblank after the last
+    unsigned int missed = 0;
+    if(msc > game.present.last_msc + swaps)
+        missed = (unsigned int)(msc - game.present.last_msc - swaps);
+
+    game.present.last_msc = msc;
+    game.present.recorded_sbc = sbc;
+
+    const present_frame_t *frame =
+                        &game.present.queue[sbc % PRESENT_QUEUE_SIZE];
+
+    if(frame->id != (uint64_t)sbc)
+        return;
+
+    // Swaps that finished between two looks have no time of their own, so
+    // the gap across them isn't a gap between two frames
+    if(swaps > 1)
+        game.present.last_recorded_ns = 0;
+
+    // UST is CLOCK_MONOTONIC in microseconds on Mesa, same as time_ns()
+    present_timing_record(frame->submit_ns, (uint64_t)ust * 1000, missed);
+}
+
+#ifdef DEBUG
+
+void
+gl_load_debug_functions(void)
+{
+    game.gl.push_debug_group = NULL;
+    game.gl.pop_debug_group = NULL;
+
+    if(!gl_has_extension("GL_KHR_debug")) {
+        fprintf(stderr, "GL_KHR_debug is unsupported, no debug labels!\n");
+        return;
+    }
+
+    game.gl.push_debug_group =
+                (PFNGLPUSHDEBUGGROUPPROC)gl_get_proc("glPushDebugGroup");
+    game.gl.pop_debug_group =
+                (PFNGLPOPDEBUGGROUPPROC)gl_get_proc("glPopDebugGroup");
+}
+
+void
+gl_label_begin(const char *name)
+{
+    if(game.gl.push_debug_group != NULL)
+        game.gl.push_debug_group(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+}
+
+void
+gl_label_end(void)
+{
+    if(game.gl.pop_debug_group != NULL)
+        game.gl.pop_debug_group();
+}
+
+#endif
+
+bool
+init_vulkan(void)
+{
+    fprintf(stdout, "Loading game with Vulkan.\n");
+
+    if(
+        !window_create_vulkan()          ||
+        !window_get_close_event()
+    ) {
+        return false;
+    }
+
+    // Missing layers shouldn't stop Vulkan from starting
+    if(game.vk.validation && !vk_supports_validation_layers()) {
+        fprintf(stderr, "Continuing without validation layers.\n");
+        game.vk.validation = false;
+    }
+
+    if(
+        !vk_create_instance()            ||
+        !vk_create_debug_messenger()     ||
+        !vk_create_window_surfaces()     ||
+        !vk_get_physical_device()        ||
+        !vk_create_logic_device()        ||
+        !vk_create_render_pass()         ||
+        !vk_create_graphics_pipeline()   ||
+        !vk_create_mesh_pipeline()       ||
+        !vk_create_cmd_pool()            ||
+        !vk_create_cmd_buffer()          ||
+        !vk_create_sync_objects()        ||
+        !vk_create_particles()           ||
+        !vk_create_windows()
+    ) {
+        return false;
+    }
+
+    if(game.present.active)
+        vk_present_timing_init();
+
+    return true;
+}
+
+void
+render_vulkan(const sim_state_t *state)
+{
+    // Wait for the last frame in this slot to finish
+    uint64_t wait_start = time_ns();
+
+    vk_timeline_wait(game.vk.frame_values[game.vk.current_frame], UINT64_MAX);
+
+    uint64_t wait_ns = time_ns() - wait_start;
+
+    // This frame's last use of anything it retired is done now
+    vk_release_retired(game.vk.current_frame, false);
+    vk_trim_frame_slots();
+
+    if(game.capture.active)
+        vk_capture_collect(false);
+
+    // See which image every window is using. Windows that are out of date
+    // are rebuilt and sit this frame out, the rest still draw.
+    const VkSemaphore *img_available =
+            &game.vk.img_available[game.vk.current_frame * game.window.count];
+
+    vk_window_t *drawn[WINDOW_MAX];
+    unsigned int drawn_c = 0;
+
+    for(unsigned int i = 0; i < game.window.count; i++)
+    {
+        vk_window_t *win = &game.vk.windows[i];
+
+        vk_swap_lock(win);
+
+        VkResult success = vkAcquireNextImageKHR(game.vk.device, 
+                                                 win->swap, 
+                                                 UINT64_MAX, 
+                                                 img_available[i], 
+                                                 VK_NULL_HANDLE, 
+                                                 &win->image);
+
+        vk_swap_unlock(win);
+
+        if(success == VK_ERROR_OUT_OF_DATE_KHR) {
+            if(!vk_recreate_swapchain(win)) {
+                game.should_close = true;
+                return;
+            }
+
+            continue;
+        } else if(success != VK_SUCCESS && success != VK_SUBOPTIMAL_KHR) {
+            fprintf(stderr, "Failed to get next image!\n");
+            vk_error_print(success);
+        
+            game.should_close = true;
+            return;
+        }
+
+        drawn[drawn_c++] = win;
+    }
+
+    if(drawn_c == 0)
+        return;
+
+    VkCommandBuffer slot_cmd = game.vk.cmdbuffer[game.vk.current_frame];
+
+    vkResetCommandBuffer(slot_cmd, 0);
+
+    // Command buffer data
+    // Uploads and captures, the draws have their own per image
+
+    const VkCommandBufferBeginInfo info_b = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+
+    VkResult success = vkBeginCommandBuffer(slot_cmd, &info_b);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to begin recording to the command buffer!\n"
+                        "Render failed!\n");
+        vk_error_print(success);
+
+        game.should_close = true;
+        return;
+    }
+
+    game.vk.slot_used = false;
+
+    bool particles = game.vk.compute.count > 0;
+    bool async = particles && game.vk.compute.async &&
+                 !game.vk.compute.on_graphics;
+
+    // Without a queue of its own the step goes first in the submit
+    if(particles && !async) {
+        vk_record_particles(slot_cmd);
+        game.vk.slot_used = true;
+    }
+
+    // Uploads go in before the draws
+    texture_stream();
+
+    if(game.mesh.pending)
+        vk_mesh_upload();
+
+    // Only the first window is ever captured
+    bool captured = game.capture.active && drawn[0] == &game.vk.windows[0];
+
+    if(captured) {
+        // The copy has to come after the draws, so they go in here too
+        vk_record_scene(slot_cmd, drawn[0], state);
+
+        VK_LABEL(slot_cmd, "Capture")
+        {
+            vk_capture_record(drawn[0]->image);
+        }
+
+        game.vk.slot_used = true;
+    }
+
+    for(unsigned int i = captured ? 1 : 0; i < drawn_c; i++)
+        if(!vk_prepare_image_cmd(drawn[i], state)) {
+            game.should_close = true;
+            return;
+        }
+
+    success = vkEndCommandBuffer(slot_cmd);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to record command buffer!\n"
+                        "Render failed!\n");
+        vk_error_print(success);
+
+        game.should_close = true;
+        return;
+    }
+
+    if(async && !vk_submit_particles()) {
+        game.should_close = true;
+        return;
+    }
+
+    // Every window goes in one submit. Empty slot buffers aren't worth
+    // submitting.
+    VkCommandBuffer cmds[WINDOW_MAX + 1];
+    unsigned int cmd_c = 0;
+
+    // The acquires, then the compute step when it has a queue of its own
+    VkSemaphore wait[WINDOW_MAX + 1];
+    VkPipelineStageFlags waitf[WINDOW_MAX + 1];
+    uint64_t wait_values[WINDOW_MAX + 1] = {0};
+    unsigned int wait_c = drawn_c;
+
+    // Binary semaphores ignore their value
+    VkSemaphore signal[WINDOW_MAX + 1];
+    uint64_t signal_values[WINDOW_MAX + 1] = {0};
+    uint64_t frame_value = game.vk.timeline_value + 1;
+
+    if(game.vk.slot_used)
+        cmds[cmd_c++] = slot_cmd;
+
+    for(unsigned int i = 0; i < drawn_c; i++)
+    {
+        if(i > 0 || !captured)
+            cmds[cmd_c++] = drawn[i]->image_cmds[drawn[i]->image].cmd;
+
+        wait[i] = img_available[drawn[i] - game.vk.windows];
+        waitf[i] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        signal[i] = drawn[i]->render_finished[drawn[i]->image];
+    }
+
+    // The draws get the step before, the one just submitted runs next to
+    // them
+    if(async) {
+        wait[wait_c] = game.vk.compute.timeline;
+        waitf[wait_c] = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+        wait_values[wait_c++] = game.vk.compute.value - 1;
+    }
+
+    signal[drawn_c] = game.vk.timeline;
+    signal_values[drawn_c] = frame_value;
+
+    const VkTimelineSemaphoreSubmitInfo info_t = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = wait_c,
+        .pWaitSemaphoreValues = wait_values,
+        .signalSemaphoreValueCount = drawn_c + 1,
+        .pSignalSemaphoreValues = signal_values
+    };
+
+    const VkSubmitInfo info_s = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &info_t,
+        .waitSemaphoreCount = wait_c,
+        .pWaitSemaphores = wait,
+        .pWaitDstStageMask = waitf,
+        .commandBufferCount = cmd_c,
+        .pCommandBuffers = cmds,
+        .signalSemaphoreCount = drawn_c + 1,
+        .pSignalSemaphores = signal
+    };
+
+    uint64_t submit_ns = time_ns();
+
+    success = vkQueueSubmit(game.vk.gp_queue, 1, &info_s, VK_NULL_HANDLE);
+    
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to submit draw command!\n"
+                        "Render failed!\n");
+        vk_error_print(success);
+        
+        game.should_close = true;
+        return;
+    }
+
+    game.vk.timeline_value = frame_value;
+    game.vk.frame_values[game.vk.current_frame] = frame_value;
+
+    for(unsigned int i = captured ? 1 : 0; i < drawn_c; i++)
+        drawn[i]->image_cmds[drawn[i]->image].value = frame_value;
+
+    // Show the images, all of them in one present
+
+    VkSwapchainKHR chains[WINDOW_MAX];
+    uint32_t indices[WINDOW_MAX];
+    uint64_t present_ids[WINDOW_MAX] = {0};
+    VkResult results[WINDOW_MAX];
+
+    for(unsigned int i = 0; i < drawn_c; i++)
+    {
+        chains[i] = drawn[i]->swap;
+        indices[i] = drawn[i]->image;
+    }
+
+    // Tag the first window's present so the timing thread can wait for it,
+    // 0 leaves the others untagged
+    bool timed = drawn[0] == &game.vk.windows[0];
+    uint64_t present_id = timed ? ++game.present.next_id : 0;
+
+    present_ids[0] = present_id;
+
+    const VkPresentIdKHR info_id = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+        .swapchainCount = drawn_c,
+        .pPresentIds = present_ids
+    };
+
+    const VkPresentInfoKHR info_p = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        .pNext = game.present.active ? &info_id : NULL,
+        .waitSemaphoreCount = drawn_c,
+        .pWaitSemaphores = signal,
+        .swapchainCount = drawn_c,
+        .pSwapchains = chains,
+        .pImageIndices = indices,
+        .pResults = results
+    };
+
+    // One call for every window, so it locks the first whether it's among
+    // them or not
+    vk_swap_lock(&game.vk.windows[0]);
+    success = vkQueuePresentKHR(game.vk.pr_queue, &info_p);
+    vk_swap_unlock(&game.vk.windows[0]);
+
+    // Device level failures can leave the per swapchain results unset
+    if(success != VK_SUCCESS && success != VK_SUBOPTIMAL_KHR &&
+       success != VK_ERROR_OUT_OF_DATE_KHR)
+        for(unsigned int i = 0; i < drawn_c; i++)
+            results[i] = success;
+
+    if(game.present.active && timed && results[0] == VK_SUCCESS) {
+        pthread_mutex_lock(&game.present.lock);
+
+        // If the thread fell this far behind, drop the frame
+        if(game.present.head - game.present.tail < PRESENT_QUEUE_SIZE) {
+            game.present.queue[game.present.head % PRESENT_QUEUE_SIZE] =
+                            (present_frame_t){
+                                .id = present_id,
+                                .submit_ns = submit_ns,
+                                .generation = game.present.generation
+                            };
+
+            game.present.head++;
+            pthread_cond_signal(&game.present.cond);
+        }
+
+        pthread_mutex_unlock(&game.present.lock);
+    }
+
+    for(unsigned int i = 0; i < drawn_c && !game.should_close; i++)
+    {
+        if(results[i] == VK_ERROR_OUT_OF_DATE_KHR ||
+           results[i] == VK_SUBOPTIMAL_KHR) {
+            if(!vk_recreate_swapchain(drawn[i]))
+                game.should_close = true;
+        } else if(results[i] != VK_SUCCESS) {
+            fprintf(stderr, "Failed to get next image!\n");
+            vk_error_print(results[i]);
+
+            game.should_close = true;
+        }
+    }
+
+    game.vk.current_frame = (game.vk.current_frame + 1) % game.vk.max_frames;
+
+    if(game.vk.adapt.enabled)
+        vk_adapt_frames_in_flight(wait_ns);
+}
+
+// Everything drawn into the swapchain image, from the clear to the
+// transition for presenting
+void
+vk_record_scene(VkCommandBuffer cmd,
+                const vk_window_t *win,
+                const sim_state_t *state)
+{
+    const VkClearValue clear_color = {{{
+        state->clear_color[0],
+        state->clear_color[1],
+        state->clear_color[2],
+        state->clear_color[3]
+    }}};
+
+    const VkExtent2D ex = vk_render_extent(win);
+
+    VK_LABEL(cmd, "Render pass")
+    {
+        vk_begin_rendering(cmd, win, &clear_color);
+
+        const VkViewport view = {
+            .x = 0.0f,
+            .y = 0.0f,
+            .width = (float)ex.width,
+            .height = (float)ex.height,
+            .minDepth = 0.0f,
+            .maxDepth = 1.0f,
+        };
+        vkCmdSetViewport(cmd, 0, 1, &view);
+
+        const VkRect2D scissor = {
+            .offset = {
+                .x = 0,
+                .y = 0
+            },
+
+            .extent = ex,
+        };
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+        VK_LABEL(cmd, "Draw")
+        {
+            // Sorted, so each bind only happens when the state changes
+            unsigned int pipeline = UINT32_MAX;
+            unsigned int material = UINT32_MAX;
+
+            for(unsigned int i = 0; i < game.cmds.count; i++)
+            {
+                const draw_cmd_t *draw = &game.cmds.list[i];
+
+                if(SORT_KEY_PIPELINE(draw->key) != pipeline) {
+                    pipeline = SORT_KEY_PIPELINE(draw->key);
+
+                    if(pipeline == RENDER_PIPELINE_MESH)
+                        vk_mesh_bind(cmd);
+                    else
+                        vkCmdBindPipeline(cmd,
+                                          VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                          game.vk.pipeline);
+
+                    game.stats.pipeline_binds++;
+                }
+
+                // Materials will be descriptor sets, none exist yet
+                if(SORT_KEY_MATERIAL(draw->key) != material) {
+                    material = SORT_KEY_MATERIAL(draw->key);
+                    game.stats.material_binds++;
+                }
+
+                if(pipeline == RENDER_PIPELINE_MESH) {
+                    // Only worked out again when the frame changed
+                    vkCmdPushConstants(cmd,
+                                       game.vk.mesh_layout,
+                                       VK_SHADER_STAGE_VERTEX_BIT,
+                                       0,
+                                       sizeof(mesh_push_t),
+                                       &game.render.pushes[i]);
+
+                    vkCmdDrawIndexed(cmd,
+                                     draw->vertex_count,
+                                     1,
+                                     draw->first_vertex,
+                                     0,
+                                     0);
+
+                    game.mesh.triangles += draw->vertex_count / 3;
+                } else {
+                    vkCmdDraw(cmd,
+                              draw->vertex_count,
+                              1,
+                              draw->first_vertex,
+                              0);
+                }
+            }
+
+            game.stats.draws += game.cmds.count;
+        }
+
+        vk_end_rendering(cmd, win);
+    }
+}
+
+// Makes sure the image's own command buffer draws this frame, recording it
+// again only if the frame changed since
+bool
+vk_prepare_image_cmd(vk_window_t *win, const sim_state_t *state)
+{
+    vk_image_cmd_t *rec = &win->image_cmds[win->image];
+
+    // It can't be reset or submitted again while the GPU still has it
+    vk_timeline_wait(rec->value, UINT64_MAX);
+
+    // So the times it wrote last time are in too
+    if(rec->timed && rec->value != 0) {
+        uint64_t stamps[2];
+
+        VkResult success = vkGetQueryPoolResults(game.vk.device,
+                                                 game.vk.scene.queries,
+                                                 win->image * 2,
+                                                 2,
+                                                 sizeof(stamps),
+                                                 stamps,
+                                                 sizeof(uint64_t),
+                                                 VK_QUERY_RESULT_64_BIT);
+
+        if(success == VK_SUCCESS) {
+            uint64_t ticks = (stamps[1] - stamps[0]) &
+                             game.vk.scene.timestamp_mask;
+
+            dynres_update((uint64_t)((double)ticks *
+                                     (double)game.vk.scene.timestamp_period));
+        }
+    }
+
+    // A new render scale needs it recorded again too
+    VkExtent2D ex = vk_render_extent(win);
+
+    if(rec->frame == game.render.frame &&
+       rec->ex.width == ex.width && rec->ex.height == ex.height) {
+        game.stats.draws += rec->draws;
+        game.stats.pipeline_binds += rec->pipeline_binds;
+        game.stats.material_binds += rec->material_binds;
+        game.mesh.triangles += rec->triangles;
+
+        return true;
+    }
+
+    vkResetCommandBuffer(rec->cmd, 0);
+
+    // No one time flag, it's meant to be submitted again
+    const VkCommandBufferBeginInfo info_b = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+    };
+
+    VkResult success = vkBeginCommandBuffer(rec->cmd, &info_b);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to begin recording to the command buffer!\n"
+                        "Render failed!\n");
+        vk_error_print(success);
+
+        return false;
+    }
+
+    uint64_t draws = game.stats.draws;
+    uint64_t pipeline_binds = game.stats.pipeline_binds;
+    uint64_t material_binds = game.stats.material_binds;
+    uint64_t triangles = game.mesh.triangles;
+
+    // Around everything the scene costs, the blit included
+    rec->timed = vk_window_scaled(win);
+
+    if(rec->timed) {
+        vkCmdResetQueryPool(rec->cmd, game.vk.scene.queries, win->image * 2, 2);
+        vkCmdWriteTimestamp(rec->cmd,
+                            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            game.vk.scene.queries,
+                            win->image * 2);
+    }
+
+    vk_record_scene(rec->cmd, win, state);
+
+    if(rec->timed)
+        vkCmdWriteTimestamp(rec->cmd,
+                            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            game.vk.scene.queries,
+                            win->image * 2 + 1);
+
+    success = vkEndCommandBuffer(rec->cmd);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to record command buffer!\n"
+                        "Render failed!\n");
+        vk_error_print(success);
+
+        rec->frame = 0;
+        return false;
+    }
+
+    rec->frame = game.render.frame;
+    rec->ex = ex;
+    rec->draws = game.stats.draws - draws;
+    rec->pipeline_binds = game.stats.pipeline_binds - pipeline_binds;
+    rec->material_binds = game.stats.material_binds - material_binds;
+    rec->triangles = game.mesh.triangles - triangles;
+
+    return true;
+}
+
+bool
+window_create_vulkan(void)
+{
+    // Create the connection
+    game.xcb.connection = xcb_connect(NULL, NULL);
+
+    if(!game.xcb.connection) {
+        fprintf(stderr, "Failed to create connection to Xorg!\n");
+
+        return false;
+    }
+
+    // Get screen
+    const xcb_setup_t *setup = xcb_get_setup(game.xcb.connection);
+    xcb_screen_iterator_t iter = xcb_setup_roots_iterator(setup);
+    xcb_screen_t *screen = iter.data;
+
+    for(unsigned int i = 0; i < game.window.count; i++)
+        if(!window_open(i, screen, 0))
+            return false;
+
+    return true;
+}
+
+void
+vk_error_print(VkResult error)
+{
+    switch(error)
+    {
+        case VK_ERROR_OUT_OF_HOST_MEMORY:
+            fprintf(stderr, "VK_ERROR_OUT_OF_HOST_MEMORY\n");
+            break;
+
+        case VK_ERROR_OUT_OF_DEVICE_MEMORY:
+            fprintf(stderr, "VK_ERROR_OUT_OF_DEVICE_MEMORY\n");
+            break;
+
+        case VK_ERROR_INITIALIZATION_FAILED:
+            fprintf(stderr, "VK_ERROR_INITIALIZATION_FAILED\n");
+            break;
+
+        case VK_ERROR_DEVICE_LOST:
+            fprintf(stderr, "VK_ERROR_DEVICE_LOST\n");
+            break;
+
+        case VK_ERROR_MEMORY_MAP_FAILED:
+            fprintf(stderr, "VK_ERROR_MEMORY_MAP_FAILED\n");
+            break;
+
+        case VK_ERROR_LAYER_NOT_PRESENT:
+            fprintf(stderr, "VK_ERROR_LAYER_NOT_PRESENT\n");
+            break;
+
+        case VK_ERROR_EXTENSION_NOT_PRESENT:
+            fprintf(stderr, "VK_ERROR_EXTENSION_NOT_PRESENT\n");
+            break;
+
+        case VK_ERROR_FEATURE_NOT_PRESENT:
+            fprintf(stderr, "VK_ERROR_FEATURE_NOT_PRESENT\n");
+            break;
+
+        case VK_ERROR_INCOMPATIBLE_DRIVER:
+            fprintf(stderr, "VK_ERROR_FEATURE_NOT_PRESENT\n");
+            break;
+
+        case VK_ERROR_TOO_MANY_OBJECTS:
+            fprintf(stderr, "VK_ERROR_TOO_MANY_OBJECTS\n");
+            break;
+
+        case VK_ERROR_FORMAT_NOT_SUPPORTED:
+            fprintf(stderr, "VK_ERROR_FORMAT_NOT_SUPPORTED\n");
+            break;
+
+        case VK_ERROR_FRAGMENTED_POOL:
+            fprintf(stderr, "VK_ERROR_FRAGMENTED_POOL\n");
+            break;
+
+        case VK_ERROR_UNKNOWN:
+            fprintf(stderr, "VK_ERROR_UNKNOWN\n");
+            break;
+
+        case VK_ERROR_OUT_OF_POOL_MEMORY:
+            fprintf(stderr, "VK_ERROR_OUT_OF_POOL_MEMORY\n");
+            break;
+
+        case VK_ERROR_INVALID_EXTERNAL_HANDLE:
+            fprintf(stderr, "VK_ERROR_INVALID_EXTERNAL_HANDLE\n");
+            break;
+
+        case VK_ERROR_FRAGMENTATION:
+            fprintf(stderr, "VK_ERROR_FRAGMENTATION\n");
+            break;
+
+        case VK_ERROR_INVALID_OPAQUE_CAPTURE_ADDRESS:
+            fprintf(stderr, "VK_ERROR_INVALID_OPAQUE_CAPTURE_ADDRESS\n");
+            break;
+
+        case VK_ERROR_SURFACE_LOST_KHR:
+            fprintf(stderr, "VK_ERROR_SURFACE_LOST_KHR\n");
+            break;
+
+        case VK_ERROR_NATIVE_WINDOW_IN_USE_KHR:
+            fprintf(stderr, "VK_ERROR_NATIVE_WINDOW_IN_USE_KHR\n");
+            break;
+
+        case VK_ERROR_OUT_OF_DATE_KHR:
+            fprintf(stderr, "VK_ERROR_OUT_OF_DATE_KHR\n");
+            break;
+
+        case VK_ERROR_INCOMPATIBLE_DISPLAY_KHR:
+            fprintf(stderr, "VK_ERROR_INCOMPATIBLE_DISPLAY_KHR\n");
+            break;
+
+        case VK_ERROR_VALIDATION_FAILED_EXT:
+            fprintf(stderr, "VK_ERROR_VALIDATION_FAILED_EXT\n");
+            break;
+
+        case VK_ERROR_INVALID_SHADER_NV:
+            fprintf(stderr, "VK_ERROR_INVALID_SHADER_NV\n");
+            break;
+
+#ifdef VK_ENABLE_BETA_EXTENSIONS
+
+        case VK_ERROR_IMAGE_USAGE_NOT_SUPPORTED_KHR:
+            fprintf(stderr, "VK_ERROR_IMAGE_USAGE_NOT_SUPPORTED_KHR\n");
+            break;
+
+        case VK_ERROR_VIDEO_PICTURE_LAYOUT_NOT_SUPPORTED_KHR:
+            fprintf(stderr, 
+                    "VK_ERROR_VIDEO_PICTURE_LAYOUT_NOT_SUPPORTED_KHR\n");
+            break;
+
+        case VK_ERROR_VIDEO_PROFILE_OPERATION_NOT_SUPPORTED_KHR:
+            fprintf(stderr, 
+                    "VK_ERROR_VIDEO_PROFILE_OPERATION_NOT_SUPPORTED_KHR\n");
+            break;
+
+        case VK_ERROR_VIDEO_PROFILE_FORMAT_NOT_SUPPORTED_KHR:
+            fprintf(stderr, 
+                    "VK_ERROR_VIDEO_PROFILE_FORMAT_NOT_SUPPORTED_KHR\n");
+            break;
+
+        case VK_ERROR_VIDEO_PROFILE_FORMAT_NOT_SUPPORTED_KHR:
+            fprintf(stderr, 
+                    "VK_ERROR_VIDEO_PROFILE_CODEC_NOT_SUPPORTED_KHR\n");
+            break;
+
+        case VK_ERROR_VIDEO_STD_VERSION_NOT_SUPPORTED_KHR:
+            fprintf(stderr, "VK_ERROR_VIDEO_STD_VERSION_NOT_SUPPORTED_KHR\n");
+            break;
+
+#endif
+
+        case VK_ERROR_INVALID_DRM_FORMAT_MODIFIER_PLANE_LAYOUT_EXT:
+            fprintf(stderr, 
+                    "VK_ERROR_INVALID_DRM_FORMAT_MODIFIER_PLANE_LAYOUT_EXT\n");
+            break;
+
+        case VK_ERROR_NOT_PERMITTED_KHR:
+            fprintf(stderr, "VK_ERROR_NOT_PERMITTED_KHR\n");
+            break;
+
+        case VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT:
+            fprintf(stderr, "VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT\n");
+            break;
+
+        case VK_ERROR_COMPRESSION_EXHAUSTED_EXT:
+            fprintf(stderr, "VK_ERROR_COMPRESSION_EXHAUSTED_EXT\n");
+            break;
+
+        default:
+            break;
+    }
+}
+
+void
+vk_read_file(const char *file_name, size_t *size, char **out)
+{
+    // Open the file and make sure it opened
+    FILE *file = fopen(file_name, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "File '%s' failed to open!\n"
+                        "%s\n", 
+                        file_name, strerror(errno));
+
+        return;
+    }
+
+    // Get file size
+    fseek(file, 0, SEEK_END);
+    size_t file_size = ftell(file);
+
+    // Read the file
+    *out = malloc(sizeof(char) * file_size);
+    fseek(file, 0, SEEK_SET);
+
+    fread(*out, sizeof(char) * file_size, 1, file);
+
+    // Close it
+    fclose(file);
+
+    *size = file_size;
+}
+
+bool
+vk_has_instance_extension(const char *name)
+{
+    unsigned int ext_c;
+    vkEnumerateInstanceExtensionProperties(NULL, &ext_c, NULL);
+
+    VkExtensionProperties exts[ext_c];
+    vkEnumerateInstanceExtensionProperties(NULL, &ext_c, exts);
+
+    for(unsigned int i = 0; i < ext_c; i++)
+        if(strcmp(exts[i].extensionName, name) == 0)
+            return true;
+
+    return false;
+}
+
+bool
+vk_supports_validation_layers(void)
+{
+    // Get layers
+    unsigned int layer_c;
+    vkEnumerateInstanceLayerProperties(&layer_c, NULL);
+
+    VkLayerProperties layers[layer_c];
+    vkEnumerateInstanceLayerProperties(&layer_c, layers);
+
+    // Look for needed layers
+    bool has_layer = false;
+    for(unsigned int i = 0; i < layer_c; i++)
+        if(strcmp(layers[i].layerName, VK_layer[0]) == 0)
+            has_layer = true;
+
+    if(!has_layer) {
+        fprintf(stderr, "Vulkan does not support validation layers!\n");
+        return false;
+    }
+
+    // We also need debug utils to get the messages back
+    if(!vk_has_instance_extension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME)) {
+        fprintf(stderr, "Vulkan does not support debug utils!\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool
+vk_create_instance(void)
+{
+    // Use the newest version we know about, newer core features are only
+    // used when the device supports them too
+    game.vk.api_version = VK_API_VERSION_1_0;
+
+    PFN_vkEnumerateInstanceVersion get_version =
+                (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(
+                                            NULL,
+                                            "vkEnumerateInstanceVersion");
+
+    if(get_version != NULL) {
+        get_version(&game.vk.api_version);
+
+        if(game.vk.api_version > VK_API_VERSION_1_3)
+            game.vk.api_version = VK_API_VERSION_1_3;
+    }
+
+    // Set app info
+    const VkApplicationInfo pinfo = {
+        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+        .pApplicationName = WN_NAME,
+        .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+        .pEngineName = "None",
+        .engineVersion = VK_MAKE_VERSION(1, 0, 0),
+        .apiVersion = game.vk.api_version
+    };
+
+    // Add debug utils when validating
+    const char *ext[VK_ext_c + 1];
+    unsigned int ext_c = VK_ext_c;
+
+    for(unsigned int i = 0; i < VK_ext_c; i++)
+        ext[i] = VK_ext[i];
+
+    game.vk.debug_utils = game.vk.validation;
+
+#ifdef DEBUG
+    // Debug builds also want labels and object names for frame captures
+    if(vk_has_instance_extension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME))
+        game.vk.debug_utils = true;
+#endif
+
+    if(game.vk.debug_utils)
+        ext[ext_c++] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+
+    // Chaining the messenger info also catches instance creation messages
+    VkDebugUtilsMessengerCreateInfoEXT debug_info;
+    vk_get_debug_messenger_info(&debug_info);
+
+    // Set instance info
+    const VkInstanceCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pNext = game.vk.validation ? &debug_info : NULL,
+        .pApplicationInfo = &pinfo,
+        .enabledExtensionCount = ext_c,
+        .ppEnabledExtensionNames = ext,
+        .enabledLayerCount = game.vk.validation ? VK_layer_c : 0,
+        .ppEnabledLayerNames = VK_layer
+    };
+
+    // Create vulkan instance
+    VkResult success = vkCreateInstance(&info, NULL, &game.vk.instance);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create instance!\n");
+        vk_error_print(success);
+
+        return false;
+    }
+
+#ifdef DEBUG
+    vk_load_debug_functions();
+#endif
+
+    return true;
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL
+vk_debug_callback(
+    VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+    VkDebugUtilsMessageTypeFlagsEXT type,
+    const VkDebugUtilsMessengerCallbackDataEXT *data,
+    void *user_data
+    )
+{
+    (void)user_data;
+
+    const char *level = "VERBOSE";
+    FILE *out = stdout;
+
+    if(severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+        level = "ERROR";
+        out = stderr;
+    } else if(severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+        level = "WARNING";
+        out = stderr;
+    } else if(severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
+        level = "INFO";
+    }
+
+    const char *kind = "general";
+
+    if(type & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT)
+        kind = "validation";
+    else if(type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT)
+        kind = "performance";
+
+    fprintf(out, "Vulkan %s (%s): %s\n", level, kind, data->pMessage);
+
+    // Never abort the call that triggered the message
+    return VK_FALSE;
+}
+
+void
+vk_get_debug_messenger_info(VkDebugUtilsMessengerCreateInfoEXT *info)
+{
+    // Severity bits are ordered, so take every bit at or above the minimum
+    VkDebugUtilsMessageSeverityFlagsEXT severity = 0;
+    const VkDebugUtilsMessageSeverityFlagsEXT levels[] = {
+        VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT,
+        VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
+        VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT,
+        VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT
+    };
+
+    for(unsigned int i = 0; i < 4; i++)
+        if(levels[i] >= game.vk.severity)
+            severity |= levels[i];
+
+    *info = (VkDebugUtilsMessengerCreateInfoEXT){
+        .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
+        .messageSeverity = severity,
+        .messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+                       VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+                       VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
+        .pfnUserCallback = vk_debug_callback
+    };
+}
+
+bool
+vk_create_debug_messenger(void)
+{
+    game.vk.messenger = VK_NULL_HANDLE;
+
+    if(!game.vk.validation)
+        return true;
+
+    // This is an extension function so we have to load it ourselves
+    PFN_vkCreateDebugUtilsMessengerEXT create = 
+                (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(
+                                            game.vk.instance,
+                                            "vkCreateDebugUtilsMessengerEXT");
+
+    if(create == NULL) {
+        fprintf(stderr, "Failed to load vkCreateDebugUtilsMessengerEXT!\n");
+        return false;
+    }
+
+    VkDebugUtilsMessengerCreateInfoEXT info;
+    vk_get_debug_messenger_info(&info);
+
+    VkResult success = create(game.vk.instance, 
+                              &info, 
+                              NULL, 
+                              &game.vk.messenger);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create debug messenger!\n");
+        vk_error_print(success);
+
+        return false;
+    }
+
+    return true;
+}
+
+bool
+vk_has_device_extension(VkPhysicalDevice device, const char *name)
+{
+    unsigned int ext_c;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &ext_c, NULL);
+
+    VkExtensionProperties exts[ext_c];
+    vkEnumerateDeviceExtensionProperties(device, NULL, &ext_c, exts);
+
+    for(unsigned int i = 0; i < ext_c; i++)
+        if(strcmp(exts[i].extensionName, name) == 0)
+            return true;
+
+    return false;
+}
+
+bool
+vk_supports_present_timing(void)
+{
+    if(game.vk.device_version < VK_API_VERSION_1_1)
+        return false;
+
+    if(!vk_has_device_extension(game.vk.physical_device,
+                                VK_KHR_PRESENT_ID_EXTENSION_NAME) ||
+       !vk_has_device_extension(game.vk.physical_device,
+                                VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+        return false;
+
+    // Having the extension doesn't mean the features are on
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR
+    };
+
+    VkPhysicalDevicePresentIdFeaturesKHR present_id = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+        .pNext = &present_wait
+    };
+
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &present_id
+    };
+
+    vkGetPhysicalDeviceFeatures2(game.vk.physical_device, &features);
+
+    return present_id.presentId && present_wait.presentWait;
+}
+
+bool
+vk_supports_dynamic_rendering(void)
+{
+    if(game.vk.device_version < VK_API_VERSION_1_3)
+        return false;
+
+    VkPhysicalDeviceVulkan13Features features13 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES
+    };
+
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &features13
+    };
+
+    vkGetPhysicalDeviceFeatures2(game.vk.physical_device, &features);
+
+    return features13.dynamicRendering && features13.synchronization2;
+}
+
+// The scene is blitted up to the swapchain and timed with timestamps, the
+// swapchain's own usage is checked when it's made
+bool
+vk_supports_dynamic_resolution(void)
+{
+    const VkFormatFeatureFlags needs =
+        VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT |
+        VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+        VK_FORMAT_FEATURE_BLIT_DST_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    VkFormatProperties format;
+    vkGetPhysicalDeviceFormatProperties(game.vk.physical_device,
+                                        game.vk.surface_format.format,
+                                        &format);
+
+    if((format.optimalTilingFeatures & needs) != needs) {
+        fprintf(stderr, "Can't blit the surface format, "
+                        "dynamic resolution is disabled!\n");
+        return false;
+    }
+
+    unsigned int gp_family, pr_family;
+    vk_get_queue_families(game.vk.physical_device, &gp_family, &pr_family);
+
+    uint32_t count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(game.vk.physical_device,
+                                             &count,
+                                             NULL);
+
+    VkQueueFamilyProperties *families = malloc(sizeof(*families) * count);
+
+    if(families == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        return false;
+    }
+
+    vkGetPhysicalDeviceQueueFamilyProperties(game.vk.physical_device,
+                                             &count,
+                                             families);
+
+    uint32_t bits = gp_family < count ? families[gp_family].timestampValidBits
+                                      : 0;
+    free(families);
+
+    if(bits == 0) {
+        fprintf(stderr, "No timestamps on the graphics queue, "
+                        "dynamic resolution is disabled!\n");
+        return false;
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(game.vk.physical_device, &props);
+
+    game.vk.scene.timestamp_mask = bits >= 64 ? UINT64_MAX
+                                              : (1ull << bits) - 1;
+    game.vk.scene.timestamp_period = props.limits.timestampPeriod;
+
+    return true;
+}
+
+void
+vk_present_timing_init(void)
+{
+    game.present.wait_for_present =
+                (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(
+                                            game.vk.device,
+                                            "vkWaitForPresentKHR");
+
+    if(game.present.wait_for_present == NULL) {
+        game.present.active = false;
+        return;
+    }
+
+    pthread_mutex_init(&game.present.lock, NULL);
+    pthread_mutex_init(&game.present.swap_lock, NULL);
+    pthread_cond_init(&game.present.cond, NULL);
+
+    game.present.quit = false;
+    game.present.head = game.present.tail = 0;
+
+    if(pthread_create(&game.present.thread,
+                      NULL,
+                      vk_present_wait_thread,
+                      NULL) != 0) {
+        fprintf(stderr, "Failed to start present timing thread!\n");
+        game.present.active = false;
+    }
+}
+
+void
+vk_present_timing_stop(void)
+{
+    if(!game.present.active)
+        return;
+
+    pthread_mutex_lock(&game.present.lock);
+    game.present.quit = true;
+    pthread_cond_signal(&game.present.cond);
+    pthread_mutex_unlock(&game.present.lock);
+
+    pthread_join(game.present.thread, NULL);
+
+    pthread_cond_destroy(&game.present.cond);
+    pthread_mutex_destroy(&game.present.swap_lock);
+    pthread_mutex_destroy(&game.present.lock);
+
+    game.present.active = false;
+}
+
+void *
+vk_present_wait_thread(void *arg)
+{
+    (void)arg;
+
+    const struct timespec poll = {
+        .tv_sec = 0,
+        .tv_nsec = PRESENT_POLL_NS
+    };
+
+    while(true)
     {
-        if(strcmp(argv[i], "--use-opengl") == 0) {
-            game.gpu_api = GRAPHICS_API_OPENGL;
-        } else if(strcmp(argv[i], "--force-opengl") == 0) {
-            game.gpu_api = GRAPHICS_API_OPENGL;
-            game.gpu_api_is_forced = true;
-        } else if(strcmp(argv[i], "--use-vulkan") == 0) {
-            game.gpu_api = GRAPHICS_API_VULKAN;
-        } else if(strcmp(argv[i], "--force-vulkan") == 0) {
-            game.gpu_api = GRAPHICS_API_VULKAN;
-            game.gpu_api_is_forced = true;
-        } else if(strcmp(argv[i], "--vulkan-max-frames-in-flight") == 0) {
-            if(argc >= i + 1) {
-                game.vk.max_frames = (unsigned int)strtol(argv[i + 1], 
-                                                            (char **)NULL, 
-                                                            10);
+        // Take the oldest present
+        pthread_mutex_lock(&game.present.lock);
 
-                if(game.vk.max_frames == 0) {
-                    fprintf(stderr, 
-                            "Unknown number, "
-                            "failed to change max frames in flight!\n");
+        while(!game.present.quit && game.present.head == game.present.tail)
+            pthread_cond_wait(&game.present.cond, &game.present.lock);
+
+        bool quit = game.present.quit;
+
+        present_frame_t frame =
+                    game.present.queue[game.present.tail % PRESENT_QUEUE_SIZE];
+        game.present.tail++;
+
+        pthread_mutex_unlock(&game.present.lock);
+
+        if(quit)
+            break;
+
+        // Wait for it to reach the screen. The swapchain can only be used
+        // by one thread at a time and the render thread acquires and
+        // presents on it, so this polls instead of holding it while
+        // blocked.
+        VkResult success = VK_TIMEOUT;
+
+        while(true)
+        {
+            pthread_mutex_lock(&game.present.swap_lock);
+
+            // The swapchain it was presented to is gone
+            if(frame.generation != game.present.generation) {
+                pthread_mutex_unlock(&game.present.swap_lock);
+                break;
+            }
+
+            success = game.present.wait_for_present(game.vk.device,
+                                                    game.vk.windows[0].swap,
+                                                    frame.id,
+                                                    0);
+
+            pthread_mutex_unlock(&game.present.swap_lock);
+
+            if(success != VK_TIMEOUT)
+                break;
+
+            pthread_mutex_lock(&game.present.lock);
+            quit = game.present.quit;
+            pthread_mutex_unlock(&game.present.lock);
+
+            if(quit)
+                break;
+
+            nanosleep(&poll, NULL);
+        }
+
+        if(success != VK_SUCCESS)
+            continue;
+
+        uint64_t display_ns = time_ns();
+
+        // Vulkan doesn't tell us about vblanks, so the shortest gap between
+        // two frames on screen stands in for the refresh interval
+        unsigned int missed = 0;
+
+        if(game.present.last_display_ns != 0) {
+            uint64_t gap = display_ns - game.present.last_display_ns;
+
+            if(gap > 1000000 &&
+               (game.present.refresh_ns == 0 || gap < game.present.refresh_ns))
+                game.present.refresh_ns = gap;
+
+            if(game.present.refresh_ns != 0 &&
+               gap > game.present.refresh_ns * 3 / 2)
+                missed = (unsigned int)((gap + game.present.refresh_ns / 2) /
+                                        game.present.refresh_ns) - 1;
+        }
+
+        game.present.last_display_ns = display_ns;
+
+        present_timing_record(frame.submit_ns, display_ns, missed);
+    }
+
+    return NULL;
+}
+
+// Keeps the present timing thread off the first window's swapchain while
+// the render thread uses it
+void
+vk_swap_lock(const vk_window_t *win)
+{
+    if(game.present.active && win == &game.vk.windows[0])
+        pthread_mutex_lock(&game.present.swap_lock);
+}
+
+void
+vk_swap_unlock(const vk_window_t *win)
+{
+    if(game.present.active && win == &game.vk.windows[0])
+        pthread_mutex_unlock(&game.present.swap_lock);
+}
+
+#ifdef DEBUG
+
+void
+vk_load_debug_functions(void)
+{
+    game.vk.cmd_begin_label = NULL;
+    game.vk.cmd_end_label = NULL;
+    game.vk.set_object_name = NULL;
+
+    if(!game.vk.debug_utils)
+        return;
+
+    game.vk.cmd_begin_label = 
+                (PFN_vkCmdBeginDebugUtilsLabelEXT)vkGetInstanceProcAddr(
+                                            game.vk.instance,
+                                            "vkCmdBeginDebugUtilsLabelEXT");
+
+    game.vk.cmd_end_label = 
+                (PFN_vkCmdEndDebugUtilsLabelEXT)vkGetInstanceProcAddr(
+                                            game.vk.instance,
+                                            "vkCmdEndDebugUtilsLabelEXT");
+
+    game.vk.set_object_name = 
+                (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(
+                                            game.vk.instance,
+                                            "vkSetDebugUtilsObjectNameEXT");
+}
+
+void
+vk_label_begin(VkCommandBuffer cmd, const char *name)
+{
+    if(game.vk.cmd_begin_label == NULL)
+        return;
+
+    const VkDebugUtilsLabelEXT label = {
+        .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT,
+        .pLabelName = name
+    };
+
+    game.vk.cmd_begin_label(cmd, &label);
+}
+
+void
+vk_label_end(VkCommandBuffer cmd)
+{
+    if(game.vk.cmd_end_label != NULL)
+        game.vk.cmd_end_label(cmd);
+}
+
+void
+vk_set_object_name(VkObjectType type, uint64_t handle, const char *fmt, ...)
+{
+    if(game.vk.set_object_name == NULL)
+        return;
+
+    char name[64];
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(name, sizeof(name), fmt, args);
+    va_end(args);
+
+    const VkDebugUtilsObjectNameInfoEXT info = {
+        .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT,
+        .objectType = type,
+        .objectHandle = handle,
+        .pObjectName = name
+    };
+
+    game.vk.set_object_name(game.vk.device, &info);
+}
+
+#endif
+
+bool
+vk_create_window_surfaces(void)
+{
+    for(unsigned int i = 0; i < game.window.count; i++)
+    {
+        // Set surface info
+        const VkXcbSurfaceCreateInfoKHR info = {
+            .sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR,
+            .connection = game.xcb.connection,
+            .window = game.xcb.windows[i]
+        };
+
+        // Create the surface
+        const VkResult success = vkCreateXcbSurfaceKHR(
+                                                game.vk.instance,
+                                                &info,
+                                                NULL,
+                                                &game.vk.windows[i].surface);
+
+        if(success != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create Vulkan-XCB surface!\n");
+            vk_error_print(success);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+vk_get_queue_families(
+    VkPhysicalDevice device,
+    unsigned int *gp_family,
+    unsigned int *pr_family
+    )
+{
+    // Get queue families
+    unsigned int family_c = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_c, NULL);
+
+    VkQueueFamilyProperties families[family_c];
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_c, families);
+
+    // Look for the graphics and present families
+    bool gp_set, pr_set;
+    gp_set = pr_set = false;
+
+    for(unsigned int i = 0; i < family_c; i++)
+    {
+        if((families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) 
+                                                        && gp_set == false) {
+            gp_set = true;
+            *gp_family = i;
+        }
+
+        VkBool32 supported = false;
+        vkGetPhysicalDeviceSurfaceSupportKHR(device, 
+                                             i, 
+                                             game.vk.windows[0].surface, 
+                                             &supported);
+
+        if(supported) {
+            pr_set = true;
+            *pr_family = i;
+        }
+
+        if(pr_set && gp_set)
+            return true;
+    }
+
+    return false;
+}
+
+// A queue compute can run on next to the graphics queue. A family without
+// graphics is usually hardware of its own, otherwise a second queue in the
+// graphics family still lets the driver interleave the two.
+bool
+vk_get_compute_queue(VkPhysicalDevice device,
+                     unsigned int gp_family,
+                     unsigned int *family,
+                     unsigned int *index)
+{
+    unsigned int family_c = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_c, NULL);
+
+    VkQueueFamilyProperties families[family_c];
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_c, families);
+
+    for(unsigned int i = 0; i < family_c; i++)
+        if((families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+           !(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+            *family = i;
+            *index = 0;
+            return true;
+        }
+
+    *family = gp_family;
+
+    if(families[gp_family].queueCount > 1) {
+        *index = 1;
+        return true;
+    }
+
+    // Nothing spare, it shares the graphics queue
+    *index = 0;
+    return false;
+}
+
+bool
+device_suitable(VkPhysicalDevice device)
+{
+    // Get queue families
+    unsigned int gp_family, pr_family;
+    if(!vk_get_queue_families(device, &gp_family, &pr_family))
+        return false; 
+
+    // Check extention support
+    unsigned int ext_c;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &ext_c, NULL);
+
+    VkExtensionProperties exts[ext_c];
+    vkEnumerateDeviceExtensionProperties(device, NULL, &ext_c, exts);
+
+    bool has[1] = {false};
+
+    for(unsigned int i = 0; i < ext_c; i++)
+        for(unsigned int a = 0; a < VK_dev_ext_c; a++)
+            if(strcmp(exts[i].extensionName, VK_dev_ext[a]) == 0)
+                has[a] = true;
+
+    unsigned int has2 = 0;
+
+    for(unsigned int i = 0; i < VK_dev_ext_c; i++)
+        if(has[i])
+            has2++;
+
+    if(has2 != VK_dev_ext_c)
+        return false;
+
+    // Frames are paced on a timeline semaphore, core since 1.2
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(device, &props);
+
+    if(props.apiVersion < VK_API_VERSION_1_2 ||
+       game.vk.api_version < VK_API_VERSION_1_2)
+        return false;
+
+    VkPhysicalDeviceVulkan12Features features12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+    };
+
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &features12
+    };
 
-                    game.vk.max_frames = 2;
-                }
-            } else {
-                fprintf(stderr, 
-                        "Wasn't given anything, "
-                        "failed to change max frames in flight!\n");
-            }
-        }
-    }
+    vkGetPhysicalDeviceFeatures2(device, &features);
 
-    // Init
-    if(!init()) {
-        clean_up();
-        return -1;
-    }
-    
-    // Wait until we should close
-    while(game.should_close == false)
-    {
-        input();
+    if(!features12.timelineSemaphore)
+        return false;
 
-        if(game.gpu_api == GRAPHICS_API_OPENGL)
-            render_opengl();
-        else if(game.gpu_api == GRAPHICS_API_VULKAN)
-            render_vulkan();
-    }
+    // Check surface formats
+    unsigned int format_c;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, 
+                                         game.vk.windows[0].surface, 
+                                         &format_c, 
+                                         NULL);
 
-    if(game.gpu_api == GRAPHICS_API_VULKAN)
-        vkDeviceWaitIdle(game.vk.device);
-    
-    clean_up();
-    return 0;
-}
+    if(format_c == 0)
+        return false;
 
-// FUNCTIONS //
+    // Check for presentation modes
+    unsigned int mode_c;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device, 
+                                              game.vk.windows[0].surface, 
+                                              &mode_c, 
+                                              NULL);
 
-void
-clean_up(void)
-{
-    fprintf(stdout, "Exiting.\n");
+    if(mode_c == 0)
+        return false;
 
-    if(game.gpu_api == GRAPHICS_API_OPENGL) {
-        glXDestroyWindow(game.xlib.display, game.gl.window);
-        xcb_destroy_window(game.xcb.connection, game.xcb.window);
-        glXDestroyContext(game.xlib.display, game.gl.context);
-        XCloseDisplay(game.xlib.display);
-    } else if(game.gpu_api == GRAPHICS_API_VULKAN) {
+    // Get the format we'll use
+    VkSurfaceFormatKHR formats[format_c];
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, 
+                                         game.vk.windows[0].surface, 
+                                         &format_c, 
+                                         formats);
 
-        for(unsigned int i = 0; i < game.vk.max_frames; i++)
-        {
-            vkDestroyFence(game.vk.device, game.vk.flight[i], NULL);
-            vkDestroySemaphore(game.vk.device, 
-                               game.vk.render_finished[i], 
-                               NULL);
+    bool set = false;
+    for(unsigned int i = 0; i < format_c; i++)
+        if(formats[i].format == VK_FORMAT_B8G8R8A8_SRGB && 
+                formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
 
-            vkDestroySemaphore(game.vk.device, game.vk.img_available[i], NULL);
-        }
+                game.vk.surface_format = formats[i];
+                set = true;
+                break;
+            }
 
-        free(game.vk.flight);
-        free(game.vk.render_finished);
-        free(game.vk.img_available);
+    if(!set)
+        game.vk.surface_format = formats[0];
 
-        vkDestroyCommandPool(game.vk.device, game.vk.cmdpool, NULL);
+    // Get the presentation mode we'll use
+    VkPresentModeKHR modes[mode_c];
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device, 
+                                              game.vk.windows[0].surface, 
+                                              &mode_c, 
+                                              modes);
 
-        for(unsigned int i = 0; i < game.vk.image_c; i++)
-            vkDestroyFramebuffer(game.vk.device, 
-                                 game.vk.framebuffers[i], 
-                                 NULL);
-        
-        free(game.vk.framebuffers);
+    game.vk.surface_mode = vk_pick_present_mode(modes, mode_c);
 
-        vkDestroyPipeline(game.vk.device, game.vk.pipeline, NULL);
-        vkDestroyPipelineLayout(game.vk.device, game.vk.pipeline_layout, NULL);
-        vkDestroyRenderPass(game.vk.device, game.vk.render_pass, NULL);
+    return true;
+}
 
-        for(unsigned int i = 0; i < game.vk.image_c; i++)
-            vkDestroyImageView(game.vk.device, game.vk.views[i], NULL);
-        
-        free(game.vk.views);
-        free(game.vk.images);
+// The first --vsync asks for that's there. FIFO always is.
+VkPresentModeKHR
+vk_pick_present_mode(const VkPresentModeKHR *modes, unsigned int count)
+{
+    VkPresentModeKHR wanted[2] = {
+        VK_PRESENT_MODE_MAILBOX_KHR,
+        VK_PRESENT_MODE_FIFO_KHR
+    };
 
-        vkDestroySwapchainKHR(game.vk.device, game.vk.swap, NULL);
-        vkDestroyDevice(game.vk.device, NULL);
-        vkDestroySurfaceKHR(game.vk.instance, game.vk.surface, NULL);
-        vkDestroyInstance(game.vk.instance, NULL);
+    if(game.vsync.mode == VSYNC_OFF) {
+        wanted[0] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        wanted[1] = VK_PRESENT_MODE_MAILBOX_KHR;
+    } else if(game.vsync.mode == VSYNC_ON) {
+        wanted[0] = VK_PRESENT_MODE_FIFO_KHR;
+    } else if(game.vsync.mode == VSYNC_ADAPTIVE) {
+        wanted[0] = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    }
 
-        xcb_destroy_window(game.xcb.connection, game.xcb.window);
-        xcb_disconnect(game.xcb.connection);
+    for(unsigned int w = 0; w < 2; w++)
+        for(unsigned int i = 0; i < count; i++)
+            if(modes[i] == wanted[w])
+                return wanted[w];
+
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
 
+const char *
+vk_present_mode_name(VkPresentModeKHR mode)
+{
+    switch(mode)
+    {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR:
+            return "no vsync, immediate";
+        case VK_PRESENT_MODE_MAILBOX_KHR:
+            return "vsync, mailbox";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+            return "adaptive vsync, relaxed FIFO";
+        default:
+            return "vsync, FIFO";
     }
 }
 
 bool
-init(void)
+vk_get_physical_device(void)
 {
-    if(game.gpu_api == GRAPHICS_API_OPENGL) {
-        bool success = init_opengl();
-
-        if(!success && !game.gpu_api_is_forced) {
-            fprintf(stdout, "Failed to load OpenGL, using Vulkan!\n");
-            if(!init_vulkan()) {
-                fprintf(stderr, "\nInitialization failed!\n");
-                return false;
-            }
-        } else if(!success) {
-            fprintf(stderr, "\nInitialization failed!\n");
-            return false;
-        }
-    } else if(game.gpu_api == GRAPHICS_API_VULKAN) {
-        bool success = init_vulkan();
+    // Get physical devices
+    unsigned int device_c;
+    vkEnumeratePhysicalDevices(game.vk.instance, &device_c, NULL);
 
-        if(!success && !game.gpu_api_is_forced) {
-            fprintf(stdout, "Failed to load Vulkan, using OpenGL!\n");
-            if(!init_opengl()) {
-                fprintf(stderr, "\nInitialization failed!\n");
-                return false;
-            }
-        } else if(!success) {
-            fprintf(stderr, "\nInitialization failed!\n");
-            return false;
-        }
+    if(device_c == 0) {
+        fprintf(stderr, "No physical device supports Vulkan!\n");
+        return false;
     }
 
-    fprintf(stdout, "Initialization finished.\n");
+    VkPhysicalDevice devices[device_c];
+    vkEnumeratePhysicalDevices(game.vk.instance, &device_c, devices);
+
+    // Find the proper device
+    for( unsigned int i = 0; i < device_c; i++)
+        if(device_suitable(devices[i])) {
+            game.vk.physical_device = devices[i];
+
+            VkPhysicalDeviceProperties props;
+            vkGetPhysicalDeviceProperties(devices[i], &props);
 
-    return true;
+            game.vk.device_version = props.apiVersion;
+            if(game.vk.device_version > game.vk.api_version)
+                game.vk.device_version = game.vk.api_version;
+
+            vkGetPhysicalDeviceMemoryProperties(devices[i],
+                                                &game.vk.memory_props);
+
+            return true;
+        }
+
+    fprintf(stderr, "Failed to find suitable physical device!\n");
+    return false;
 }
 
-void
-input(void)
+bool
+vk_create_logic_device(void)
 {
-    while(true)
+    // Get queue families
+    unsigned int gp_family, pr_family;
+    vk_get_queue_families(game.vk.physical_device, &gp_family, &pr_family);
+
+    game.vk.compute.async = vk_get_compute_queue(game.vk.physical_device,
+                                                 gp_family,
+                                                 &game.vk.compute.family,
+                                                 &game.vk.compute.index);
+
+    // Set queue info, once per family. A second graphics queue for compute
+    // is asked for with the first.
+    const float priorities[2] = {1.0, 1.0};
+    const unsigned int families[3] = {
+        gp_family,
+        pr_family,
+        game.vk.compute.family
+    };
+
+    VkDeviceQueueCreateInfo qinfo[3];
+    unsigned int info_count = 0;
+
+    for(unsigned int i = 0; i < 3; i++)
     {
-        xcb_generic_event_t *event = xcb_poll_for_event(game.xcb.connection);
+        bool listed = false;
 
-        if(event == NULL)
-            break;
+        for(unsigned int j = 0; j < info_count; j++)
+            if(qinfo[j].queueFamilyIndex == families[i])
+                listed = true;
 
-        switch(event->response_type & ~0x80)
-        {
-            // if it's a message about our window 
-            case XCB_CLIENT_MESSAGE:
-            {
-                unsigned int ev = 
-                        (*(xcb_client_message_event_t *)event).data.data32[0];
+        if(listed)
+            continue;
 
-                // if it's the close event
-                if(ev == game.xcb.close_event)
-                    game.should_close = true;
-            }
+        qinfo[info_count++] = (VkDeviceQueueCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = families[i],
+            .queueCount = families[i] == game.vk.compute.family
+                          ? game.vk.compute.index + 1
+                          : 1,
+            .pQueuePriorities = priorities
+        };
+    }
 
-            break;
+    // Set device info
+    const char *ext[VK_dev_ext_c + 3];
+    unsigned int ext_c = VK_dev_ext_c;
 
-            case XCB_CONFIGURE_NOTIFY:
-            {
-                int new_width = (*(xcb_configure_notify_event_t *)event).width;
-                int new_height = 
-                            (*(xcb_configure_notify_event_t *)event).height;
-
-                if(new_height != game.window.height || 
-                   new_width != game.window.width) {
-                    game.window.width = new_width;
-                    game.window.height = new_height;
-
-                    if(game.gpu_api == GRAPHICS_API_OPENGL)
-                        glViewport(0, 0, game.window.width, game.window.height);
-                   } else if(game.gpu_api == GRAPHICS_API_VULKAN) {
-                        if(!vk_recreate_swapchain())
-                            game.should_close = true;
-                   }
-            }
+    for(unsigned int i = 0; i < VK_dev_ext_c; i++)
+        ext[i] = VK_dev_ext[i];
 
-            break;
+    // Optional features go on a chain, so they need features2
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+        .presentWait = VK_TRUE
+    };
+
+    VkPhysicalDevicePresentIdFeaturesKHR present_id = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+        .pNext = &present_wait,
+        .presentId = VK_TRUE
+    };
+
+    VkPhysicalDeviceVulkan13Features features13 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+        .dynamicRendering = VK_TRUE,
+        .synchronization2 = VK_TRUE
+    };
+
+    // Always there, device_suitable() checked
+    VkPhysicalDeviceVulkan12Features features12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .timelineSemaphore = VK_TRUE
+    };
+
+    VkPhysicalDeviceFeatures2 dev_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &features12
+    };
+
+    game.vk.dynamic_rendering = !game.vk.no_dynamic_rendering &&
+                                vk_supports_dynamic_rendering();
+
+    game.dynres.active = game.dynres.enabled &&
+                         vk_supports_dynamic_resolution();
+
+    if(game.vk.dynamic_rendering) {
+        features13.pNext = dev_features.pNext;
+        dev_features.pNext = &features13;
+    }
+
+    game.present.active = false;
+
+    if(game.present.enabled) {
+        if(vk_supports_present_timing()) {
+            ext[ext_c++] = VK_KHR_PRESENT_ID_EXTENSION_NAME;
+            ext[ext_c++] = VK_KHR_PRESENT_WAIT_EXTENSION_NAME;
+            present_wait.pNext = dev_features.pNext;
+            dev_features.pNext = &present_id;
+            game.present.active = true;
+        } else {
+            fprintf(stderr, "VK_KHR_present_wait is unsupported, "
+                            "present timing is disabled!\n");
         }
+    }
+
+    // Lets texture streaming know how much memory it can really have
+    game.vk.memory_budget = vk_has_device_extension(
+                                    game.vk.physical_device,
+                                    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    if(game.vk.memory_budget)
+        ext[ext_c++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+
+    const VkDeviceCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &dev_features,
+        .queueCreateInfoCount = info_count,
+        .pQueueCreateInfos = qinfo,
+        .pEnabledFeatures = NULL,
+        .enabledExtensionCount = ext_c,
+        .ppEnabledExtensionNames = ext,
+        .enabledLayerCount = game.vk.validation ? VK_layer_c : 0,
+        .ppEnabledLayerNames = VK_layer
+    };
+
+    // Create device
+    const VkResult success = vkCreateDevice(game.vk.physical_device, 
+                                            &info, 
+                                            NULL, 
+                                            &game.vk.device);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "failed to create Vulkan Logical device!\n");
+        vk_error_print(success);
+
+        return false;
+    }
 
-        free(event); // Always free your event!
+    // Get the actual queue for each family
+    vkGetDeviceQueue(game.vk.device, gp_family, 0, &game.vk.gp_queue);
+    vkGetDeviceQueue(game.vk.device, pr_family, 0, &game.vk.pr_queue);
+    vkGetDeviceQueue(game.vk.device,
+                     game.vk.compute.family,
+                     game.vk.compute.index,
+                     &game.vk.compute.queue);
+
+    // Core in 1.3, but the loader we linked against may be older
+    if(game.vk.dynamic_rendering) {
+        game.vk.cmd_begin_rendering =
+                    (PFN_vkCmdBeginRendering)vkGetDeviceProcAddr(
+                                            game.vk.device,
+                                            "vkCmdBeginRendering");
+        game.vk.cmd_end_rendering =
+                    (PFN_vkCmdEndRendering)vkGetDeviceProcAddr(
+                                            game.vk.device,
+                                            "vkCmdEndRendering");
+        game.vk.cmd_pipeline_barrier2 =
+                    (PFN_vkCmdPipelineBarrier2)vkGetDeviceProcAddr(
+                                            game.vk.device,
+                                            "vkCmdPipelineBarrier2");
+
+        game.vk.dynamic_rendering = game.vk.cmd_begin_rendering != NULL &&
+                                    game.vk.cmd_end_rendering != NULL &&
+                                    game.vk.cmd_pipeline_barrier2 != NULL;
     }
+
+    fprintf(stdout, "Rendering with %s.\n",
+                    game.vk.dynamic_rendering ? "dynamic rendering"
+                                              : "a render pass");
+
+    // Falls back quietly, this says what it fell back to
+    game.vsync.picked = vk_present_mode_name(game.vk.surface_mode);
+
+    fprintf(stdout, "Presenting with %s.\n", game.vsync.picked);
+
+    return true;
 }
 
-// As far as I could find, there are very few recources on XCB error codes
-// All I can say is look through xproto.h or pray google finds it
-void
-window_error_print(xcb_generic_error_t *error)
+bool
+vk_create_windows(void)
 {
-    if(error == NULL)
-        return;
+    for(unsigned int i = 0; i < game.window.count; i++)
+        if(!vk_create_window(&game.vk.windows[i]))
+            return false;
 
-    const char *names[] = {
-        "XCB_REQUEST",
-        "XCB_VALUE",
-        "XCB_WINDOW",
-        "XCB_PIXMAP",
-        "XCB_ATOM",
-        "XCB_CURSOR",
-        "XCB_FONT",
-        "XCB_MATCH",
-        "XCB_DRAWABLE",
-        "XCB_ACCESS",
-        "XCB_ALLOC",
-        "XCB_COLORMAP",
-        "XCB_G_CONTEXT",
-        "XCB_ID_CHOICE",
-        "XCB_NAME",
-        "XCB_LENGTH",
-        "XCB_IMPLEMENTATION"
-    };
+    return true;
+}
 
-    switch(error->error_code)
-    {
-        case XCB_REQUEST:
-        case XCB_MATCH:
-        case XCB_ACCESS:
-        case XCB_ALLOC:
-        case XCB_NAME:
-        case XCB_LENGTH:
-        case XCB_IMPLEMENTATION:
-            {
-                xcb_request_error_t *er = (xcb_request_error_t *)error;
+// The swapchain and everything sized by it, at the surface's size now
+bool
+vk_create_window(vk_window_t *win)
+{
+    // The device was picked for the first window, the others have to be
+    // presentable from the same queue
+    unsigned int gp_family, pr_family;
+    vk_get_queue_families(game.vk.physical_device, &gp_family, &pr_family);
 
-                fprintf(stderr, "REQUEST ERROR\n"
-                                "%s\n"
-                                "error_code: %d\n"
-                                "major: %d\n"
-                                "minor: %d\n",
-                                names[er->error_code],
-                                er->error_code,
-                                er->major_opcode,
-                                er->minor_opcode);
-            }
-            break;
+    VkBool32 supported = VK_FALSE;
+    vkGetPhysicalDeviceSurfaceSupportKHR(game.vk.physical_device,
+                                         pr_family,
+                                         win->surface,
+                                         &supported);
 
-        case XCB_VALUE:
-        case XCB_WINDOW:
-        case XCB_PIXMAP:
-        case XCB_ATOM:
-        case XCB_CURSOR:
-        case XCB_FONT:
-        case XCB_DRAWABLE:
-        case XCB_COLORMAP:
-        case XCB_G_CONTEXT:
-        case XCB_ID_CHOICE:
-            {
-                xcb_value_error_t *er = (xcb_value_error_t *)error;
+    if(!supported) {
+        fprintf(stderr, "Can't present to every window from one queue!\n");
+        return false;
+    }
 
-                fprintf(stderr, "VALUE ERROR\n"
-                                "%s\n"
-                                "error_code: %d\n"
-                                "major: %d\n"
-                                "minor: %d\n",
-                                names[er->error_code],
-                                er->error_code,
-                                er->major_opcode,
-                                er->minor_opcode);
-            }
-            break;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(game.vk.physical_device,
+                                              win->surface,
+                                              &win->surface_cap);
+
+    win->ex = win->surface_cap.currentExtent;
+    win->image = UINT32_MAX;
+
+    if(
+        !vk_create_swapchain(win)          ||
+        !vk_create_image_views(win)        ||
+        !vk_create_present_semaphores(win) ||
+        !vk_create_image_cmds(win)         ||
+        !vk_create_framebuffers(win)
+    ) {
+        return false;
     }
+
+    // Only the first window is scaled
+    if(win == &game.vk.windows[0] && game.dynres.active)
+        return vk_create_scene_target(win);
+
+    return true;
 }
 
+// Everything vk_create_window() made, the surface stays
+void
+vk_destroy_window(vk_window_t *win)
+{
+    // Dynamic rendering has none
+    if(win->framebuffers != NULL)
+        for(unsigned int i = 0; i < win->image_c; i++)
+            vkDestroyFramebuffer(game.vk.device, win->framebuffers[i], NULL);
+
+    free(win->framebuffers);
+    win->framebuffers = NULL;
+
+    if(win->views != NULL)
+        for(unsigned int i = 0; i < win->image_c; i++)
+            vkDestroyImageView(game.vk.device, win->views[i], NULL);
+
+    free(win->views);
+    free(win->images);
+    win->views = NULL;
+    win->images = NULL;
+
+    vk_destroy_present_semaphores(win);
+    vk_destroy_image_cmds(win);
+
+    if(win == &game.vk.windows[0])
+        vk_destroy_scene_target();
+
+    vkDestroySwapchainKHR(game.vk.device, win->swap, NULL);
+    win->swap = VK_NULL_HANDLE;
+    win->image_c = 0;
+}
+
+// An image the size of the swapchain, the scene only ever uses the top left
+// of it at the render scale. That way changing the scale is free.
 bool
-window_get_close_event(void)
+vk_create_scene_target(const vk_window_t *win)
 {
-    xcb_generic_error_t *error;
+    const VkImageCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = game.vk.surface_format.format,
+        .extent = {
+            .width = win->ex.width,
+            .height = win->ex.height,
+            .depth = 1
+        },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
 
-    // We need to get WM_PROTOCOLS before we can get the close event
-    xcb_intern_atom_cookie_t c_proto = xcb_intern_atom(game.xcb.connection,
-                                                       1, 12,
-                                                       "WM_PROTOCOLS");
-    xcb_intern_atom_reply_t *r_proto = 
-                                    xcb_intern_atom_reply(game.xcb.connection,
-                                                          c_proto,
-                                                          &error);
+    VkResult success = vkCreateImage(game.vk.device,
+                                     &info,
+                                     NULL,
+                                     &game.vk.scene.image);
 
-    // Check for error
-    if(error != NULL)
-    {
-        fprintf(stderr, "Failed to get WM_PROTOCOLS!\n");
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create the scene target!\n");
+        vk_error_print(success);
 
-        window_error_print(error);
+        game.vk.scene.image = VK_NULL_HANDLE;
+        return false;
+    }
 
-        free(error);
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(game.vk.device, game.vk.scene.image, &reqs);
+
+    unsigned int type;
+    if(!vk_find_memory_type(reqs.memoryTypeBits,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            &type)) {
+        fprintf(stderr, "No memory type fits the scene target!\n");
         return false;
     }
 
-    // Get the close event
-    xcb_intern_atom_cookie_t c_close = xcb_intern_atom(game.xcb.connection,
-                                                       0, 16,
-                                                       "WM_DELETE_WINDOW");
-    xcb_intern_atom_reply_t *r_close = 
-                                    xcb_intern_atom_reply(game.xcb.connection,
-                                                          c_close,
-                                                          &error);
+    const VkMemoryAllocateInfo info_a = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = reqs.size,
+        .memoryTypeIndex = type
+    };
 
-    // Check for error
-    if(error != NULL)
-    {
-        fprintf(stderr, "Failed to get WM_DELETE_WINDOW!\n");
+    success = vkAllocateMemory(game.vk.device,
+                               &info_a,
+                               NULL,
+                               &game.vk.scene.memory);
 
-        window_error_print(error);
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to allocate the scene target!\n");
+        vk_error_print(success);
 
-        free(error);
+        game.vk.scene.memory = VK_NULL_HANDLE;
         return false;
     }
 
-    // Enable the close event so we can actually receive it
-    xcb_void_cookie_t cookie = xcb_change_property(game.xcb.connection,
-                                                   XCB_PROP_MODE_REPLACE,
-                                                   game.xcb.window,
-                                                   r_proto->atom,
-                                                   XCB_ATOM_ATOM,
-                                                   32,
-                                                   1,
-                                                   &r_close->atom);
+    vkBindImageMemory(game.vk.device,
+                      game.vk.scene.image,
+                      game.vk.scene.memory,
+                      0);
 
-    error = xcb_request_check(game.xcb.connection, cookie);
+    const VkImageViewCreateInfo info_v = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = game.vk.scene.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = game.vk.surface_format.format,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
 
-    if(error != NULL) {
-        fprintf(stderr, "Failed to get XCB window close event!\n");
+    success = vkCreateImageView(game.vk.device,
+                                &info_v,
+                                NULL,
+                                &game.vk.scene.view);
 
-        window_error_print(error);
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create the scene target's view!\n");
+        vk_error_print(success);
 
-        free(error);
+        game.vk.scene.view = VK_NULL_HANDLE;
         return false;
     }
 
+    // Dynamic rendering draws straight into the view
+    if(!game.vk.dynamic_rendering) {
+        const VkFramebufferCreateInfo info_f = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = game.vk.scene.render_pass,
+            .attachmentCount = 1,
+            .pAttachments = &game.vk.scene.view,
+            .width = win->ex.width,
+            .height = win->ex.height,
+            .layers = 1
+        };
+
+        success = vkCreateFramebuffer(game.vk.device,
+                                      &info_f,
+                                      NULL,
+                                      &game.vk.scene.framebuffer);
 
-    game.xcb.close_event = r_close->atom;
+        if(success != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create the scene framebuffer!\n");
+            vk_error_print(success);
 
-    return true;
-}
+            game.vk.scene.framebuffer = VK_NULL_HANDLE;
+            return false;
+        }
+    }
 
-bool
-init_opengl(void)
-{
-    fprintf(stdout, "Loading game with OpenGL.\n");
+    const VkQueryPoolCreateInfo info_q = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = win->image_c * 2
+    };
+
+    success = vkCreateQueryPool(game.vk.device,
+                                &info_q,
+                                NULL,
+                                &game.vk.scene.queries);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create the scene's query pool!\n");
+        vk_error_print(success);
 
-    if(!window_create_opengl() ||
-       !window_get_close_event())
+        game.vk.scene.queries = VK_NULL_HANDLE;
         return false;
+    }
 
-    glViewport(0, 0, game.window.width, game.window.height);
+    VK_NAME(VK_OBJECT_TYPE_IMAGE, game.vk.scene.image, "Scene target");
+    VK_NAME(VK_OBJECT_TYPE_QUERY_POOL, game.vk.scene.queries, "Scene times");
 
     return true;
 }
 
+// Null handles are fine to destroy, so half made targets are too
 void
-render_opengl()
+vk_destroy_scene_target(void)
+{
+    vkDestroyQueryPool(game.vk.device, game.vk.scene.queries, NULL);
+    vkDestroyFramebuffer(game.vk.device, game.vk.scene.framebuffer, NULL);
+    vkDestroyImageView(game.vk.device, game.vk.scene.view, NULL);
+    vkDestroyImage(game.vk.device, game.vk.scene.image, NULL);
+    vkFreeMemory(game.vk.device, game.vk.scene.memory, NULL);
+
+    game.vk.scene.queries = VK_NULL_HANDLE;
+    game.vk.scene.framebuffer = VK_NULL_HANDLE;
+    game.vk.scene.view = VK_NULL_HANDLE;
+    game.vk.scene.image = VK_NULL_HANDLE;
+    game.vk.scene.memory = VK_NULL_HANDLE;
+}
+
+// Drawn through the scene target rather than into the swapchain
+bool
+vk_window_scaled(const vk_window_t *win)
 {
-    // Clear the buffer
-    glClearColor(0.0, 1.0, 0.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
+    return win == &game.vk.windows[0] &&
+           game.vk.scene.image != VK_NULL_HANDLE;
+}
 
-    // We'd do our drawing here 
+VkExtent2D
+vk_render_extent(const vk_window_t *win)
+{
+    if(!vk_window_scaled(win))
+        return win->ex;
 
-    // Swap buffers
-    glXSwapBuffers(game.xlib.display, game.gl.drawable);
+    return (VkExtent2D){
+        .width = dynres_scale(win->ex.width),
+        .height = dynres_scale(win->ex.height)
+    };
 }
 
-// See https://xcb.freedesktop.org/tutorial/basicwindowsanddrawing/
-// and https://xcb.freedesktop.org/tutorial/events/
-// and https://xcb.freedesktop.org/windowcontextandmanipulation/
 bool
-window_create_opengl(void)
+vk_recreate_swapchain(vk_window_t *win)
 {
-    // Create the connection
-    game.xlib.display = XOpenDisplay(0);
-    if(!game.xlib.display) {
-        fprintf(stderr, "Failed to open X display!\n");
+    uint64_t start = time_ns();
 
-        return false;
-    }
-
-    game.xcb.connection = XGetXCBConnection(game.xlib.display);
+    vkDeviceWaitIdle(game.vk.device);
 
-    if(!game.xcb.connection) {
-        fprintf(stderr, "Failed to create connection to Xorg!\n");
+    // Keep the present timing thread off the swapchain while it's replaced,
+    // it only waits on the first window's
+    if(game.present.active) {
+        pthread_mutex_lock(&game.present.swap_lock);
 
-        return false;
+        if(win == &game.vk.windows[0])
+            game.present.generation++;
     }
 
-    XSetEventQueueOwner(game.xlib.display, XCBOwnsEventQueue);
+    // The image count can change, so everything per image goes too
+    vk_destroy_window(win);
 
-    // Get screen
-    int def_screen = DefaultScreen(game.xlib.display);
+    if(!vk_create_window(win)) {
+        fprintf(stderr, "Failed to recreate framebuffer!\n");
 
-    const xcb_setup_t *setup = xcb_get_setup(game.xcb.connection);
-    xcb_screen_iterator_t iter = xcb_setup_roots_iterator(setup);
-    for(int screen_num = def_screen;
-        iter.rem && screen_num > 0;
-        screen_num--, xcb_screen_next(&iter));
+        if(game.present.active)
+            pthread_mutex_unlock(&game.present.swap_lock);
 
-    xcb_screen_t *screen = iter.data;
+        return false;
+    }
 
-    // Find GL FB
-    int vis_id = 0;
-    int num_fb_configs = 0;
+    if(game.present.active)
+        pthread_mutex_unlock(&game.present.swap_lock);
 
-    const int vis_attribs[] = {
-		GLX_X_RENDERABLE, True,
-		GLX_DRAWABLE_TYPE, GLX_WINDOW_BIT,
-		GLX_RENDER_TYPE, GLX_RGBA_BIT,
-		GLX_X_VISUAL_TYPE, GLX_TRUE_COLOR,
-		GLX_RED_SIZE, 8,
-		GLX_GREEN_SIZE, 8,
-		GLX_BLUE_SIZE, 8,
-		GLX_ALPHA_SIZE, 8,
-		GLX_DEPTH_SIZE, 24,
-		GLX_STENCIL_SIZE, 8,
-		GLX_DOUBLEBUFFER, True,
-	};
+    game.vk.recreates++;
+    game.vk.recreate_ns += time_ns() - start;
 
-    const GLXFBConfig *fb_configs = glXChooseFBConfig(game.xlib.display,
-                                                      def_screen,
-                                                      vis_attribs,
-                                                      &num_fb_configs);
+    return true;
+}
 
-    if(!fb_configs || num_fb_configs == 0) {
-        fprintf(stderr, "Failed to find an OpenGL FB!\n");
+bool
+vk_create_swapchain(vk_window_t *win)
+{
+    // Get image count
+    win->image_c = win->surface_cap.minImageCount + 1;
+    
+    if(win->surface_cap.maxImageCount > 0 && 
+                        win->image_c > win->surface_cap.maxImageCount)
+        win->image_c = win->surface_cap.maxImageCount;
 
-        return false;
+    // Get sharing mode
+    VkSharingMode sharing;
+    unsigned int index_c, gp_family, pr_family;
+    vk_get_queue_families(game.vk.physical_device, &gp_family, &pr_family);
+    unsigned int families[] = {gp_family, gp_family};
+    
+    if(gp_family != pr_family) {
+        sharing = VK_SHARING_MODE_CONCURRENT;
+        index_c = 2;
+    } else {
+        sharing = VK_SHARING_MODE_EXCLUSIVE;
+        index_c = 0;
     }
 
-    GLXFBConfig fb_config = fb_configs[0];
-    glXGetFBConfigAttrib(game.xlib.display, fb_config, GLX_VISUAL_ID, &vis_id);
+    // Captures copy straight out of the first window's swapchain images,
+    // in any 8 bit RGBA or BGRA format
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    VkFormat format = game.vk.surface_format.format;
+
+    if(win == &game.vk.windows[0]) {
+        game.capture.supported =
+                    (win->surface_cap.supportedUsageFlags &
+                     VK_IMAGE_USAGE_TRANSFER_SRC_BIT) &&
+                    (format == VK_FORMAT_B8G8R8A8_SRGB ||
+                     format == VK_FORMAT_B8G8R8A8_UNORM ||
+                     format == VK_FORMAT_R8G8B8A8_SRGB ||
+                     format == VK_FORMAT_R8G8B8A8_UNORM);
+
+        if(game.capture.path != NULL && game.capture.supported)
+            usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+        // Dynamic resolution blits the scene into it
+        if(game.dynres.active &&
+           !(win->surface_cap.supportedUsageFlags &
+             VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+            fprintf(stderr, "Can't blit to the swapchain, "
+                            "dynamic resolution is disabled!\n");
+            game.dynres.active = false;
+        }
 
-    // Create GLX context
+        if(game.dynres.active)
+            usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
+
+    // Set info
+    const VkSwapchainCreateInfoKHR info = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .surface = win->surface,
+        .minImageCount = win->image_c,
+        .imageFormat = game.vk.surface_format.format,
+        .imageColorSpace = game.vk.surface_format.colorSpace,
+        .imageExtent = win->ex,
+        .imageArrayLayers = 1,
+        .imageUsage = usage,
+        .imageSharingMode = sharing,
+        .queueFamilyIndexCount = index_c,
+        .pQueueFamilyIndices = families,
+        .preTransform = win->surface_cap.currentTransform,
+        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+        .presentMode = game.vk.surface_mode,
+        .clipped = VK_TRUE,
+        .oldSwapchain = VK_NULL_HANDLE,
+    };
 
-    game.gl.context = glXCreateNewContext(game.xlib.display,
-                                           fb_config,
-                                           GLX_RGBA_TYPE,
-                                           0,
-                                           True);
+    // Create swapchain
+    VkResult success = vkCreateSwapchainKHR(game.vk.device, 
+                                            &info, 
+                                            NULL, 
+                                            &win->swap);
 
-    if(!game.gl.context) {
-        fprintf(stderr, "Failed to create an OpenGL context!\n");
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create swap chain!\n");
+        vk_error_print(success);
 
         return false;
     }
 
-    // Error data, used later
-    xcb_void_cookie_t cookie;
-    xcb_generic_error_t *error;
+    // Get swapchain images
 
-    // Create colormap
-    xcb_colormap_t colormap = xcb_generate_id(game.xcb.connection);
+    vkGetSwapchainImagesKHR(game.vk.device, 
+                            win->swap, 
+                            &win->image_c, 
+                            NULL);
 
-    cookie = xcb_create_colormap_checked(game.xcb.connection,
-                                         XCB_COLORMAP_ALLOC_NONE,
-                                         colormap,
-                                         screen->root,
-                                         vis_id);
+    win->images = malloc(sizeof(VkImage) * win->image_c);
 
-    error = xcb_request_check(game.xcb.connection, cookie);
+    vkGetSwapchainImagesKHR(game.vk.device, 
+                            win->swap, 
+                            &win->image_c, 
+                            win->images);
 
-    if(error != NULL) {
-        fprintf(stderr, "Failed to create XCB colormap!\n");
+    VK_NAME(VK_OBJECT_TYPE_SWAPCHAIN_KHR,
+            win->swap,
+            "Swapchain %u", (unsigned int)(win - game.vk.windows));
 
-        window_error_print(error);
+    for(unsigned int i = 0; i < win->image_c; i++)
+        VK_NAME(VK_OBJECT_TYPE_IMAGE, 
+                win->images[i], 
+                "Swapchain %u image %u",
+                (unsigned int)(win - game.vk.windows), i);
 
-        free(error);
+    return true;
+}
+
+bool
+vk_create_image_views(vk_window_t *win)
+{
+    // Loop throught all images
+    // Zeroed, so a failure part way leaves nothing to trip over
+    win->views = calloc(win->image_c, sizeof(VkImageView));
+
+    if(win->views == NULL) {
+        fprintf(stderr, "Out of memory!\n");
         return false;
     }
 
-    // Create window
-    game.xcb.window = xcb_generate_id(game.xcb.connection);
-
-    const int eventmask = XCB_EVENT_MASK_EXPOSURE | 
-                          XCB_EVENT_MASK_KEY_PRESS | 
-                          XCB_EVENT_MASK_KEY_RELEASE | 
-                          XCB_EVENT_MASK_BUTTON_PRESS | 
-                          XCB_EVENT_MASK_BUTTON_RELEASE | 
-                          XCB_EVENT_MASK_POINTER_MOTION | 
-                          XCB_EVENT_MASK_BUTTON_MOTION |
-                          XCB_EVENT_MASK_STRUCTURE_NOTIFY;
-
-    const int valwin[] = {eventmask, colormap, 0};
-    const int valmask = XCB_CW_EVENT_MASK | XCB_CW_COLORMAP;
+    for(unsigned int i = 0; i < win->image_c; i++)
+    {   
+        // Set info
+        const VkImageViewCreateInfo info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = win->images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = game.vk.surface_format.format,
 
-    cookie = xcb_create_window_checked(game.xcb.connection,
-                                       XCB_COPY_FROM_PARENT,
-                                       game.xcb.window,
-                                       screen->root,
-                                       0, 0,
-                                       game.window.width, game.window.height,
-                                       10,
-                                       XCB_WINDOW_CLASS_INPUT_OUTPUT,
-                                       screen->root_visual,
-                                       valmask, valwin);
+            .components = {
+                .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .a = VK_COMPONENT_SWIZZLE_IDENTITY
+            },
 
-    error = xcb_request_check(game.xcb.connection, cookie);
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1
+            }
+        };
 
-    if(error != NULL) {
-        fprintf(stderr, "Failed to create XCB window!\n");
+        // Create image view
+        VkResult success = vkCreateImageView(game.vk.device, 
+                                             &info, 
+                                             NULL, 
+                                             &win->views[i]);
 
-        window_error_print(error);
+        if(success != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create image views!\n");
+            vk_error_print(success);
 
-        free(error);
-        return false;
+            return false;
+        }
     }
-    
-    // Map the window
-    cookie = xcb_map_window_checked(game.xcb.connection, game.xcb.window);
 
-    error = xcb_request_check(game.xcb.connection, cookie);
+    return true;
+}
 
-    if(error != NULL) {
-        fprintf(stderr, "Failed to map XCB window!\n");
+bool
+vk_create_render_pass(void)
+{
+    // Pipelines take the attachment formats instead
+    if(game.vk.dynamic_rendering)
+        return true;
 
-        window_error_print(error);
+    // Set info
+    VkAttachmentDescription color = {
+        .format = game.vk.surface_format.format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+    };
 
-        free(error);
-        return false;
-    }
+    const VkAttachmentReference color_ref = {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    };
 
-    // Start GLX
-    game.gl.window = glXCreateWindow(game.xlib.display, 
-                                     fb_config, 
-                                     game.xcb.window, 
-                                     0);
+    const VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_ref
+    };
 
-    if(!game.xcb.window) {
-        fprintf(stderr, "Failed to create XCB window!\n");
-        
-        return false;
-    }
+    const VkSubpassDependency subpass_dep = {
+        .srcSubpass = VK_SUBPASS_EXTERNAL,
+        .dstSubpass = 0,
+        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .srcAccessMask = 0,
+        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+    };
 
-    game.gl.drawable = game.gl.window;
+    const VkRenderPassCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &color,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = 1,
+        .pDependencies = &subpass_dep
+    };
 
-    int success = glXMakeContextCurrent(game.xlib.display,
-                                       game.gl.drawable,
-                                       game.gl.drawable,
-                                       game.gl.context);
+    // Create render pass
+    VkResult success = vkCreateRenderPass(game.vk.device, 
+                                          &info, 
+                                          NULL, 
+                                          &game.vk.render_pass);
 
-    if(!success) {
-        fprintf(stderr, "Failed to make OpenGL current!\n");
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create render pass!\n");
+        vk_error_print(success);
 
         return false;
     }
 
-    // Set the window's name
-    cookie = xcb_change_property_checked(game.xcb.connection,
-                                         XCB_PROP_MODE_REPLACE,
-                                         game.xcb.window,
-                                         XCB_ATOM_WM_NAME,
-                                         XCB_ATOM_STRING,
-                                         8,
-                                         strlen(WN_NAME),
-                                         WN_NAME);
+    VK_NAME(VK_OBJECT_TYPE_RENDER_PASS, 
+            game.vk.render_pass, 
+            "Main render pass");
 
-    error = xcb_request_check(game.xcb.connection, cookie);
+    if(!game.dynres.active)
+        return true;
 
-    if(error != NULL) {
-        fprintf(stderr, "Failed to rename window!\n");
+    // The same again for the scene target, compatible with the pipelines.
+    // It's blitted from after, and the last frame's blit could still be
+    // reading it before.
+    color.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
-        window_error_print(error);
+    const VkSubpassDependency scene_deps[] = {
+        {
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = 0,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            .srcAccessMask = 0,
+            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        },
+        {
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+        }
+    };
+
+    const VkRenderPassCreateInfo info_scene = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &color,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = 2,
+        .pDependencies = scene_deps
+    };
+
+    success = vkCreateRenderPass(game.vk.device,
+                                 &info_scene,
+                                 NULL,
+                                 &game.vk.scene.render_pass);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create the scene render pass!\n");
+        vk_error_print(success);
 
-        free(error);
         return false;
     }
 
+    VK_NAME(VK_OBJECT_TYPE_RENDER_PASS,
+            game.vk.scene.render_pass,
+            "Scene render pass");
+
     return true;
 }
 
 bool
-init_vulkan(void)
+vk_create_graphics_pipeline(void)
 {
-    fprintf(stdout, "Loading game with Vulkan.\n");
+    // The placeholder shaders make their own vertices
+    const VkPipelineVertexInputStateCreateInfo v_input = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 0,
+        .vertexAttributeDescriptionCount = 0,
+    };
+
+    const VkPipelineLayoutCreateInfo layout = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 0,
+        .pushConstantRangeCount = 0
+    };
+
+    // Create pipeline layout
+    VkResult success = vkCreatePipelineLayout(game.vk.device,
+                                              &layout,
+                                              NULL,
+                                              &game.vk.pipeline_layout);
+
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create pipeline layout!\n");
+        vk_error_print(success);
 
-    if(
-        !window_create_vulkan()          ||
-        !window_get_close_event()        ||
-        !vk_supports_validation_layers() ||
-        !vk_create_instance()            ||
-        !vk_create_window_surface()      ||
-        !vk_get_physical_device()        ||
-        !vk_create_logic_device()        ||
-        !vk_create_swapchain()           ||
-        !vk_create_image_views()         ||
-        !vk_create_render_pass()         ||
-        !vk_create_graphics_pipeline()   ||
-        !vk_create_framebuffers()        ||
-        !vk_create_cmd_pool()            ||
-        !vk_create_cmd_buffer()          ||
-        !vk_create_sync_objects()
-    ) {
         return false;
     }
 
+    if(!vk_create_pipeline("shaders/vert.spv",
+                           "shaders/frag.spv",
+                           &v_input,
+                           VK_FRONT_FACE_CLOCKWISE,
+                           game.vk.pipeline_layout,
+                           &game.vk.pipeline))
+        return false;
+
+    VK_NAME(VK_OBJECT_TYPE_PIPELINE, game.vk.pipeline, "Main pipeline");
+
     return true;
 }
 
-void
-render_vulkan(void)
+bool
+vk_create_mesh_pipeline(void)
 {
-    // Wait for previous frame to finish
-    vkWaitForFences(game.vk.device, 
-                    1, 
-                    &game.vk.flight[game.vk.current_frame], 
-                    VK_TRUE, 
-                    UINT64_MAX);
-
-    // See which image we are using
-    unsigned int img_index;
-    VkResult success = vkAcquireNextImageKHR(game.vk.device, 
-                                             game.vk.swap, 
-                                             UINT64_MAX, 
-                                game.vk.img_available[game.vk.current_frame], 
-                                             VK_NULL_HANDLE, 
-                                             &img_index);
-
-    if(success == VK_ERROR_OUT_OF_DATE_KHR) {
-        if(!vk_recreate_swapchain())
-            game.should_close = true;
-        return;
-    } else if(success != VK_SUCCESS && success != VK_SUBOPTIMAL_KHR) {
-        fprintf(stderr, "Failed to get next image!\n");
-        vk_error_print(success);
-    
-        game.should_close = true;
-        return;
-    }
+    // Nothing to draw without --mesh
+    if(!game.mesh.pending)
+        return true;
+
+    const VkVertexInputBindingDescription binding = {
+        .binding = 0,
+        .stride = sizeof(mesh_vertex_t),
+        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+    };
 
-    vkResetFences(game.vk.device, 1, &game.vk.flight[game.vk.current_frame]);
+    // The shaders undo the packing, see mesh.h
+    const VkVertexInputAttributeDescription attributes[] = {
+        {
+            .location = 0,
+            .binding = 0,
+            .format = VK_FORMAT_R16G16B16A16_UNORM,
+            .offset = offsetof(mesh_vertex_t, position)
+        },
+        {
+            .location = 1,
+            .binding = 0,
+            .format = VK_FORMAT_R16G16_SNORM,
+            .offset = offsetof(mesh_vertex_t, normal)
+        },
+        {
+            .location = 2,
+            .binding = 0,
+            .format = VK_FORMAT_R16G16_SFLOAT,
+            .offset = offsetof(mesh_vertex_t, uv)
+        }
+    };
 
-    vkResetCommandBuffer(game.vk.cmdbuffer[game.vk.current_frame], 0);
+    const VkPipelineVertexInputStateCreateInfo v_input = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &binding,
+        .vertexAttributeDescriptionCount = 3,
+        .pVertexAttributeDescriptions = attributes
+    };
 
-    // Command buffer data
-    // This is were we submit our draw calls
+    const VkPushConstantRange push = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(mesh_push_t)
+    };
 
-    const VkCommandBufferBeginInfo info_b = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+    const VkPipelineLayoutCreateInfo layout = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 0,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push
     };
 
-    success = vkBeginCommandBuffer(game.vk.cmdbuffer[game.vk.current_frame], 
-                                   &info_b);
+    VkResult success = vkCreatePipelineLayout(game.vk.device,
+                                              &layout,
+                                              NULL,
+                                              &game.vk.mesh_layout);
 
     if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to begin recording to the command buffer!\n"
-                        "Render failed!\n");
+        fprintf(stderr, "Failed to create the mesh pipeline layout!\n");
         vk_error_print(success);
 
-        game.should_close = true;
-        return;
+        return false;
     }
 
-    const VkClearValue clear_color = {{{0.0f, 1.0f, 0.0f, 1.0f}}};
-    const VkRenderPassBeginInfo info_r = {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .renderPass = game.vk.render_pass,
-        .framebuffer = game.vk.framebuffers[img_index],
-        .renderArea = {
+    // The shaders flip y, so what's counter clockwise stays that way
+    if(!vk_create_pipeline("shaders/mesh_vert.spv",
+                           "shaders/mesh_frag.spv",
+                           &v_input,
+                           VK_FRONT_FACE_COUNTER_CLOCKWISE,
+                           game.vk.mesh_layout,
+                           &game.vk.mesh_pipeline))
+        return false;
 
-            .offset = {
-                .x = 0,
-                .y = 0
-            },
+    VK_NAME(VK_OBJECT_TYPE_PIPELINE, game.vk.mesh_pipeline, "Mesh pipeline");
 
-            .extent = game.vk.ex
-        },
+    // The render thread copies into it on its first frame
+    const mesh_header_t *h = &game.mesh.header;
+    VkDeviceSize size = (VkDeviceSize)h->vertex_count * sizeof(mesh_vertex_t) +
+                        (VkDeviceSize)h->index_count * h->index_size;
 
-        .clearValueCount = 1,
-        .pClearValues = &clear_color
-    };
+    if(!vk_create_buffer(size,
+                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                         &game.vk.mesh_buffer,
+                         &game.vk.mesh_memory))
+        return false;
 
-    vkCmdBeginRenderPass(game.vk.cmdbuffer[game.vk.current_frame], 
-                         &info_r, 
-                         VK_SUBPASS_CONTENTS_INLINE);
+    VK_NAME(VK_OBJECT_TYPE_BUFFER, game.vk.mesh_buffer, "Mesh '%s'",
+            game.mesh.name);
 
-        vkCmdBindPipeline(game.vk.cmdbuffer[game.vk.current_frame], 
-                          VK_PIPELINE_BIND_POINT_GRAPHICS, 
-                          game.vk.pipeline);
-        
-        const VkViewport view = {
-            .x = 0.0f,
-            .y = 0.0f,
-            .width = (float)game.vk.ex.width,
-            .height = (float)game.vk.ex.height,
-            .minDepth = 0.0f,
-            .maxDepth = 1.0f,
-        };
-        vkCmdSetViewport(game.vk.cmdbuffer[game.vk.current_frame], 
-                         0, 
-                         1, 
-                         &view);
+    return true;
+}
 
-        const VkRect2D scissor = {
-            .offset = {
-                .x = 0,
-                .y = 0
-            },
+bool
+vk_create_pipeline(const char *vert_name,
+                   const char *frag_name,
+                   const VkPipelineVertexInputStateCreateInfo *v_input,
+                   VkFrontFace front_face,
+                   VkPipelineLayout layout,
+                   VkPipeline *pipeline)
+{
+    // Create shaders
+    VkShaderModule v_shader, f_shader;
+    asset_t v, f;
 
-            .extent = game.vk.ex,
-        };
-        vkCmdSetScissor(game.vk.cmdbuffer[game.vk.current_frame], 
-                        0, 
-                        1, 
-                        &scissor);
+    if(!asset_load(vert_name, &v))
+        return false;
 
-        vkCmdDraw(game.vk.cmdbuffer[game.vk.current_frame], 0, 0, 0, 0);
+    if(!asset_load(frag_name, &f)) {
+        asset_release(&v);
+        return false;
+    }
 
-    vkCmdEndRenderPass(game.vk.cmdbuffer[game.vk.current_frame]);
+    const VkShaderModuleCreateInfo f_shader_info = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = f.size,
+        .pCode = (const uint32_t *)f.data
+    };
 
-    success = vkEndCommandBuffer(game.vk.cmdbuffer[game.vk.current_frame]);
+    VkResult success = vkCreateShaderModule(game.vk.device, 
+                                            &f_shader_info, 
+                                            NULL, 
+                                            &f_shader);
 
     if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to record command buffer!\n"
-                        "Render failed!\n");
+        fprintf(stderr, "Failed to create fragment shader!\n");
         vk_error_print(success);
 
-        game.should_close = true;
-        return;
+        asset_release(&f);
+        asset_release(&v);
+        return false;
     }
-
-    // Submit the command buffer
-
-    VkSemaphore wait[] = {game.vk.img_available[game.vk.current_frame]};
-    VkPipelineStageFlags waitf[] = 
-                            {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    VkSemaphore signal[] = {game.vk.render_finished[game.vk.current_frame]};
-
-    const VkSubmitInfo info_s = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = wait,
-        .pWaitDstStageMask = waitf,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &game.vk.cmdbuffer[game.vk.current_frame],
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = signal
+
+    const VkShaderModuleCreateInfo v_shader_info = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = v.size,
+        .pCode = (const uint32_t *)v.data
     };
 
-    success = vkQueueSubmit(game.vk.gp_queue, 
-                            1, 
-                            &info_s, 
-                            game.vk.flight[game.vk.current_frame]);
-    
+    success = vkCreateShaderModule(game.vk.device,
+                                   &v_shader_info,
+                                   NULL,
+                                   &v_shader);
+
     if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to submit draw command!\n"
-                        "Render failed!\n");
+        fprintf(stderr, "Failed to create vertex sahder!\n");
         vk_error_print(success);
-        
-        game.should_close = true;
-        return;
+
+        vkDestroyShaderModule(game.vk.device, f_shader, NULL);
+        asset_release(&f);
+        asset_release(&v);
+        return false;
     }
 
-    // Show the image
+    const VkPipelineShaderStageCreateInfo shader_stage[2] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = v_shader,
+            .pName = "main"
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = f_shader,
+            .pName = "main"
+        }
+    };
 
-    VkSwapchainKHR chains[] = {game.vk.swap};
+    // Set fixed functions
+    const VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        .primitiveRestartEnable = VK_FALSE
+    };
 
-    const VkPresentInfoKHR info_p = {
-        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = signal,
-        .swapchainCount = 1,
-        .pSwapchains = chains,
-        .pImageIndices = &img_index
+    const VkPipelineViewportStateCreateInfo view = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1
     };
 
-    success = vkQueuePresentKHR(game.vk.pr_queue, &info_p);
+    const VkPipelineRasterizationStateCreateInfo raster = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .depthClampEnable = VK_FALSE,
+        .rasterizerDiscardEnable = VK_FALSE,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .lineWidth = 1.0f,
+        .cullMode = VK_CULL_MODE_BACK_BIT,
+        .frontFace = front_face,
+        .depthBiasEnable = VK_FALSE
+    };
 
-    if(success == VK_ERROR_OUT_OF_DATE_KHR ||
-       success == VK_SUBOPTIMAL_KHR) {
-        if(!vk_recreate_swapchain())
-            game.should_close = true;
-    } else if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to get next image!\n");
-        vk_error_print(success);
+    const VkPipelineMultisampleStateCreateInfo multi = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .sampleShadingEnable = VK_FALSE,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+    };
 
-        game.should_close = true;
-    }
+    const VkPipelineColorBlendAttachmentState color_at = {
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | 
+                          VK_COLOR_COMPONENT_G_BIT | 
+                          VK_COLOR_COMPONENT_B_BIT | 
+                          VK_COLOR_COMPONENT_A_BIT,
 
-    game.vk.current_frame = (game.vk.current_frame + 1) & game.vk.max_frames;
-}
+        .blendEnable = VK_FALSE
+    };
 
-bool
-window_create_vulkan(void)
-{
-    // Create the connection
-    game.xcb.connection = xcb_connect(NULL, NULL);
+    const VkPipelineColorBlendStateCreateInfo color = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .logicOpEnable = VK_FALSE,
+        .logicOp = VK_LOGIC_OP_COPY,
+        .attachmentCount = 1,
+        .pAttachments = &color_at,
+        .blendConstants = {
+            0.0f,
+            0.0f,
+            0.0f,
+            0.0f
+        }
+    };
 
-    if(!game.xcb.connection) {
-        fprintf(stderr, "Failed to create connection to Xorg!\n");
+    const VkDynamicState dym_states[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+    };
 
-        return false;
-    }
+    const VkPipelineDynamicStateCreateInfo dym = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = 2,
+        .pDynamicStates = dym_states
+    };
 
-    // Error data, used later
-    xcb_void_cookie_t cookie;
-    xcb_generic_error_t *error;
+    // Without a render pass the pipeline needs to know what it draws to
+    const VkPipelineRenderingCreateInfo rendering = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &game.vk.surface_format.format
+    };
 
-    // Get screen
-    const xcb_setup_t *setup = xcb_get_setup(game.xcb.connection);
-    xcb_screen_iterator_t iter = xcb_setup_roots_iterator(setup);
-    xcb_screen_t *screen = iter.data;
+    // Set info
+    const VkGraphicsPipelineCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = game.vk.dynamic_rendering ? &rendering : NULL,
+        .stageCount = 2,
+        .pStages = shader_stage,
+        .pVertexInputState = v_input,
+        .pInputAssemblyState = &input_assembly,
+        .pViewportState = &view,
+        .pRasterizationState = &raster,
+        .pMultisampleState = &multi,
+        .pColorBlendState = &color,
+        .pDynamicState = &dym,
+        .layout = layout,
+        .renderPass = game.vk.render_pass,
+        .subpass = 0,
+        .basePipelineHandle = VK_NULL_HANDLE
+    };
 
-    // Create window
-    const int eventmask = XCB_EVENT_MASK_EXPOSURE | 
-                          XCB_EVENT_MASK_KEY_PRESS | 
-                          XCB_EVENT_MASK_KEY_RELEASE | 
-                          XCB_EVENT_MASK_BUTTON_PRESS | 
-                          XCB_EVENT_MASK_BUTTON_RELEASE | 
-                          XCB_EVENT_MASK_POINTER_MOTION | 
-                          XCB_EVENT_MASK_BUTTON_MOTION |
-                          XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+    // Create graphics pipeline
+    success = vkCreateGraphicsPipelines(game.vk.device,
+                                        VK_NULL_HANDLE,
+                                        1,
+                                        &info,
+                                        NULL, 
+                                        pipeline);
 
-    const int valwin[] = {eventmask, 0};
-    const int valmask = XCB_CW_EVENT_MASK;
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create graphics pipeline!\n");
+        vk_error_print(success);
 
-    game.xcb.window = xcb_generate_id(game.xcb.connection);
+        vkDestroyShaderModule(game.vk.device, v_shader, NULL);
+        vkDestroyShaderModule(game.vk.device, f_shader, NULL);
+        asset_release(&f);
+        asset_release(&v);
+        return false;
+    }
 
-    cookie = xcb_create_window_checked(game.xcb.connection,
-                                       XCB_COPY_FROM_PARENT,
-                                       game.xcb.window,
-                                       screen->root,
-                                       0, 0,
-                                       game.window.width, game.window.height,
-                                       10,
-                                       XCB_WINDOW_CLASS_INPUT_OUTPUT,
-                                       screen->root_visual,
-                                       valmask, valwin);
-    // Check if there was an error
-    error = xcb_request_check(game.xcb.connection, cookie);
+    vkDestroyShaderModule(game.vk.device, v_shader, NULL);
+    vkDestroyShaderModule(game.vk.device, f_shader, NULL);
+    asset_release(&f);
+    asset_release(&v);
 
-    if(error != NULL)
-    {
-        fprintf(stderr, "Failed to create window!\n");
+    return true;
+}
 
-        window_error_print(error);
+bool
+vk_create_compute_pipeline(const char *name,
+                           VkPipelineLayout layout,
+                           VkPipeline *pipeline)
+{
+    VkShaderModule shader;
+    asset_t c;
 
-        free(error);
+    if(!asset_load(name, &c))
         return false;
-    }
-    
-    // Map the window
-    cookie = xcb_map_window_checked(game.xcb.connection, game.xcb.window);
 
-    // Check for error
-    error = xcb_request_check(game.xcb.connection, cookie);
+    const VkShaderModuleCreateInfo shader_info = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = c.size,
+        .pCode = (const uint32_t *)c.data
+    };
 
-    if(error != NULL)
-    {
-        fprintf(stderr, "Failed to map window!\n");
+    VkResult success = vkCreateShaderModule(game.vk.device,
+                                            &shader_info,
+                                            NULL,
+                                            &shader);
 
-        window_error_print(error);
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create compute shader!\n");
+        vk_error_print(success);
 
-        free(error);
+        asset_release(&c);
         return false;
     }
 
-    // Set the window's name
-    cookie = xcb_change_property_checked(game.xcb.connection,
-                                         XCB_PROP_MODE_REPLACE,
-                                         game.xcb.window,
-                                         XCB_ATOM_WM_NAME,
-                                         XCB_ATOM_STRING,
-                                         8,
-                                         strlen(WN_NAME),
-                                         WN_NAME);
+    // No fixed functions, the stage and layout are all there is
+    const VkComputePipelineCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = shader,
+            .pName = "main"
+        },
+        .layout = layout,
+        .basePipelineHandle = VK_NULL_HANDLE
+    };
 
-    // Check for error
-    error = xcb_request_check(game.xcb.connection, cookie);
+    success = vkCreateComputePipelines(game.vk.device,
+                                       VK_NULL_HANDLE,
+                                       1,
+                                       &info,
+                                       NULL,
+                                       pipeline);
 
-    if(error != NULL)
-    {
-        fprintf(stderr, "Failed to rename window!\n");
+    vkDestroyShaderModule(game.vk.device, shader, NULL);
+    asset_release(&c);
 
-        window_error_print(error);
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create compute pipeline!\n");
+        vk_error_print(success);
 
-        free(error);
         return false;
     }
 
     return true;
 }
 
-void
-vk_error_print(VkResult error)
+// The --vk-particles simulation. Nothing draws it yet, it's what the
+// compute queue runs and is timed with.
+bool
+vk_create_particles(void)
 {
-    switch(error)
-    {
-        case VK_ERROR_OUT_OF_HOST_MEMORY:
-            fprintf(stderr, "VK_ERROR_OUT_OF_HOST_MEMORY\n");
-            break;
+    if(game.vk.compute.particles == 0)
+        return true;
 
-        case VK_ERROR_OUT_OF_DEVICE_MEMORY:
-            fprintf(stderr, "VK_ERROR_OUT_OF_DEVICE_MEMORY\n");
-            break;
+    // The most workgroups every device can dispatch in x
+    unsigned int count = game.vk.compute.particles;
 
-        case VK_ERROR_INITIALIZATION_FAILED:
-            fprintf(stderr, "VK_ERROR_INITIALIZATION_FAILED\n");
-            break;
+    if(count > 65535u * PARTICLE_GROUP) {
+        count = 65535u * PARTICLE_GROUP;
+        fprintf(stderr, "Too many particles, simulating %u!\n", count);
+    }
 
-        case VK_ERROR_DEVICE_LOST:
-            fprintf(stderr, "VK_ERROR_DEVICE_LOST\n");
-            break;
+    // What one step reads and what it writes
+    const VkDescriptorSetLayoutBinding bindings[2] = {
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+        }
+    };
 
-        case VK_ERROR_MEMORY_MAP_FAILED:
-            fprintf(stderr, "VK_ERROR_MEMORY_MAP_FAILED\n");
-            break;
+    const VkDescriptorSetLayoutCreateInfo info_l = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindings = bindings
+    };
 
-        case VK_ERROR_LAYER_NOT_PRESENT:
-            fprintf(stderr, "VK_ERROR_LAYER_NOT_PRESENT\n");
-            break;
+    VkResult success = vkCreateDescriptorSetLayout(
+                                            game.vk.device,
+                                            &info_l,
+                                            NULL,
+                                            &game.vk.compute.set_layout);
 
-        case VK_ERROR_EXTENSION_NOT_PRESENT:
-            fprintf(stderr, "VK_ERROR_EXTENSION_NOT_PRESENT\n");
-            break;
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create the particle set layout!\n");
+        vk_error_print(success);
 
-        case VK_ERROR_FEATURE_NOT_PRESENT:
-            fprintf(stderr, "VK_ERROR_FEATURE_NOT_PRESENT\n");
-            break;
+        return false;
+    }
 
-        case VK_ERROR_INCOMPATIBLE_DRIVER:
-            fprintf(stderr, "VK_ERROR_FEATURE_NOT_PRESENT\n");
-            break;
+    const VkPushConstantRange push = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(particle_push_t)
+    };
 
-        case VK_ERROR_TOO_MANY_OBJECTS:
-            fprintf(stderr, "VK_ERROR_TOO_MANY_OBJECTS\n");
-            break;
+    const VkPipelineLayoutCreateInfo layout = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &game.vk.compute.set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push
+    };
 
-        case VK_ERROR_FORMAT_NOT_SUPPORTED:
-            fprintf(stderr, "VK_ERROR_FORMAT_NOT_SUPPORTED\n");
-            break;
+    success = vkCreatePipelineLayout(game.vk.device,
+                                     &layout,
+                                     NULL,
+                                     &game.vk.compute.layout);
 
-        case VK_ERROR_FRAGMENTED_POOL:
-            fprintf(stderr, "VK_ERROR_FRAGMENTED_POOL\n");
-            break;
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create the particle pipeline layout!\n");
+        vk_error_print(success);
+
+        return false;
+    }
 
-        case VK_ERROR_UNKNOWN:
-            fprintf(stderr, "VK_ERROR_UNKNOWN\n");
-            break;
+    if(!vk_create_compute_pipeline("shaders/particles_comp.spv",
+                                   game.vk.compute.layout,
+                                   &game.vk.compute.pipeline))
+        return false;
 
-        case VK_ERROR_OUT_OF_POOL_MEMORY:
-            fprintf(stderr, "VK_ERROR_OUT_OF_POOL_MEMORY\n");
-            break;
+    VK_NAME(VK_OBJECT_TYPE_PIPELINE, game.vk.compute.pipeline,
+            "Particle pipeline");
 
-        case VK_ERROR_INVALID_EXTERNAL_HANDLE:
-            fprintf(stderr, "VK_ERROR_INVALID_EXTERNAL_HANDLE\n");
-            break;
+    // Only ever used by one queue family at a time. Drawing them while
+    // compute runs on a family of its own would need concurrent sharing.
+    VkDeviceSize size = (VkDeviceSize)count * PARTICLE_SIZE;
 
-        case VK_ERROR_FRAGMENTATION:
-            fprintf(stderr, "VK_ERROR_FRAGMENTATION\n");
-            break;
+    for(unsigned int i = 0; i < 2; i++)
+    {
+        if(!vk_create_buffer(size,
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             &game.vk.compute.buffers[i],
+                             &game.vk.compute.memory[i]))
+            return false;
 
-        case VK_ERROR_INVALID_OPAQUE_CAPTURE_ADDRESS:
-            fprintf(stderr, "VK_ERROR_INVALID_OPAQUE_CAPTURE_ADDRESS\n");
-            break;
+        VK_NAME(VK_OBJECT_TYPE_BUFFER, game.vk.compute.buffers[i],
+                "Particles %u", i);
+    }
 
-        case VK_ERROR_SURFACE_LOST_KHR:
-            fprintf(stderr, "VK_ERROR_SURFACE_LOST_KHR\n");
-            break;
+    const VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 4
+    };
 
-        case VK_ERROR_NATIVE_WINDOW_IN_USE_KHR:
-            fprintf(stderr, "VK_ERROR_NATIVE_WINDOW_IN_USE_KHR\n");
-            break;
+    const VkDescriptorPoolCreateInfo info_p = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 2,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size
+    };
 
-        case VK_ERROR_OUT_OF_DATE_KHR:
-            fprintf(stderr, "VK_ERROR_OUT_OF_DATE_KHR\n");
-            break;
+    success = vkCreateDescriptorPool(game.vk.device,
+                                     &info_p,
+                                     NULL,
+                                     &game.vk.compute.descriptor_pool);
 
-        case VK_ERROR_INCOMPATIBLE_DISPLAY_KHR:
-            fprintf(stderr, "VK_ERROR_INCOMPATIBLE_DISPLAY_KHR\n");
-            break;
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create the particle descriptor pool!\n");
+        vk_error_print(success);
 
-        case VK_ERROR_VALIDATION_FAILED_EXT:
-            fprintf(stderr, "VK_ERROR_VALIDATION_FAILED_EXT\n");
-            break;
+        return false;
+    }
 
-        case VK_ERROR_INVALID_SHADER_NV:
-            fprintf(stderr, "VK_ERROR_INVALID_SHADER_NV\n");
-            break;
+    const VkDescriptorSetLayout set_layouts[2] = {
+        game.vk.compute.set_layout,
+        game.vk.compute.set_layout
+    };
 
-#ifdef VK_ENABLE_BETA_EXTENSIONS
+    const VkDescriptorSetAllocateInfo info_a = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = game.vk.compute.descriptor_pool,
+        .descriptorSetCount = 2,
+        .pSetLayouts = set_layouts
+    };
 
-        case VK_ERROR_IMAGE_USAGE_NOT_SUPPORTED_KHR:
-            fprintf(stderr, "VK_ERROR_IMAGE_USAGE_NOT_SUPPORTED_KHR\n");
-            break;
+    success = vkAllocateDescriptorSets(game.vk.device,
+                                       &info_a,
+                                       game.vk.compute.sets);
 
-        case VK_ERROR_VIDEO_PICTURE_LAYOUT_NOT_SUPPORTED_KHR:
-            fprintf(stderr, 
-                    "VK_ERROR_VIDEO_PICTURE_LAYOUT_NOT_SUPPORTED_KHR\n");
-            break;
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to allocate the particle sets!\n");
+        vk_error_print(success);
 
-        case VK_ERROR_VIDEO_PROFILE_OPERATION_NOT_SUPPORTED_KHR:
-            fprintf(stderr, 
-                    "VK_ERROR_VIDEO_PROFILE_OPERATION_NOT_SUPPORTED_KHR\n");
-            break;
+        return false;
+    }
 
-        case VK_ERROR_VIDEO_PROFILE_FORMAT_NOT_SUPPORTED_KHR:
-            fprintf(stderr, 
-                    "VK_ERROR_VIDEO_PROFILE_FORMAT_NOT_SUPPORTED_KHR\n");
-            break;
+    // Set i reads buffer i and writes the other
+    for(unsigned int i = 0; i < 2; i++)
+    {
+        const VkDescriptorBufferInfo buffers[2] = {
+            {
+                .buffer = game.vk.compute.buffers[i],
+                .offset = 0,
+                .range = VK_WHOLE_SIZE
+            },
+            {
+                .buffer = game.vk.compute.buffers[1 - i],
+                .offset = 0,
+                .range = VK_WHOLE_SIZE
+            }
+        };
 
-        case VK_ERROR_VIDEO_PROFILE_FORMAT_NOT_SUPPORTED_KHR:
-            fprintf(stderr, 
-                    "VK_ERROR_VIDEO_PROFILE_CODEC_NOT_SUPPORTED_KHR\n");
-            break;
+        VkWriteDescriptorSet writes[2];
 
-        case VK_ERROR_VIDEO_STD_VERSION_NOT_SUPPORTED_KHR:
-            fprintf(stderr, "VK_ERROR_VIDEO_STD_VERSION_NOT_SUPPORTED_KHR\n");
-            break;
+        for(unsigned int j = 0; j < 2; j++)
+            writes[j] = (VkWriteDescriptorSet){
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = game.vk.compute.sets[i],
+                .dstBinding = j,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &buffers[j]
+            };
 
-#endif
+        vkUpdateDescriptorSets(game.vk.device, 2, writes, 0, NULL);
+    }
 
-        case VK_ERROR_INVALID_DRM_FORMAT_MODIFIER_PLANE_LAYOUT_EXT:
-            fprintf(stderr, 
-                    "VK_ERROR_INVALID_DRM_FORMAT_MODIFIER_PLANE_LAYOUT_EXT\n");
-            break;
+    const VkSemaphoreTypeCreateInfo info_t = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0
+    };
 
-        case VK_ERROR_NOT_PERMITTED_KHR:
-            fprintf(stderr, "VK_ERROR_NOT_PERMITTED_KHR\n");
-            break;
+    const VkSemaphoreCreateInfo info_s = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &info_t
+    };
 
-        case VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT:
-            fprintf(stderr, "VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT\n");
-            break;
+    success = vkCreateSemaphore(game.vk.device,
+                                &info_s,
+                                NULL,
+                                &game.vk.compute.timeline);
 
-        case VK_ERROR_COMPRESSION_EXHAUSTED_EXT:
-            fprintf(stderr, "VK_ERROR_COMPRESSION_EXHAUSTED_EXT\n");
-            break;
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create the compute timeline semaphore!\n");
+        vk_error_print(success);
 
-        default:
-            break;
+        return false;
     }
-}
 
-void
-vk_read_file(const char *file_name, size_t *size, char **out)
-{
-    // Open the file and make sure it opened
-    FILE *file = fopen(file_name, "rb");
-    if(file == NULL) {
-        fprintf(stderr, "File '%s' failed to open!\n"
-                        "%s\n", 
-                        file_name, strerror(errno));
+    VK_NAME(VK_OBJECT_TYPE_SEMAPHORE, game.vk.compute.timeline,
+            "Compute timeline");
 
-        return;
+    // On the graphics queue the steps go in the frame's slot buffer
+    if(game.vk.compute.async) {
+        const VkCommandPoolCreateInfo info_c = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = game.vk.compute.family
+        };
+
+        success = vkCreateCommandPool(game.vk.device,
+                                      &info_c,
+                                      NULL,
+                                      &game.vk.compute.pool);
+
+        if(success != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create the compute command pool!\n");
+            vk_error_print(success);
+
+            return false;
+        }
+
+        if(!vk_alloc_compute_cmds(0, game.vk.frame_slots))
+            return false;
     }
 
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    size_t file_size = ftell(file);
+    game.vk.compute.count = count;
+    game.vk.compute.frame = 0;
+    game.vk.compute.value = 0;
+    game.vk.compute.last_ns = 0;
 
-    // Read the file
-    *out = malloc(sizeof(char) * file_size);
-    fseek(file, 0, SEEK_SET);
+    const char *queue = "the graphics queue, there's no other";
 
-    fread(*out, sizeof(char) * file_size, 1, file);
+    if(game.vk.compute.async)
+        queue = game.vk.compute.on_graphics ? "the graphics queue"
+              : game.vk.compute.index > 0   ? "a second graphics queue"
+                                            : "a compute queue";
 
-    // Close it
-    fclose(file);
+    fprintf(stdout, "Simulating %u particles on %s.\n", count, queue);
 
-    *size = file_size;
+    return true;
 }
 
-bool
-vk_supports_validation_layers(void)
+void
+vk_destroy_particles(void)
 {
-    // Get layers
-    unsigned int layer_c;
-    vkEnumerateInstanceLayerProperties(&layer_c, NULL);
-
-    VkLayerProperties layers[layer_c];
-    vkEnumerateInstanceLayerProperties(&layer_c, layers);
+    // The pools free the command buffers and sets
+    vkDestroyCommandPool(game.vk.device, game.vk.compute.pool, NULL);
+    free(game.vk.compute.cmds);
+    free(game.vk.compute.values);
+
+    vkDestroySemaphore(game.vk.device, game.vk.compute.timeline, NULL);
+    vkDestroyDescriptorPool(game.vk.device,
+                            game.vk.compute.descriptor_pool,
+                            NULL);
 
-    // Look for needed layers
-    for(unsigned int i = 0; i < layer_c; i++)
-        if(strcmp(layers[i].layerName, VK_layer[0]) == 0)
-            return true;
+    vkDestroyPipeline(game.vk.device, game.vk.compute.pipeline, NULL);
+    vkDestroyPipelineLayout(game.vk.device, game.vk.compute.layout, NULL);
+    vkDestroyDescriptorSetLayout(game.vk.device,
+                                 game.vk.compute.set_layout,
+                                 NULL);
 
-    fprintf(stderr, "Vulkan does not support validation layers!\n");
+    for(unsigned int i = 0; i < 2; i++)
+    {
+        vkDestroyBuffer(game.vk.device, game.vk.compute.buffers[i], NULL);
+        vkFreeMemory(game.vk.device, game.vk.compute.memory[i], NULL);
+    }
 
-    return false;
-    
+    // The options and the queue outlive the particles
+    unsigned int particles = game.vk.compute.particles;
+    bool on_graphics = game.vk.compute.on_graphics;
+    bool async = game.vk.compute.async;
+    unsigned int family = game.vk.compute.family;
+    unsigned int index = game.vk.compute.index;
+    VkQueue queue = game.vk.compute.queue;
+
+    memset(&game.vk.compute, 0, sizeof(game.vk.compute));
+
+    game.vk.compute.particles = particles;
+    game.vk.compute.on_graphics = on_graphics;
+    game.vk.compute.async = async;
+    game.vk.compute.family = family;
+    game.vk.compute.index = index;
+    game.vk.compute.queue = queue;
 }
 
 bool
-vk_create_instance(void)
+vk_alloc_compute_cmds(unsigned int first, unsigned int count)
 {
-    // Set app info
-    const VkApplicationInfo pinfo = {
-        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-        .pApplicationName = WN_NAME,
-        .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
-        .pEngineName = "None",
-        .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-        .apiVersion = VK_API_VERSION_1_0
-    };
+    VkCommandBuffer *cmds = realloc(game.vk.compute.cmds,
+                                    sizeof(VkCommandBuffer) * (first + count));
+    uint64_t *values = realloc(game.vk.compute.values,
+                               sizeof(uint64_t) * (first + count));
+
+    // Whatever did get moved is still valid, so keep it
+    if(cmds != NULL)
+        game.vk.compute.cmds = cmds;
+    if(values != NULL)
+        game.vk.compute.values = values;
+
+    if(cmds == NULL || values == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        return false;
+    }
 
-    // Set instance info
-    const VkInstanceCreateInfo info = {
-        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-        .pApplicationInfo = &pinfo,
-        .enabledExtensionCount = VK_ext_c,
-        .ppEnabledExtensionNames = VK_ext,
-        .enabledLayerCount = VK_layer_c,
-        .ppEnabledLayerNames = VK_layer
+    const VkCommandBufferAllocateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = game.vk.compute.pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = count
     };
 
-    // Create vulkan instance
-    VkResult success = vkCreateInstance(&info, NULL, &game.vk.instance);
+    VkResult success = vkAllocateCommandBuffers(game.vk.device,
+                                                &info,
+                                                &game.vk.compute.cmds[first]);
 
     if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create instance!\n");
+        fprintf(stderr, "Failed to create command buffer!\n");
         vk_error_print(success);
 
         return false;
     }
 
+    for(unsigned int i = first; i < first + count; i++)
+    {
+        game.vk.compute.values[i] = 0;
+
+        VK_NAME(VK_OBJECT_TYPE_COMMAND_BUFFER,
+                game.vk.compute.cmds[i],
+                "Compute command buffer %u", i);
+    }
+
     return true;
 }
 
+// One step of the simulation, into either queue's command buffer
+void
+vk_record_particles(VkCommandBuffer cmd)
+{
+    bool async = game.vk.compute.async && !game.vk.compute.on_graphics;
+
+    // The step before wrote what this one reads. On the graphics queue the
+    // draws before this read what it overwrites and the draws after read
+    // what the step before wrote. A queue of its own has the semaphores
+    // for that, and no vertex stage to name.
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    if(!async)
+        stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+
+    const VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+    };
+
+    vkCmdPipelineBarrier(cmd,
+                         stages,
+                         stages,
+                         0,
+                         1, &barrier,
+                         0, NULL,
+                         0, NULL);
+
+    // Clamped, or a long stall would throw everything across the screen
+    uint64_t now = time_ns();
+    double dt = 0.0;
+
+    if(game.vk.compute.last_ns != 0)
+        dt = (double)(now - game.vk.compute.last_ns) / 1e9;
+
+    if(dt > 0.1)
+        dt = 0.1;
+
+    game.vk.compute.last_ns = now;
+
+    const particle_push_t push = {
+        .dt = (float)dt,
+        .count = game.vk.compute.count,
+        .steps = PARTICLE_STEPS,
+        .reset = game.vk.compute.frame == 0
+    };
+
+    const VkDescriptorSet *set =
+                        &game.vk.compute.sets[game.vk.compute.frame % 2];
+
+    VK_LABEL(cmd, "Particles")
+    {
+        vkCmdBindPipeline(cmd,
+                          VK_PIPELINE_BIND_POINT_COMPUTE,
+                          game.vk.compute.pipeline);
+
+        vkCmdBindDescriptorSets(cmd,
+                                VK_PIPELINE_BIND_POINT_COMPUTE,
+                                game.vk.compute.layout,
+                                0,
+                                1, set,
+                                0, NULL);
+
+        vkCmdPushConstants(cmd,
+                           game.vk.compute.layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           sizeof(particle_push_t),
+                           &push);
+
+        vkCmdDispatch(cmd,
+                      (game.vk.compute.count + PARTICLE_GROUP - 1) /
+                      PARTICLE_GROUP,
+                      1,
+                      1);
+    }
+
+    game.vk.compute.frame++;
+}
+
+// Starts this frame's step on the compute queue. It waits for the last
+// frame's draws, which read what it's about to overwrite, and this frame's
+// draws wait for the step before it, so each frame's step and draws run
+// side by side.
 bool
-vk_create_window_surface(void)
+vk_submit_particles(void)
 {
-    // Set surface info
-    const VkXcbSurfaceCreateInfoKHR info = {
-        .sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR,
-        .connection = game.xcb.connection,
-        .window = game.xcb.window
+    unsigned int slot = game.vk.current_frame;
+    VkCommandBuffer cmd = game.vk.compute.cmds[slot];
+
+    // The slot's last frame is done, but its draws only waited for the
+    // step before the one it submitted
+    if(game.vk.compute.values[slot] != 0) {
+        const VkSemaphoreWaitInfo info_w = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores = &game.vk.compute.timeline,
+            .pValues = &game.vk.compute.values[slot]
+        };
+
+        vkWaitSemaphores(game.vk.device, &info_w, UINT64_MAX);
+    }
+
+    vkResetCommandBuffer(cmd, 0);
+
+    const VkCommandBufferBeginInfo info_b = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
     };
 
-    // Create the surface
-    const VkResult success = vkCreateXcbSurfaceKHR(game.vk.instance, 
-                                                   &info, 
-                                                   NULL, 
-                                                   &game.vk.surface);
+    VkResult success = vkBeginCommandBuffer(cmd, &info_b);
 
     if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create Vulkan-XCB surface!\n");
+        fprintf(stderr, "Failed to begin recording the particles!\n");
         vk_error_print(success);
 
         return false;
     }
 
-    return true;
-}
+    vk_record_particles(cmd);
 
-bool
-vk_get_queue_families(
-    VkPhysicalDevice device,
-    unsigned int *gp_family,
-    unsigned int *pr_family
-    )
-{
-    // Get queue families
-    unsigned int family_c = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_c, NULL);
+    success = vkEndCommandBuffer(cmd);
 
-    VkQueueFamilyProperties families[family_c];
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_c, families);
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to record the particles!\n");
+        vk_error_print(success);
 
-    // Look for the graphics and present families
-    bool gp_set, pr_set;
-    gp_set = pr_set = false;
+        return false;
+    }
 
-    for(unsigned int i = 0; i < family_c; i++)
-    {
-        if((families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) 
-                                                        && gp_set == false) {
-            gp_set = true;
-            *gp_family = i;
-        }
+    // The last frame submitted is the one reading what this writes
+    const uint64_t wait_value = game.vk.timeline_value;
+    const uint64_t signal_value = game.vk.compute.value + 1;
+    const VkPipelineStageFlags waitf = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    const VkTimelineSemaphoreSubmitInfo info_t = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = 1,
+        .pWaitSemaphoreValues = &wait_value,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &signal_value
+    };
 
-        VkBool32 supported = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, 
-                                             i, 
-                                             game.vk.surface, 
-                                             &supported);
+    const VkSubmitInfo info_s = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &info_t,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &game.vk.timeline,
+        .pWaitDstStageMask = &waitf,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &game.vk.compute.timeline
+    };
 
-        if(supported) {
-            pr_set = true;
-            *pr_family = i;
-        }
+    success = vkQueueSubmit(game.vk.compute.queue, 1, &info_s, VK_NULL_HANDLE);
 
-        if(pr_set && gp_set)
-            return true;
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to submit the particles!\n");
+        vk_error_print(success);
+
+        return false;
     }
 
-    return false;
+    game.vk.compute.value = signal_value;
+    game.vk.compute.values[slot] = signal_value;
+
+    return true;
 }
 
 bool
-device_suitable(VkPhysicalDevice device)
+vk_create_framebuffers(vk_window_t *win)
 {
-    // Get queue families
-    unsigned int gp_family, pr_family;
-    if(!vk_get_queue_families(device, &gp_family, &pr_family))
-        return false; 
+    // Dynamic rendering draws straight into the image views
+    if(game.vk.dynamic_rendering)
+        return true;
 
-    // Check extention support
-    unsigned int ext_c;
-    vkEnumerateDeviceExtensionProperties(device, NULL, &ext_c, NULL);
+    // Loop through the framebuffers
+    win->framebuffers = calloc(win->image_c, sizeof(VkFramebuffer));
 
-    VkExtensionProperties exts[ext_c];
-    vkEnumerateDeviceExtensionProperties(device, NULL, &ext_c, exts);
+    if(win->framebuffers == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        return false;
+    }
 
-    bool has[1] = {false};
+    for(unsigned int i = 0; i < win->image_c; i++)
+    {
+        // Set info
+        const VkImageView attach[] = {
+            win->views[i]
+        };
 
-    for(unsigned int i = 0; i < ext_c; i++)
-        for(unsigned int a = 0; a < VK_dev_ext_c; a++)
-            if(strcmp(exts[i].extensionName, VK_dev_ext[a]) == 0)
-                has[a] = true;
+        const VkFramebufferCreateInfo info = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = game.vk.render_pass,
+            .attachmentCount = 1,
+            .pAttachments = attach,
+            .width = win->ex.width,
+            .height = win->ex.height,
+            .layers = 1
+        };
 
-    unsigned int has2 = 0;
+        // Create framebuffer
+        VkResult success = vkCreateFramebuffer(game.vk.device, 
+                                               &info, 
+                                               NULL, 
+                                               &win->framebuffers[i]);
 
-    for(unsigned int i = 0; i < VK_dev_ext_c; i++)
-        if(has[i])
-            has2++;
+        if(success != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create framebuffer!\n");
+            vk_error_print(success);
 
-    if(has2 != VK_dev_ext_c)
-        return false;
+            return false;
+        }
+    }
 
-    // Check swapchain support
-    VkSurfaceCapabilitiesKHR sr_cap;
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, 
-                                              game.vk.surface, 
-                                              &sr_cap);
+    return true;
+}
 
-    // Check surface formats
-    unsigned int format_c;
-    vkGetPhysicalDeviceSurfaceFormatsKHR(device, 
-                                         game.vk.surface, 
-                                         &format_c, 
-                                         NULL);
+void
+vk_begin_rendering(VkCommandBuffer cmd,
+                   const vk_window_t *win,
+                   const VkClearValue *clear)
+{
+    bool scaled = vk_window_scaled(win);
 
-    if(format_c == 0)
-        return false;
+    const VkRect2D area = {
+        .offset = {
+            .x = 0,
+            .y = 0
+        },
 
-    // Check for presentation modes
-    unsigned int mode_c;
-    vkGetPhysicalDeviceSurfacePresentModesKHR(device, 
-                                              game.vk.surface, 
-                                              &mode_c, 
-                                              NULL);
+        .extent = vk_render_extent(win)
+    };
 
-    if(mode_c == 0)
-        return false;
+    if(!game.vk.dynamic_rendering) {
+        const VkRenderPassBeginInfo info = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = scaled ? game.vk.scene.render_pass
+                                 : game.vk.render_pass,
+            .framebuffer = scaled ? game.vk.scene.framebuffer
+                                  : win->framebuffers[win->image],
+            .renderArea = area,
+            .clearValueCount = 1,
+            .pClearValues = clear
+        };
 
-    game.vk.surface_cap = sr_cap;
+        vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_INLINE);
+        return;
+    }
 
-    // Get the format we'll use
-    VkSurfaceFormatKHR formats[format_c];
-    vkGetPhysicalDeviceSurfaceFormatsKHR(device, 
-                                         game.vk.surface, 
-                                         &format_c, 
-                                         formats);
+    // The old contents are cleared anyway, so don't keep them. The last
+    // frame's blit could still be reading the scene target.
+    if(scaled)
+        vk_image_barrier(cmd,
+                         game.vk.scene.image,
+                         VK_IMAGE_LAYOUT_UNDEFINED,
+                         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+    else
+        vk_swapchain_barrier(cmd,
+                             win,
+                             VK_IMAGE_LAYOUT_UNDEFINED,
+                             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                             VK_ACCESS_2_NONE,
+                             VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+
+    const VkRenderingAttachmentInfo color = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = scaled ? game.vk.scene.view : win->views[win->image],
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = *clear
+    };
 
-    bool set = false;
-    for(unsigned int i = 0; i < format_c; i++)
-        if(formats[i].format == VK_FORMAT_B8G8R8A8_SRGB && 
-                formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+    const VkRenderingInfo info = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .renderArea = area,
+        .layerCount = 1,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color
+    };
 
-                game.vk.surface_format = formats[i];
-                set = true;
-                break;
-            }
+    game.vk.cmd_begin_rendering(cmd, &info);
+}
 
-    if(!set)
-        game.vk.surface_format = formats[0];
+void
+vk_end_rendering(VkCommandBuffer cmd, const vk_window_t *win)
+{
+    bool scaled = vk_window_scaled(win);
 
-    // Get the presentation mode we'll use
-    VkPresentModeKHR modes[mode_c];
-    vkGetPhysicalDeviceSurfacePresentModesKHR(device, 
-                                              game.vk.surface, 
-                                              &mode_c, 
-                                              modes);
+    if(!game.vk.dynamic_rendering) {
+        vkCmdEndRenderPass(cmd);
+    } else {
+        game.vk.cmd_end_rendering(cmd);
+
+        // The scene render pass ends with this itself
+        if(scaled)
+            vk_image_barrier(cmd,
+                             game.vk.scene.image,
+                             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                             VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_ACCESS_TRANSFER_READ_BIT);
+        else
+            // Leave it how the render pass would have, captures expect that
+            vk_swapchain_barrier(cmd,
+                                 win,
+                                 VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                 VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                                 VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                                 VK_ACCESS_2_NONE);
+    }
 
-    set = false;
-    for(unsigned int i = 0; i < mode_c; i++)
-        if(modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
-            game.vk.surface_mode = modes[i];
-            set = true;
+    if(scaled)
+        vk_blit_scene(cmd, win);
+}
 
-            break;
-        }
+// Stretches the scene target's render scale corner over the whole
+// swapchain image, filtered
+void
+vk_blit_scene(VkCommandBuffer cmd, const vk_window_t *win)
+{
+    VkExtent2D from = vk_render_extent(win);
+    VkImage image = win->images[win->image];
+
+    // From where acquiring waits, and all of it is written so the old
+    // contents can go
+    vk_image_barrier(cmd,
+                     image,
+                     VK_IMAGE_LAYOUT_UNDEFINED,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                     0,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+                     VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    const VkImageSubresourceLayers layers = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .mipLevel = 0,
+        .baseArrayLayer = 0,
+        .layerCount = 1
+    };
 
-    if(!set)
-        game.vk.surface_mode = VK_PRESENT_MODE_FIFO_KHR;
-    
-    game.vk.ex = game.vk.surface_cap.currentExtent;
+    const VkImageBlit blit = {
+        .srcSubresource = layers,
+        .srcOffsets = {
+            {0, 0, 0},
+            {(int32_t)from.width, (int32_t)from.height, 1}
+        },
+        .dstSubresource = layers,
+        .dstOffsets = {
+            {0, 0, 0},
+            {(int32_t)win->ex.width, (int32_t)win->ex.height, 1}
+        }
+    };
 
-    return true;
+    vkCmdBlitImage(cmd,
+                   game.vk.scene.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   image,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   1,
+                   &blit,
+                   VK_FILTER_LINEAR);
+
+    // Ready to present. Ends on the color output stage like a render pass
+    // would, so a capture's barrier chains on from it the same way.
+    vk_image_barrier(cmd,
+                     image,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+                     VK_ACCESS_TRANSFER_WRITE_BIT,
+                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                     0);
 }
 
-bool
-vk_get_physical_device(void)
+// A whole color image, on either rendering path
+void
+vk_image_barrier(VkCommandBuffer cmd,
+                 VkImage image,
+                 VkImageLayout old_layout,
+                 VkImageLayout new_layout,
+                 VkPipelineStageFlags src_stage,
+                 VkAccessFlags src_access,
+                 VkPipelineStageFlags dst_stage,
+                 VkAccessFlags dst_access)
 {
-    // Get physical devices
-    unsigned int device_c;
-    vkEnumeratePhysicalDevices(game.vk.instance, &device_c, NULL);
-
-    if(device_c == 0) {
-        fprintf(stderr, "No physical device supports Vulkan!\n");
-        return false;
-    }
+    const VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
 
-    VkPhysicalDevice devices[device_c];
-    vkEnumeratePhysicalDevices(game.vk.instance, &device_c, devices);
+    vkCmdPipelineBarrier(cmd,
+                         src_stage,
+                         dst_stage,
+                         0,
+                         0, NULL,
+                         0, NULL,
+                         1, &barrier);
+}
 
-    // Find the proper device
-    for( unsigned int i = 0; i < device_c; i++)
-        if(device_suitable(devices[i])) {
-            game.vk.physical_device = devices[i];
-            return true;
+void
+vk_swapchain_barrier(VkCommandBuffer cmd,
+                     const vk_window_t *win,
+                     VkImageLayout old_layout,
+                     VkImageLayout new_layout,
+                     VkAccessFlags2 src_access,
+                     VkAccessFlags2 dst_access)
+{
+    // Both sides are the color output stage. Acquiring waits there, and a
+    // capture's barrier after this one chains on to it from there.
+    const VkImageMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .srcAccessMask = src_access,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .dstAccessMask = dst_access,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = win->images[win->image],
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
         }
+    };
 
-    fprintf(stderr, "Failed to find suitable physical device!\n");
-    return false;
+    const VkDependencyInfo info = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &barrier
+    };
+
+    game.vk.cmd_pipeline_barrier2(cmd, &info);
 }
 
 bool
-vk_create_logic_device(void)
+vk_create_cmd_pool(void)
 {
-    // Get queue families
+    // Get queue families and set info
     unsigned int gp_family, pr_family;
     vk_get_queue_families(game.vk.physical_device, &gp_family, &pr_family);
 
-    // Set queue info
-    const float priority = 1.0;
-    const VkDeviceQueueCreateInfo qinfo[2] = {
-        {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = gp_family,
-            .queueCount = 1,
-            .pQueuePriorities = &priority
-        },
-        {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = pr_family,
-            .queueCount = 1,
-            .pQueuePriorities = &priority
-        }
-    };
-
-    // Set device info
-    const VkPhysicalDeviceFeatures dev_features = {};
-
-    int info_count = 2;
-    if(gp_family == pr_family)
-        info_count = 1;
-
-    const VkDeviceCreateInfo info = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .queueCreateInfoCount = info_count,
-        .pQueueCreateInfos = qinfo,
-        .pEnabledFeatures = &dev_features,
-        .enabledExtensionCount = VK_dev_ext_c,
-        .ppEnabledExtensionNames = VK_dev_ext,
-        .enabledLayerCount = VK_layer_c,
-        .ppEnabledLayerNames = VK_layer
+    const VkCommandPoolCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = gp_family
     };
 
-    // Create device
-    const VkResult success = vkCreateDevice(game.vk.physical_device, 
-                                            &info, 
-                                            NULL, 
-                                            &game.vk.device);
+    // Create the command pool
+    VkResult success = vkCreateCommandPool(game.vk.device, 
+                                           &info, 
+                                           NULL, 
+                                           &game.vk.cmdpool);
 
     if(success != VK_SUCCESS) {
-        fprintf(stderr, "failed to create Vulkan Logical device!\n");
+        fprintf(stderr, "Failed to create command pool!\n");
         vk_error_print(success);
 
         return false;
     }
 
-    // Get the actual queue for each family
-    vkGetDeviceQueue(game.vk.device, gp_family, 0, &game.vk.gp_queue);
-    vkGetDeviceQueue(game.vk.device, pr_family, 0, &game.vk.pr_queue);
-
     return true;
 }
 
 bool
-vk_recreate_swapchain()
+vk_create_cmd_buffer(void)
 {
-    vkDeviceWaitIdle(game.vk.device);
+    game.vk.cmdbuffer = malloc(sizeof(VkCommandBuffer) * game.vk.max_frames);
+
+    return vk_alloc_cmd_buffers(0, game.vk.max_frames);
+}
+
+bool
+vk_create_sync_objects(void)
+{
+    const VkSemaphoreTypeCreateInfo info_t = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0
+    };
+
+    const VkSemaphoreCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &info_t
+    };
 
-    // Clean up old swapchain
-    for(unsigned int i = 0; i < game.vk.image_c; i++)
-        vkDestroyFramebuffer(game.vk.device, game.vk.framebuffers[i], NULL);
+    VkResult success = vkCreateSemaphore(game.vk.device,
+                                         &info,
+                                         NULL,
+                                         &game.vk.timeline);
 
-    free(game.vk.framebuffers);
+    if(success != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create the timeline semaphore!\n");
+        vk_error_print(success);
 
-    for(unsigned int i = 0; i < game.vk.image_c; i++)
-        vkDestroyImageView(game.vk.device, game.vk.views[i], NULL);
+        return false;
+    }
 
-    free(game.vk.views);
+    VK_NAME(VK_OBJECT_TYPE_SEMAPHORE, game.vk.timeline, "Frame timeline");
 
-    vkDestroySwapchainKHR(game.vk.device, game.vk.swap, NULL);
+    game.vk.timeline_value = 0;
 
-    // Create new swapchain
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(game.vk.physical_device, 
-                                              game.vk.surface, 
-                                              &game.vk.surface_cap);
+    // 0 is where the timeline starts, so slots that never ran don't wait.
+    // Every window acquires with its own semaphore.
+    game.vk.img_available = malloc(sizeof(VkSemaphore) *
+                                   game.vk.max_frames * game.window.count);
+    game.vk.frame_values = calloc(game.vk.max_frames, sizeof(uint64_t));
 
-    game.vk.ex = game.vk.surface_cap.currentExtent;
-    
-    if(
-        !vk_create_swapchain()   ||
-        !vk_create_image_views() ||
-        !vk_create_framebuffers()
-    ) {
-        fprintf(stderr, "Failed to recreate framebuffer!\n");
+    if(game.vk.img_available == NULL || game.vk.frame_values == NULL) {
+        fprintf(stderr, "Out of memory!\n");
         return false;
     }
 
+    if(!vk_create_frame_sync(0, game.vk.max_frames))
+        return false;
+
+    game.vk.frame_slots = game.vk.max_frames;
+
     return true;
 }
 
 bool
-vk_create_swapchain(void)
+vk_create_present_semaphores(vk_window_t *win)
 {
-    // Get image count
-    game.vk.image_c = game.vk.surface_cap.minImageCount + 1;
-    
-    if(game.vk.surface_cap.maxImageCount > 0 && 
-                        game.vk.image_c > game.vk.surface_cap.maxImageCount)
-        game.vk.image_c = game.vk.surface_cap.maxImageCount;
+    // One per image, a slot's semaphore could still be waited on by a
+    // present of another image
+    win->render_finished = calloc(win->image_c, sizeof(VkSemaphore));
 
-    // Get sharing mode
-    VkSharingMode sharing;
-    unsigned int index_c, gp_family, pr_family;
-    vk_get_queue_families(game.vk.physical_device, &gp_family, &pr_family);
-    unsigned int families[] = {gp_family, gp_family};
-    
-    if(gp_family != pr_family) {
-        sharing = VK_SHARING_MODE_CONCURRENT;
-        index_c = 2;
-    } else {
-        sharing = VK_SHARING_MODE_EXCLUSIVE;
-        index_c = 0;
+    if(win->render_finished == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        return false;
     }
 
-    // Set info
-    const VkSwapchainCreateInfoKHR info = {
-        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-        .surface = game.vk.surface,
-        .minImageCount = game.vk.image_c,
-        .imageFormat = game.vk.surface_format.format,
-        .imageColorSpace = game.vk.surface_format.colorSpace,
-        .imageExtent = game.vk.ex,
-        .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-        .imageSharingMode = sharing,
-        .queueFamilyIndexCount = index_c,
-        .pQueueFamilyIndices = families,
-        .preTransform = game.vk.surface_cap.currentTransform,
-        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-        .presentMode = game.vk.surface_mode,
-        .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE,
+    const VkSemaphoreCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
     };
 
-    // Create swapchain
-    VkResult success = vkCreateSwapchainKHR(game.vk.device, 
-                                            &info, 
-                                            NULL, 
-                                            &game.vk.swap);
+    for(unsigned int i = 0; i < win->image_c; i++)
+    {
+        VkResult success = vkCreateSemaphore(game.vk.device,
+                                             &info,
+                                             NULL,
+                                             &win->render_finished[i]);
 
-    if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create swap chain!\n");
-        vk_error_print(success);
+        if(success != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create semaphore!\n");
+            vk_error_print(success);
 
-        return false;
+            return false;
+        }
     }
 
-    // Get swapchain images
-
-    vkGetSwapchainImagesKHR(game.vk.device, 
-                            game.vk.swap, 
-                            &game.vk.image_c, 
-                            NULL);
-
-    game.vk.images = malloc(sizeof(VkImage) * game.vk.image_c);
+    return true;
+}
 
-    vkGetSwapchainImagesKHR(game.vk.device, 
-                            game.vk.swap, 
-                            &game.vk.image_c, 
-                            game.vk.images);
+void
+vk_destroy_present_semaphores(vk_window_t *win)
+{
+    // Anything left out is VK_NULL_HANDLE, which is fine to destroy
+    if(win->render_finished != NULL)
+        for(unsigned int i = 0; i < win->image_c; i++)
+            vkDestroySemaphore(game.vk.device,
+                               win->render_finished[i],
+                               NULL);
 
-    return true;
+    free(win->render_finished);
+    win->render_finished = NULL;
 }
 
 bool
-vk_create_image_views(void)
+vk_create_image_cmds(vk_window_t *win)
 {
-    // Loop throught all images
-    game.vk.views = malloc(sizeof(VkImageView) * game.vk.image_c);
-
-    for(unsigned int i = 0; i < game.vk.image_c; i++)
-    {   
-        // Set info
-        const VkImageViewCreateInfo info = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            .image = game.vk.images[i],
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = game.vk.surface_format.format,
+    // Nothing is recorded yet, frame 0 never matches
+    win->image_cmds = calloc(win->image_c, sizeof(vk_image_cmd_t));
 
-            .components = {
-                .r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                .a = VK_COMPONENT_SWIZZLE_IDENTITY
-            },
+    if(win->image_cmds == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        return false;
+    }
 
-            .subresourceRange = {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .baseMipLevel = 0,
-                .levelCount = 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1
-            }
+    for(unsigned int i = 0; i < win->image_c; i++)
+    {
+        const VkCommandBufferAllocateInfo info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = game.vk.cmdpool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1
         };
 
-        // Create image view
-        VkResult success = vkCreateImageView(game.vk.device, 
-                                             &info, 
-                                             NULL, 
-                                             &game.vk.views[i]);
+        VkResult success = vkAllocateCommandBuffers(game.vk.device,
+                                                    &info,
+                                                    &win->image_cmds[i].cmd);
 
         if(success != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create image views!\n");
+            fprintf(stderr, "Failed to create command buffer!\n");
             vk_error_print(success);
 
             return false;
         }
+
+        VK_NAME(VK_OBJECT_TYPE_COMMAND_BUFFER,
+                win->image_cmds[i].cmd,
+                "Image command buffer %u", i);
     }
 
     return true;
 }
 
-bool
-vk_create_render_pass(void)
+void
+vk_destroy_image_cmds(vk_window_t *win)
 {
-    // Set info
-    const VkAttachmentDescription color = {
-        .format = game.vk.surface_format.format,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-    };
+    // Freeing VK_NULL_HANDLE is fine, so half made arrays are too
+    if(win->image_cmds != NULL)
+        for(unsigned int i = 0; i < win->image_c; i++)
+            vkFreeCommandBuffers(game.vk.device,
+                                 game.vk.cmdpool,
+                                 1,
+                                 &win->image_cmds[i].cmd);
+
+    free(win->image_cmds);
+    win->image_cmds = NULL;
+}
 
-    const VkAttachmentReference color_ref = {
-        .attachment = 0,
-        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+// Blocks until the GPU has signalled value, 0 never blocks
+VkResult
+vk_timeline_wait(uint64_t value, uint64_t timeout)
+{
+    if(value == 0)
+        return VK_SUCCESS;
+
+    const VkSemaphoreWaitInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &game.vk.timeline,
+        .pValues = &value
     };
 
-    const VkSubpassDescription subpass = {
-        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-        .colorAttachmentCount = 1,
-        .pColorAttachments = &color_ref
-    };
+    return vkWaitSemaphores(game.vk.device, &info, timeout);
+}
 
-    const VkSubpassDependency subpass_dep = {
-        .srcSubpass = VK_SUBPASS_EXTERNAL,
-        .dstSubpass = 0,
-        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .srcAccessMask = 0,
-        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
-    };
+uint64_t
+vk_timeline_completed(void)
+{
+    uint64_t value = 0;
 
-    const VkRenderPassCreateInfo info = {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-        .attachmentCount = 1,
-        .pAttachments = &color,
-        .subpassCount = 1,
-        .pSubpasses = &subpass,
-        .dependencyCount = 1,
-        .pDependencies = &subpass_dep
+    if(vkGetSemaphoreCounterValue(game.vk.device,
+                                  game.vk.timeline,
+                                  &value) != VK_SUCCESS)
+        return 0;
+
+    return value;
+}
+
+bool
+vk_alloc_cmd_buffers(unsigned int first, unsigned int count)
+{
+    // Set info
+    const VkCommandBufferAllocateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = game.vk.cmdpool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = count
     };
 
-    // Create render pass
-    VkResult success = vkCreateRenderPass(game.vk.device, 
-                                          &info, 
-                                          NULL, 
-                                          &game.vk.render_pass);
+    // Create command buffer
+    VkResult success = vkAllocateCommandBuffers(game.vk.device, 
+                                                &info, 
+                                                &game.vk.cmdbuffer[first]);
 
     if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create render pass!\n");
+        fprintf(stderr, "Failed to create command buffer!\n");
         vk_error_print(success);
 
         return false;
     }
 
+    for(unsigned int i = first; i < first + count; i++)
+        VK_NAME(VK_OBJECT_TYPE_COMMAND_BUFFER, 
+                game.vk.cmdbuffer[i], 
+                "Frame command buffer %u", i);
+
     return true;
 }
 
 bool
-vk_create_graphics_pipeline(void)
+vk_create_frame_sync(unsigned int first, unsigned int count)
 {
-    // Create shaders
-    VkShaderModule v_shader, f_shader;
-    size_t v_size, f_size;
-    char *f = NULL; 
-    char *v = NULL;
+    // Set info
+    const VkSemaphoreCreateInfo info_s = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+    };
 
-    vk_read_file("shaders/vert.spv", &v_size, &v);
-    vk_read_file("shaders/frag.spv", &f_size, &f);
+    // Acquiring still needs a binary semaphore, one per window
+    unsigned int window_c = game.window.count;
 
-    if(v == NULL || f == NULL)
-        return false;
+    for(unsigned int i = first * window_c; i < (first + count) * window_c; i++)
+    {
+        VkResult success = vkCreateSemaphore(game.vk.device, 
+                                            &info_s, 
+                                            NULL, 
+                                            &game.vk.img_available[i]);
+        
+        if(success != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create semaphore!\n");
+            vk_error_print(success);
 
-    const VkShaderModuleCreateInfo f_shader_info = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = f_size,
-        .pCode = (unsigned int *)f
-    };
+            return false;
+        }
+    }
 
-    VkResult success = vkCreateShaderModule(game.vk.device, 
-                                            &f_shader_info, 
-                                            NULL, 
-                                            &f_shader);
+    for(unsigned int i = first; i < first + count; i++)
+        game.vk.frame_values[i] = 0;
 
-    if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create fragment shader!\n");
-        vk_error_print(success);
+    return true;
+}
 
-        free(f);
-        free(v);
+bool
+vk_add_frame_slot(void)
+{
+    unsigned int slot = game.vk.frame_slots;
+
+    // Grow every per frame array by one
+    VkCommandBuffer *cmdbuffer = realloc(game.vk.cmdbuffer, 
+                                         sizeof(VkCommandBuffer) * (slot + 1));
+    VkSemaphore *img_available = realloc(game.vk.img_available, 
+                                         sizeof(VkSemaphore) * (slot + 1) *
+                                         game.window.count);
+    uint64_t *frame_values = realloc(game.vk.frame_values,
+                                     sizeof(uint64_t) * (slot + 1));
+
+    // Whatever did get moved is still valid, so keep it
+    if(cmdbuffer != NULL)
+        game.vk.cmdbuffer = cmdbuffer;
+    if(img_available != NULL)
+        game.vk.img_available = img_available;
+    if(frame_values != NULL)
+        game.vk.frame_values = frame_values;
+
+    if(!cmdbuffer || !img_available || !frame_values) {
+        fprintf(stderr, "Failed to grow frames in flight!\n");
         return false;
     }
 
-    const VkShaderModuleCreateInfo v_shader_info = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = v_size,
-        .pCode = (unsigned int *)v
-    };
-
-    success = vkCreateShaderModule(game.vk.device,
-                                   &v_shader_info,
-                                   NULL,
-                                   &v_shader);
+    // Compute's come out of its own pool, which frees them either way
+    if(game.vk.compute.pool != VK_NULL_HANDLE &&
+       !vk_alloc_compute_cmds(slot, 1))
+        return false;
 
-    if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create vertex sahder!\n");
-        vk_error_print(success);
+    // The new slot hasn't submitted anything, so nothing waits on it
+    if(!vk_alloc_cmd_buffers(slot, 1))
+        return false;
 
-        vkDestroyShaderModule(game.vk.device, f_shader, NULL);
-        free(f);
-        free(v);
+    if(!vk_create_frame_sync(slot, 1)) {
+        vkFreeCommandBuffers(game.vk.device, 
+                             game.vk.cmdpool, 
+                             1, 
+                             &game.vk.cmdbuffer[slot]);
         return false;
     }
 
-    const VkPipelineShaderStageCreateInfo shader_stage[2] = {
-        {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .stage = VK_SHADER_STAGE_VERTEX_BIT,
-            .module = v_shader,
-            .pName = "main"
-        },
-        {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-            .module = f_shader,
-            .pName = "main"
+    game.vk.frame_slots++;
+
+    return true;
+}
+
+// Frees the slots past max_frames from the top down, each once the GPU is
+// done with the last frame it submitted. Retired resources are already
+// released by the timeline, what's left is the slot's own.
+void
+vk_trim_frame_slots(void)
+{
+    if(game.vk.frame_slots <= game.vk.max_frames)
+        return;
+
+    uint64_t completed = vk_timeline_completed();
+    uint64_t compute_completed = 0;
+    bool compute = game.vk.compute.pool != VK_NULL_HANDLE;
+
+    if(compute && vkGetSemaphoreCounterValue(game.vk.device,
+                                             game.vk.compute.timeline,
+                                             &compute_completed) != VK_SUCCESS)
+        return;
+
+    while(game.vk.frame_slots > game.vk.max_frames)
+    {
+        unsigned int slot = game.vk.frame_slots - 1;
+
+        if(game.vk.frame_values[slot] > completed ||
+           (compute && game.vk.compute.values[slot] > compute_completed))
+            return;
+
+        vkFreeCommandBuffers(game.vk.device,
+                             game.vk.cmdpool,
+                             1,
+                             &game.vk.cmdbuffer[slot]);
+
+        if(compute)
+            vkFreeCommandBuffers(game.vk.device,
+                                 game.vk.compute.pool,
+                                 1,
+                                 &game.vk.compute.cmds[slot]);
+
+        VkSemaphore *img_available =
+                &game.vk.img_available[slot * game.window.count];
+
+        for(unsigned int i = 0; i < game.window.count; i++)
+            vkDestroySemaphore(game.vk.device, img_available[i], NULL);
+
+        // Staging buffers are made as slots first use them, so the last
+        // one there is this slot's
+        if(slot < game.vk.staging_c) {
+            vkDestroyBuffer(game.vk.device,
+                            game.vk.staging[slot].buffer,
+                            NULL);
+            vkFreeMemory(game.vk.device, game.vk.staging[slot].memory, NULL);
+
+            game.vk.staging_c = slot;
         }
-    };
 
-    // Set fixed functions
-    const VkPipelineVertexInputStateCreateInfo v_input = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 0,
-        .vertexAttributeDescriptionCount = 0,
-    };
+        // The arrays keep their size, growing again reallocates anyway
+        game.vk.frame_slots--;
+    }
+}
 
-    const VkPipelineInputAssemblyStateCreateInfo input_assembly = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-        .primitiveRestartEnable = VK_FALSE
-    };
+void
+vk_set_frames_in_flight(unsigned int frames, const char *reason)
+{
+    // A dropped slot might still be in flight, so it's only freed later by
+    // vk_trim_frame_slots(). Its timeline value keeps it safe if it gets
+    // picked up again before that.
+    while(game.vk.frame_slots < frames)
+        if(!vk_add_frame_slot())
+            return;
 
-    const VkPipelineViewportStateCreateInfo view = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-        .viewportCount = 1,
-        .scissorCount = 1
-    };
+    fprintf(stdout, "Frames in flight %u -> %u (%s).\n", 
+                    game.vk.max_frames, frames, reason);
 
-    const VkPipelineRasterizationStateCreateInfo raster = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-        .depthClampEnable = VK_FALSE,
-        .rasterizerDiscardEnable = VK_FALSE,
-        .polygonMode = VK_POLYGON_MODE_FILL,
-        .lineWidth = 1.0f,
-        .cullMode = VK_CULL_MODE_BACK_BIT,
-        .frontFace = VK_FRONT_FACE_CLOCKWISE,
-        .depthBiasEnable = VK_FALSE
-    };
+    game.vk.max_frames = frames;
 
-    const VkPipelineMultisampleStateCreateInfo multi = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-        .sampleShadingEnable = VK_FALSE,
-        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
-    };
+    if(game.vk.current_frame >= game.vk.max_frames)
+        game.vk.current_frame = 0;
+}
 
-    const VkPipelineColorBlendAttachmentState color_at = {
-        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | 
-                          VK_COLOR_COMPONENT_G_BIT | 
-                          VK_COLOR_COMPONENT_B_BIT | 
-                          VK_COLOR_COMPONENT_A_BIT,
+void
+vk_adapt_frames_in_flight(uint64_t wait_ns)
+{
+    // How many frames go into each decision
+    const unsigned int window = 120;
 
-        .blendEnable = VK_FALSE
-    };
+    uint64_t now = time_ns();
 
-    const VkPipelineColorBlendStateCreateInfo color = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-        .logicOpEnable = VK_FALSE,
-        .logicOp = VK_LOGIC_OP_COPY,
-        .attachmentCount = 1,
-        .pAttachments = &color_at,
-        .blendConstants = {
-            0.0f,
-            0.0f,
-            0.0f,
-            0.0f
+    if(game.vk.adapt.last_frame != 0) {
+        game.vk.adapt.frame_ns += now - game.vk.adapt.last_frame;
+        game.vk.adapt.wait_ns += wait_ns;
+        game.vk.adapt.samples++;
+    }
+
+    game.vk.adapt.last_frame = now;
+
+    if(game.vk.adapt.samples < window)
+        return;
+
+    double frame = (double)game.vk.adapt.frame_ns / window;
+    double wait = (double)game.vk.adapt.wait_ns / window;
+
+    game.vk.adapt.frame_ns = game.vk.adapt.wait_ns = 0;
+    game.vk.adapt.samples = 0;
+
+    unsigned int frames = game.vk.max_frames;
+
+    // Judge the last change, keep it only if it didn't cost frame rate
+    if(game.vk.adapt.trial_frame_ns > 0.0) {
+        double before = game.vk.adapt.trial_frame_ns;
+        game.vk.adapt.trial_frame_ns = 0.0;
+
+        if(game.vk.adapt.last_change < 0 && frame > before * 1.05) {
+            // Shrinking starved the GPU, go back and stay there for a while
+            vk_set_frames_in_flight(frames + 1, "starved the GPU, undo");
+
+            game.vk.adapt.cooldown = 10;
+            return;
         }
-    };
 
-    const VkDynamicState dym_states[] = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR
-    };
+        if(game.vk.adapt.last_change > 0 && frame > before * 0.95) {
+            // Growing didn't help, we're GPU bound and it only adds latency
+            vk_set_frames_in_flight(frames - 1, "no gain, undo");
+
+            game.vk.adapt.cooldown = 10;
+            return;
+        }
+
+        fprintf(stdout, "Frames in flight %u kept (%.3f -> %.3f ms).\n", 
+                        frames, before / 1e6, frame / 1e6);
+    }
+
+    if(game.vk.adapt.cooldown > 0) {
+        game.vk.adapt.cooldown--;
+        return;
+    }
+
+    if(wait < frame * 0.05 && frames > game.vk.adapt.min) {
+        // The oldest frame was done before we needed it, that frame of
+        // buffering is only latency
+        game.vk.adapt.trial_frame_ns = frame;
+        game.vk.adapt.last_change = -1;
+        vk_set_frames_in_flight(frames - 1, "frame was already done");
+    } else if(wait > frame * 0.25 && frames < game.vk.adapt.max) {
+        // We stall on the GPU, maybe it's idle while we record
+        game.vk.adapt.trial_frame_ns = frame;
+        game.vk.adapt.last_change = 1;
+        vk_set_frames_in_flight(frames + 1, "stalled on the GPU");
+    }
+}
+
+bool
+vk_find_memory_type(uint32_t type_bits,
+                    VkMemoryPropertyFlags flags,
+                    unsigned int *type)
+{
+    const VkPhysicalDeviceMemoryProperties *props = &game.vk.memory_props;
+
+    for(unsigned int i = 0; i < props->memoryTypeCount; i++)
+        if((type_bits & (1u << i)) &&
+           (props->memoryTypes[i].propertyFlags & flags) == flags) {
+            *type = i;
+            return true;
+        }
 
-    const VkPipelineDynamicStateCreateInfo dym = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-        .dynamicStateCount = 2,
-        .pDynamicStates = dym_states
-    };
+    return false;
+}
 
-    const VkPipelineLayoutCreateInfo layout = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 0,
-        .pushConstantRangeCount = 0
+bool
+vk_create_buffer(VkDeviceSize size,
+                 VkBufferUsageFlags usage,
+                 VkMemoryPropertyFlags flags,
+                 VkBuffer *buffer,
+                 VkDeviceMemory *memory)
+{
+    const VkBufferCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
     };
 
-    // Create pipeline layout
-    success = vkCreatePipelineLayout(game.vk.device, 
-                                     &layout, 
-                                     NULL, 
-                                     &game.vk.pipeline_layout);
+    VkResult success = vkCreateBuffer(game.vk.device, &info, NULL, buffer);
 
     if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create pipeline layout!\n");
+        fprintf(stderr, "Failed to create buffer!\n");
         vk_error_print(success);
 
-        vkDestroyShaderModule(game.vk.device, v_shader, NULL);
-        vkDestroyShaderModule(game.vk.device, f_shader, NULL);
-        free(f);
-        free(v);
         return false;
     }
 
-    // Set info
-    const VkGraphicsPipelineCreateInfo info = {
-        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .stageCount = 2,
-        .pStages = shader_stage,
-        .pVertexInputState = &v_input,
-        .pInputAssemblyState = &input_assembly,
-        .pViewportState = &view,
-        .pRasterizationState = &raster,
-        .pMultisampleState = &multi,
-        .pColorBlendState = &color,
-        .pDynamicState = &dym,
-        .layout = game.vk.pipeline_layout,
-        .renderPass = game.vk.render_pass,
-        .subpass = 0,
-        .basePipelineHandle = VK_NULL_HANDLE
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(game.vk.device, *buffer, &reqs);
+
+    unsigned int type;
+    if(!vk_find_memory_type(reqs.memoryTypeBits, flags, &type)) {
+        fprintf(stderr, "No memory type fits the buffer!\n");
+        vkDestroyBuffer(game.vk.device, *buffer, NULL);
+
+        return false;
+    }
+
+    const VkMemoryAllocateInfo info_a = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = reqs.size,
+        .memoryTypeIndex = type
     };
 
-    // Create graphics pipeline
-    success = vkCreateGraphicsPipelines(game.vk.device,
-                                        VK_NULL_HANDLE,
-                                        1,
-                                        &info,
-                                        NULL, 
-                                        &game.vk.pipeline);
+    success = vkAllocateMemory(game.vk.device, &info_a, NULL, memory);
 
     if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create graphics pipeline!\n");
+        fprintf(stderr, "Failed to allocate buffer memory!\n");
         vk_error_print(success);
+        vkDestroyBuffer(game.vk.device, *buffer, NULL);
 
-        vkDestroyShaderModule(game.vk.device, v_shader, NULL);
-        vkDestroyShaderModule(game.vk.device, f_shader, NULL);
-        free(f);
-        free(v);
         return false;
     }
 
-    vkDestroyShaderModule(game.vk.device, v_shader, NULL);
-    vkDestroyShaderModule(game.vk.device, f_shader, NULL);
-    free(f);
-    free(v);
+    vkBindBufferMemory(game.vk.device, *buffer, *memory, 0);
 
     return true;
 }
 
-bool
-vk_create_framebuffers(void)
+void
+vk_retire(VkImage image, VkBuffer buffer, VkDeviceMemory memory)
 {
-    // Loop through the framebuffers
-    game.vk.framebuffers = malloc(sizeof(VkFramebuffer) * game.vk.image_c);
-    for(unsigned int i = 0; i < game.vk.image_c; i++)
+    if(game.vk.retired_c == game.vk.retired_size) {
+        unsigned int size = game.vk.retired_size ? game.vk.retired_size * 2
+                                                 : 64;
+
+        vk_retired_t *retired = realloc(game.vk.retired,
+                                        size * sizeof(*retired));
+
+        // Nowhere to keep it, so wait for the GPU instead
+        if(retired == NULL) {
+            vkDeviceWaitIdle(game.vk.device);
+            vkDestroyImage(game.vk.device, image, NULL);
+            vkDestroyBuffer(game.vk.device, buffer, NULL);
+            vkFreeMemory(game.vk.device, memory, NULL);
+
+            return;
+        }
+
+        game.vk.retired = retired;
+        game.vk.retired_size = size;
+    }
+
+    game.vk.retired[game.vk.retired_c++] = (vk_retired_t){
+        .image = image,
+        .buffer = buffer,
+        .memory = memory,
+        .value = game.vk.timeline_value + 1 // The frame being recorded
+    };
+}
+
+void
+vk_release_retired(unsigned int slot, bool all)
+{
+    uint64_t completed = all ? UINT64_MAX : vk_timeline_completed();
+    unsigned int kept = 0;
+
+    for(unsigned int i = 0; i < game.vk.retired_c; i++)
     {
-        // Set info
-        const VkImageView attach[] = {
-            game.vk.views[i]
-        };
+        vk_retired_t *r = &game.vk.retired[i];
 
-        const VkFramebufferCreateInfo info = {
-            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .renderPass = game.vk.render_pass,
-            .attachmentCount = 1,
-            .pAttachments = attach,
-            .width = game.vk.ex.width,
-            .height = game.vk.ex.height,
-            .layers = 1
-        };
+        if(r->value > completed) {
+            game.vk.retired[kept++] = *r;
+            continue;
+        }
 
-        // Create framebuffer
-        VkResult success = vkCreateFramebuffer(game.vk.device, 
-                                               &info, 
-                                               NULL, 
-                                               &game.vk.framebuffers[i]);
+        vkDestroyImage(game.vk.device, r->image, NULL);
+        vkDestroyBuffer(game.vk.device, r->buffer, NULL);
+        vkFreeMemory(game.vk.device, r->memory, NULL);
+    }
 
-        if(success != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create framebuffer!\n");
-            vk_error_print(success);
+    game.vk.retired_c = kept;
+
+    if(!all && slot < game.vk.staging_c)
+        game.vk.staging[slot].offset = 0;
+}
+
+bool
+vk_staging_alloc(VkDeviceSize size, VkDeviceSize *offset, void **data)
+{
+    unsigned int slot = game.vk.current_frame;
+
+    if(slot >= game.vk.staging_c) {
+        vk_staging_t *staging = realloc(game.vk.staging,
+                                        (slot + 1) * sizeof(*staging));
+        if(staging == NULL)
+            return false;
+
+        memset(&staging[game.vk.staging_c],
+               0,
+               (slot + 1 - game.vk.staging_c) * sizeof(*staging));
+
+        game.vk.staging = staging;
+        game.vk.staging_c = slot + 1;
+    }
+
+    vk_staging_t *s = &game.vk.staging[slot];
+
+    // Copies want their offset a multiple of the texel size
+    VkDeviceSize start = (s->offset + 15) & ~(VkDeviceSize)15;
+
+    if(start + size > s->size) {
+        // Only grow when nothing this frame is using it yet
+        if(s->offset > 0)
+            return false;
+
+        if(s->buffer != VK_NULL_HANDLE)
+            vk_retire(VK_NULL_HANDLE, s->buffer, s->memory);
+
+        VkDeviceSize new_size = size > TEXTURE_UPLOAD_BYTES ?
+                                size : TEXTURE_UPLOAD_BYTES;
+
+        memset(s, 0, sizeof(*s));
+
+        if(!vk_create_buffer(new_size,
+                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                             &s->buffer,
+                             &s->memory))
+            return false;
+
+        // Stays mapped, unmapping happens when the memory is freed
+        if(vkMapMemory(game.vk.device,
+                       s->memory,
+                       0,
+                       VK_WHOLE_SIZE,
+                       0,
+                       &s->data) != VK_SUCCESS) {
+            vkDestroyBuffer(game.vk.device, s->buffer, NULL);
+            vkFreeMemory(game.vk.device, s->memory, NULL);
+            memset(s, 0, sizeof(*s));
 
             return false;
         }
+
+        s->size = new_size;
+        start = 0;
     }
 
+    *offset = start;
+    *data = (uint8_t *)s->data + start;
+    s->offset = start + size;
+
     return true;
 }
 
 bool
-vk_create_cmd_pool(void)
+vk_texture_upload(texture_t *tex, unsigned int level)
 {
-    // Get queue families and set info
-    unsigned int gp_family, pr_family;
-    vk_get_queue_families(game.vk.physical_device, &gp_family, &pr_family);
+    VkCommandBuffer cmd = game.vk.cmdbuffer[game.vk.current_frame];
 
-    const VkCommandPoolCreateInfo info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = gp_family
+    unsigned int width = tex->width >> level ? tex->width >> level : 1;
+    unsigned int height = tex->height >> level ? tex->height >> level : 1;
+
+    VkDeviceSize offset;
+    void *data;
+
+    if(!vk_staging_alloc(texture_level_size(tex, level), &offset, &data))
+        return false;
+
+    texture_fill(tex, level, data);
+
+    const VkImageCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .extent = {
+            .width = width,
+            .height = height,
+            .depth = 1
+        },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
     };
 
-    // Create the command pool
-    VkResult success = vkCreateCommandPool(game.vk.device, 
-                                           &info, 
-                                           NULL, 
-                                           &game.vk.cmdpool);
+    VkImage image;
+    if(vkCreateImage(game.vk.device, &info, NULL, &image) != VK_SUCCESS)
+        return false;
 
-    if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create command pool!\n");
-        vk_error_print(success);
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(game.vk.device, image, &reqs);
 
+    unsigned int type;
+    if(!vk_find_memory_type(reqs.memoryTypeBits,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            &type)) {
+        vkDestroyImage(game.vk.device, image, NULL);
         return false;
     }
 
+    const VkMemoryAllocateInfo info_a = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = reqs.size,
+        .memoryTypeIndex = type
+    };
+
+    VkDeviceMemory memory;
+    if(vkAllocateMemory(game.vk.device,
+                        &info_a,
+                        NULL,
+                        &memory) != VK_SUCCESS) {
+        vkDestroyImage(game.vk.device, image, NULL);
+        return false;
+    }
+
+    vkBindImageMemory(game.vk.device, image, memory, 0);
+
+    const VkImageSubresourceRange range = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = 0,
+        .levelCount = 1,
+        .baseArrayLayer = 0,
+        .layerCount = 1
+    };
+
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = range
+    };
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0, NULL,
+                         0, NULL,
+                         1, &barrier);
+
+    const VkBufferImageCopy copy = {
+        .bufferOffset = offset,
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        },
+        .imageExtent = {
+            .width = width,
+            .height = height,
+            .depth = 1
+        }
+    };
+
+    vkCmdCopyBufferToImage(cmd,
+                           game.vk.staging[game.vk.current_frame].buffer,
+                           image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           1,
+                           &copy);
+
+    // Ready for whatever samples it
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0,
+                         0, NULL,
+                         0, NULL,
+                         1, &barrier);
+
+    game.vk.slot_used = true;
+
+    tex->images[level] = image;
+    tex->memory[level] = memory;
+    tex->bytes[level] = reqs.size;
+    tex->heap = game.vk.memory_props.memoryTypes[type].heapIndex;
+
     return true;
 }
 
-bool
-vk_create_cmd_buffer(void)
+void
+vk_texture_evict(texture_t *tex, unsigned int level)
 {
-    game.vk.cmdbuffer = malloc(sizeof(VkCommandBuffer) * game.vk.max_frames);
+    // A frame still in flight might be copying into it
+    vk_retire(tex->images[level], VK_NULL_HANDLE, tex->memory[level]);
 
-    // Set info
-    const VkCommandBufferAllocateInfo info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = game.vk.cmdpool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = game.vk.max_frames
+    tex->images[level] = VK_NULL_HANDLE;
+    tex->memory[level] = VK_NULL_HANDLE;
+}
+
+void
+vk_texture_budget(void)
+{
+    if(!game.vk.memory_budget)
+        return;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT
     };
 
-    // Create command buffer
-    VkResult success = vkAllocateCommandBuffers(game.vk.device, 
-                                                &info, 
-                                                game.vk.cmdbuffer);
+    VkPhysicalDeviceMemoryProperties2 props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+        .pNext = &budget
+    };
 
-    if(success != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create command buffer!\n");
-        vk_error_print(success);
+    vkGetPhysicalDeviceMemoryProperties2(game.vk.physical_device, &props);
 
-        return false;
+    for(unsigned int i = 0; i < props.memoryProperties.memoryHeapCount; i++)
+    {
+        // Usage counts ours too, only what others use is off limits
+        uint64_t used = game.textures.used[i];
+        uint64_t others = budget.heapUsage[i] > used ?
+                          budget.heapUsage[i] - used : 0;
+        uint64_t avail = budget.heapBudget[i] > others ?
+                         budget.heapBudget[i] - others : 0;
+
+        avail = (uint64_t)((double)avail * TEXTURE_BUDGET_SHARE);
+
+        if(game.textures.cap == 0 || avail < game.textures.cap)
+            game.textures.budget[i] = avail;
     }
 
-    return true;
+    game.textures.driver_budget = true;
 }
 
-bool
-vk_create_sync_objects(void)
+void
+vk_mesh_upload(void)
 {
-    game.vk.img_available = malloc(sizeof(VkSemaphore) * game.vk.max_frames);
-    game.vk.render_finished = malloc(sizeof(VkSemaphore) * game.vk.max_frames);
-    game.vk.flight = malloc(sizeof(VkFence) * game.vk.max_frames);
+    VkCommandBuffer cmd = game.vk.cmdbuffer[game.vk.current_frame];
 
-    // Set info
-    const VkSemaphoreCreateInfo info_s = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+    const mesh_header_t *h = &game.mesh.header;
+    const uint8_t *data = game.mesh.asset.data;
+
+    VkDeviceSize vertex_bytes = (VkDeviceSize)h->vertex_count *
+                                sizeof(mesh_vertex_t);
+    VkDeviceSize index_bytes = (VkDeviceSize)h->index_count * h->index_size;
+
+    VkDeviceSize offset;
+    void *staged;
+
+    // Textures got there first this frame, try again next frame
+    if(!vk_staging_alloc(vertex_bytes + index_bytes, &offset, &staged))
+        return;
+
+    memcpy(staged, data + h->vertex_offset, vertex_bytes);
+    memcpy((uint8_t *)staged + vertex_bytes,
+           data + h->index_offset,
+           index_bytes);
+
+    const VkBufferCopy copy = {
+        .srcOffset = offset,
+        .dstOffset = 0,
+        .size = vertex_bytes + index_bytes
     };
 
-    const VkFenceCreateInfo info_f = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT
+    vkCmdCopyBuffer(cmd,
+                    game.vk.staging[game.vk.current_frame].buffer,
+                    game.vk.mesh_buffer,
+                    1,
+                    &copy);
+
+    // Every later submission sees it, not just this one
+    const VkBufferMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                         VK_ACCESS_INDEX_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = game.vk.mesh_buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE
     };
 
-    // Create semaphores
-    for(unsigned int i = 0; i < game.vk.max_frames; i++)
-    {
-        VkResult success = vkCreateSemaphore(game.vk.device, 
-                                            &info_s, 
-                                            NULL, 
-                                            &game.vk.img_available[i]);
-        
-        if(success != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create semaphore!\n");
-            vk_error_print(success);
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                         0,
+                         0, NULL,
+                         1, &barrier,
+                         0, NULL);
 
-            return false;
+    game.vk.slot_used = true;
+
+    // Anything recorded before could have bound the old contents
+    for(unsigned int w = 0; w < game.window.count; w++)
+        for(unsigned int i = 0; i < game.vk.windows[w].image_c; i++)
+            game.vk.windows[w].image_cmds[i].frame = 0;
+
+    mesh_uploaded(vertex_bytes + index_bytes);
+}
+
+void
+vk_mesh_bind(VkCommandBuffer cmd)
+{
+    const VkDeviceSize vertex_offset = 0;
+
+    vkCmdBindPipeline(cmd,
+                      VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      game.vk.mesh_pipeline);
+
+    vkCmdBindVertexBuffers(cmd, 0, 1, &game.vk.mesh_buffer, &vertex_offset);
+
+    vkCmdBindIndexBuffer(cmd,
+                         game.vk.mesh_buffer,
+                         (VkDeviceSize)game.mesh.header.vertex_count *
+                         sizeof(mesh_vertex_t),
+                         game.mesh.header.index_size == 2 ?
+                                VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+}
+
+// Copies the image that's about to be presented into host memory. It's
+// there once the timeline reaches this frame's value.
+void
+vk_capture_record(unsigned int image)
+{
+    // Captures only ever come from the first window
+    const vk_window_t *win = &game.vk.windows[0];
+
+    VkCommandBuffer cmd = game.vk.cmdbuffer[game.vk.current_frame];
+    VkDeviceSize size = (VkDeviceSize)win->ex.width * win->ex.height * 4;
+
+    if(size == 0)
+        return;
+
+    int index = capture_acquire();
+    if(index < 0)
+        return;
+
+    capture_readback_t *rb = &game.capture.readbacks[index];
+
+    // Idle, so the GPU is done with the old one
+    if(rb->size != size) {
+        vk_capture_destroy(rb);
+
+        // The writer reads every byte, uncached memory would crawl
+        VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                      VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        unsigned int type;
+
+        if(!vk_find_memory_type(UINT32_MAX, flags, &type))
+            flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+        if(!vk_create_buffer(size,
+                             VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             flags,
+                             &rb->buffer,
+                             &rb->memory)) {
+            fprintf(stderr, "Failed to create a readback buffer, "
+                            "not capturing any more!\n");
+            game.capture.supported = false;
+            rb->buffer = VK_NULL_HANDLE;
+            rb->memory = VK_NULL_HANDLE;
+            return;
         }
 
-        success = vkCreateSemaphore(game.vk.device, 
-                                    &info_s, 
-                                    NULL, 
-                                    &game.vk.render_finished[i]);
+        VkResult success = vkMapMemory(game.vk.device,
+                                       rb->memory,
+                                       0,
+                                       VK_WHOLE_SIZE,
+                                       0,
+                                       &rb->mapped);
 
         if(success != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create semaphore!\n");
+            fprintf(stderr, "Failed to map a readback buffer, "
+                            "not capturing any more!\n");
             vk_error_print(success);
+            vk_capture_destroy(rb);
+            game.capture.supported = false;
+            return;
+        }
 
-            return false;
+        rb->size = size;
+
+        VK_NAME(VK_OBJECT_TYPE_BUFFER, rb->buffer, "Capture %d", index);
+    }
+
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = win->images[image],
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+
+    // The render pass left it ready to present
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0, NULL,
+                         0, NULL,
+                         1, &barrier);
+
+    const VkBufferImageCopy copy = {
+        .bufferOffset = 0,
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        },
+        .imageExtent = {
+            .width = win->ex.width,
+            .height = win->ex.height,
+            .depth = 1
+        }
+    };
+
+    vkCmdCopyImageToBuffer(cmd,
+                           win->images[image],
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           rb->buffer,
+                           1,
+                           &copy);
+
+    // Back for presenting, and the copy visible to the host
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    const VkBufferMemoryBarrier host = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = rb->buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE
+    };
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT |
+                         VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         0, NULL,
+                         1, &host,
+                         1, &barrier);
+
+    VkFormat format = game.vk.surface_format.format;
+
+    rb->width = win->ex.width;
+    rb->height = win->ex.height;
+    rb->stride = (size_t)win->ex.width * 4;
+    rb->bgr = format == VK_FORMAT_B8G8R8A8_SRGB ||
+              format == VK_FORMAT_B8G8R8A8_UNORM;
+    rb->flip = false;
+    rb->value = game.vk.timeline_value + 1;
+    rb->number = game.capture.captured++;
+    rb->recorded_frame = game.stats.frames;
+
+    atomic_store(&rb->state, CAPTURE_RECORDED);
+}
+
+// Hands over every copy whose frame has finished
+void
+vk_capture_collect(bool wait)
+{
+    uint64_t completed = vk_timeline_completed();
+
+    for(unsigned int i = 0; i < CAPTURE_RING; i++)
+    {
+        capture_readback_t *rb = &game.capture.readbacks[i];
+        unsigned int state = atomic_load(&rb->state);
+
+        // Stays mapped, nothing to undo
+        if(state == CAPTURE_WRITTEN) {
+            rb->data = NULL;
+            atomic_store(&rb->state, CAPTURE_IDLE);
+            continue;
+        }
+
+        if(state != CAPTURE_RECORDED)
+            continue;
+
+        VkResult success = VK_SUCCESS;
+
+        if(rb->value > completed) {
+            if(!wait)
+                continue;
+
+            success = vk_timeline_wait(rb->value, 1000000000ull);
         }
 
-        // Create fence
-        success = vkCreateFence(game.vk.device, &info_f, NULL, &game.vk.flight[i]);
+        if(success == VK_TIMEOUT)
+            continue;
 
         if(success != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create fence!\n");
+            fprintf(stderr, "Failed to read back frame %lu!\n",
+                            (unsigned long)rb->number);
             vk_error_print(success);
-            
-            return false;
+            game.capture.dropped++;
+
+            atomic_store(&rb->state, CAPTURE_IDLE);
+            continue;
         }
+
+        const VkMappedMemoryRange range = {
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = rb->memory,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE
+        };
+
+        // Only does anything if the memory isn't coherent
+        vkInvalidateMappedMemoryRanges(game.vk.device, 1, &range);
+
+        rb->data = rb->mapped;
+        atomic_store(&rb->state, CAPTURE_READY);
     }
 
-    return true;
-}
\ No newline at end of file
+    capture_submit_ready();
+}
+
+void
+vk_capture_destroy(capture_readback_t *rb)
+{
+    if(rb->buffer != VK_NULL_HANDLE)
+        vkDestroyBuffer(game.vk.device, rb->buffer, NULL);
+
+    // Unmaps it too
+    if(rb->memory != VK_NULL_HANDLE)
+        vkFreeMemory(game.vk.device, rb->memory, NULL);
+
+    rb->buffer = VK_NULL_HANDLE;
+    rb->memory = VK_NULL_HANDLE;
+    rb->mapped = NULL;
+    rb->data = NULL;
+    rb->size = 0;
+}
+
+// Once the writer is gone
+void
+vk_capture_free(void)
+{
+    for(unsigned int i = 0; i < CAPTURE_RING; i++)
+    {
+        vk_capture_destroy(&game.capture.readbacks[i]);
+        atomic_store(&game.capture.readbacks[i].state, CAPTURE_IDLE);
+    }
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2023 licktheroom //
+
+/*
+    Compiled mesh layout, shared by the game and src/meshc.c.
+
+    [header][vertices][indices]
+
+    Positions are unorm16 within the mesh's bounds, normals are octahedral
+    snorm16 and UVs are half floats, 16 bytes a vertex against 32 for the
+    same thing in float32. Indices are 16 bit when the vertices fit.
+    Everything is little endian.
+*/
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+
+#define MESH_MAGIC "XCBMESH1"
+#define MESH_ALIGN 16
+
+typedef struct
+{
+    char magic[8];
+    uint32_t vertex_count;
+    uint32_t index_count;
+    uint32_t index_size; // 2 or 4
+    uint32_t vertex_size;
+
+    // position = offset + unorm * scale, w is unused
+    float offset[4];
+    float scale[4];
+
+    // Estimated vertex fetch bytes per triangle, for the OBJ as float32 in
+    // its own order and for this mesh as compiled
+    float fetch_float;
+    float fetch_compiled;
+
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+} mesh_header_t;
+
+typedef struct
+{
+    uint16_t position[4]; // w is always 0
+    int16_t normal[2];
+    uint16_t uv[2];
+} mesh_vertex_t;
+
+#endif
@@ -0,0 +1,1105 @@
+// Copyright (c) 2023 licktheroom //
+
+/*
+    Compiles an OBJ into the layout in mesh.h.
+
+    meshc in.obj out.mesh
+
+    Triangles are reordered for the post-transform cache with Forsyth's
+    linear-speed vertex cache optimisation, then vertices are reordered to
+    the order the triangles first use them so fetches walk forward through
+    memory. If that fetches no less than the cache order alone, the cache
+    order is kept. The OBJ order is only kept if it costs less, counting
+    each vertex transformed as its size in bytes on top of what's fetched. Memory and estimated vertex fetch bandwidth are printed for the
+    OBJ as float32 and for what was written.
+*/
+
+// DEFINES //
+
+#define _POSIX_C_SOURCE 200809L
+
+// Forsyth's cache model and scoring
+#define CACHE_SIZE 32
+#define SCORE_LAST_TRI 0.75f
+#define SCORE_DECAY 1.5f
+#define SCORE_VALENCE 2.0f
+#define SCORE_VALENCE_POWER 0.5f
+
+// What the numbers are measured against. A small FIFO post-transform cache,
+// and a vertex fetch cache of a few 64 byte lines, like integrated GPUs.
+#define MEASURE_FIFO 16
+#define MEASURE_LINE 64
+#define MEASURE_LINES 32
+
+// float32 position, normal and UV, 32 bit indices
+#define FLOAT_VERTEX_SIZE 32
+#define FLOAT_INDEX_SIZE 4
+
+// HEADERS //
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "mesh.h"
+
+// TYPES //
+
+// One OBJ face corner, -1 where it has no UV or normal
+typedef struct
+{
+    int position, uv, normal;
+} corner_t;
+
+typedef struct
+{
+    float position[3];
+    float normal[3];
+    float uv[2];
+} vertex_t;
+
+typedef struct
+{
+    float *positions, *uvs, *normals;
+    unsigned int position_c, uv_c, normal_c;
+    unsigned int position_size, uv_size, normal_size;
+
+    // Unique corners become vertices
+    corner_t *corners;
+    unsigned int corner_c, corner_size;
+
+    uint32_t *indices;
+    unsigned int index_c, index_size;
+
+    // Open addressing, corner to vertex
+    struct
+    {
+        corner_t key;
+        uint32_t vertex;
+    } *table;
+    unsigned int table_size;
+} obj_t;
+
+typedef struct
+{
+    double acmr;  // Vertices transformed per triangle
+    double fetch; // Bytes fetched per triangle
+    double cost;  // Both as bytes per triangle, the ACMR in vertex sizes
+    uint64_t memory;
+} stats_t;
+
+// FUNCTIONS //
+
+bool
+grow(void **list, unsigned int *size, unsigned int count, size_t elem);
+
+bool
+obj_load(const char *name, obj_t *obj);
+
+bool
+obj_face(obj_t *obj, char *line, unsigned int line_n);
+
+bool
+obj_corner(obj_t *obj, const corner_t *corner, uint32_t *vertex);
+
+bool
+obj_vertices(const obj_t *obj, vertex_t **out);
+
+void
+obj_free(obj_t *obj);
+
+bool
+optimize_cache(uint32_t *indices, unsigned int index_c, unsigned int vertex_c);
+
+float
+vertex_score(int cache_pos, unsigned int live);
+
+bool
+optimize_fetch(vertex_t *vertices,
+               uint32_t *indices,
+               unsigned int vertex_c,
+               unsigned int index_c);
+
+void
+measure(const uint32_t *indices,
+        unsigned int index_c,
+        unsigned int vertex_c,
+        size_t vertex_size,
+        size_t index_size,
+        stats_t *out);
+
+void
+quantize(const vertex_t *vertices,
+         unsigned int vertex_c,
+         mesh_header_t *header,
+         mesh_vertex_t *out);
+
+void
+oct_encode(const float n[3], int16_t out[2]);
+
+int16_t
+snorm16(float v);
+
+uint16_t
+half_from_float(float f);
+
+bool
+mesh_write(const char *name,
+           const mesh_header_t *header,
+           const mesh_vertex_t *vertices,
+           const uint32_t *indices);
+
+// MAIN //
+
+int
+main(int argc, char **argv)
+{
+    if(argc != 3) {
+        fprintf(stderr, "Usage: %s in.obj out.mesh\n", argv[0]);
+        return 1;
+    }
+
+    obj_t obj;
+    memset(&obj, 0, sizeof(obj));
+
+    if(!obj_load(argv[1], &obj)) {
+        obj_free(&obj);
+        return 1;
+    }
+
+    if(obj.index_c == 0) {
+        fprintf(stderr, "'%s' has no triangles!\n", argv[1]);
+        obj_free(&obj);
+        return 1;
+    }
+
+    vertex_t *vertices;
+    if(!obj_vertices(&obj, &vertices)) {
+        obj_free(&obj);
+        return 1;
+    }
+
+    unsigned int vertex_c = obj.corner_c;
+    unsigned int index_c = obj.index_c;
+    uint32_t *indices = obj.indices;
+    size_t index_size = vertex_c <= 65536 ? 2 : 4;
+
+    stats_t before, quantized, after;
+
+    measure(indices, index_c, vertex_c,
+            FLOAT_VERTEX_SIZE, FLOAT_INDEX_SIZE,
+            &before);
+    measure(indices, index_c, vertex_c,
+            sizeof(mesh_vertex_t), index_size,
+            &quantized);
+
+    // The OBJ's own order, in case reordering doesn't pay off
+    uint32_t *obj_indices = malloc(index_c * sizeof(uint32_t));
+    vertex_t *obj_vertices = malloc(vertex_c * sizeof(vertex_t));
+
+    if(obj_indices == NULL || obj_vertices == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        free(obj_indices);
+        free(obj_vertices);
+        free(vertices);
+        obj_free(&obj);
+        return 1;
+    }
+
+    memcpy(obj_indices, indices, index_c * sizeof(uint32_t));
+    memcpy(obj_vertices, vertices, vertex_c * sizeof(vertex_t));
+
+    if(!optimize_cache(indices, index_c, vertex_c)) {
+        free(obj_indices);
+        free(obj_vertices);
+        free(vertices);
+        obj_free(&obj);
+        return 1;
+    }
+
+    stats_t cached;
+    measure(indices, index_c, vertex_c,
+            sizeof(mesh_vertex_t), index_size,
+            &cached);
+
+    // The cache order, in case the fetch order doesn't pay off. Only the
+    // indices, that order leaves the vertices where they were.
+    uint32_t *cache_indices = malloc(index_c * sizeof(uint32_t));
+
+    if(cache_indices == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        free(obj_indices);
+        free(obj_vertices);
+        free(vertices);
+        obj_free(&obj);
+        return 1;
+    }
+
+    memcpy(cache_indices, indices, index_c * sizeof(uint32_t));
+
+    if(!optimize_fetch(vertices, indices, vertex_c, index_c)) {
+        free(cache_indices);
+        free(obj_indices);
+        free(obj_vertices);
+        free(vertices);
+        obj_free(&obj);
+        return 1;
+    }
+
+    measure(indices, index_c, vertex_c,
+            sizeof(mesh_vertex_t), index_size,
+            &after);
+
+    bool fetch_kept = after.fetch < cached.fetch;
+
+    if(!fetch_kept) {
+        memcpy(indices, cache_indices, index_c * sizeof(uint32_t));
+        memcpy(vertices, obj_vertices, vertex_c * sizeof(vertex_t));
+        after = cached;
+    }
+
+    free(cache_indices);
+
+    // Cache order can scatter the vertices more than the fetch order
+    // gathers them back, transforming fewer usually pays for that
+    bool kept = after.cost > quantized.cost;
+
+    if(kept) {
+        memcpy(indices, obj_indices, index_c * sizeof(uint32_t));
+        memcpy(vertices, obj_vertices, vertex_c * sizeof(vertex_t));
+        after = quantized;
+    }
+
+    free(obj_indices);
+    free(obj_vertices);
+
+    mesh_vertex_t *out = calloc(vertex_c, sizeof(mesh_vertex_t));
+    if(out == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        free(vertices);
+        obj_free(&obj);
+        return 1;
+    }
+
+    mesh_header_t header = {
+        .vertex_count = vertex_c,
+        .index_count = index_c,
+        .index_size = (uint32_t)index_size,
+        .vertex_size = sizeof(mesh_vertex_t),
+        .fetch_float = (float)before.fetch,
+        .fetch_compiled = (float)after.fetch
+    };
+
+    memcpy(header.magic, MESH_MAGIC, sizeof(header.magic));
+
+    quantize(vertices, vertex_c, &header, out);
+
+    bool success = mesh_write(argv[2], &header, out, indices);
+
+    if(success) {
+        fprintf(stdout, "%s: %u vertices, %u triangles\n"
+                        "  %-22s %10s %8s %10s\n",
+                        argv[1], vertex_c, index_c / 3,
+                        "", "memory", "ACMR", "fetch/tri");
+
+        const struct {
+            const char *name;
+            const stats_t *stats;
+        } rows[] = {
+            {"float32, OBJ order", &before},
+            {"quantized, OBJ order", &quantized},
+            {"compiled", &after}
+        };
+
+        for(unsigned int i = 0; i < 3; i++)
+            fprintf(stdout, "  %-22s %6.1f KiB %8.3f %8.1f B\n",
+                            rows[i].name,
+                            (double)rows[i].stats->memory / 1024.0,
+                            rows[i].stats->acmr,
+                            rows[i].stats->fetch);
+
+        if(kept)
+            fprintf(stdout, "  Kept the OBJ order, reordering didn't "
+                            "cost less.\n");
+        else if(!fetch_kept)
+            fprintf(stdout, "  Kept the cache order, reordering the "
+                            "vertices didn't fetch less.\n");
+    }
+
+    free(out);
+    free(vertices);
+    obj_free(&obj);
+
+    return success ? 0 : 1;
+}
+
+// FUNCTIONS //
+
+bool
+grow(void **list, unsigned int *size, unsigned int count, size_t elem)
+{
+    if(count < *size)
+        return true;
+
+    unsigned int new_size = *size ? *size * 2 : 256;
+    void *new_list = realloc(*list, new_size * elem);
+
+    if(new_list == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        return false;
+    }
+
+    *list = new_list;
+    *size = new_size;
+
+    return true;
+}
+
+bool
+obj_load(const char *name, obj_t *obj)
+{
+    FILE *file = fopen(name, "r");
+    if(file == NULL) {
+        fprintf(stderr, "File '%s' failed to open!\n"
+                        "%s\n",
+                        name, strerror(errno));
+        return false;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned int line_n = 0;
+    bool success = true;
+
+    while(success && getline(&line, &line_size, file) != -1)
+    {
+        line_n++;
+
+        float v[3] = {0.0f, 0.0f, 0.0f};
+
+        // Materials, groups and the rest don't change the geometry
+        if(strncmp(line, "v ", 2) == 0) {
+            success = sscanf(line + 2, "%f %f %f", &v[0], &v[1], &v[2]) == 3 &&
+                      grow((void **)&obj->positions, &obj->position_size,
+                           obj->position_c * 3 + 2, sizeof(float));
+
+            if(success)
+                memcpy(&obj->positions[obj->position_c++ * 3], v, sizeof(v));
+        } else if(strncmp(line, "vt ", 3) == 0) {
+            success = sscanf(line + 3, "%f %f", &v[0], &v[1]) >= 1 &&
+                      grow((void **)&obj->uvs, &obj->uv_size,
+                           obj->uv_c * 2 + 1, sizeof(float));
+
+            if(success)
+                memcpy(&obj->uvs[obj->uv_c++ * 2], v, sizeof(float) * 2);
+        } else if(strncmp(line, "vn ", 3) == 0) {
+            success = sscanf(line + 3, "%f %f %f", &v[0], &v[1], &v[2]) == 3 &&
+                      grow((void **)&obj->normals, &obj->normal_size,
+                           obj->normal_c * 3 + 2, sizeof(float));
+
+            if(success)
+                memcpy(&obj->normals[obj->normal_c++ * 3], v, sizeof(v));
+        } else if(strncmp(line, "f ", 2) == 0) {
+            success = obj_face(obj, line + 2, line_n);
+            continue;
+        } else {
+            continue;
+        }
+
+        if(!success)
+            fprintf(stderr, "%s:%u: Bad vertex!\n", name, line_n);
+    }
+
+    free(line);
+    fclose(file);
+
+    return success;
+}
+
+bool
+obj_face(obj_t *obj, char *line, unsigned int line_n)
+{
+    uint32_t first = 0, prev = 0;
+    unsigned int count = 0;
+    char *save = NULL;
+
+    for(char *tok = strtok_r(line, " \t\r\n", &save);
+        tok != NULL;
+        tok = strtok_r(NULL, " \t\r\n", &save))
+    {
+        // v, v/vt, v//vn or v/vt/vn, negative counts back from the end
+        long ids[3] = {0, 0, 0};
+        const unsigned int counts[3] = {
+            obj->position_c,
+            obj->uv_c,
+            obj->normal_c
+        };
+
+        char *at = tok;
+        for(unsigned int i = 0; i < 3; i++)
+        {
+            char *end;
+            ids[i] = strtol(at, &end, 10);
+
+            if(*end != '/')
+                break;
+
+            at = end + 1;
+        }
+
+        int resolved[3];
+        for(unsigned int i = 0; i < 3; i++)
+        {
+            long id = ids[i] < 0 ? (long)counts[i] + ids[i] : ids[i] - 1;
+
+            if(ids[i] == 0 && i > 0) {
+                resolved[i] = -1;
+            } else if(id < 0 || id >= (long)counts[i]) {
+                fprintf(stderr, "Line %u: '%s' is out of range!\n",
+                                line_n, tok);
+                return false;
+            } else {
+                resolved[i] = (int)id;
+            }
+        }
+
+        const corner_t corner = {resolved[0], resolved[1], resolved[2]};
+        uint32_t vertex;
+
+        if(!obj_corner(obj, &corner, &vertex))
+            return false;
+
+        // Fan out anything bigger than a triangle
+        if(count >= 2) {
+            if(!grow((void **)&obj->indices, &obj->index_size,
+                     obj->index_c + 2, sizeof(uint32_t)))
+                return false;
+
+            obj->indices[obj->index_c++] = first;
+            obj->indices[obj->index_c++] = prev;
+            obj->indices[obj->index_c++] = vertex;
+        }
+
+        if(count == 0)
+            first = vertex;
+
+        prev = vertex;
+        count++;
+    }
+
+    return true;
+}
+
+bool
+obj_corner(obj_t *obj, const corner_t *corner, uint32_t *vertex)
+{
+    // Keep the table at most half full
+    if(obj->corner_c * 2 >= obj->table_size) {
+        unsigned int size = obj->table_size ? obj->table_size * 2 : 1024;
+
+        void *table = malloc(size * sizeof(*obj->table));
+        if(table == NULL) {
+            fprintf(stderr, "Out of memory!\n");
+            return false;
+        }
+
+        free(obj->table);
+        obj->table = table;
+        obj->table_size = size;
+
+        for(unsigned int i = 0; i < size; i++)
+            obj->table[i].key.position = -1;
+
+        // Every corner so far is in the list, so rebuild from that
+        for(uint32_t i = 0; i < obj->corner_c; i++)
+        {
+            const corner_t *c = &obj->corners[i];
+            unsigned int slot = ((unsigned int)c->position * 73856093u ^
+                                 (unsigned int)c->uv * 19349663u ^
+                                 (unsigned int)c->normal * 83492791u) &
+                                (size - 1);
+
+            while(obj->table[slot].key.position != -1)
+                slot = (slot + 1) & (size - 1);
+
+            obj->table[slot].key = *c;
+            obj->table[slot].vertex = i;
+        }
+    }
+
+    unsigned int slot = ((unsigned int)corner->position * 73856093u ^
+                         (unsigned int)corner->uv * 19349663u ^
+                         (unsigned int)corner->normal * 83492791u) &
+                        (obj->table_size - 1);
+
+    while(obj->table[slot].key.position != -1)
+    {
+        const corner_t *key = &obj->table[slot].key;
+
+        if(key->position == corner->position &&
+           key->uv == corner->uv &&
+           key->normal == corner->normal) {
+            *vertex = obj->table[slot].vertex;
+            return true;
+        }
+
+        slot = (slot + 1) & (obj->table_size - 1);
+    }
+
+    if(!grow((void **)&obj->corners, &obj->corner_size,
+             obj->corner_c, sizeof(corner_t)))
+        return false;
+
+    *vertex = obj->corner_c;
+
+    obj->corners[obj->corner_c++] = *corner;
+    obj->table[slot].key = *corner;
+    obj->table[slot].vertex = *vertex;
+
+    return true;
+}
+
+bool
+obj_vertices(const obj_t *obj, vertex_t **out)
+{
+    vertex_t *vertices = calloc(obj->corner_c, sizeof(vertex_t));
+
+    // Area weighted face normals, for corners that didn't come with one
+    float *smooth = calloc((size_t)obj->position_c * 3, sizeof(float));
+
+    if(vertices == NULL || smooth == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        free(vertices);
+        free(smooth);
+        return false;
+    }
+
+    for(unsigned int i = 0; i < obj->index_c; i += 3)
+    {
+        const float *p[3];
+        for(unsigned int j = 0; j < 3; j++)
+            p[j] = &obj->positions[obj->corners[obj->indices[i + j]].position *
+                                   3];
+
+        float a[3], b[3];
+        for(unsigned int j = 0; j < 3; j++)
+        {
+            a[j] = p[1][j] - p[0][j];
+            b[j] = p[2][j] - p[0][j];
+        }
+
+        const float n[3] = {
+            a[1] * b[2] - a[2] * b[1],
+            a[2] * b[0] - a[0] * b[2],
+            a[0] * b[1] - a[1] * b[0]
+        };
+
+        for(unsigned int j = 0; j < 3; j++)
+        {
+            float *s = &smooth[obj->corners[obj->indices[i + j]].position * 3];
+
+            s[0] += n[0];
+            s[1] += n[1];
+            s[2] += n[2];
+        }
+    }
+
+    for(unsigned int i = 0; i < obj->corner_c; i++)
+    {
+        const corner_t *c = &obj->corners[i];
+        vertex_t *v = &vertices[i];
+
+        memcpy(v->position,
+               &obj->positions[c->position * 3],
+               sizeof(float) * 3);
+
+        if(c->uv >= 0)
+            memcpy(v->uv, &obj->uvs[c->uv * 2], sizeof(float) * 2);
+
+        const float *n = c->normal >= 0 ? &obj->normals[c->normal * 3]
+                                        : &smooth[c->position * 3];
+
+        float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        for(unsigned int j = 0; j < 3 && len > 0.0f; j++)
+            v->normal[j] = n[j] / len;
+    }
+
+    free(smooth);
+    *out = vertices;
+
+    return true;
+}
+
+void
+obj_free(obj_t *obj)
+{
+    free(obj->positions);
+    free(obj->uvs);
+    free(obj->normals);
+    free(obj->corners);
+    free(obj->indices);
+    free(obj->table);
+
+    memset(obj, 0, sizeof(*obj));
+}
+
+// See https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+bool
+optimize_cache(uint32_t *indices, unsigned int index_c, unsigned int vertex_c)
+{
+    unsigned int tri_c = index_c / 3;
+
+    unsigned int *live = calloc(vertex_c, sizeof(unsigned int));
+    unsigned int *first = calloc((size_t)vertex_c + 1, sizeof(unsigned int));
+    uint32_t *adjacent = malloc(index_c * sizeof(uint32_t));
+    int *cache_pos = malloc(vertex_c * sizeof(int));
+    float *score = malloc(vertex_c * sizeof(float));
+    float *tri_score = malloc(tri_c * sizeof(float));
+    bool *emitted = calloc(tri_c, sizeof(bool));
+    uint32_t *out = malloc(index_c * sizeof(uint32_t));
+
+    bool success = live && first && adjacent && cache_pos && score &&
+                   tri_score && emitted && out;
+
+    if(!success) {
+        fprintf(stderr, "Out of memory!\n");
+        goto done;
+    }
+
+    // Triangles using each vertex, packed one vertex after another
+    for(unsigned int i = 0; i < index_c; i++)
+        live[indices[i]]++;
+
+    for(unsigned int v = 0; v < vertex_c; v++)
+        first[v + 1] = first[v] + live[v];
+
+    memset(live, 0, vertex_c * sizeof(unsigned int));
+
+    for(unsigned int i = 0; i < index_c; i++)
+    {
+        uint32_t v = indices[i];
+        adjacent[first[v] + live[v]++] = i / 3;
+    }
+
+    for(unsigned int v = 0; v < vertex_c; v++)
+    {
+        cache_pos[v] = -1;
+        score[v] = vertex_score(-1, live[v]);
+    }
+
+    for(unsigned int t = 0; t < tri_c; t++)
+        tri_score[t] = score[indices[t * 3]] +
+                       score[indices[t * 3 + 1]] +
+                       score[indices[t * 3 + 2]];
+
+    // Room for a triangle's vertices pushing past the end
+    int cache[CACHE_SIZE + 3];
+    unsigned int cache_c = 0;
+
+    unsigned int scan = 0;
+    int best = -1;
+
+    for(unsigned int n = 0; n < tri_c; n++)
+    {
+        // Nothing in the cache has triangles left, take the next one
+        if(best < 0) {
+            while(emitted[scan])
+                scan++;
+
+            best = (int)scan;
+        }
+
+        const uint32_t *tri = &indices[best * 3];
+
+        memcpy(&out[n * 3], tri, sizeof(uint32_t) * 3);
+        emitted[best] = true;
+
+        for(unsigned int j = 0; j < 3; j++)
+        {
+            uint32_t v = tri[j];
+
+            for(unsigned int k = first[v]; k < first[v] + live[v]; k++)
+                if(adjacent[k] == (uint32_t)best) {
+                    adjacent[k] = adjacent[first[v] + live[v] - 1];
+                    break;
+                }
+
+            live[v]--;
+        }
+
+        // The triangle's vertices go to the front, the rest shift back
+        int next[CACHE_SIZE + 3];
+        unsigned int next_c = 0;
+
+        for(unsigned int j = 0; j < 3; j++)
+            if(j == 0 || tri[j] != tri[0])
+                if(j < 2 || tri[j] != tri[1])
+                    next[next_c++] = (int)tri[j];
+
+        for(unsigned int j = 0; j < cache_c; j++)
+            if(cache[j] != (int)tri[0] &&
+               cache[j] != (int)tri[1] &&
+               cache[j] != (int)tri[2])
+                next[next_c++] = cache[j];
+
+        for(unsigned int j = 0; j < next_c; j++)
+        {
+            int v = next[j];
+
+            cache_pos[v] = j < CACHE_SIZE ? (int)j : -1;
+            score[v] = vertex_score(cache_pos[v], live[v]);
+        }
+
+        // Only triangles touching the cache could have changed
+        best = -1;
+        float best_score = -1.0f;
+
+        for(unsigned int j = 0; j < next_c; j++)
+        {
+            uint32_t v = (uint32_t)next[j];
+
+            for(unsigned int k = first[v]; k < first[v] + live[v]; k++)
+            {
+                unsigned int t = adjacent[k];
+
+                tri_score[t] = score[indices[t * 3]] +
+                               score[indices[t * 3 + 1]] +
+                               score[indices[t * 3 + 2]];
+
+                if(tri_score[t] > best_score) {
+                    best_score = tri_score[t];
+                    best = (int)t;
+                }
+            }
+        }
+
+        cache_c = next_c < CACHE_SIZE ? next_c : CACHE_SIZE;
+        memcpy(cache, next, cache_c * sizeof(int));
+    }
+
+    memcpy(indices, out, index_c * sizeof(uint32_t));
+
+done:
+    free(live);
+    free(first);
+    free(adjacent);
+    free(cache_pos);
+    free(score);
+    free(tri_score);
+    free(emitted);
+    free(out);
+
+    return success;
+}
+
+float
+vertex_score(int cache_pos, unsigned int live)
+{
+    // Nothing left to draw with it
+    if(live == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+
+    if(cache_pos >= 0) {
+        // The last triangle's vertices, scored lower so it doesn't
+        // just strip
+        if(cache_pos < 3) {
+            score = SCORE_LAST_TRI;
+        } else {
+            float scale = 1.0f / (float)(CACHE_SIZE - 3);
+            score = powf(1.0f - (float)(cache_pos - 3) * scale, SCORE_DECAY);
+        }
+    }
+
+    // Finish off vertices with few triangles left before they fall out
+    return score + SCORE_VALENCE * powf((float)live, -SCORE_VALENCE_POWER);
+}
+
+bool
+optimize_fetch(vertex_t *vertices,
+               uint32_t *indices,
+               unsigned int vertex_c,
+               unsigned int index_c)
+{
+    uint32_t *remap = malloc(vertex_c * sizeof(uint32_t));
+    vertex_t *sorted = malloc(vertex_c * sizeof(vertex_t));
+
+    if(remap == NULL || sorted == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        free(remap);
+        free(sorted);
+        return false;
+    }
+
+    memset(remap, 0xFF, vertex_c * sizeof(uint32_t));
+
+    // Vertices in the order the triangles first need them
+    uint32_t next = 0;
+
+    for(unsigned int i = 0; i < index_c; i++)
+    {
+        uint32_t v = indices[i];
+
+        if(remap[v] == UINT32_MAX) {
+            remap[v] = next;
+            sorted[next++] = vertices[v];
+        }
+
+        indices[i] = remap[v];
+    }
+
+    // Every vertex came from a face, so all of them were used
+    memcpy(vertices, sorted, next * sizeof(vertex_t));
+
+    free(remap);
+    free(sorted);
+
+    return true;
+}
+
+void
+measure(const uint32_t *indices,
+        unsigned int index_c,
+        unsigned int vertex_c,
+        size_t vertex_size,
+        size_t index_size,
+        stats_t *out)
+{
+    int fifo[MEASURE_FIFO];
+    unsigned int fifo_at = 0;
+
+    uint64_t lines[MEASURE_LINES];
+    unsigned int line_c = 0;
+
+    uint64_t transformed = 0, fetched = 0;
+
+    for(unsigned int i = 0; i < MEASURE_FIFO; i++)
+        fifo[i] = -1;
+
+    for(unsigned int i = 0; i < index_c; i++)
+    {
+        int v = (int)indices[i];
+        bool hit = false;
+
+        for(unsigned int j = 0; j < MEASURE_FIFO && !hit; j++)
+            hit = fifo[j] == v;
+
+        if(hit)
+            continue;
+
+        fifo[fifo_at] = v;
+        fifo_at = (fifo_at + 1) % MEASURE_FIFO;
+        transformed++;
+
+        // Every line the vertex touches, most recently used first
+        uint64_t start = (uint64_t)v * vertex_size;
+        uint64_t end = start + vertex_size - 1;
+
+        for(uint64_t line = start / MEASURE_LINE;
+            line <= end / MEASURE_LINE;
+            line++)
+        {
+            unsigned int j = 0;
+            while(j < line_c && lines[j] != line)
+                j++;
+
+            if(j == line_c) {
+                fetched += MEASURE_LINE;
+
+                if(line_c < MEASURE_LINES)
+                    line_c++;
+
+                j = line_c - 1;
+            }
+
+            memmove(&lines[1], &lines[0], j * sizeof(uint64_t));
+            lines[0] = line;
+        }
+    }
+
+    double tris = (double)(index_c / 3);
+
+    out->acmr = (double)transformed / tris;
+    out->fetch = (double)fetched / tris;
+    out->cost = out->acmr * (double)vertex_size + out->fetch;
+    out->memory = (uint64_t)vertex_c * vertex_size +
+                  (uint64_t)index_c * index_size;
+}
+
+void
+quantize(const vertex_t *vertices,
+         unsigned int vertex_c,
+         mesh_header_t *header,
+         mesh_vertex_t *out)
+{
+    float min[3], max[3];
+
+    memcpy(min, vertices[0].position, sizeof(min));
+    memcpy(max, vertices[0].position, sizeof(max));
+
+    for(unsigned int i = 1; i < vertex_c; i++)
+        for(unsigned int j = 0; j < 3; j++)
+        {
+            min[j] = fminf(min[j], vertices[i].position[j]);
+            max[j] = fmaxf(max[j], vertices[i].position[j]);
+        }
+
+    for(unsigned int j = 0; j < 3; j++)
+    {
+        header->offset[j] = min[j];
+        header->scale[j] = max[j] - min[j];
+    }
+
+    for(unsigned int i = 0; i < vertex_c; i++)
+    {
+        const vertex_t *v = &vertices[i];
+        mesh_vertex_t *o = &out[i];
+
+        // Flat axes keep everything at 0
+        for(unsigned int j = 0; j < 3; j++)
+            if(header->scale[j] > 0.0f)
+                o->position[j] = (uint16_t)lrintf((v->position[j] - min[j]) /
+                                                  header->scale[j] *
+                                                  65535.0f);
+
+        oct_encode(v->normal, o->normal);
+
+        o->uv[0] = half_from_float(v->uv[0]);
+        o->uv[1] = half_from_float(v->uv[1]);
+    }
+}
+
+// Onto an octahedron, then the lower half folded over the upper
+void
+oct_encode(const float n[3], int16_t out[2])
+{
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    float x = 0.0f, y = 0.0f;
+
+    if(l1 > 0.0f) {
+        x = n[0] / l1;
+        y = n[1] / l1;
+
+        if(n[2] < 0.0f) {
+            float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+
+            x = fx;
+            y = fy;
+        }
+    }
+
+    out[0] = snorm16(x);
+    out[1] = snorm16(y);
+}
+
+int16_t
+snorm16(float v)
+{
+    if(v > 1.0f)
+        v = 1.0f;
+    else if(v < -1.0f)
+        v = -1.0f;
+
+    return (int16_t)lrintf(v * 32767.0f);
+}
+
+// Rounds to nearest even, too small flushes to zero, too big is infinity
+uint16_t
+half_from_float(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    uint32_t mant = bits & 0x7FFFFF;
+    int exp = (int)((bits >> 23) & 0xFF) - 127 + 15;
+
+    if(((bits >> 23) & 0xFF) == 0xFF)
+        return sign | 0x7C00 | (mant ? 0x200 : 0);
+
+    if(exp >= 31)
+        return sign | 0x7C00;
+
+    if(exp <= 0) {
+        if(exp < -10)
+            return sign;
+
+        // Denormal, put the implicit bit back and shift it down
+        mant |= 0x800000;
+
+        unsigned int shift = (unsigned int)(14 - exp);
+        uint32_t half = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+
+        if(rest > mid || (rest == mid && (half & 1)))
+            half++;
+
+        return sign | (uint16_t)half;
+    }
+
+    uint32_t half = (uint32_t)exp << 10 | mant >> 13;
+    uint32_t rest = mant & 0x1FFF;
+
+    // Carrying into the exponent is still right
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+
+    return sign | (uint16_t)half;
+}
+
+bool
+mesh_write(const char *name,
+           const mesh_header_t *header,
+           const mesh_vertex_t *vertices,
+           const uint32_t *indices)
+{
+    mesh_header_t h = *header;
+
+    h.vertex_offset = (sizeof(h) + MESH_ALIGN - 1) &
+                      ~(uint64_t)(MESH_ALIGN - 1);
+    h.index_offset = h.vertex_offset +
+                     (uint64_t)h.vertex_count * sizeof(mesh_vertex_t);
+
+    FILE *file = fopen(name, "wb");
+    if(file == NULL) {
+        fprintf(stderr, "Failed to open '%s'!\n"
+                        "%s\n",
+                        name, strerror(errno));
+        return false;
+    }
+
+    static const uint8_t zeros[MESH_ALIGN] = {0};
+
+    bool success = fwrite(&h, sizeof(h), 1, file) == 1 &&
+                   (h.vertex_offset == sizeof(h) ||
+                    fwrite(zeros, h.vertex_offset - sizeof(h), 1, file) == 1) &&
+                   fwrite(vertices,
+                          sizeof(mesh_vertex_t),
+                          h.vertex_count,
+                          file) == h.vertex_count;
+
+    for(uint32_t i = 0; i < h.index_count && success; i++)
+    {
+        if(h.index_size == 2) {
+            uint16_t index = (uint16_t)indices[i];
+            success = fwrite(&index, sizeof(index), 1, file) == 1;
+        } else {
+            success = fwrite(&indices[i], sizeof(indices[i]), 1, file) == 1;
+        }
+    }
+
+    if(fclose(file) != 0 || !success) {
+        fprintf(stderr, "Failed to write '%s'!\n", name);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,365 @@
+// Copyright (c) 2023 licktheroom //
+
+/*
+    Packs assets into one archive the game can map in a single go.
+
+    pack out.pak [-z] file...
+
+    Files after -z are LZ4 compressed, if that makes them at least an eighth
+    smaller. Files are named in the archive by the path given here, so run
+    it from build/ like the game.
+*/
+
+// DEFINES //
+
+#define _POSIX_C_SOURCE 200809L
+
+// LZ4 block format rules
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // The block always ends in this many literals
+#define LZ4_MF_LIMIT 12     // No match may start closer to the end than this
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 16
+
+// HEADERS //
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "archive.h"
+
+// TYPES //
+
+typedef struct
+{
+    const char *name;
+    uint8_t *data; // What goes in the archive
+    archive_entry_t entry;
+} input_t;
+
+// FUNCTIONS //
+
+bool
+read_file(const char *name, uint8_t **data, size_t *size);
+
+size_t
+lz4_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap);
+
+int
+compare_entries(const void *a, const void *b);
+
+bool
+write_padding(FILE *file, uint64_t *at);
+
+// MAIN //
+
+int
+main(int argc, char **argv)
+{
+    if(argc < 3) {
+        fprintf(stderr, "Usage: %s out.pak [-z] file...\n", argv[0]);
+        return 1;
+    }
+
+    input_t *inputs = calloc((size_t)argc, sizeof(input_t));
+    if(inputs == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        return 1;
+    }
+
+    unsigned int count = 0;
+    uint32_t names_size = 0;
+    bool compress = false;
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-z") == 0) {
+            compress = true;
+            continue;
+        }
+
+        input_t *in = &inputs[count];
+        size_t size;
+
+        if(!read_file(argv[i], &in->data, &size))
+            return 1;
+
+        in->name = argv[i];
+        in->entry.hash = archive_hash(argv[i]);
+        in->entry.size = in->entry.raw_size = size;
+        in->entry.name = names_size;
+        in->entry.flags = 0;
+
+        names_size += (uint32_t)strlen(argv[i]) + 1;
+
+        if(compress && size > 0) {
+            // LZ4's worst case is a little over the input
+            size_t cap = size + size / 255 + 16;
+            uint8_t *packed = malloc(cap);
+
+            size_t packed_size = packed ? lz4_compress(in->data,
+                                                       size,
+                                                       packed,
+                                                       cap)
+                                        : 0;
+
+            if(packed_size > 0 && packed_size <= size - size / 8) {
+                free(in->data);
+                in->data = packed;
+                in->entry.size = packed_size;
+                in->entry.flags |= ARCHIVE_LZ4;
+            } else {
+                free(packed);
+            }
+        }
+
+        count++;
+    }
+
+    // Blobs go after the names, each aligned
+    uint64_t entries_offset = sizeof(archive_header_t);
+    uint64_t names_offset = entries_offset + count * sizeof(archive_entry_t);
+    uint64_t at = names_offset + names_size;
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+        at = (at + ARCHIVE_ALIGN - 1) & ~(uint64_t)(ARCHIVE_ALIGN - 1);
+        inputs[i].entry.offset = at;
+        at += inputs[i].entry.size;
+    }
+
+    // The game binary searches on the hash
+    qsort(inputs, count, sizeof(input_t), compare_entries);
+
+    for(unsigned int i = 1; i < count; i++)
+        if(inputs[i].entry.hash == inputs[i - 1].entry.hash &&
+           strcmp(inputs[i].name, inputs[i - 1].name) == 0) {
+            fprintf(stderr, "'%s' was given twice!\n", inputs[i].name);
+            return 1;
+        }
+
+    FILE *file = fopen(argv[1], "wb");
+    if(file == NULL) {
+        fprintf(stderr, "Failed to open '%s'!\n"
+                        "%s\n",
+                        argv[1], strerror(errno));
+        return 1;
+    }
+
+    archive_header_t header = {
+        .entry_count = count,
+        .names_size = names_size,
+        .entries_offset = entries_offset,
+        .names_offset = names_offset
+    };
+
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for(unsigned int i = 0; i < count && success; i++)
+        success = fwrite(&inputs[i].entry,
+                         sizeof(archive_entry_t),
+                         1,
+                         file) == 1;
+
+    // Names in the order their offsets were handed out
+    for(int i = 2; i < argc && success; i++)
+        if(strcmp(argv[i], "-z") != 0)
+            success = fwrite(argv[i], strlen(argv[i]) + 1, 1, file) == 1;
+
+    // Blobs in offset order, which isn't the sorted order
+    at = names_offset + names_size;
+
+    for(int i = 2; i < argc && success; i++)
+    {
+        if(strcmp(argv[i], "-z") == 0)
+            continue;
+
+        input_t *in = NULL;
+        for(unsigned int j = 0; j < count; j++)
+            if(inputs[j].name == argv[i])
+                in = &inputs[j];
+
+        success = write_padding(file, &at);
+
+        if(success && in->entry.size > 0)
+            success = fwrite(in->data, in->entry.size, 1, file) == 1;
+
+        at += in->entry.size;
+    }
+
+    if(fclose(file) != 0 || !success) {
+        fprintf(stderr, "Failed to write '%s'!\n", argv[1]);
+        return 1;
+    }
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+        fprintf(stdout, "%-32s %8lu -> %8lu%s\n",
+                        inputs[i].name,
+                        (unsigned long)inputs[i].entry.raw_size,
+                        (unsigned long)inputs[i].entry.size,
+                        inputs[i].entry.flags & ARCHIVE_LZ4 ? " lz4" : "");
+
+        free(inputs[i].data);
+    }
+
+    free(inputs);
+
+    return 0;
+}
+
+// FUNCTIONS //
+
+bool
+read_file(const char *name, uint8_t **data, size_t *size)
+{
+    FILE *file = fopen(name, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "File '%s' failed to open!\n"
+                        "%s\n",
+                        name, strerror(errno));
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    *data = malloc(file_size > 0 ? (size_t)file_size : 1);
+
+    if(*data == NULL || file_size < 0 ||
+       (file_size > 0 && fread(*data, (size_t)file_size, 1, file) != 1)) {
+        fprintf(stderr, "Failed to read '%s'!\n", name);
+        fclose(file);
+        return false;
+    }
+
+    fclose(file);
+    *size = (size_t)file_size;
+
+    return true;
+}
+
+// Greedy, one candidate per hash. Returns 0 if it didn't fit in cap.
+size_t
+lz4_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap)
+{
+    uint32_t *table = calloc(1u << LZ4_HASH_BITS, sizeof(uint32_t));
+    if(table == NULL)
+        return 0;
+
+    size_t ip = 0, anchor = 0, op = 0;
+
+    while(size >= LZ4_MF_LIMIT && ip <= size - LZ4_MF_LIMIT)
+    {
+        uint32_t seq;
+        memcpy(&seq, &src[ip], sizeof(seq));
+
+        uint32_t hash = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        size_t ref = table[hash];
+        table[hash] = (uint32_t)ip + 1;
+
+        // Positions are stored plus one, so 0 means nothing yet
+        if(ref == 0 || ip - (ref - 1) > LZ4_MAX_OFFSET ||
+           memcmp(&src[ref - 1], &seq, sizeof(seq)) != 0) {
+            ip++;
+            continue;
+        }
+
+        size_t match = ref - 1;
+        size_t len = LZ4_MIN_MATCH;
+
+        while(ip + len < size - LZ4_LAST_LITERALS &&
+              src[match + len] == src[ip + len])
+            len++;
+
+        size_t lit = ip - anchor;
+
+        // Token, lengths, literals and offset in the worst case
+        if(op + 1 + lit / 255 + 1 + lit + 2 + len / 255 + 1 > cap) {
+            free(table);
+            return 0;
+        }
+
+        uint8_t *token = &dst[op++];
+        size_t ml = len - LZ4_MIN_MATCH;
+
+        *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+
+        if(lit >= 15) {
+            size_t n = lit - 15;
+            for(; n >= 255; n -= 255)
+                dst[op++] = 255;
+            dst[op++] = (uint8_t)n;
+        }
+
+        memcpy(&dst[op], &src[anchor], lit);
+        op += lit;
+
+        dst[op++] = (uint8_t)(ip - match);
+        dst[op++] = (uint8_t)((ip - match) >> 8);
+
+        *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+
+        if(ml >= 15) {
+            size_t n = ml - 15;
+            for(; n >= 255; n -= 255)
+                dst[op++] = 255;
+            dst[op++] = (uint8_t)n;
+        }
+
+        ip += len;
+        anchor = ip;
+    }
+
+    free(table);
+
+    // Whatever is left goes out as literals
+    size_t lit = size - anchor;
+
+    if(op + 1 + lit / 255 + 1 + lit > cap)
+        return 0;
+
+    dst[op++] = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+
+    if(lit >= 15) {
+        size_t n = lit - 15;
+        for(; n >= 255; n -= 255)
+            dst[op++] = 255;
+        dst[op++] = (uint8_t)n;
+    }
+
+    memcpy(&dst[op], &src[anchor], lit);
+    op += lit;
+
+    return op;
+}
+
+int
+compare_entries(const void *a, const void *b)
+{
+    const input_t *x = a;
+    const input_t *y = b;
+
+    if(x->entry.hash != y->entry.hash)
+        return x->entry.hash < y->entry.hash ? -1 : 1;
+
+    return strcmp(x->name, y->name);
+}
+
+bool
+write_padding(FILE *file, uint64_t *at)
+{
+    static const uint8_t zeros[ARCHIVE_ALIGN] = {0};
+
+    uint64_t pad = (ARCHIVE_ALIGN - (*at % ARCHIVE_ALIGN)) % ARCHIVE_ALIGN;
+    *at += pad;
+
+    return pad == 0 || fwrite(zeros, pad, 1, file) == 1;
+}
@@ -0,0 +1,17 @@
+#version 450
+
+layout(location = 0) in vec3 normal;
+layout(location = 1) in vec2 uv;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    float light = max(dot(normalize(normal), normalize(vec3(0.4, 0.6, 0.7))),
+                      0.0);
+
+    // A checker from the UVs, so they can be seen
+    float check = mod(floor(uv.x * 8.0) + floor(uv.y * 8.0), 2.0);
+
+    outColor = vec4(vec3(0.2 + 0.8 * light) * mix(0.8, 1.0, check), 1.0);
+}
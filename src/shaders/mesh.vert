@@ -0,0 +1,51 @@
+#version 450
+
+// Matches mesh_push_t
+layout(push_constant) uniform Mesh
+{
+    mat4 transform; // To OpenGL's clip space
+    vec4 offset;
+    vec4 scale;
+    vec4 params; // Turns the normals have made
+} mesh;
+
+layout(location = 0) in vec4 in_position; // unorm16 within the bounds
+layout(location = 1) in vec2 in_normal;   // Octahedral snorm16
+layout(location = 2) in vec2 in_uv;
+
+layout(location = 0) out vec3 normal;
+layout(location = 1) out vec2 uv;
+
+vec3 oct_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+
+    return normalize(n);
+}
+
+void main()
+{
+    // Centered and scaled to fit, whatever the bounds were
+    vec3 p = mesh.offset.xyz + in_position.xyz * mesh.scale.xyz;
+    vec3 center = mesh.offset.xyz + mesh.scale.xyz * 0.5;
+    p = (p - center) / max(length(mesh.scale.xyz) * 0.5, 1e-6);
+
+    // The transform already turns the position
+    float angle = mesh.params.x * 6.28318531;
+    float c = cos(angle);
+    float s = sin(angle);
+    mat3 turn = mat3(c, 0.0, -s,
+                     0.0, 1.0, 0.0,
+                     s, 0.0, c);
+
+    normal = turn * oct_decode(in_normal);
+    uv = in_uv;
+
+    // Vulkan's y points down and its depth goes from 0 to w
+    gl_Position = mesh.transform * vec4(p, 1.0);
+    gl_Position.y = -gl_Position.y;
+    gl_Position.z = (gl_Position.z + gl_Position.w) * 0.5;
+}
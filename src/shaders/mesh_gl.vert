@@ -0,0 +1,46 @@
+#version 130
+
+// The same as mesh.vert, for OpenGL. The constants are attributes, the same
+// for the whole draw.
+in mat4 transform;
+in vec4 offset;
+in vec4 scale;
+in vec4 params; // Turns the normals have made
+
+in vec4 in_position; // unorm16 within the bounds
+in vec2 in_normal;   // Octahedral snorm16
+in vec2 in_uv;
+
+out vec3 normal;
+out vec2 uv;
+
+vec3 oct_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+
+    return normalize(n);
+}
+
+void main()
+{
+    // Centered and scaled to fit, whatever the bounds were
+    vec3 p = offset.xyz + in_position.xyz * scale.xyz;
+    vec3 center = offset.xyz + scale.xyz * 0.5;
+    p = (p - center) / max(length(scale.xyz) * 0.5, 1e-6);
+
+    // The transform already turns the position
+    float angle = params.x * 6.28318531;
+    float c = cos(angle);
+    float s = sin(angle);
+    mat3 turn = mat3(c, 0.0, -s,
+                     0.0, 1.0, 0.0,
+                     s, 0.0, c);
+
+    normal = turn * oct_decode(in_normal);
+    uv = in_uv;
+
+    gl_Position = transform * vec4(p, 1.0);
+}